@@ -0,0 +1,251 @@
+// Heap allocations per streamed token on the frame path, once it is warm.
+//
+// A server transport and a client transport talk over loopback in one process. A
+// producer thread plays the server's workers: it streams RESP_CHUNKs round-robin over
+// --streams requests, at most --window frames ahead of the client. Global operator
+// new is replaced by a counter; the allocations made while the last --tokens chunks
+// travel send() -> MPSC hand-off -> tx queue / RESP_BATCH -> socket or ring -> client handler
+// are reported per token. Exits 1 if that is not zero.
+#include "cc50/common.hpp"
+#include "cc50/protocol.hpp"
+#include "cc50/slab_pool.hpp"
+#include "cc50/transport/tcp_transport.hpp"
+#include "cc50/transport/unix_transport.hpp"
+#include "cc50/transport/shm_transport.hpp"
+#if CC50_HAVE_IO_URING
+#include "cc50/transport/io_uring_transport.hpp"
+#endif
+
+#include <getopt.h>
+
+#include <algorithm>
+#include <atomic>
+#include <cstdio>
+#include <cstdlib>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <new>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace {
+
+std::atomic<uint64_t> g_allocs{0};
+
+void* counted_alloc(std::size_t n, std::size_t align) {
+  g_allocs.fetch_add(1, std::memory_order_relaxed);
+  void* p = nullptr;
+  if (align <= alignof(std::max_align_t)) p = std::malloc(n ? n : 1);
+  else if (::posix_memalign(&p, align, n ? n : 1) != 0) p = nullptr;
+  return p;
+}
+
+} // namespace
+
+void* operator new(std::size_t n) {
+  if (void* p = counted_alloc(n, 0)) return p;
+  throw std::bad_alloc();
+}
+void* operator new[](std::size_t n) { return ::operator new(n); }
+void* operator new(std::size_t n, const std::nothrow_t&) noexcept { return counted_alloc(n, 0); }
+void* operator new[](std::size_t n, const std::nothrow_t&) noexcept { return counted_alloc(n, 0); }
+void* operator new(std::size_t n, std::align_val_t a) {
+  if (void* p = counted_alloc(n, (std::size_t)a)) return p;
+  throw std::bad_alloc();
+}
+void* operator new[](std::size_t n, std::align_val_t a) { return ::operator new(n, a); }
+void operator delete(void* p) noexcept { std::free(p); }
+void operator delete[](void* p) noexcept { std::free(p); }
+void operator delete(void* p, std::size_t) noexcept { std::free(p); }
+void operator delete[](void* p, std::size_t) noexcept { std::free(p); }
+void operator delete(void* p, std::align_val_t) noexcept { std::free(p); }
+void operator delete[](void* p, std::align_val_t) noexcept { std::free(p); }
+void operator delete(void* p, std::size_t, std::align_val_t) noexcept { std::free(p); }
+void operator delete[](void* p, std::size_t, std::align_val_t) noexcept { std::free(p); }
+
+namespace cc50 {
+
+struct BenchConfig {
+  std::string transport{"tcp"};  // server side: tcp|io_uring|unix|shm
+  uint16_t port{9299};
+  uint32_t streams{16};
+  uint32_t chunk_bytes{6};       // " token"
+  uint32_t window{256};          // frames in flight before the producer waits
+  uint64_t warmup{100000};       // tokens before counting starts
+  uint64_t tokens{200000};       // tokens counted
+};
+
+static int run(const BenchConfig& cfg) {
+  std::unique_ptr<ITransport> server;
+  std::unique_ptr<ITransport> client;
+  if (cfg.transport == "tcp") {
+    server = std::make_unique<TcpTransport>();
+  } else if (cfg.transport == "unix") {
+    server = std::make_unique<UnixTransport>();
+    client = std::make_unique<UnixTransport>();
+  } else if (cfg.transport == "shm") {
+    server = std::make_unique<ShmTransport>();
+    client = std::make_unique<ShmTransport>();
+  } else if (cfg.transport == "io_uring") {
+#if CC50_HAVE_IO_URING
+    server = std::make_unique<IoUringTransport>();
+#else
+    std::cerr << "this build has no io_uring support\n";
+    return 2;
+#endif
+  } else {
+    std::cerr << "unknown --transport: " << cfg.transport << "\n";
+    return 2;
+  }
+  if (!client) client = std::make_unique<TcpTransport>();
+  const std::string unix_path = "@cc50_alloc_bench." + std::to_string(cfg.port);
+
+  // the client announces each stream with a REQ_INFER; the producer answers on its conn
+  std::mutex mu;
+  std::vector<uint64_t> req_ids;
+  std::atomic<ConnId> conn{kNoConn};
+  TransportOptions sopt;
+  sopt.listen_host = "127.0.0.1";
+  sopt.listen_port = cfg.port;
+  sopt.unix_path = unix_path;
+  auto st = server->start_server(sopt, [&](const IncomingMessage& m) {
+    if (m.type != (uint16_t)MsgType::REQ_INFER) return;
+    std::lock_guard<std::mutex> lk(mu);
+    req_ids.push_back(m.req_id);
+    conn.store(m.conn);
+  });
+  if (!st.ok) {
+    std::cerr << "server: " << st.msg << "\n";
+    return 2;
+  }
+  std::atomic<bool> stop{false};
+  std::thread server_loop([&] {
+    while (!stop.load(std::memory_order_relaxed)) {
+      auto ps = server->progress(10);
+      if (!ps.ok) break;
+    }
+  });
+
+  std::atomic<uint64_t> received{0};
+  TransportOptions copt;
+  copt.server_host = "127.0.0.1";
+  copt.server_port = cfg.port;
+  copt.unix_path = unix_path;
+  st = client->start_client(copt, [&](const IncomingMessage& m) {
+    if (m.type == (uint16_t)MsgType::RESP_CHUNK) received.fetch_add(1, std::memory_order_relaxed);
+  });
+  if (!st.ok) {
+    std::cerr << "client: " << st.msg << "\n";
+    stop = true;
+    server_loop.join();
+    return 2;
+  }
+  for (uint32_t i = 0; i < cfg.streams; i++) client->send(kNoConn, i + 1, (uint16_t)MsgType::REQ_INFER, nullptr, 0);
+
+  const uint64_t total = cfg.warmup + cfg.tokens;
+  std::thread producer([&] {
+    while (!stop.load(std::memory_order_relaxed)) {
+      {
+        std::lock_guard<std::mutex> lk(mu);
+        if (req_ids.size() == cfg.streams) break;
+      }
+      std::this_thread::yield();
+    }
+    const std::string chunk(cfg.chunk_bytes, 'x');
+    for (uint64_t sent = 0; sent < total && !stop.load(std::memory_order_relaxed); sent++) {
+      while (sent - received.load(std::memory_order_relaxed) >= cfg.window) {
+        if (stop.load(std::memory_order_relaxed)) return;
+        std::this_thread::yield();
+      }
+      server->send(conn.load(), req_ids[sent % req_ids.size()], (uint16_t)MsgType::RESP_CHUNK,
+                   (const uint8_t*)chunk.data(), chunk.size());
+    }
+  });
+
+  uint64_t a0 = 0, t0 = 0;
+  bool counting = false;
+  Status cs = Status::Ok();
+  while (received.load(std::memory_order_relaxed) < total) {
+    cs = client->progress(100);
+    if (!cs.ok) break;
+    if (!counting && received.load(std::memory_order_relaxed) >= cfg.warmup) {
+      a0 = g_allocs.load(std::memory_order_relaxed);
+      t0 = now_us();
+      counting = true;
+    }
+  }
+  const uint64_t allocs = g_allocs.load(std::memory_order_relaxed) - a0;
+  const uint64_t us = now_us() - t0;
+  const uint64_t counted = received.load(std::memory_order_relaxed) - cfg.warmup;
+
+  stop = true;
+  producer.join();
+  server_loop.join();
+  if (!cs.ok) {
+    std::cerr << "client: " << cs.msg << "\n";
+    return 2;
+  }
+
+  const auto ps = slab_pool()->stats();
+  std::printf("transport=%s streams=%u chunk_bytes=%u tokens=%llu heap_allocs=%llu allocs_per_token=%.4f "
+              "tokens_per_s=%.0f slab_kib=%llu large_allocs=%llu\n",
+              cfg.transport.c_str(), cfg.streams, cfg.chunk_bytes, (unsigned long long)counted,
+              (unsigned long long)allocs, counted ? (double)allocs / (double)counted : 0.0,
+              us ? counted * 1e6 / (double)us : 0.0, (unsigned long long)(ps.slab_bytes >> 10),
+              (unsigned long long)ps.large_allocs);
+  return allocs == 0 ? 0 : 1;
+}
+
+} // namespace cc50
+
+static void usage() {
+  std::cerr << R"(cc50_alloc_bench
+  --transport=tcp|io_uring|unix|shm
+                             server-side transport (the client is tcp for io_uring, else the same)
+  --port=9299                (unix|shm: names the abstract socket)
+  --streams=16               concurrent RESP_CHUNK streams on one connection
+  --chunk-bytes=6            payload per chunk (the toy backend sends " token")
+  --window=256               chunks in flight before the producer waits
+  --warmup=100000            tokens before counting starts
+  --tokens=200000            tokens counted
+
+Exits 0 when the counted tokens caused no heap allocation, 1 otherwise.
+)";
+}
+
+int main(int argc, char** argv) {
+  cc50::BenchConfig cfg;
+
+  static option opts[] = {
+    {"transport", required_argument, nullptr, 't'},
+    {"port", required_argument, nullptr, 'p'},
+    {"streams", required_argument, nullptr, 's'},
+    {"chunk-bytes", required_argument, nullptr, 'c'},
+    {"window", required_argument, nullptr, 'w'},
+    {"warmup", required_argument, nullptr, 'W'},
+    {"tokens", required_argument, nullptr, 'n'},
+    {"help", no_argument, nullptr, 'h'},
+    {nullptr, 0, nullptr, 0}
+  };
+
+  while (true) {
+    int idx = 0;
+    int c = getopt_long(argc, argv, "t:p:s:c:w:W:n:h", opts, &idx);
+    if (c == -1) break;
+    switch (c) {
+      case 't': cfg.transport = optarg; break;
+      case 'p': cfg.port = (uint16_t)std::stoul(optarg); break;
+      case 's': cfg.streams = std::max(1u, (uint32_t)std::stoul(optarg)); break;
+      case 'c': cfg.chunk_bytes = (uint32_t)std::stoul(optarg); break;
+      case 'w': cfg.window = std::max(1u, (uint32_t)std::stoul(optarg)); break;
+      case 'W': cfg.warmup = std::stoull(optarg); break;
+      case 'n': cfg.tokens = std::stoull(optarg); break;
+      case 'h': usage(); return 0;
+      default: usage(); return 2;
+    }
+  }
+
+  return cc50::run(cfg);
+}
@@ -0,0 +1,757 @@
+// Microbenchmarks for the transport and backend layers, one line per case:
+//   frame/*   TxFrame build + gather + retire, RESP_BATCH merge and decode (no I/O)
+//   stream/*  one-way RESP_CHUNK throughput, server send() to client handler, over loopback
+//   rtt/*     request / echo round trip over a loopback pair, by transport and payload size
+//   toy/*     ToyBackend cost per token with a one-iteration kernel (launch + sync overhead)
+//   json/*    LlamaServerBackend::parse_completion on a /completion body and SSE events
+//   queue/*   hand-off to a sleeping consumer: ServerApp's FairQueue + mutex + condvar
+//             (on_msg -> worker_loop) and the transports' MpscQueue + eventfd
+//
+// Every case runs --reps times after a warm-up rep. ns_per_op is the median over reps
+// (min and max alongside); for rtt/* and queue/* it is the mean latency of a rep, and
+// the p50/p99/p99.9 columns are taken over all samples. Results go to stdout or --out
+// as an aligned table, CSV or JSON, so runs can be diffed or plotted.
+#include "cc50/common.hpp"
+#include "cc50/fair_queue.hpp"
+#include "cc50/mpsc_queue.hpp"
+#include "cc50/protocol.hpp"
+#include "cc50/slab_pool.hpp"
+#include "cc50/backend/llama_server_backend.hpp"
+#include "cc50/backend/toy_backend.hpp"
+#include "cc50/transport/frame.hpp"
+#include "cc50/transport/tcp_transport.hpp"
+#include "cc50/transport/unix_transport.hpp"
+#include "cc50/transport/shm_transport.hpp"
+#if CC50_HAVE_IO_URING
+#include "cc50/transport/io_uring_transport.hpp"
+#endif
+
+#include <getopt.h>
+#include <sys/eventfd.h>
+#include <sys/utsname.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cerrno>
+#include <condition_variable>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <functional>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace cc50 {
+
+struct BenchConfig {
+  std::vector<std::string> filters;  // run cases whose name contains one of these (none = all)
+  std::string format{"text"};        // text|csv|json
+  std::string out;                   // "" = stdout
+  uint32_t reps{5};
+  uint32_t scale{10};                // iterations per rep, in tenths of the default (--quick: 1)
+  uint16_t port{9399};               // first loopback port; each pair takes the next one
+  bool list{false};
+};
+
+struct Result {
+  std::string name;
+  uint64_t iters{0};            // ops per rep
+  std::vector<double> ns;       // ns per op, one per rep
+  double bytes_per_op{0};       // 0 = not a byte-moving case
+  std::vector<double> lat_us;   // latency samples across reps (rtt, queue)
+};
+
+static uint64_t now_ns() {
+  using namespace std::chrono;
+  return duration_cast<nanoseconds>(steady_clock::now().time_since_epoch()).count();
+}
+
+// Keep `v` (and what it points to) alive as far as the optimizer can tell.
+template <typename T>
+static inline void keep(const T& v) {
+  asm volatile("" : : "r,m"(v) : "memory");
+}
+
+// `v` must be sorted.
+static double percentile(const std::vector<double>& v, double p) {
+  if (v.empty()) return 0.0;
+  double idx = (p / 100.0) * (v.size() - 1);
+  size_t i = (size_t)idx;
+  double frac = idx - i;
+  if (i + 1 < v.size()) return v[i] * (1 - frac) + v[i + 1] * frac;
+  return v.back();
+}
+
+class Bench {
+public:
+  explicit Bench(const BenchConfig& cfg) : cfg_(cfg), port_(cfg.port) {}
+
+  const std::vector<Result>& results() const { return results_; }
+
+  bool wanted(const std::string& name) const {
+    if (cfg_.list) {
+      std::cout << name << "\n";
+      return false;
+    }
+    if (cfg_.filters.empty()) return true;
+    for (const auto& f : cfg_.filters)
+      if (name.find(f) != std::string::npos) return true;
+    return false;
+  }
+
+  uint64_t scaled(uint64_t iters) const { return std::max<uint64_t>(1, iters * cfg_.scale / 10); }
+
+  // Run `op(iters)` once to warm up, then --reps timed times.
+  void timed(const std::string& name, uint64_t iters, double bytes_per_op,
+             const std::function<void(uint64_t)>& op) {
+    Result r{name, scaled(iters), {}, bytes_per_op, {}};
+    op(r.iters);
+    for (uint32_t i = 0; i < cfg_.reps; i++) {
+      const uint64_t t0 = now_ns();
+      op(r.iters);
+      r.ns.push_back((double)(now_ns() - t0) / (double)r.iters);
+    }
+    results_.push_back(std::move(r));
+  }
+
+  // Same for latency cases: `op(iters, samples)` appends one sample (us) per op.
+  void sampled(const std::string& name, uint64_t iters, double bytes_per_op,
+               const std::function<void(uint64_t, std::vector<double>&)>& op) {
+    Result r{name, scaled(iters), {}, bytes_per_op, {}};
+    std::vector<double> s;
+    s.reserve(r.iters);
+    op(r.iters, s);
+    for (uint32_t i = 0; i < cfg_.reps; i++) {
+      s.clear();
+      op(r.iters, s);
+      double sum = 0;
+      for (double x : s) sum += x;
+      r.ns.push_back(s.empty() ? 0.0 : sum * 1000.0 / (double)s.size());
+      r.lat_us.insert(r.lat_us.end(), s.begin(), s.end());
+    }
+    results_.push_back(std::move(r));
+  }
+
+  void skip(const std::string& name, const std::string& why) {
+    std::cerr << "skip " << name << ": " << why << "\n";
+  }
+
+  uint16_t next_port() { return port_++; }
+
+  void frame_cases();
+  void stream_cases();
+  void rtt_cases();
+  void toy_cases();
+  void json_cases();
+  void queue_cases();
+
+private:
+  const BenchConfig& cfg_;
+  uint16_t port_;
+  std::vector<Result> results_;
+};
+
+// ---- frame/* ----
+
+void Bench::frame_cases() {
+  static constexpr size_t kDepth = 64;   // frames queued before one gathered write
+  for (size_t len : {6, 256, 4096, 65536}) {
+    const std::string name = "frame/build_gather_retire/" + std::to_string(len);
+    if (!wanted(name)) continue;
+    const std::string payload(len, 'x');
+    TxQueue tx{slab_pool()};
+    iovec iov[2 * kDepth];
+    timed(name, len < 4096 ? 2000000 : 200000, (double)(sizeof(MsgHeader) + len), [&](uint64_t n) {
+      for (uint64_t done = 0; done < n;) {
+        const uint64_t k = std::min<uint64_t>(kDepth, n - done);
+        size_t bytes = 0;
+        for (uint64_t i = 0; i < k; i++) {
+          tx.push_back(make_tx_frame(done + i, (uint16_t)MsgType::RESP_CHUNK,
+                                     (const uint8_t*)payload.data(), payload.size()));
+          bytes += tx.back().size();
+        }
+        const int niov = gather_tx(tx, 0, iov, 2 * kDepth);
+        keep(niov);
+        keep(iov[0]);
+        size_t off = 0;
+        retire_tx(tx, off, bytes);
+        done += k;
+      }
+    });
+  }
+
+  // RESP_CHUNKs of one token each folded into RESP_BATCH frames as the event loops do,
+  // then the batches handed back entry by entry as the client does
+  const std::string token = " token";
+  const TxFrame chunk = make_tx_frame(1, (uint16_t)MsgType::RESP_CHUNK, (const uint8_t*)token.data(), token.size());
+  if (const std::string name = "frame/batch_merge/6"; wanted(name)) {
+    TxQueue tx{slab_pool()};
+    timed(name, 2000000, (double)(sizeof(BatchEntryHdr) + token.size()), [&](uint64_t n) {
+      for (uint64_t done = 0; done < n;) {
+        const uint64_t k = std::min<uint64_t>(4096, n - done);
+        for (uint64_t i = 0; i < k; i++) {
+          size_t grown = 0;
+          if (!merge_into_batch(tx, 0, chunk, grown)) tx.push_back(chunk);
+        }
+        keep(tx.back().payload.data());
+        tx.clear();
+        done += k;
+      }
+    });
+  }
+  if (const std::string name = "frame/batch_decode/6"; wanted(name)) {
+    std::pmr::string batch{slab_pool()};
+    while (batch.size() + sizeof(BatchEntryHdr) + token.size() <= kBatchMaxBytes)
+      append_batch_entry(batch, 1, (uint16_t)MsgType::RESP_CHUNK, token);
+    const size_t entries = batch.size() / (sizeof(BatchEntryHdr) + token.size());
+    const std::span<const uint8_t> p((const uint8_t*)batch.data(), batch.size());
+    timed(name, 4000000, (double)(sizeof(BatchEntryHdr) + token.size()), [&](uint64_t n) {
+      uint64_t bytes = 0;
+      for (uint64_t done = 0; done < n; done += entries) {
+        for_each_batch_entry(p, [&](uint64_t, uint16_t, std::span<const uint8_t> e) { bytes += e.size(); });
+      }
+      keep(bytes);
+    });
+  }
+}
+
+// ---- loopback pairs (stream/*, rtt/*) ----
+
+// A server and a client transport of one kind in this process; the server's event loop
+// runs on its own thread, the client's on whoever calls client->progress().
+struct Pair {
+  std::unique_ptr<ITransport> server;
+  std::unique_ptr<ITransport> client;
+  std::atomic<bool> stop{false};
+  std::thread server_loop;
+
+  ~Pair() {
+    stop = true;
+    if (server_loop.joinable()) server_loop.join();
+    client.reset();
+    server.reset();
+  }
+};
+
+static Status open_pair(const std::string& kind, uint16_t port, MessageHandler on_server,
+                        MessageHandler on_client, Pair& p) {
+  if (kind == "tcp") {
+    p.server = std::make_unique<TcpTransport>();
+  } else if (kind == "unix") {
+    p.server = std::make_unique<UnixTransport>();
+    p.client = std::make_unique<UnixTransport>();
+  } else if (kind == "shm") {
+    p.server = std::make_unique<ShmTransport>();
+    p.client = std::make_unique<ShmTransport>();
+  } else if (kind == "io_uring") {
+#if CC50_HAVE_IO_URING
+    p.server = std::make_unique<IoUringTransport>();
+#else
+    return Status::Err("this build has no io_uring support");
+#endif
+  } else {
+    return Status::Err("unknown transport: " + kind);
+  }
+  if (!p.client) p.client = std::make_unique<TcpTransport>();
+
+  TransportOptions opt;
+  opt.listen_host = "127.0.0.1";
+  opt.listen_port = port;
+  opt.server_host = "127.0.0.1";
+  opt.server_port = port;
+  opt.unix_path = "@cc50_bench." + std::to_string(port);
+  auto st = p.server->start_server(opt, std::move(on_server));
+  if (!st.ok) return Status::Err("server: " + st.msg);
+  p.server_loop = std::thread([&p] {
+    while (!p.stop.load(std::memory_order_relaxed)) {
+      if (!p.server->progress(10).ok) break;
+    }
+  });
+  st = p.client->start_client(opt, std::move(on_client));
+  if (!st.ok) return Status::Err("client: " + st.msg);
+  return Status::Ok();
+}
+
+void Bench::stream_cases() {
+  static constexpr uint64_t kWindow = 256;   // frames in flight before the producer waits
+  for (const char* kind : {"tcp", "unix", "shm"}) {
+    for (size_t len : {6, 1024, 65536}) {
+      const std::string name = std::string("stream/") + kind + "/" + std::to_string(len);
+      if (!wanted(name)) continue;
+      // the client's first frame tells the producer which connection to answer on
+      std::atomic<ConnId> conn{kNoConn};
+      std::atomic<uint64_t> received{0};
+      Pair p;
+      auto st = open_pair(kind, next_port(),
+                          [&](const IncomingMessage& m) { conn.store(m.conn); },
+                          [&](const IncomingMessage& m) {
+                            if (m.type == (uint16_t)MsgType::RESP_CHUNK) {
+                              received.fetch_add(1, std::memory_order_relaxed);
+                            } else if (m.type == (uint16_t)MsgType::RESP_BATCH) {
+                              uint64_t k = 0;
+                              for_each_batch_entry(m.payload, [&](uint64_t, uint16_t, std::span<const uint8_t>) { k++; });
+                              received.fetch_add(k, std::memory_order_relaxed);
+                            }
+                          },
+                          p);
+      if (st.ok) st = p.client->send(kNoConn, 1, (uint16_t)MsgType::REQ_INFER, nullptr, 0);
+      while (st.ok && conn.load() == kNoConn) st = p.client->progress(10);
+      if (!st.ok) {
+        skip(name, st.msg);
+        continue;
+      }
+      const std::string payload(len, 'x');
+      timed(name, len < 65536 ? 400000 : 20000, (double)(sizeof(MsgHeader) + len), [&](uint64_t n) {
+        const uint64_t base = received.load();
+        std::thread producer([&] {
+          for (uint64_t sent = 0; sent < n; sent++) {
+            while (sent - (received.load(std::memory_order_relaxed) - base) >= kWindow) std::this_thread::yield();
+            p.server->send(conn.load(), 1, (uint16_t)MsgType::RESP_CHUNK, (const uint8_t*)payload.data(),
+                           payload.size());
+          }
+        });
+        while (received.load(std::memory_order_relaxed) - base < n) {
+          if (!p.client->progress(100).ok) break;
+        }
+        producer.join();
+      });
+    }
+  }
+}
+
+void Bench::rtt_cases() {
+  std::vector<const char*> kinds{"tcp", "unix", "shm"};
+#if CC50_HAVE_IO_URING
+  kinds.push_back("io_uring");
+#endif
+  for (const char* kind : kinds) {
+    for (size_t len : {16, 1024, 16384, 262144}) {
+      const std::string name = std::string("rtt/") + kind + "/" + std::to_string(len);
+      if (!wanted(name)) continue;
+      Pair p;
+      std::atomic<uint64_t> replies{0};
+      auto st = open_pair(kind, next_port(),
+                          [&](const IncomingMessage& m) {
+                            p.server->send(m.conn, m.req_id, (uint16_t)MsgType::RESP_CHUNK, m.payload.data(),
+                                           m.payload.size());
+                          },
+                          [&](const IncomingMessage&) { replies.fetch_add(1, std::memory_order_relaxed); }, p);
+      if (!st.ok) {
+        skip(name, st.msg);
+        continue;
+      }
+      const std::string payload(len, 'x');
+      bool broken = false;
+      // both directions carry the payload
+      sampled(name, len < 16384 ? 20000 : 2000, 2.0 * (double)(sizeof(MsgHeader) + len),
+              [&](uint64_t n, std::vector<double>& lat) {
+                for (uint64_t i = 0; i < n && !broken; i++) {
+                  const uint64_t want = replies.load(std::memory_order_relaxed) + 1;
+                  const uint64_t t0 = now_ns();
+                  p.client->send(kNoConn, i + 1, (uint16_t)MsgType::REQ_INFER, (const uint8_t*)payload.data(),
+                                 payload.size());
+                  while (replies.load(std::memory_order_relaxed) < want) {
+                    if (!p.client->progress(100).ok) {
+                      broken = true;
+                      break;
+                    }
+                  }
+                  lat.push_back((double)(now_ns() - t0) / 1000.0);
+                }
+              });
+      if (broken) {
+        results_.pop_back();
+        skip(name, "connection lost");
+      }
+    }
+  }
+}
+
+// ---- toy/* ----
+
+void Bench::toy_cases() {
+  for (bool batching : {true, false}) {
+    const std::string name = std::string("toy/launch/") + (batching ? "batched" : "lanes");
+    if (!wanted(name)) continue;
+    ToyBackendOptions o;
+    o.batching = batching;
+    o.kernel_iters = 1;   // next to no GPU work: what is left is launch, sync and the hand-off
+    ToyBackend be(o);
+    auto st = be.init();
+    if (st.ok) st = be.load_model("", 0, 0);
+    if (!st.ok) {
+      skip(name, st.msg);
+      continue;
+    }
+    InferRequest req;
+    req.req_id = 1;
+    req.prompt = "hello";
+    CancelToken cancel;
+    uint64_t chunks = 0;
+    timed(name, 20000, 0, [&](uint64_t n) {
+      req.max_tokens = (uint32_t)n;
+      InferResult res;
+      st = be.infer_stream(req, [&](const std::string&) { chunks++; }, res, cancel);
+    });
+    if (!st.ok) {
+      results_.pop_back();
+      skip(name, st.msg);
+    }
+    keep(chunks);
+  }
+}
+
+// ---- json/* ----
+
+// What llama-server sends, trimmed to the members that matter for the scan: the ones
+// parse_completion picks up, and the nested settings it has to skip.
+static const char kCompletionBody[] =
+    R"({"content":" Paris is the capital and most populous city of France, with an estimated population of 2,102,650 residents.",)"
+    R"("id_slot":0,"stop":true,"model":"models/llama-3.1-8b-instruct-q4_k_m.gguf","tokens_predicted":24,"tokens_evaluated":12,)"
+    R"("generation_settings":{"n_ctx":8192,"n_predict":64,"model":"models/llama-3.1-8b-instruct-q4_k_m.gguf","seed":4294967295,)"
+    R"("temperature":0.800000011920929,"dynatemp_range":0.0,"dynatemp_exponent":1.0,"top_k":40,"top_p":0.949999988079071,)"
+    R"("min_p":0.05000000074505806,"tfs_z":1.0,"typical_p":1.0,"repeat_last_n":64,"repeat_penalty":1.0,"presence_penalty":0.0,)"
+    R"("frequency_penalty":0.0,"mirostat":0,"mirostat_tau":5.0,"mirostat_eta":0.10000000149011612,"penalize_nl":false,)"
+    R"("stop":["</s>","<|eot_id|>"],"max_tokens":64,"n_keep":0,"n_discard":0,"ignore_eos":false,"stream":false,)"
+    R"("logit_bias":[],"n_probs":0,"min_keep":0,"grammar":"","samplers":["top_k","tfs_z","typical_p","top_p","min_p","temperature"]},)"
+    R"("prompt":"Q: What is the capital of France?\nA:","truncated":false,"stopped_eos":true,"stopped_word":false,)"
+    R"("stopped_limit":false,"stopping_word":"","tokens_cached":35,)"
+    R"("timings":{"prompt_n":12,"prompt_ms":18.532,"prompt_per_token_ms":1.544,"prompt_per_second":647.5,)"
+    R"("predicted_n":24,"predicted_ms":301.2,"predicted_per_token_ms":12.55,"predicted_per_second":79.68}})";
+
+static const char kSseEvent[] =
+    R"({"content":" token","stop":false,"id_slot":0,"multimodal":false,"index":0})";
+
+static const char kOpenAiEvent[] =
+    R"({"id":"cmpl-3f9a1c","object":"text_completion","created":1760400000,"model":"llama-3.1-8b-instruct",)"
+    R"("system_fingerprint":"b4000-1a2b3c4d","choices":[{"text":" token","index":0,"logprobs":null,"finish_reason":null}]})";
+
+void Bench::json_cases() {
+  struct Doc {
+    const char* name;
+    std::string_view body;
+  };
+  for (const Doc& d : {Doc{"json/completion_body", kCompletionBody}, Doc{"json/sse_event", kSseEvent},
+                       Doc{"json/openai_event", kOpenAiEvent}}) {
+    if (!wanted(d.name)) continue;
+    LlamaServerBackend::Completion c;
+    if (!LlamaServerBackend::parse_completion(d.body, c) || !c.has_text) {
+      skip(d.name, "sample does not parse");
+      continue;
+    }
+    timed(d.name, d.body.size() > 512 ? 200000 : 2000000, (double)d.body.size(), [&](uint64_t n) {
+      for (uint64_t i = 0; i < n; i++) {
+        c.clear();
+        LlamaServerBackend::parse_completion(d.body, c);
+        keep(c.text.data());
+      }
+    });
+  }
+}
+
+// ---- queue/* ----
+
+// Shaped like ServerApp's WorkItem: a prompt and a shared flow record travel with it.
+struct QueueItem {
+  uint64_t sent_ns{0};
+  std::string prompt;
+  std::shared_ptr<int> flow;
+};
+
+// Spin for `ns` so the consumer is back asleep before the next item: each sample is a
+// cold hand-off, like a request arriving at an idle worker.
+static void idle_gap(uint64_t ns) {
+  const uint64_t until = now_ns() + ns;
+  while (now_ns() < until) {}
+}
+
+void Bench::queue_cases() {
+  static constexpr uint64_t kGapNs = 50000;
+
+  if (const std::string name = "queue/fair_queue_condvar"; wanted(name)) {
+    // on_msg pushes under mu_ and notifies one worker, which pops under the same lock
+    FairQueue<QueueItem> q(kMaxPriority + 1, 1, 0, slab_pool());
+    std::mutex mu;
+    std::condition_variable cv;
+    bool stop = false;
+    std::atomic<uint64_t> popped{0};
+    std::vector<double>* lat = nullptr;   // guarded by mu
+    std::thread worker([&] {
+      while (true) {
+        QueueItem wi;
+        std::unique_lock<std::mutex> lk(mu);
+        cv.wait(lk, [&] { return stop || !q.empty(); });
+        if (stop) break;
+        q.pop(wi);
+        lat->push_back((double)(now_ns() - wi.sent_ns) / 1000.0);
+        lk.unlock();
+        popped.fetch_add(1, std::memory_order_release);
+      }
+    });
+    const auto flow = std::make_shared<int>(0);
+    sampled(name, 20000, 0, [&](uint64_t n, std::vector<double>& s) {
+      {
+        std::lock_guard<std::mutex> lk(mu);
+        lat = &s;
+      }
+      const uint64_t base = popped.load();
+      for (uint64_t i = 0; i < n; i++) {
+        QueueItem wi{0, "Q: What is the capital of France?\nA:", flow};
+        {
+          std::lock_guard<std::mutex> lk(mu);
+          wi.sent_ns = now_ns();
+          q.push(0, i % 16, 64, wi);
+        }
+        cv.notify_one();
+        while (popped.load(std::memory_order_acquire) - base <= i) {}
+        idle_gap(kGapNs);
+      }
+    });
+    {
+      std::lock_guard<std::mutex> lk(mu);
+      stop = true;
+    }
+    cv.notify_one();
+    worker.join();
+  }
+
+  if (const std::string name = "queue/mpsc_eventfd"; wanted(name)) {
+    // send() from a worker: push, then kick the event loop's eventfd
+    MpscQueue<uint64_t> q(slab_pool());
+    const int efd = ::eventfd(0, EFD_CLOEXEC);
+    if (efd < 0) {
+      skip(name, std::string("eventfd: ") + std::strerror(errno));
+      return;
+    }
+    std::atomic<bool> stop{false};
+    std::atomic<uint64_t> popped{0};
+    std::atomic<std::vector<double>*> lat{nullptr};
+    std::thread loop([&] {
+      while (!stop.load(std::memory_order_relaxed)) {
+        uint64_t v;
+        if (::read(efd, &v, sizeof(v)) != (ssize_t)sizeof(v)) continue;
+        uint64_t sent;
+        while (q.pop(sent)) {
+          if (sent) lat.load()->push_back((double)(now_ns() - sent) / 1000.0);
+          popped.fetch_add(1, std::memory_order_release);
+        }
+      }
+    });
+    const uint64_t one = 1;
+    sampled(name, 20000, 0, [&](uint64_t n, std::vector<double>& s) {
+      lat.store(&s);
+      const uint64_t base = popped.load();
+      for (uint64_t i = 0; i < n; i++) {
+        q.push(now_ns());
+        if (::write(efd, &one, sizeof(one)) != (ssize_t)sizeof(one)) break;
+        while (popped.load(std::memory_order_acquire) - base <= i) {}
+        idle_gap(kGapNs);
+      }
+    });
+    stop = true;
+    q.push(0);   // 0 = wake-up only
+    if (::write(efd, &one, sizeof(one)) != (ssize_t)sizeof(one)) {}
+    loop.join();
+    ::close(efd);
+  }
+}
+
+// ---- report ----
+
+struct Row {
+  const Result* r;
+  double med, min, max, ops_s, mb_s;
+  double p50, p99, p999;   // us; only when r->lat_us is set
+};
+
+static Row summarize(Result& r) {
+  std::vector<double> ns = r.ns;
+  std::sort(ns.begin(), ns.end());
+  std::sort(r.lat_us.begin(), r.lat_us.end());
+  Row w{&r, percentile(ns, 50), ns.empty() ? 0 : ns.front(), ns.empty() ? 0 : ns.back(), 0, 0, 0, 0, 0};
+  w.ops_s = w.med > 0 ? 1e9 / w.med : 0;
+  w.mb_s = r.bytes_per_op * w.ops_s / 1e6;
+  w.p50 = percentile(r.lat_us, 50);
+  w.p99 = percentile(r.lat_us, 99);
+  w.p999 = percentile(r.lat_us, 99.9);
+  return w;
+}
+
+static std::string fmt(double v, int prec) {
+  char b[64];
+  std::snprintf(b, sizeof(b), "%.*f", prec, v);
+  return b;
+}
+
+static std::string json_str(std::string_view s) {
+  std::string o = "\"";
+  for (char c : s) {
+    if (c == '"' || c == '\\') o += '\\';
+    if ((unsigned char)c < 0x20) o += ' ';
+    else o += c;
+  }
+  return o + "\"";
+}
+
+static void report(const BenchConfig& cfg, std::vector<Result>& results, std::ostream& os) {
+  std::vector<Row> rows;
+  for (auto& r : results) rows.push_back(summarize(r));
+  const char* cols[] = {"name", "reps", "iters", "ns_per_op", "ns_per_op_min", "ns_per_op_max",
+                        "ops_per_s", "mb_per_s", "p50_us", "p99_us", "p999_us"};
+
+  if (cfg.format == "csv") {
+    for (size_t i = 0; i < std::size(cols); i++) os << (i ? "," : "") << cols[i];
+    os << "\n";
+    for (const Row& w : rows) {
+      const bool lat = !w.r->lat_us.empty();
+      os << w.r->name << "," << w.r->ns.size() << "," << w.r->iters << "," << fmt(w.med, 1) << ","
+         << fmt(w.min, 1) << "," << fmt(w.max, 1) << "," << fmt(w.ops_s, 0) << ","
+         << (w.r->bytes_per_op ? fmt(w.mb_s, 1) : "") << "," << (lat ? fmt(w.p50, 2) : "") << ","
+         << (lat ? fmt(w.p99, 2) : "") << "," << (lat ? fmt(w.p999, 2) : "") << "\n";
+    }
+    return;
+  }
+
+  if (cfg.format == "json") {
+    utsname u{};
+    ::uname(&u);
+    char host[256] = {};
+    ::gethostname(host, sizeof(host) - 1);
+#ifdef NDEBUG
+    const bool ndebug = true;
+#else
+    const bool ndebug = false;
+#endif
+    os << "{\n  \"suite\": \"cc50_bench\",\n"
+       << "  \"host\": " << json_str(host) << ",\n"
+       << "  \"kernel\": " << json_str(std::string(u.sysname) + " " + u.release + " " + u.machine) << ",\n"
+       << "  \"cpus\": " << std::thread::hardware_concurrency() << ",\n"
+       << "  \"compiler\": " << json_str(__VERSION__) << ",\n"
+       << "  \"ndebug\": " << (ndebug ? "true" : "false") << ",\n"
+       << "  \"protocol_version\": " << kProtoVer << ",\n"
+       << "  \"results\": [";
+    auto num = [](double v, int prec, bool set) { return set ? fmt(v, prec) : std::string("null"); };
+    for (size_t i = 0; i < rows.size(); i++) {
+      const Row& w = rows[i];
+      const bool lat = !w.r->lat_us.empty();
+      os << (i ? ",\n" : "\n") << "    {\"name\": " << json_str(w.r->name) << ", \"reps\": " << w.r->ns.size()
+         << ", \"iters\": " << w.r->iters << ", \"ns_per_op\": " << fmt(w.med, 1)
+         << ", \"ns_per_op_min\": " << fmt(w.min, 1) << ", \"ns_per_op_max\": " << fmt(w.max, 1)
+         << ", \"ops_per_s\": " << fmt(w.ops_s, 0) << ", \"mb_per_s\": " << num(w.mb_s, 1, w.r->bytes_per_op != 0)
+         << ", \"p50_us\": " << num(w.p50, 2, lat) << ", \"p99_us\": " << num(w.p99, 2, lat)
+         << ", \"p999_us\": " << num(w.p999, 2, lat) << "}";
+    }
+    os << "\n  ]\n}\n";
+    return;
+  }
+
+  char line[256];
+  std::snprintf(line, sizeof(line), "%-34s %12s %12s %12s %10s %10s %10s %10s\n", "name", "ns/op", "+/-%",
+                "ops/s", "MB/s", "p50_us", "p99_us", "p99.9_us");
+  os << line;
+  for (const Row& w : rows) {
+    const bool lat = !w.r->lat_us.empty();
+    const double spread = w.med > 0 ? 50.0 * (w.max - w.min) / w.med : 0;
+    std::snprintf(line, sizeof(line), "%-34s %12.1f %12.1f %12.0f %10s %10s %10s %10s\n", w.r->name.c_str(), w.med,
+                  spread, w.ops_s, w.r->bytes_per_op ? fmt(w.mb_s, 1).c_str() : "-",
+                  lat ? fmt(w.p50, 2).c_str() : "-", lat ? fmt(w.p99, 2).c_str() : "-",
+                  lat ? fmt(w.p999, 2).c_str() : "-");
+    os << line;
+  }
+}
+
+static int run(const BenchConfig& cfg) {
+  Bench b(cfg);
+  b.frame_cases();
+  b.stream_cases();
+  b.rtt_cases();
+  b.toy_cases();
+  b.json_cases();
+  b.queue_cases();
+  if (cfg.list) return 0;
+
+  std::vector<Result> results = b.results();
+  if (results.empty()) {
+    std::cerr << "no benchmark ran\n";
+    return 1;
+  }
+  if (cfg.out.empty()) {
+    report(cfg, results, std::cout);
+    return 0;
+  }
+  std::ofstream f(cfg.out);
+  report(cfg, results, f);
+  f.close();
+  if (!f) {
+    std::cerr << "cannot write " << cfg.out << "\n";
+    return 2;
+  }
+  return 0;
+}
+
+} // namespace cc50
+
+static void usage() {
+  std::cerr << R"(cc50_bench
+  --filter=SUBSTR[,SUBSTR...]  only cases whose name contains one of these (e.g. rtt/shm,json)
+  --list                       print the case names and exit
+  --format=text|csv|json
+  --out=FILE                   write the report here instead of stdout
+  --reps=5                     timed repetitions per case, after one warm-up
+  --quick                      a tenth of the iterations, for a smoke run
+  --port=9399                  first loopback port (unix|shm: names the abstract socket)
+
+Cases: frame/* stream/* rtt/* toy/* json/* queue/*. toy/* is skipped when no GPU is usable.
+)";
+}
+
+int main(int argc, char** argv) {
+  cc50::BenchConfig cfg;
+
+  static option opts[] = {
+    {"filter", required_argument, nullptr, 'f'},
+    {"list", no_argument, nullptr, 'l'},
+    {"format", required_argument, nullptr, 'F'},
+    {"out", required_argument, nullptr, 'o'},
+    {"reps", required_argument, nullptr, 'r'},
+    {"quick", no_argument, nullptr, 'q'},
+    {"port", required_argument, nullptr, 'p'},
+    {"help", no_argument, nullptr, 'h'},
+    {nullptr, 0, nullptr, 0}
+  };
+
+  while (true) {
+    int idx = 0;
+    int c = getopt_long(argc, argv, "f:lF:o:r:qp:h", opts, &idx);
+    if (c == -1) break;
+    switch (c) {
+      case 'f': {
+        std::stringstream ss(optarg);
+        for (std::string f; std::getline(ss, f, ',');)
+          if (!f.empty()) cfg.filters.push_back(f);
+        break;
+      }
+      case 'l': cfg.list = true; break;
+      case 'F': cfg.format = optarg; break;
+      case 'o': cfg.out = optarg; break;
+      case 'r': cfg.reps = std::max(1u, (uint32_t)std::stoul(optarg)); break;
+      case 'q': cfg.scale = 1; break;
+      case 'p': cfg.port = (uint16_t)std::stoul(optarg); break;
+      case 'h': usage(); return 0;
+      default: usage(); return 2;
+    }
+  }
+  if (cfg.format != "text" && cfg.format != "csv" && cfg.format != "json") {
+    std::cerr << "unknown --format: " << cfg.format << "\n";
+    return 2;
+  }
+
+  return cc50::run(cfg);
+}
@@ -1,8 +1,10 @@
 #pragma once
 
 #include "../common.hpp"
+#include "../sampling_params.hpp"
 
 #include <functional>
+#include <memory>
 #include <string>
 
 namespace cc50 {
@@ -12,23 +14,62 @@ struct InferRequest {
   uint32_t max_tokens{64};
   uint32_t credit_bytes{256 * 1024};
   std::string prompt{};
+  SamplingParams params{};
 };
 
 using StreamFn = std::function<void(const std::string& chunk)>;
 
 struct InferResult {
-  uint32_t tokens{0};
+  uint32_t tokens{0};              // generated tokens
   uint64_t elapsed_us{0};
+  // Model-side accounting, 0 when the backend cannot tell. Upstream backends pass on
+  // what the inference server reports instead of timing the HTTP exchange.
+  uint32_t prompt_tokens{0};       // prompt tokens processed (a prefix reused from a KV cache may be left out)
+  uint64_t prefill_us{0};          // prompt processing time
+  uint64_t decode_us{0};           // generation time
   std::string text{};
   std::string error{};
 };
 
+// Completion of a request started with IBackend::infer_async; `out` as infer_stream fills it.
+using DoneFn = std::function<void(const Status& st, InferResult& out)>;
+
+// Handle on a running asynchronous request, for backpressure: a caller that cannot
+// take more output pauses it, and the backend stops reading from the model until
+// resume(). Output already in hand may still be delivered after pause().
+class AsyncInfer {
+public:
+  virtual ~AsyncInfer() = default;
+  virtual void pause() = 0;
+  virtual void resume() = 0;
+};
+
 class IBackend {
 public:
   virtual ~IBackend() = default;
   virtual Status init() = 0;
   virtual Status load_model(const std::string& path, int ctx, int threads) = 0;
-  virtual Status infer_stream(const InferRequest& req, StreamFn on_chunk, InferResult& out) = 0;
+  // Run one request, streaming output through on_chunk. Implementations poll `cancel`
+  // and return early (with an error) once it is set.
+  virtual Status infer_stream(const InferRequest& req, StreamFn on_chunk, InferResult& out,
+                              const CancelToken& cancel) = 0;
+
+  // True when infer_async runs requests without holding the caller's thread, so one
+  // thread can keep many of them in flight.
+  virtual bool async_capable() const { return false; }
+  // Start a request and return at once. on_chunk and on_done run on the backend's
+  // threads, on_done exactly once and last (possibly before infer_async returns).
+  // `cancel` is polled as for infer_stream and must stay valid until on_done.
+  virtual std::shared_ptr<AsyncInfer> infer_async(const InferRequest& req, StreamFn on_chunk, DoneFn on_done,
+                                                  const CancelToken& cancel) {
+    (void)req;
+    (void)on_chunk;
+    (void)cancel;
+    InferResult out{};
+    out.error = "asynchronous requests are not supported by this backend";
+    on_done(Status::Err(out.error), out);
+    return nullptr;
+  }
 };
 
 } // namespace cc50
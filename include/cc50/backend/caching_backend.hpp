@@ -0,0 +1,98 @@
+#pragma once
+#include "backend.hpp"
+
+#include <condition_variable>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+namespace cc50 {
+
+struct CacheOptions {
+  size_t max_bytes{64u << 20};      // keys + cached chunks; least recently used entries go first
+  uint32_t ttl_ms{60000};           // 0 = entries never expire
+  size_t max_entry_bytes{1u << 20}; // larger results are served but not cached
+};
+
+// Result cache in front of another backend. Requests with the same key (prompt,
+// max_tokens, sampling parameters) are answered from memory and replayed through on_chunk without any
+// pacing. Concurrent identical misses are coalesced: one caller runs the inner
+// backend and the others stream its chunks as they are produced. Hits and followers
+// report the token counts of the call that produced the result, but no prefill or
+// decode time, since no model work was done for them.
+// Only successful, complete results are cached. Thread-safe.
+class CachingBackend final : public IBackend {
+public:
+  struct Stats {
+    uint64_t hits{0};
+    uint64_t misses{0};
+    uint64_t coalesced{0};  // misses that joined an in-flight call instead of starting one
+    uint64_t evictions{0};
+    size_t bytes{0};
+    size_t entries{0};
+  };
+
+  CachingBackend(std::unique_ptr<IBackend> inner, CacheOptions opt = {});
+
+  Status init() override { return inner_->init(); }
+  Status load_model(const std::string& path, int ctx, int threads) override {
+    return inner_->load_model(path, ctx, threads);
+  }
+  Status infer_stream(const InferRequest& req, StreamFn on_chunk, InferResult& out,
+                      const CancelToken& cancel) override;
+
+  Stats stats() const;
+
+private:
+  using Chunks = std::shared_ptr<const std::vector<std::string>>;
+
+  struct Entry {
+    std::string key;
+    Chunks chunks;            // shared with replays in progress
+    uint32_t tokens{0};
+    uint32_t prompt_tokens{0};
+    uint64_t expires_us{0};   // 0 = never
+    size_t bytes{0};
+  };
+
+  // A miss being computed; followers read `chunks` as the leader appends them.
+  struct Flight {
+    std::mutex mu;
+    std::condition_variable cv;
+    std::vector<std::string> chunks;
+    bool done{false};
+    bool ok{false};
+    bool cancelled{false};    // the leader's own caller gave up
+    uint32_t tokens{0};
+    uint32_t prompt_tokens{0};
+    std::string error;
+  };
+
+  static std::string make_key(const InferRequest& req);
+
+  bool lookup_locked(const std::string& key, Chunks& chunks, uint32_t& tokens, uint32_t& prompt_tokens);
+  void insert_locked(const std::string& key, Chunks chunks, uint32_t tokens, uint32_t prompt_tokens);
+  void evict_locked();
+
+  Status run_leader(const std::string& key, const std::shared_ptr<Flight>& fl, const InferRequest& req,
+                    StreamFn& on_chunk, InferResult& out, const CancelToken& cancel);
+  // Returns false if the leader's caller cancelled before this one emitted anything;
+  // the follower then starts over (and usually becomes the new leader).
+  bool follow(const std::shared_ptr<Flight>& fl, StreamFn& on_chunk, InferResult& out,
+              const CancelToken& cancel, Status& st);
+
+  std::unique_ptr<IBackend> inner_;
+  CacheOptions opt_;
+
+  mutable std::mutex mu_;
+  std::list<Entry> lru_;   // most recently used at the front
+  std::unordered_map<std::string_view, std::list<Entry>::iterator> index_;  // views into Entry::key
+  std::unordered_map<std::string, std::shared_ptr<Flight>> inflight_;
+  Stats stats_;
+};
+
+} // namespace cc50
@@ -0,0 +1,169 @@
+#pragma once
+#include "../common.hpp"
+#include "../socket_options.hpp"
+
+#include <netdb.h>
+#include <sys/socket.h>
+
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+namespace cc50 {
+
+// Minimal blocking HTTP/1.1 client used by LlamaServerBackend.
+// Only plain http:// is supported; the upstream is expected to be a local llama-server.
+
+struct UrlParts {
+  std::string host;
+  int port{80};
+  std::string path{"/"};
+};
+
+bool parse_http_url(const std::string& base_url, const std::string& endpoint, UrlParts& out, std::string& err);
+
+// Receives decoded body bytes as they arrive. Return false to stop reading early.
+using HttpBodyFn = std::function<bool(std::string_view)>;
+
+// Incremental HTTP/1.1 response decoder. Raw socket bytes are pushed in with feed();
+// body bytes (after Content-Length / chunked transfer decoding) are handed to the
+// sink immediately, so a streamed response can be consumed before it completes.
+class HttpResponseParser {
+public:
+  explicit HttpResponseParser(HttpBodyFn on_body) : on_body_(std::move(on_body)) {}
+
+  Status feed(const char* p, size_t n);
+  // Peer closed the connection. Completes a read-until-close body.
+  Status finish_eof();
+
+  bool headers_done() const { return state_ != State::Headers; }
+  bool complete() const { return state_ == State::Done; }
+  bool stopped() const { return stopped_; }
+  int status() const { return status_; }
+  bool keep_alive() const { return keep_alive_; }
+
+private:
+  enum class State { Headers, Fixed, ChunkSize, ChunkData, ChunkCrlf, Trailers, UntilClose, Done };
+
+  Status parse_headers(std::string_view head);
+  bool emit(const char* p, size_t n);
+
+  HttpBodyFn on_body_;
+  State state_{State::Headers};
+  std::string line_;       // header block / chunk-size line accumulator
+  size_t remaining_{0};    // bytes left in fixed body or current chunk
+  int status_{0};
+  bool keep_alive_{true};
+  bool stopped_{false};
+};
+
+// Server-Sent Events framing: splits a byte stream into events and hands the
+// (joined) `data:` payload of each event to the callback. Return false to stop.
+class SseParser {
+public:
+  using EventFn = std::function<bool(std::string_view data)>;
+  explicit SseParser(EventFn on_event) : on_event_(std::move(on_event)) {}
+
+  // Returns false once the callback asked to stop.
+  bool feed(std::string_view bytes);
+
+private:
+  bool dispatch_line(std::string_view line);
+
+  EventFn on_event_;
+  std::string line_;
+  std::string data_;
+  bool has_data_{false};
+};
+
+struct HttpPoolOptions {
+  size_t max_idle{16};          // idle keep-alive sockets kept per upstream
+  size_t max_per_host{64};      // open sockets per upstream (0 = unlimited); acquire waits when reached
+  int idle_timeout_ms{30000};   // idle sockets older than this are closed instead of reused
+};
+
+// Per-upstream pool of keep-alive HTTP/1.1 connections. The resolved address of each
+// upstream is cached, so a warm request costs neither a DNS lookup nor a TCP handshake.
+// Thread-safe.
+class HttpConnPool {
+public:
+  explicit HttpConnPool(HttpPoolOptions opt = {}) : opt_(opt) {}
+  ~HttpConnPool();
+
+  HttpConnPool(const HttpConnPool&) = delete;
+  HttpConnPool& operator=(const HttpConnPool&) = delete;
+
+  // Hand out a connected socket, reusing an idle one when available. `sock` is
+  // applied to new sockets before they connect.
+  Status acquire(const UrlParts& u, int connect_timeout_ms, int& fd, bool& reused,
+                 const SocketOptions* sock = nullptr);
+  // Return a socket. Non-reusable sockets (error, Connection: close, partial read) are closed.
+  void release(const UrlParts& u, int fd, bool reusable);
+
+  const HttpPoolOptions& options() const { return opt_; }
+
+private:
+  struct Addr {
+    sockaddr_storage sa{};
+    socklen_t len{0};
+    int family{0}, socktype{0}, protocol{0};
+  };
+  struct Idle {
+    int fd{-1};
+    uint64_t since_us{0};
+  };
+  struct Upstream {
+    std::vector<Addr> addrs;      // cached getaddrinfo result
+    std::deque<Idle> idle;        // most recently released at the back
+    size_t open{0};               // sockets handed out + idle
+  };
+
+  static std::string key_of(const UrlParts& u) { return u.host + ":" + std::to_string(u.port); }
+  Status resolve(const UrlParts& u, std::vector<Addr>& out);
+  void prune_locked(Upstream& up, uint64_t now);
+
+  HttpPoolOptions opt_;
+  std::mutex mu_;
+  std::condition_variable cv_;
+  std::unordered_map<std::string, Upstream> ups_;
+};
+
+// POST `body` (application/json) and stream the decoded response body into `on_body`.
+// `http_status` is filled as soon as the status line is parsed. With a pool the
+// connection is kept alive and returned to it once the response has been fully read.
+// If `cancel` fires the socket is closed mid-response (so the upstream frees its slot)
+// and "cancelled" is returned. `sock` tunes newly opened sockets (nullptr = defaults).
+Status http_post(const UrlParts& u, int connect_timeout_ms, int request_timeout_ms,
+                 const std::string& body, bool accept_sse, int& http_status, const HttpBodyFn& on_body,
+                 HttpConnPool* pool = nullptr, const CancelToken* cancel = nullptr,
+                 const SocketOptions* sock = nullptr);
+
+// Convenience wrapper: buffer the whole response body.
+Status http_post_json(const UrlParts& u, int connect_timeout_ms, int request_timeout_ms,
+                      const std::string& body, int& http_status, std::string& out_body,
+                      HttpConnPool* pool = nullptr, const CancelToken* cancel = nullptr,
+                      const SocketOptions* sock = nullptr);
+
+// GET without a body (health probes); the whole response body is buffered.
+Status http_get(const UrlParts& u, int connect_timeout_ms, int request_timeout_ms,
+                int& http_status, std::string& out_body, HttpConnPool* pool = nullptr,
+                const SocketOptions* sock = nullptr);
+
+// Shared by the blocking client and HttpReactor.
+namespace detail {
+// Request line, headers and (when `body` is set) the JSON body, ready to write.
+std::string build_http_request(const char* method, const UrlParts& u, const std::string* body, bool accept_sse,
+                               bool keep_alive);
+// getaddrinfo() for a stream socket to u.host:u.port, every result passed to `each`.
+Status resolve_addrs(const UrlParts& u, const std::function<void(const addrinfo*)>& each);
+// An idle keep-alive socket is only worth reusing if the server has not closed it
+// (or sent unsolicited bytes) while it sat in a pool.
+bool idle_socket_alive(int fd);
+} // namespace detail
+
+} // namespace cc50
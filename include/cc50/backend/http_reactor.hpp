@@ -0,0 +1,173 @@
+#pragma once
+#include "http_client.hpp"
+#include "../common.hpp"
+#include "../mpsc_queue.hpp"
+#include "../socket_options.hpp"
+
+#include <sys/epoll.h>
+
+#include <atomic>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+namespace cc50 {
+
+// Non-blocking HTTP/1.1 client: every request is a small state machine (wait for a
+// socket slot, connect, write, read headers, stream the body) driven by a handful of
+// epoll loops, so thousands of upstream exchanges in flight cost sockets, not threads.
+// Bodies are decoded with the same HttpResponseParser as the blocking client.
+//
+// Each loop keeps its own keep-alive pool and cached upstream addresses. Host names
+// are resolved on the loop the first time they are used (getaddrinfo blocks it once
+// per upstream; numeric addresses never do).
+struct HttpReactorOptions {
+  int threads{1};               // epoll loops; calls are spread round-robin
+  bool keep_alive{true};
+  size_t max_idle{16};          // idle keep-alive sockets kept per upstream, per loop
+  size_t max_per_host{64};      // open sockets per upstream, per loop (0 = unlimited); extra calls wait
+  int idle_timeout_ms{30000};   // idle sockets older than this are closed instead of reused
+  SocketOptions sock{};         // applied to new sockets before they connect
+};
+
+struct HttpCallOptions {
+  int connect_timeout_ms{2000};       // waiting for a socket slot + TCP handshake
+  int request_timeout_ms{600000};     // longest silence from the upstream (not counted while paused)
+  bool accept_sse{false};
+  const CancelToken* cancel{nullptr}; // polled; must outlive the call
+};
+
+// Callbacks run on the call's loop thread, one at a time.
+struct HttpCallbacks {
+  std::function<void(int http_status)> on_headers;   // once, before any body bytes
+  HttpBodyFn on_body;                                 // decoded body; false stops reading (socket is dropped)
+  std::function<void(const Status& st)> on_done;      // exactly once, last; "cancelled" after a cancel
+};
+
+class HttpReactor {
+public:
+  explicit HttpReactor(HttpReactorOptions opt = {});
+  ~HttpReactor();
+
+  HttpReactor(const HttpReactor&) = delete;
+  HttpReactor& operator=(const HttpReactor&) = delete;
+
+  Status start();
+  // Ends every call still in flight with an error and joins the loops.
+  void stop();
+
+  // POST `body` (application/json). Returns the call's id at once; the callbacks may
+  // already be running by then. A call that fails on a reused keep-alive socket before
+  // any response byte is replayed on a fresh connection, as in http_post().
+  uint64_t post(const UrlParts& u, const std::string& body, const HttpCallOptions& o, HttpCallbacks cb);
+
+  // Stop / restart reading a call's response: backpressure for a consumer that cannot
+  // take more yet. Bytes already read are still delivered. Unknown (finished) ids are
+  // ignored. Safe from any thread, including from inside the call's own callbacks.
+  void pause(uint64_t id);
+  void resume(uint64_t id);
+
+  const HttpReactorOptions& options() const { return opt_; }
+
+private:
+  enum class State { WaitSlot, Connecting, Writing, Reading };
+
+  struct Call {
+    uint64_t id{0};
+    UrlParts u;
+    std::string key;          // host:port of the pool it draws from
+    std::string req;          // request bytes; [req_off, end) still to write
+    size_t req_off{0};
+    HttpCallOptions opt;
+    HttpCallbacks cb;
+
+    State state{State::WaitSlot};
+    int fd{-1};
+    uint32_t events{0};       // epoll interest currently registered (0 = not registered)
+    bool has_slot{false};     // counted in Host::open (idle socket taken or slot reserved)
+    bool reused{false};
+    bool got_bytes{false};
+    int attempt{0};
+    size_t addr_i{0};
+    std::unique_ptr<HttpResponseParser> parser;
+    bool headers_reported{false};
+    bool paused{false};
+    uint64_t deadline_us{0};
+  };
+
+  struct Addr {
+    sockaddr_storage sa{};
+    socklen_t len{0};
+    int family{0}, socktype{0}, protocol{0};
+  };
+  struct Idle {
+    int fd{-1};
+    uint64_t since_us{0};
+  };
+  struct Host {
+    std::vector<Addr> addrs;          // cached getaddrinfo result
+    std::deque<Idle> idle;            // most recently released at the back
+    size_t open{0};                   // sockets of running calls + idle
+    std::deque<uint64_t> waiting;     // calls queued for a slot, oldest first
+  };
+
+  struct Op {
+    enum class Kind { Start, Pause, Resume } kind{Kind::Start};
+    uint64_t id{0};
+    std::unique_ptr<Call> call;       // Start
+  };
+
+  // Like TcpTransport's shards: an id carries its loop in the low kLoopBits bits.
+  struct Loop {
+    uint32_t index{0};
+    int ep{-1};
+    int wake_fd{-1};
+    std::atomic<bool> wake_pending{false};
+    MpscQueue<Op> ops;
+    std::unordered_map<uint64_t, std::unique_ptr<Call>> calls;
+    std::unordered_map<std::string, Host> hosts;
+    std::vector<epoll_event> events;
+    std::atomic<uint64_t> next_seq{1};
+    uint64_t last_scan_us{0};
+    std::thread thread;
+  };
+
+  static constexpr int kLoopBits = 8;
+  static constexpr int kMaxLoops = 1 << kLoopBits;
+
+  Loop& loop_of(uint64_t id) { return *loops_[id & (kMaxLoops - 1)]; }
+  void submit(Loop& l, Op op);
+  void wake(Loop& l);
+  bool on_loop_thread(const Loop& l) const { return l.thread.get_id() == std::this_thread::get_id(); }
+
+  void run(Loop& l);
+  void drain_ops(Loop& l);
+  void scan(Loop& l, uint64_t now);
+
+  void begin(Loop& l, Call& c);                 // take an idle socket or a slot, or queue for one
+  void connect_next(Loop& l, Call& c, Status err); // try c.addr_i onwards; `err` if none is left
+  void on_connected(Loop& l, Call& c);
+  void begin_request(Loop& l, Call& c);
+  void handle_write(Loop& l, Call& c);
+  void handle_read(Loop& l, Call& c);
+  void set_paused(Loop& l, Call& c, bool paused);
+  void watch(Loop& l, Call& c, uint32_t events);
+  // Fail the current attempt; replays it when nothing was received on a reused socket.
+  void fail(Loop& l, Call& c, const Status& st);
+  // Hand the socket back (or close it), free the slot and run on_done.
+  void finish(Loop& l, uint64_t id, const Status& st);
+  void serve_waiting(Loop& l, Host& h);
+  void prune_idle(Host& h, uint64_t now);
+
+  HttpReactorOptions opt_;
+  std::vector<std::unique_ptr<Loop>> loops_;
+  std::atomic<uint32_t> rr_{0};
+  std::atomic<bool> stop_{false};
+  bool started_{false};
+};
+
+} // namespace cc50
@@ -0,0 +1,66 @@
+#pragma once
+#include <cstdint>
+#include <string>
+#include <string_view>
+
+namespace cc50 {
+
+// Pull tokenizer over one complete JSON document (a response body or one SSE
+// `data:` payload). It makes a single pass, builds no tree and does not allocate:
+// strings and numbers come back as views into the input, and strings are decoded
+// only when the caller asks (json_unescape). Nesting deeper than 64 is an error.
+class JsonReader {
+public:
+  enum class Token : uint8_t {
+    BeginObject, EndObject, BeginArray, EndArray,
+    Key,      // member name; the member's value follows
+    String, Number, True, False, Null,
+    End,      // document complete
+    Error,    // malformed input; every later call returns Error too
+  };
+
+  explicit JsonReader(std::string_view doc) : s_(doc) {}
+
+  Token next();
+
+  // The value starting at the next token is consumed whole (scalar, object or array).
+  Token skip_value();
+
+  // Key/String: the text between the quotes, escapes still in place. Number: the literal.
+  std::string_view raw() const { return raw_; }
+  // raw() contains backslash escapes and must go through json_unescape().
+  bool escaped() const { return escaped_; }
+  // Containers open after the last token (a top-level member's key is at depth 1).
+  int depth() const { return depth_; }
+
+private:
+  static constexpr int kMaxDepth = 64;
+
+  Token fail() { failed_ = true; return Token::Error; }
+  bool in_object() const { return depth_ > 0 && ((objects_ >> (depth_ - 1)) & 1u); }
+  Token scan_string();
+  Token scan_literal(std::string_view word, Token t);
+
+  std::string_view s_;
+  size_t pos_{0};
+  std::string_view raw_;
+  bool escaped_{false};
+  int depth_{0};
+  uint64_t objects_{0};      // bit d-1 set: container at depth d is an object
+  bool expect_key_{false};
+  bool failed_{false};
+};
+
+// Append the decoded form of an escaped JSON string body to `out` as UTF-8.
+// \uXXXX escapes cover the whole range, surrogate pairs included; a lone
+// surrogate becomes U+FFFD. Returns false on a malformed escape.
+bool json_unescape(std::string_view raw, std::string& out);
+
+// Text of the current Key/String token; decoded into `scratch` only when it has escapes.
+std::string_view json_string(const JsonReader& r, std::string& scratch);
+
+// Number literal to a value; false (out untouched) when it is malformed or out of range.
+bool json_to_int(std::string_view num, int64_t& out);
+bool json_to_double(std::string_view num, double& out);
+
+} // namespace cc50
@@ -1,7 +1,17 @@
 #pragma once
 #include "backend.hpp"
+#include "../metrics.hpp"
+#include "../socket_options.hpp"
 
+#include <atomic>
+#include <cstdint>
+#include <condition_variable>
+#include <memory>
+#include <mutex>
 #include <string>
+#include <thread>
+#include <utility>
+#include <vector>
 
 namespace cc50 {
 
@@ -13,31 +23,164 @@ namespace cc50 {
 //   - or POST /v1/completions (OpenAI-style) body: {"model":"", "prompt":"...", "max_tokens":128, "stream":false}
 //
 // We try /completion first by default and fall back to /v1/completions if needed.
+// With `stream` set, the request uses "stream":true and every SSE `data:` event is
+// forwarded to on_chunk as it arrives instead of waiting for the full completion.
+//
+// Several llama-server instances (e.g. one per GPU) can be listed in `upstreams`. Each
+// request goes to the healthy upstream with the fewest requests in flight (least) or the
+// better of two random picks (p2c). An upstream is ejected after `eject_after_failures`
+// consecutive errors and comes back once GET /health answers 200 (or after `eject_ms` when
+// health checks are off). A request that fails before any text was streamed is retried on
+// another upstream.
+//
+// With `reactor_threads` set, infer_async() runs the same exchange non-blocking on an
+// HttpReactor, so a request in flight costs a socket rather than a thread;
+// infer_stream() keeps using the blocking client on the caller's thread.
 struct LlamaServerOptions {
   std::string base_url {"http://127.0.0.1:8090"};
   std::string endpoint {"/completion"};        // default
   int connect_timeout_ms {2000};
   int request_timeout_ms {600000};             // 10 minutes
-  size_t chunk_bytes {4096};                   // how we re-chunk output to our RESP_CHUNK messages
+  size_t chunk_bytes {4096};                   // how we re-chunk output to our RESP_CHUNK messages (non-stream)
+  bool stream {true};                          // SSE token streaming from llama-server
+
+  // keep-alive connection pool to the upstream
+  bool keep_alive {true};
+  size_t pool_max_idle {16};                   // idle sockets kept per upstream
+  size_t pool_max_per_host {64};               // concurrent sockets per upstream (0 = unlimited)
+  int pool_idle_timeout_ms {30000};            // close idle sockets older than this
+  SocketOptions sock {};                       // tuning for upstream sockets (TCP_NODELAY on by default)
+  int reactor_threads {0};                     // epoll loops for infer_async (0 = not async capable)
+
+  // several llama-server instances
+  std::vector<std::string> upstreams {};       // base URLs; empty = just base_url
+  std::string balance {"p2c"};                 // p2c | least
+  int health_interval_ms {2000};               // GET /health period (0 = no health checks)
+  int eject_after_failures {3};                // consecutive errors before an upstream is skipped
+  int eject_ms {10000};                        // earliest retry of an ejected upstream without health checks
+
+  MetricsRegistry* metrics {nullptr};          // upstream counters and latencies, registered by init()
 };
 
+class HttpConnPool;
+class HttpReactor;
+
 class LlamaServerBackend final : public IBackend {
 public:
-  explicit LlamaServerBackend(LlamaServerOptions opt = {}) : opt_(std::move(opt)) {}
+  explicit LlamaServerBackend(LlamaServerOptions opt = {});
+  ~LlamaServerBackend() override;
 
   Status init() override;
   Status load_model(const std::string& path, int ctx, int threads) override; // no-op (server already has model)
-  Status infer_stream(const InferRequest& req, StreamFn on_chunk, InferResult& out) override;
+  Status infer_stream(const InferRequest& req, StreamFn on_chunk, InferResult& out,
+                      const CancelToken& cancel) override;
+  bool async_capable() const override { return reactor_ != nullptr; }
+  std::shared_ptr<AsyncInfer> infer_async(const InferRequest& req, StreamFn on_chunk, DoneFn on_done,
+                                          const CancelToken& cancel) override;
 
-  void set_options(LlamaServerOptions o) { opt_ = std::move(o); }
+  // Not safe while requests are in flight.
+  void set_options(LlamaServerOptions o);
   const LlamaServerOptions& options() const { return opt_; }
 
+  // Fields of one llama-server response body or SSE event (/completion or the
+  // OpenAI-style /v1/completions schema), filled by parse_completion in one scan.
+  struct Completion {
+    std::string text;              // content | response | completion | choices[0].text
+    bool has_text{false};
+    bool stop{false};              // "stop": true, or choices[0].finish_reason set
+    bool has_error{false};         // top-level "error" member
+    std::string error;             // its message
+    int64_t tokens_predicted{-1};  // -1 = not reported; usage.completion_tokens for OpenAI
+    int64_t tokens_evaluated{-1};  // usage.prompt_tokens for OpenAI
+    double prompt_ms{-1};          // timings.prompt_ms
+    double predicted_ms{-1};       // timings.predicted_ms
+    int64_t prompt_n{-1};          // timings.prompt_n: prompt tokens actually processed
+
+    void clear();
+  };
+
+  // Returns false for malformed JSON; fields seen before the error are kept.
+  static bool parse_completion(std::string_view body, Completion& out);
+
 private:
+  // Kept per upstream URL for the life of the backend (set_options() does not drop
+  // them), so the registry never refers to a replaced Upstream.
+  struct UpstreamMetrics {
+    Counter requests;         // attempts sent
+    Counter failures;         // attempts that failed through the upstream's fault
+    Gauge in_flight;
+    Gauge ejected;            // 1 while ejected
+  };
+
+  struct Upstream {
+    std::string base_url;
+    UpstreamMetrics* m {nullptr};
+    std::atomic<int> outstanding {0};
+    std::atomic<int> failures {0};          // consecutive
+    std::atomic<bool> ejected {false};
+    std::atomic<uint64_t> retry_at_us {0};  // ejected: eligible again from here on
+  };
+
+  struct Reply;
+  struct AsyncReq;
+
+  void reset_pool();
+  void reset_reactor();
+  void reset_upstreams();
+  void start_health();
+  void stop_health();
+  void health_loop();
+
+  // Pick an upstream not in `tried` (nullptr when all have been tried).
+  Upstream* pick(const std::vector<Upstream*>& tried);
+  void note_success(Upstream& up);
+  void note_failure(Upstream& up, const std::string& why);
+
+  UpstreamMetrics& upstream_metrics(const std::string& url);
+  void register_upstream(const std::string& url, const UpstreamMetrics& m);
+
+  // One upstream: primary endpoint, then the /v1/completions fallback.
+  // `fault` is set when the failure is the upstream's (connect/IO error, 5xx, broken stream).
+  // Token counts and timings the upstream reports are stored in `out`.
+  Status try_upstream(const Upstream& up, const InferRequest& req, const std::string& prompt,
+                      const StreamFn& on_chunk, const CancelToken& cancel, InferResult& out,
+                      std::string& text, size_t& emitted, bool& fault);
+
+  // Bookkeeping around one attempt on `up`, shared by infer_stream and AsyncReq.
+  void begin_attempt(Upstream& up, std::vector<Upstream*>& tried);
+  // Records the outcome in the upstream's health and `errors`. Returns true when the
+  // request should move on to another upstream.
+  bool end_attempt(Upstream& up, uint64_t attempt_t0, const Status& st, bool fault, bool cancelled,
+                   size_t emitted, std::string& errors);
+  // Final status and `out` once no attempt is left; `st` is the last attempt's.
+  Status conclude(const Status& st, bool cancelled, bool attempted, size_t emitted, const std::string& errors,
+                  std::string& text, const StreamFn& on_chunk, uint64_t t0, InferResult& out);
+
   LlamaServerOptions opt_;
+  std::unique_ptr<HttpConnPool> pool_; // null when keep_alive is off
+  std::unique_ptr<HttpReactor> reactor_; // started by init() when reactor_threads > 0
+  std::vector<std::unique_ptr<Upstream>> ups_;
+
+  std::vector<std::pair<std::string, std::unique_ptr<UpstreamMetrics>>> up_metrics_;
+  Counter fallbacks_;           // attempts moved on to /v1/completions
+  Counter retries_;             // requests moved on to another upstream
+  Histogram attempt_us_;        // one attempt on one upstream, fallback included
+  Histogram first_event_us_;    // streaming: request sent -> first token event
+  bool metrics_registered_ {false};
+
+  std::thread health_;
+  std::mutex health_mu_;
+  std::condition_variable health_cv_;
+  bool health_stop_ {false};
+
+  // Copy the counts and timings `c` reports into `out`; fields it lacks are left alone.
+  static void apply_usage(const Completion& c, InferResult& out);
 
   // small helpers
   static std::string json_escape(std::string_view s);
-  static bool json_extract_string(const std::string& body, const char* key, std::string& out);
+  // The set fields of `p` as request body members, each preceded by a comma ("" if none).
+  // llama-server takes the same names on /completion and /v1/completions.
+  static std::string sampling_json(const SamplingParams& p);
 };
 
 } // namespace cc50
@@ -1,15 +1,47 @@
 #pragma once
 #include "backend.hpp"
 
+#include <memory>
+
 namespace cc50 {
 
+class MetricsRegistry;
+
+struct ToyBackendOptions {
+  bool batching {true};        // continuous batching decode loop (false: one kernel stream per request)
+  uint32_t max_batch {64};     // sequences per decode step; later arrivals wait for a free slot
+  uint32_t kernel_iters {20000};
+  MetricsRegistry* metrics {nullptr};  // decode step counters, registered by init()
+};
+
 // CUDA toy backend: generates token-like chunks with GPU work so benchmarking is meaningful.
 // Always builds, independent of llama.cpp.
+//
+// Batching mode mirrors iteration-level scheduling in llama.cpp server slots / vLLM: a
+// single decode thread gathers every active request, launches one kernel per step that
+// covers the whole batch, and hands each request one token per step. Requests join and
+// leave between steps, so aggregate tokens/s grows with the batch instead of staying flat.
+//
+// Without batching, each in-flight request borrows a "lane" (its own non-blocking CUDA
+// stream, completion event and device scratch buffer) from a pool that grows to the number
+// of concurrent workers. Lanes are reused across requests, so the steady state does no
+// cudaMalloc, and a token only waits for its own stream instead of synchronizing the device.
 class ToyBackend final : public IBackend {
 public:
+  explicit ToyBackend(ToyBackendOptions opt = {});
+  ~ToyBackend() override;
+
   Status init() override;
   Status load_model(const std::string& path, int ctx, int threads) override;
-  Status infer_stream(const InferRequest& req, StreamFn on_chunk, InferResult& out) override;
+  Status infer_stream(const InferRequest& req, StreamFn on_chunk, InferResult& out,
+                      const CancelToken& cancel) override;
+
+private:
+  Status infer_lane(const InferRequest& req, StreamFn& on_chunk, InferResult& out, const CancelToken& cancel);
+  Status infer_batched(const InferRequest& req, StreamFn& on_chunk, InferResult& out, const CancelToken& cancel);
+
+  struct Impl;
+  std::unique_ptr<Impl> impl_;
 };
 
 } // namespace cc50
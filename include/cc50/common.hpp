@@ -1,11 +1,18 @@
 #pragma once
+#include <unistd.h>
+
+#include <algorithm>
+#include <atomic>
 #include <cstdint>
 #include <cstring>
+#include <memory>
+#include <sstream>
 #include <string>
 #include <string_view>
 #include <stdexcept>
 #include <iostream>
 #include <chrono>
+#include <thread>
 
 namespace cc50 {
 
@@ -23,8 +30,218 @@ struct Status {
   static Status Err(std::string m) { return {false, std::move(m)}; }
 };
 
+// Cooperative cancellation flag. Set by the server (REQ_CANCEL, client disconnect)
+// and polled by backends between units of work.
+class CancelToken {
+public:
+  void cancel() { flag_.store(true, std::memory_order_release); }
+  bool cancelled() const { return flag_.load(std::memory_order_acquire); }
+
+private:
+  std::atomic<bool> flag_{false};
+};
+
 inline void die(const std::string& m) {
   throw std::runtime_error(m);
 }
 
+// ---- logging ----
+//
+//   CC50_LOG_INFO("[Backend] upstream " << url << " is back");
+//
+// A line is formatted on the calling thread into a slot of a lock-free ring and
+// written to stderr by a background thread, so logging never waits on terminal or
+// journald I/O. A full ring drops the line (the drop count is reported) instead of
+// blocking. Levels below CC50_LOG_MIN_LEVEL compile away; the runtime level is
+// checked before anything is formatted. CC50_LOG_EVERY_N samples hot call sites.
+
+enum class LogLevel : int { Debug = 0, Info = 1, Warn = 2, Error = 3, Off = 4 };
+
+// Lowest level compiled in; release (NDEBUG) builds drop debug statements entirely.
+#ifndef CC50_LOG_MIN_LEVEL
+#ifdef NDEBUG
+#define CC50_LOG_MIN_LEVEL 1
+#else
+#define CC50_LOG_MIN_LEVEL 0
+#endif
+#endif
+
+inline bool parse_log_level(std::string_view s, LogLevel& out) {
+  if (s == "debug") out = LogLevel::Debug;
+  else if (s == "info") out = LogLevel::Info;
+  else if (s == "warn") out = LogLevel::Warn;
+  else if (s == "error") out = LogLevel::Error;
+  else if (s == "off") out = LogLevel::Off;
+  else return false;
+  return true;
+}
+
+class AsyncLog {
+public:
+  static constexpr size_t kSlots = 4096;      // power of two
+  static constexpr size_t kLineBytes = 240;   // longer lines are truncated
+
+  static AsyncLog& instance() {
+    static AsyncLog log;
+    return log;
+  }
+
+  static bool enabled(LogLevel l) { return (int)l >= level_.load(std::memory_order_relaxed); }
+  static void set_level(LogLevel l) { level_.store((int)l, std::memory_order_relaxed); }
+
+  // Any thread; never blocks.
+  void push(LogLevel l, std::string_view msg) {
+    size_t pos = head_.load(std::memory_order_relaxed);
+    Slot* s = nullptr;
+    while (true) {
+      s = &slots_[pos & (kSlots - 1)];
+      const size_t seq = s->seq.load(std::memory_order_acquire);
+      if (seq == pos) {
+        if (head_.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) break;
+      } else if ((intptr_t)(seq - pos) < 0) {
+        dropped_.fetch_add(1, std::memory_order_relaxed);  // ring full
+        return;
+      } else {
+        pos = head_.load(std::memory_order_relaxed);
+      }
+    }
+    const size_t n = std::min(msg.size(), kLineBytes);
+    s->level = l;
+    s->len = (uint16_t)n;
+    s->truncated = msg.size() > n;
+    std::memcpy(s->text, msg.data(), n);
+    // seq_cst pairs with the writer's check before it sleeps
+    s->seq.store(pos + 1, std::memory_order_seq_cst);
+    if (sleeping_.load(std::memory_order_seq_cst)) kick();
+  }
+
+  // Wait until every line pushed so far has been written.
+  void flush() {
+    const size_t target = head_.load(std::memory_order_acquire);
+    while (written_.load(std::memory_order_acquire) < target) {
+      kick();
+      std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+  }
+
+  ~AsyncLog() {
+    stop_.store(true, std::memory_order_seq_cst);
+    kick();
+    if (writer_.joinable()) writer_.join();
+  }
+
+private:
+  struct Slot {
+    std::atomic<size_t> seq{0};   // == index: free; == index + 1: holds a line
+    LogLevel level{LogLevel::Info};
+    bool truncated{false};
+    uint16_t len{0};
+    char text[kLineBytes];
+  };
+
+  AsyncLog() : slots_(new Slot[kSlots]) {
+    for (size_t i = 0; i < kSlots; i++) slots_[i].seq.store(i, std::memory_order_relaxed);
+    writer_ = std::thread([this] { run(); });
+  }
+
+  void kick() {
+    wake_.fetch_add(1, std::memory_order_release);
+    wake_.notify_one();
+  }
+
+  bool ready() const {
+    return slots_[tail_ & (kSlots - 1)].seq.load(std::memory_order_seq_cst) == tail_ + 1;
+  }
+
+  void drain(std::string& out) {
+    static constexpr char kTag[] = {'D', 'I', 'W', 'E', '-'};
+    while (out.size() < (64u << 10) && ready()) {
+      Slot& s = slots_[tail_ & (kSlots - 1)];
+      out += kTag[(int)s.level];
+      out += ' ';
+      out.append(s.text, s.len);
+      if (s.truncated) out += "...";
+      out += '\n';
+      s.seq.store(tail_ + kSlots, std::memory_order_release);
+      tail_++;
+    }
+    const uint64_t d = dropped_.load(std::memory_order_relaxed);
+    if (d != reported_dropped_) {
+      out += "W [log] " + std::to_string(d - reported_dropped_) + " lines dropped (ring full)\n";
+      reported_dropped_ = d;
+    }
+  }
+
+  void run() {
+    std::string out;
+    while (true) {
+      out.clear();
+      drain(out);
+      for (size_t off = 0; off < out.size();) {
+        ssize_t n = ::write(STDERR_FILENO, out.data() + off, out.size() - off);
+        if (n <= 0) break;
+        off += (size_t)n;
+      }
+      written_.store(tail_, std::memory_order_release);
+      if (!out.empty()) continue;
+      if (stop_.load(std::memory_order_seq_cst)) return;
+
+      const uint32_t w = wake_.load(std::memory_order_acquire);
+      sleeping_.store(true, std::memory_order_seq_cst);
+      if (!ready() && !stop_.load(std::memory_order_seq_cst)) wake_.wait(w, std::memory_order_acquire);
+      sleeping_.store(false, std::memory_order_relaxed);
+    }
+  }
+
+  static inline std::atomic<int> level_{(int)LogLevel::Info};
+
+  std::unique_ptr<Slot[]> slots_;
+  std::atomic<size_t> head_{0};
+  size_t tail_{0};                     // writer thread only
+  std::atomic<size_t> written_{0};
+  std::atomic<uint64_t> dropped_{0};
+  uint64_t reported_dropped_{0};       // writer thread only
+  std::atomic<uint32_t> wake_{0};
+  std::atomic<bool> sleeping_{false};
+  std::atomic<bool> stop_{false};
+  std::thread writer_;
+};
+
+namespace detail {
+inline std::ostringstream& log_stream() {
+  thread_local std::ostringstream os;
+  os.str(std::string());
+  os.clear();
+  return os;
+}
+} // namespace detail
+
 } // namespace cc50
+
+#define CC50_LOG(lvl, expr)                                          \
+  do {                                                               \
+    if constexpr ((int)(lvl) >= CC50_LOG_MIN_LEVEL) {                \
+      if (::cc50::AsyncLog::enabled(lvl)) {                          \
+        auto& cc50_log_os_ = ::cc50::detail::log_stream();           \
+        cc50_log_os_ << expr;                                        \
+        ::cc50::AsyncLog::instance().push(lvl, cc50_log_os_.view()); \
+      }                                                              \
+    }                                                                \
+  } while (0)
+
+// Logs the first and then every n-th pass through this call site.
+#define CC50_LOG_EVERY_N(lvl, n, expr)                                                \
+  do {                                                                                \
+    if constexpr ((int)(lvl) >= CC50_LOG_MIN_LEVEL) {                                 \
+      static std::atomic<uint64_t> cc50_log_hits_{0};                                 \
+      if (::cc50::AsyncLog::enabled(lvl) &&                                           \
+          cc50_log_hits_.fetch_add(1, std::memory_order_relaxed) % (uint64_t)(n) == 0) { \
+        CC50_LOG(lvl, expr);                                                          \
+      }                                                                               \
+    }                                                                                 \
+  } while (0)
+
+#define CC50_LOG_DEBUG(expr) CC50_LOG(::cc50::LogLevel::Debug, expr)
+#define CC50_LOG_INFO(expr)  CC50_LOG(::cc50::LogLevel::Info, expr)
+#define CC50_LOG_WARN(expr)  CC50_LOG(::cc50::LogLevel::Warn, expr)
+#define CC50_LOG_ERROR(expr) CC50_LOG(::cc50::LogLevel::Error, expr)
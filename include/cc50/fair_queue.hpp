@@ -0,0 +1,126 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <list>
+#include <memory_resource>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+namespace cc50 {
+
+// Bounded work queue with strict priority levels and deficit round robin (DRR)
+// between flows inside a level. Each item carries a cost (the server uses
+// max_tokens); every time a flow comes up in the rotation it earns `quantum`
+// and may dequeue items while its deficit covers their cost. A flow submitting
+// long jobs therefore gets the same cost share as one submitting short ones,
+// instead of blocking them FIFO.
+//
+// max_depth bounds the total number of queued items (0 = unbounded). Queue entries,
+// flows and the rotation are allocated from `mr`.
+// Not thread-safe; the caller serializes access.
+template <typename T>
+class FairQueue {
+public:
+  explicit FairQueue(size_t levels = 1, uint64_t quantum = 1, size_t max_depth = 0,
+                     std::pmr::memory_resource* mr = std::pmr::get_default_resource())
+    : quantum_(quantum ? quantum : 1), max_depth_(max_depth) {
+    levels_.reserve(levels ? levels : 1);
+    for (size_t i = 0; i < (levels ? levels : 1); i++) levels_.emplace_back(mr);
+  }
+
+  size_t size() const { return size_; }
+  bool empty() const { return size_ == 0; }
+  bool full() const { return max_depth_ && size_ >= max_depth_; }
+
+  // Returns false (item untouched) when the queue is full; see shed_below().
+  bool push(size_t level, uint64_t flow, uint64_t cost, T& item) {
+    if (full()) return false;
+    Level& lv = levels_[level < levels_.size() ? level : levels_.size() - 1];
+    auto [it, fresh] = lv.flows.try_emplace(flow);
+    Flow& f = it->second;
+    if (fresh || f.items.empty()) lv.rr.push_back(flow);
+    f.items.push_back(Entry{cost, std::move(item)});
+    size_++;
+    return true;
+  }
+
+  // Make room for a `level` arrival by taking back the newest item from the lowest
+  // non-empty level below it. Returns false when nothing less urgent is queued.
+  bool shed_below(size_t level, T& victim) {
+    for (size_t l = 0; l < level && l < levels_.size(); l++) {
+      Level& lv = levels_[l];
+      if (lv.rr.empty()) continue;
+      // take from the flow that joined the rotation last; it has waited the least
+      auto it = lv.flows.find(lv.rr.back());
+      Flow& f = it->second;
+      victim = std::move(f.items.back().item);
+      f.items.pop_back();
+      size_--;
+      if (f.items.empty()) {
+        lv.rr.pop_back();
+        lv.flows.erase(it);
+      }
+      return true;
+    }
+    return false;
+  }
+
+  bool pop(T& out) {
+    for (size_t l = levels_.size(); l-- > 0;) {
+      Level& lv = levels_[l];
+      while (!lv.rr.empty()) {
+        auto it = lv.flows.find(lv.rr.front());
+        Flow& f = it->second;
+        if (!f.visited) {
+          f.deficit += quantum_;
+          f.visited = true;
+        }
+        Entry& e = f.items.front();
+        if (f.deficit < e.cost) {
+          // turn over: keep the deficit, go to the back of the rotation
+          f.visited = false;
+          lv.rr.splice(lv.rr.end(), lv.rr, lv.rr.begin());
+          continue;
+        }
+        f.deficit -= e.cost;
+        out = std::move(e.item);
+        f.items.pop_front();
+        size_--;
+        if (f.items.empty()) {
+          // an idle flow does not bank credit
+          lv.rr.pop_front();
+          lv.flows.erase(it);
+        }
+        return true;
+      }
+    }
+    return false;
+  }
+
+private:
+  struct Entry {
+    uint64_t cost;
+    T item;
+  };
+  struct Flow {
+    using allocator_type = std::pmr::polymorphic_allocator<>;
+    explicit Flow(const allocator_type& a) : items(a) {}
+    std::pmr::deque<Entry> items;
+    uint64_t deficit{0};
+    bool visited{false};   // quantum already granted for the current turn
+  };
+  struct Level {
+    explicit Level(std::pmr::memory_resource* mr) : flows(mr), rr(mr) {}
+    std::pmr::unordered_map<uint64_t, Flow> flows;
+    std::pmr::list<uint64_t> rr;   // flows with queued work, in service order
+  };
+
+  std::vector<Level> levels_;
+  uint64_t quantum_;
+  size_t max_depth_;
+  size_t size_{0};
+};
+
+} // namespace cc50
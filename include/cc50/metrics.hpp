@@ -0,0 +1,168 @@
+#pragma once
+#include "common.hpp"
+
+#include <array>
+#include <atomic>
+#include <bit>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <vector>
+
+namespace cc50 {
+
+// ---- metrics ----
+//
+// Instruments are embedded in the component they measure and cost one relaxed atomic
+// add on the hot path: counters and gauges are split into cache-line cells and each
+// thread adds to its own, so event loops and workers never share a line. Values are
+// summed only when a scrape renders the registry; a component with no registry still
+// counts, nobody reads it.
+
+static constexpr size_t kMetricCells = 16;
+
+// Cell of the calling thread: threads are dealt out round-robin on first use.
+inline size_t metric_cell() {
+  static std::atomic<size_t> next{0};
+  thread_local const size_t cell = next.fetch_add(1, std::memory_order_relaxed) % kMetricCells;
+  return cell;
+}
+
+template <typename T>
+class ShardedValue {
+public:
+  void add(T n) { cells_[metric_cell()].v.fetch_add(n, std::memory_order_relaxed); }
+  T value() const {
+    T sum = 0;
+    for (const auto& c : cells_) sum += c.v.load(std::memory_order_relaxed);
+    return sum;
+  }
+
+private:
+  struct alignas(64) Cell { std::atomic<T> v{0}; };
+  std::array<Cell, kMetricCells> cells_{};
+};
+
+// Monotonic count (events, bytes, microseconds spent).
+class Counter {
+public:
+  void inc(uint64_t n = 1) { v_.add(n); }
+  uint64_t value() const { return v_.value(); }
+
+private:
+  ShardedValue<uint64_t> v_;
+};
+
+// Level that goes up and down (in-flight requests, queued bytes). Cells may go
+// negative on their own when a decrement lands on another thread; the sum is exact.
+class Gauge {
+public:
+  void add(int64_t n) { v_.add(n); }
+  void inc() { v_.add(1); }
+  void dec() { v_.add(-1); }
+  int64_t value() const { return v_.value(); }
+
+private:
+  ShardedValue<int64_t> v_;
+};
+
+// Latency histogram in microseconds with log-linear (HDR-style) buckets: every power
+// of two is split in two, so a bucket bound is within 25% of any value in it. Bucket
+// 0 holds everything up to 16 us; values past 2^27 us (~134 s) only count towards +Inf.
+// record() is lock-free: one relaxed add on the bucket plus the count and sum cells.
+class Histogram {
+public:
+  static constexpr int kMinOctave = 4;
+  static constexpr int kMaxOctave = 27;
+  static constexpr size_t kBuckets = 1 + (kMaxOctave - kMinOctave) * 2 + 1; // last: overflow
+
+  void record(uint64_t us) {
+    buckets_[bucket_of(us)].fetch_add(1, std::memory_order_relaxed);
+    count_.inc();
+    sum_.inc(us);
+  }
+
+  // Buckets hold (upper_bound(i - 1), upper_bound(i)]; the overflow bucket has no bound.
+  static size_t bucket_of(uint64_t us) {
+    if (us <= (1ull << kMinOctave)) return 0;
+    const uint64_t x = us - 1;
+    const int o = 63 - std::countl_zero(x);
+    if (o >= kMaxOctave) return kBuckets - 1;
+    return 1 + (size_t)(o - kMinOctave) * 2 + ((x >> (o - 1)) & 1);
+  }
+  static uint64_t upper_bound(size_t i) {
+    if (i == 0) return 1ull << kMinOctave;
+    const size_t k = i - 1;
+    const uint64_t lo = 1ull << (kMinOctave + (int)(k / 2));
+    return (k & 1) ? lo * 2 : lo + lo / 2;
+  }
+
+  uint64_t bucket(size_t i) const { return buckets_[i].load(std::memory_order_relaxed); }
+  uint64_t count() const { return count_.value(); }
+  uint64_t sum_us() const { return sum_.value(); }
+
+private:
+  std::array<std::atomic<uint64_t>, kBuckets> buckets_{};
+  Counter count_;
+  Counter sum_;
+};
+
+// Escapes `value` for use inside a label set: metric_label("upstream", url).
+std::string metric_label(std::string_view key, std::string_view value);
+
+// Named view of the instruments of a process, rendered in the Prometheus text format.
+// Instruments are registered by reference and must outlive every render(); several
+// entries may share a name with different labels (they are grouped under one HELP/TYPE).
+// Thread-safe.
+class MetricsRegistry {
+public:
+  // `scale` converts the stored integer to the exported unit (1e-6 for us -> seconds).
+  void add(std::string name, std::string help, std::string labels, const Counter& c, double scale = 1.0);
+  void add(std::string name, std::string help, std::string labels, const Gauge& g, double scale = 1.0);
+  // Exported in seconds as <name>_bucket{le=...}, <name>_sum and <name>_count.
+  void add(std::string name, std::string help, std::string labels, const Histogram& h);
+  // Sampled at scrape time, for values a component already keeps (queue depth, cache stats).
+  void add_counter_fn(std::string name, std::string help, std::string labels, std::function<double()> fn);
+  void add_gauge_fn(std::string name, std::string help, std::string labels, std::function<double()> fn);
+
+  std::string render() const;
+
+private:
+  enum class Kind : uint8_t { Counter, Gauge, Histogram, CounterFn, GaugeFn };
+  struct Entry {
+    Kind kind;
+    std::string name, help, labels;
+    const void* src{nullptr};
+    double scale{1.0};
+    std::function<double()> fn;
+  };
+  void push(Entry e);
+
+  mutable std::mutex mu_;
+  std::vector<Entry> entries_;
+};
+
+// Minimal HTTP/1.0 endpoint for scrapers: GET /metrics (or /) answers with the
+// registry, anything else with 404. One connection at a time on its own thread,
+// closed after each response; it never touches the data path.
+class MetricsHttpServer {
+public:
+  ~MetricsHttpServer() { stop(); }
+
+  Status start(const std::string& host, uint16_t port, const MetricsRegistry& reg);
+  void stop();
+
+private:
+  void run();
+  void serve(int fd);
+
+  const MetricsRegistry* reg_{nullptr};
+  int listen_fd_{-1};
+  std::atomic<bool> stop_{false};
+  std::thread thread_;
+};
+
+} // namespace cc50
@@ -0,0 +1,68 @@
+#pragma once
+#include <atomic>
+#include <memory_resource>
+#include <new>
+#include <utility>
+
+namespace cc50 {
+
+// Unbounded lock-free multi-producer / single-consumer queue (Vyukov).
+// push() may be called from any thread; pop() only from the single consumer.
+// A producer is wait-free (one atomic exchange). While a push is half done the
+// consumer may briefly see the queue as empty; callers signal the consumer
+// after push() returns, so nothing is left behind.
+// Nodes come from `mr`, which must be thread-safe: producers allocate, the consumer frees.
+template <typename T>
+class MpscQueue {
+public:
+  explicit MpscQueue(std::pmr::memory_resource* mr = std::pmr::new_delete_resource())
+    : mr_(mr), head_(make_node()), tail_(head_.load(std::memory_order_relaxed)) {}
+
+  ~MpscQueue() {
+    T tmp;
+    while (pop(tmp)) {}
+    free_node(tail_);
+  }
+
+  MpscQueue(const MpscQueue&) = delete;
+  MpscQueue& operator=(const MpscQueue&) = delete;
+
+  void push(T v) {
+    Node* n = make_node();
+    n->value = std::move(v);
+    Node* prev = head_.exchange(n, std::memory_order_acq_rel);
+    prev->next.store(n, std::memory_order_release);
+  }
+
+  bool pop(T& out) {
+    Node* tail = tail_;
+    Node* next = tail->next.load(std::memory_order_acquire);
+    if (!next) return false;
+    out = std::move(next->value);
+    tail_ = next; // `next` becomes the new stub
+    free_node(tail);
+    return true;
+  }
+
+  bool empty() const {
+    return tail_->next.load(std::memory_order_acquire) == nullptr;
+  }
+
+private:
+  struct Node {
+    std::atomic<Node*> next{nullptr};
+    T value{};
+  };
+
+  Node* make_node() { return new (mr_->allocate(sizeof(Node), alignof(Node))) Node(); }
+  void free_node(Node* n) {
+    n->~Node();
+    mr_->deallocate(n, sizeof(Node), alignof(Node));
+  }
+
+  std::pmr::memory_resource* const mr_;
+  alignas(64) std::atomic<Node*> head_; // producers
+  alignas(64) Node* tail_;              // consumer
+};
+
+} // namespace cc50
@@ -1,4 +1,5 @@
 #pragma once
+#include <cstddef>
 #include <cstdint>
 
 namespace cc50 {
@@ -8,6 +9,9 @@ enum class MsgType : uint16_t {
   RESP_CHUNK = 2,
   RESP_DONE  = 3,
   RESP_ERR   = 4,
+  CREDIT_GRANT = 5,   // client -> server, replenishes a request's RESP_CHUNK window (v3)
+  REQ_CANCEL = 6,     // client -> server, abort req_id; answered with RESP_ERR + RESP_DONE
+  RESP_BATCH = 7,     // several small frames in one (v6), see BatchEntryHdr
 };
 
 struct MsgHeader {
@@ -19,19 +23,94 @@ struct MsgHeader {
   uint32_t length;
 };
 
-static constexpr uint16_t kProtoVer = 1;
+// v1: initial framing
+// v2: InferDone carries server-side queue / backend / time-to-first-token timings.
+//     Peers decode InferDone from min(length, sizeof(InferDone)) bytes, so v1 and
+//     v2 payloads are interchangeable (missing fields read as zero).
+// v3: flow control. InferRequestHdr::credit_bytes is the initial RESP_CHUNK window and
+//     the client returns consumed bytes with CREDIT_GRANT; the server stops producing
+//     (without dropping text) while the window is empty. Requests from v1/v2 peers,
+//     which never grant, are not windowed.
+// v4: InferRequestHdr grows priority / tenant for the server's fair scheduler. The prompt
+//     starts after kInferRequestHdrV1Size bytes for older peers, sizeof(InferRequestHdr) from v4.
+// v5: InferDone grows prompt token count and the backend's prefill / decode times. Like v2
+//     the fields are appended, so shorter payloads still decode (the new fields read as 0).
+// v6: InferRequestHdr::params_len, a TLV parameter block after the prompt (sampling options
+//     forwarded to the backend; unknown tags are skipped, so tags can be added without a
+//     version bump). RESP_BATCH: once a peer has sent a v6 frame, small RESP_CHUNKs queued
+//     for it together may travel as one frame; receivers split it back into messages.
+static constexpr uint16_t kProtoVer = 6;
+static constexpr uint16_t kProtoVerCredit = 3;
+static constexpr uint16_t kProtoVerPriority = 4;
+static constexpr uint16_t kProtoVerParams = 6;
+static constexpr uint16_t kProtoVerBatch = 6;
+
+static constexpr uint8_t kMaxPriority = 3;
 
 struct InferRequestHdr {
   uint32_t max_tokens;
-  uint32_t credit_bytes;
+  uint32_t credit_bytes;   // initial flow-control window (0 = server default)
   uint32_t prompt_len;
-  // prompt bytes follow
+  // v4
+  uint8_t priority;        // 0 (bulk, default) .. kMaxPriority (most urgent); higher levels are served first
+  uint8_t reserved[3];
+  uint32_t tenant;         // fair-share key (0 = per connection)
+  // v6
+  uint32_t params_len;     // bytes of the parameter block following the prompt
+  // prompt bytes follow, then params_len bytes of ParamTag entries
+};
+
+static constexpr size_t kInferRequestHdrV1Size = 12;
+static constexpr size_t kInferRequestHdrV4Size = 20;
+
+// Header size used by a peer speaking `version`.
+inline constexpr size_t infer_request_hdr_size(uint16_t version) {
+  return version >= kProtoVerParams ? sizeof(InferRequestHdr)
+       : version >= kProtoVerPriority ? kInferRequestHdrV4Size
+       : kInferRequestHdrV1Size;
+}
+
+// Parameter block entry: uint16 tag, uint16 length, then `length` value bytes.
+// Numbers are host-order like the rest of the protocol; f32 is an IEEE float.
+enum class ParamTag : uint16_t {
+  TEMPERATURE       = 1,  // f32
+  TOP_P             = 2,  // f32
+  TOP_K             = 3,  // u32
+  MIN_P             = 4,  // f32
+  REPEAT_PENALTY    = 5,  // f32
+  PRESENCE_PENALTY  = 6,  // f32
+  FREQUENCY_PENALTY = 7,  // f32
+  SEED              = 8,  // i64
+  STOP              = 9,  // UTF-8 bytes; repeated once per stop string
+};
+
+// RESP_BATCH payload: entries back to back, each this header followed by `len` bytes.
+// MsgHeader::req_id of the batch itself is 0; every entry names its own request.
+struct BatchEntryHdr {
+  uint64_t req_id;
+  uint32_t len;
+  uint16_t type;           // MsgType of the entry (RESP_CHUNK)
+  uint16_t reserved;
 };
 
 struct InferDone {
-  uint32_t tokens;
+  uint32_t tokens;         // generated tokens (0 if the backend cannot count them)
+  uint32_t reserved;
+  uint64_t elapsed_us;     // as reported by the backend
+  // v2
+  uint64_t queue_us;       // REQ_INFER received -> picked up by a worker
+  uint64_t backend_us;     // wall time spent in the backend call
+  uint64_t ttft_us;        // REQ_INFER received -> first RESP_CHUNK queued (0 if none)
+  // v5, as reported by the backend (0 = unknown)
+  uint32_t prompt_tokens;  // prompt tokens evaluated
+  uint32_t reserved2;
+  uint64_t prefill_us;     // prompt processing time
+  uint64_t decode_us;      // generation time
+};
+
+struct CreditGrant {
+  uint32_t bytes;          // added to the window of MsgHeader::req_id
   uint32_t reserved;
-  uint64_t elapsed_us;
 };
 
 struct ErrMsg {
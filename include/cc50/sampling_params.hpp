@@ -0,0 +1,102 @@
+#pragma once
+#include "protocol.hpp"
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace cc50 {
+
+// Sampling options a client may set per request (v6 parameter block). Unset fields
+// leave the backend's defaults in place.
+struct SamplingParams {
+  std::optional<float> temperature;
+  std::optional<float> top_p;
+  std::optional<uint32_t> top_k;
+  std::optional<float> min_p;
+  std::optional<float> repeat_penalty;
+  std::optional<float> presence_penalty;
+  std::optional<float> frequency_penalty;
+  std::optional<int64_t> seed;
+  std::vector<std::string> stop;
+};
+
+namespace detail {
+inline void put_param(std::string& out, ParamTag tag, const void* v, size_t n) {
+  const uint16_t t = (uint16_t)tag, len = (uint16_t)n;
+  out.append((const char*)&t, sizeof(t));
+  out.append((const char*)&len, sizeof(len));
+  out.append((const char*)v, n);
+}
+
+template <typename T>
+inline void put_param(std::string& out, ParamTag tag, const std::optional<T>& v) {
+  if (v) put_param(out, tag, &*v, sizeof(T));
+}
+
+template <typename T>
+inline bool get_param(std::string_view v, std::optional<T>& out) {
+  if (v.size() != sizeof(T)) return false;
+  T x;
+  std::memcpy(&x, v.data(), sizeof(T));
+  out = x;
+  return true;
+}
+} // namespace detail
+
+// Encode `p` as a parameter block. Entries come out in tag order, so equal parameters
+// always give equal bytes (the result cache keys on them). Stop strings longer than
+// 65535 bytes are cut.
+inline std::string encode_params(const SamplingParams& p) {
+  using detail::put_param;
+  std::string out;
+  put_param(out, ParamTag::TEMPERATURE, p.temperature);
+  put_param(out, ParamTag::TOP_P, p.top_p);
+  put_param(out, ParamTag::TOP_K, p.top_k);
+  put_param(out, ParamTag::MIN_P, p.min_p);
+  put_param(out, ParamTag::REPEAT_PENALTY, p.repeat_penalty);
+  put_param(out, ParamTag::PRESENCE_PENALTY, p.presence_penalty);
+  put_param(out, ParamTag::FREQUENCY_PENALTY, p.frequency_penalty);
+  put_param(out, ParamTag::SEED, p.seed);
+  for (const auto& s : p.stop) put_param(out, ParamTag::STOP, s.data(), std::min<size_t>(s.size(), 0xFFFF));
+  return out;
+}
+
+// Decode a parameter block into `p`. Unknown tags are skipped; a truncated entry or a
+// known tag with the wrong value size makes the block invalid.
+inline bool decode_params(std::string_view block, SamplingParams& p) {
+  using detail::get_param;
+  size_t pos = 0;
+  while (pos < block.size()) {
+    if (block.size() - pos < 4) return false;
+    uint16_t tag = 0, len = 0;
+    std::memcpy(&tag, block.data() + pos, sizeof(tag));
+    std::memcpy(&len, block.data() + pos + 2, sizeof(len));
+    pos += 4;
+    if (block.size() - pos < len) return false;
+    const std::string_view v = block.substr(pos, len);
+    pos += len;
+
+    bool ok = true;
+    switch ((ParamTag)tag) {
+      case ParamTag::TEMPERATURE:       ok = get_param(v, p.temperature); break;
+      case ParamTag::TOP_P:             ok = get_param(v, p.top_p); break;
+      case ParamTag::TOP_K:             ok = get_param(v, p.top_k); break;
+      case ParamTag::MIN_P:             ok = get_param(v, p.min_p); break;
+      case ParamTag::REPEAT_PENALTY:    ok = get_param(v, p.repeat_penalty); break;
+      case ParamTag::PRESENCE_PENALTY:  ok = get_param(v, p.presence_penalty); break;
+      case ParamTag::FREQUENCY_PENALTY: ok = get_param(v, p.frequency_penalty); break;
+      case ParamTag::SEED:              ok = get_param(v, p.seed); break;
+      case ParamTag::STOP:              p.stop.emplace_back(v); break;
+      default: break; // newer peer: not understood, not fatal
+    }
+    if (!ok) return false;
+  }
+  return true;
+}
+
+} // namespace cc50
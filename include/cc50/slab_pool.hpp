@@ -0,0 +1,43 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <memory_resource>
+
+namespace cc50 {
+
+// ---- slab pool ----
+//
+// Size-class allocator for the memory requests and their frames churn through: frame
+// payloads, queue nodes, tx queues, scheduler entries. Blocks are powers of two from
+// 64 B to 128 KiB, carved out of slabs taken from the heap. Every thread keeps a few
+// free blocks per class and trades a batch with a shared depot (one lock per batch)
+// when it runs dry or holds too many, so a block allocated by a worker and freed by an
+// event loop finds its way back without touching the heap.
+//
+// Slabs are never returned: after warm-up the pool sits at its high-water mark and
+// steady-state traffic allocates nothing. Larger or over-aligned requests go straight
+// to operator new (counted in Stats::large_allocs).
+class SlabPool final : public std::pmr::memory_resource {
+public:
+  static constexpr size_t kMinBlock = 64;
+  static constexpr size_t kClasses = 12;                       // 64 B .. 128 KiB
+  static constexpr size_t kMaxBlock = kMinBlock << (kClasses - 1);
+  static constexpr size_t kSlabBytes = 64u << 10;              // smallest slab carved at a time
+
+  struct Stats {
+    uint64_t slab_bytes{0};    // taken from the heap for slabs so far
+    uint64_t large_allocs{0};  // requests above kMaxBlock served by operator new
+  };
+  Stats stats() const;
+
+private:
+  void* do_allocate(size_t bytes, size_t align) override;
+  void do_deallocate(void* p, size_t bytes, size_t align) override;
+  bool do_is_equal(const std::pmr::memory_resource& o) const noexcept override { return this == &o; }
+};
+
+// The process-wide pool. Never destroyed, so it outlives every static and thread.
+SlabPool* slab_pool();
+
+} // namespace cc50
@@ -0,0 +1,74 @@
+#pragma once
+#include "common.hpp"
+
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+
+#include <cerrno>
+#include <cstring>
+#include <string>
+
+namespace cc50 {
+
+// Per-socket tuning shared by the transports (accepted and client sockets) and the
+// llama-server HTTP client. Zero leaves the kernel default in place.
+struct SocketOptions {
+  // Small RESP_CHUNK frames otherwise wait for the ACK of the previous one
+  // (Nagle), which a delayed-ACK peer holds back for up to ~40 ms.
+  bool nodelay{true};
+  int sndbuf{0};              // SO_SNDBUF bytes; setting it disables buffer autotuning
+  int rcvbuf{0};              // SO_RCVBUF bytes; same
+  int busy_poll_us{0};        // SO_BUSY_POLL; values above net.core.busy_read need CAP_NET_ADMIN
+  // TCP_QUICKACK is not sticky (the kernel drops back to delayed ACKs), so the
+  // owner of the socket re-arms it after every read with rearm_quickack().
+  bool quickack{false};
+  int keepalive_idle_s{0};    // > 0 turns on SO_KEEPALIVE with this TCP_KEEPIDLE
+  int keepalive_intvl_s{0};   // TCP_KEEPINTVL (0 = kernel default)
+  int keepalive_cnt{0};       // TCP_KEEPCNT (0 = kernel default)
+};
+
+namespace detail {
+inline bool set_int_opt(int fd, int level, int name, int value, const char* what, Status& st) {
+  if (::setsockopt(fd, level, name, &value, sizeof(value)) == 0) return true;
+  st = Status::Err(std::string("setsockopt(") + what + ") failed: " + std::strerror(errno));
+  return false;
+}
+} // namespace detail
+
+// Apply `o` to a TCP socket. Returns the first option the kernel refused, if any;
+// the ones before it are already in effect.
+inline Status apply_socket_options(int fd, const SocketOptions& o) {
+  Status st = Status::Ok();
+  if (o.nodelay && !detail::set_int_opt(fd, IPPROTO_TCP, TCP_NODELAY, 1, "TCP_NODELAY", st)) return st;
+  if (o.sndbuf > 0 && !detail::set_int_opt(fd, SOL_SOCKET, SO_SNDBUF, o.sndbuf, "SO_SNDBUF", st)) return st;
+  if (o.rcvbuf > 0 && !detail::set_int_opt(fd, SOL_SOCKET, SO_RCVBUF, o.rcvbuf, "SO_RCVBUF", st)) return st;
+#ifdef SO_BUSY_POLL
+  if (o.busy_poll_us > 0 &&
+      !detail::set_int_opt(fd, SOL_SOCKET, SO_BUSY_POLL, o.busy_poll_us, "SO_BUSY_POLL", st)) {
+    return st;
+  }
+#endif
+  if (o.quickack && !detail::set_int_opt(fd, IPPROTO_TCP, TCP_QUICKACK, 1, "TCP_QUICKACK", st)) return st;
+  if (o.keepalive_idle_s > 0) {
+    if (!detail::set_int_opt(fd, SOL_SOCKET, SO_KEEPALIVE, 1, "SO_KEEPALIVE", st)) return st;
+    if (!detail::set_int_opt(fd, IPPROTO_TCP, TCP_KEEPIDLE, o.keepalive_idle_s, "TCP_KEEPIDLE", st)) return st;
+    if (o.keepalive_intvl_s > 0 &&
+        !detail::set_int_opt(fd, IPPROTO_TCP, TCP_KEEPINTVL, o.keepalive_intvl_s, "TCP_KEEPINTVL", st)) {
+      return st;
+    }
+    if (o.keepalive_cnt > 0 &&
+        !detail::set_int_opt(fd, IPPROTO_TCP, TCP_KEEPCNT, o.keepalive_cnt, "TCP_KEEPCNT", st)) {
+      return st;
+    }
+  }
+  return st;
+}
+
+inline void rearm_quickack(int fd, const SocketOptions& o) {
+  if (!o.quickack) return;
+  int one = 1;
+  ::setsockopt(fd, IPPROTO_TCP, TCP_QUICKACK, &one, sizeof(one));
+}
+
+} // namespace cc50
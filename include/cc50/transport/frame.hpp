@@ -0,0 +1,137 @@
+#pragma once
+#include "../protocol.hpp"
+#include "../slab_pool.hpp"
+
+#include <sys/uio.h>
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <deque>
+#include <memory_resource>
+#include <span>
+#include <string>
+#include <string_view>
+
+namespace cc50 {
+
+// One queued outbound frame: the header is built in place, the payload lives in the
+// slab pool, and both are flushed with a single gathered write without being copied
+// together. Every frame, queue and batch buffer uses slab_pool(), so moving a payload
+// between them only moves a pointer.
+struct TxFrame {
+  MsgHeader hdr{};
+  std::pmr::string payload{slab_pool()};
+  size_t size() const { return sizeof(MsgHeader) + payload.size(); }
+};
+
+using TxQueue = std::pmr::deque<TxFrame>;
+
+inline TxFrame make_tx_frame(uint64_t req_id, uint16_t type, const uint8_t* data, size_t len) {
+  TxFrame f;
+  f.hdr.magic   = kMagic;
+  f.hdr.version = kProtoVer;
+  f.hdr.type    = type;
+  f.hdr.req_id  = req_id;
+  f.hdr.flags   = 0;
+  f.hdr.length  = static_cast<uint32_t>(len);
+  f.payload.assign((const char*)data, len);
+  return f;
+}
+
+// Gather header+payload of the queued frames into at most `max_iov` entries;
+// the first `off` bytes of tx.front() are already written. Returns the entry count.
+// A frame takes one or two entries (none for the payload when it is empty), so a
+// frame is only started while two are left; pass the array's real size.
+inline int gather_tx(const TxQueue& tx, size_t off, iovec* iov, int max_iov) {
+  int niov = 0;
+  size_t skip = off;
+  for (auto f = tx.begin(); f != tx.end() && niov + 2 <= max_iov; ++f) {
+    const uint8_t* hp = (const uint8_t*)&f->hdr;
+    if (skip < sizeof(MsgHeader)) {
+      iov[niov++] = iovec{(void*)(hp + skip), sizeof(MsgHeader) - skip};
+      skip = 0;
+    } else {
+      skip -= sizeof(MsgHeader);
+    }
+    if (skip < f->payload.size()) {
+      iov[niov++] = iovec{(void*)(f->payload.data() + skip), f->payload.size() - skip};
+    }
+    skip = 0;
+  }
+  return niov;
+}
+
+// ---- RESP_BATCH (v6) ----
+//
+// Small RESP_CHUNKs that pile up in a connection's tx queue (several streams, or a
+// socket that is not keeping up) are folded into the RESP_BATCH frame before them,
+// paying a 16-byte entry header instead of a MsgHeader each. Only frames no write
+// has started on are touched, so the byte stream stays consistent.
+
+static constexpr size_t kBatchMaxEntryBytes = 1024;   // larger chunks keep their own frame
+static constexpr size_t kBatchMaxBytes = 64u << 10;   // payload cap of one batch
+
+inline bool batchable(const TxFrame& f) {
+  return f.hdr.type == (uint16_t)MsgType::RESP_CHUNK && f.payload.size() <= kBatchMaxEntryBytes;
+}
+
+inline void append_batch_entry(std::pmr::string& out, uint64_t req_id, uint16_t type, std::string_view payload) {
+  BatchEntryHdr e{};
+  e.req_id = req_id;
+  e.len = (uint32_t)payload.size();
+  e.type = type;
+  out.append((const char*)&e, sizeof(e));
+  out.append(payload.data(), payload.size());
+}
+
+// Fold `f` into tx.back() if both qualify; the first `locked` frames of tx are off
+// limits (partly written or referenced by an in-flight send). On success `grown` is
+// the number of bytes the queue grew by and `f` can be dropped.
+inline bool merge_into_batch(TxQueue& tx, size_t locked, const TxFrame& f, size_t& grown) {
+  if (tx.size() <= locked || !batchable(f)) return false;
+  TxFrame& b = tx.back();
+  const size_t entry = sizeof(BatchEntryHdr) + f.payload.size();
+  const size_t before = b.size();
+  if (batchable(b)) {
+    std::pmr::string p{b.payload.get_allocator()};
+    p.reserve(sizeof(BatchEntryHdr) + b.payload.size() + entry);
+    append_batch_entry(p, b.hdr.req_id, b.hdr.type, b.payload);
+    b.payload = std::move(p);
+    b.hdr.type = (uint16_t)MsgType::RESP_BATCH;
+    b.hdr.req_id = 0;
+  } else if (b.hdr.type != (uint16_t)MsgType::RESP_BATCH || b.payload.size() + entry > kBatchMaxBytes) {
+    return false;
+  }
+  append_batch_entry(b.payload, f.hdr.req_id, f.hdr.type, f.payload);
+  b.hdr.length = (uint32_t)b.payload.size();
+  grown = b.size() - before;
+  return true;
+}
+
+// Call fn(req_id, type, payload) for every entry of a RESP_BATCH payload.
+// Returns false for a malformed batch (entries already delivered stay delivered).
+template <typename Fn>
+inline bool for_each_batch_entry(std::span<const uint8_t> p, Fn&& fn) {
+  while (!p.empty()) {
+    if (p.size() < sizeof(BatchEntryHdr)) return false;
+    BatchEntryHdr e{};
+    std::memcpy(&e, p.data(), sizeof(e));
+    if (p.size() - sizeof(e) < e.len || e.type == (uint16_t)MsgType::RESP_BATCH) return false;
+    fn(e.req_id, e.type, p.subspan(sizeof(e), e.len));
+    p = p.subspan(sizeof(e) + e.len);
+  }
+  return true;
+}
+
+// Drop the frames fully covered by `n` more written bytes; `off` is updated for the new front.
+inline void retire_tx(TxQueue& tx, size_t& off, size_t n) {
+  size_t done = off + n;
+  while (!tx.empty() && done >= tx.front().size()) {
+    done -= tx.front().size();
+    tx.pop_front();
+  }
+  off = tx.empty() ? 0 : done;
+}
+
+} // namespace cc50
@@ -0,0 +1,108 @@
+#pragma once
+#include "transport.hpp"
+#include "frame.hpp"
+#include "../mpsc_queue.hpp"
+
+#include <liburing.h>
+
+#include <atomic>
+#include <deque>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace cc50 {
+
+// ITransport on io_uring (Linux >= 6.0, liburing >= 2.4). One ring driven by progress():
+//   - a multishot accept on the listen socket,
+//   - one multishot recv per connection drawing from a shared provided-buffer ring,
+//     with complete frames dispatched straight out of the kernel-filled buffer,
+//   - at most one gathered sendmsg in flight per connection, covering every queued frame.
+// Cross-thread send() uses the same MPSC queue + eventfd hand-off as TcpTransport; the
+// eventfd is read through the ring, so a wakeup costs no extra syscall on the loop side.
+// TransportOptions::event_threads is ignored (single ring).
+class IoUringTransport final : public ITransport {
+public:
+  IoUringTransport();
+  ~IoUringTransport() override;
+
+  Status start_server(const TransportOptions& opt, MessageHandler on_msg) override;
+  Status start_client(const TransportOptions& opt, MessageHandler on_msg) override;
+  void set_close_handler(CloseHandler on_close) override { on_close_ = std::move(on_close); }
+  Status send(ConnId conn, uint64_t req_id, uint16_t type, const uint8_t* data, size_t len) override;
+  Status progress(int timeout_ms) override;
+
+private:
+  static constexpr int kMaxIov = 128;  // iovecs per sendmsg (64 frames)
+
+  struct Conn {
+    ConnId id{kNoConn};
+    int fd{-1};
+    std::vector<uint8_t> rx;  // [rx_rd, rx_wr): a frame split across recv buffers
+    size_t rx_rd{0};
+    size_t rx_wr{0};
+    TxQueue tx{slab_pool()};
+    size_t tx_off{0};
+    size_t tx_bytes{0};
+    size_t tx_locked{0};      // leading tx frames the in-flight sendmsg points into
+    uint16_t peer_version{0}; // highest MsgHeader::version received; v6+ gets RESP_BATCH
+    // the kernel reads these while a sendmsg is in flight, so Conn never moves
+    iovec iov[kMaxIov];
+    msghdr mh{};
+    bool sending{false};
+    bool dirty{false};
+    bool closing{false};
+    int inflight{0};          // SQEs referencing this conn; it is freed at zero
+  };
+
+  struct OutFrame {
+    ConnId conn{kNoConn};
+    TxFrame frame;
+  };
+
+  Status init_ring();
+  Status make_listen_socket(const std::string& host, uint16_t port);
+  io_uring_sqe* get_sqe();
+  void arm_accept();
+  void arm_wake();
+  void arm_recv(Conn& c);
+  void flush_sends();
+
+  ConnId add_conn(int fd);
+  void begin_close(Conn& c);
+  void maybe_free(Conn& c);
+
+  Status on_accept(const io_uring_cqe& cqe);
+  Status on_recv(Conn& c, const io_uring_cqe& cqe);
+  void on_send(Conn& c, const io_uring_cqe& cqe);
+  Status consume(Conn& c, const uint8_t* p, size_t n);
+  void recycle_buffer(uint16_t bid);
+  void drain_outbound();
+  void queue_send(Conn& c, TxFrame&& f);
+
+  io_uring ring_{};
+  bool ring_ok_{false};
+  io_uring_buf_ring* br_{nullptr};
+  uint8_t* bufs_{nullptr};   // kBufCount x kBufSize, lent to the kernel through br_
+
+  int listen_fd_{-1};
+  int wake_fd_{-1};
+  uint64_t wake_val_{0};      // read target for the eventfd SQE
+  std::atomic<bool> wake_pending_{false};
+  MpscQueue<OutFrame> outq_{slab_pool()};
+
+  std::unordered_map<ConnId, std::unique_ptr<Conn>> conns_;
+  std::vector<ConnId> dirty_;
+  ConnId next_conn_id_{16};   // never reused, so a late send cannot reach a recycled fd
+  ConnId peer_{kNoConn};      // for client mode
+  Status fatal_;              // hard failure found while handling completions
+
+  MessageHandler on_msg_;
+  CloseHandler on_close_;
+  TransportOptions opt_;
+  TransportMetrics metrics_;
+  bool is_server_{false};
+};
+
+} // namespace cc50
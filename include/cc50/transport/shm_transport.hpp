@@ -0,0 +1,118 @@
+#pragma once
+#include "transport.hpp"
+#include "frame.hpp"
+#include "../mpsc_queue.hpp"
+
+#include <sys/epoll.h>
+
+#include <atomic>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace cc50 {
+
+struct ShmRing;  // control block of one direction, in the shared segment
+
+// ITransport over shared memory for clients on the same host. A client connects to an
+// AF_UNIX SOCK_SEQPACKET socket (TransportOptions::unix_path) and the server answers
+// with a memfd holding two single-producer / single-consumer byte rings, one per
+// direction, and an eventfd per side, passed with SCM_RIGHTS. From then on the socket
+// only reports a hangup: frames are copied into the ring and dispatched straight out of
+// the mapping (a frame that wraps around the end is copied out first), with no system
+// call while both sides keep up:
+//   - a reader that found its ring empty raises a flag before it sleeps, and only then
+//     does the writer kick its eventfd;
+//   - a writer facing a full ring raises the other flag, and the reader kicks it once it
+//     has made room.
+// Frames larger than the ring stream through it in pieces. Cross-thread send() uses the
+// same MPSC queue + eventfd hand-off as TcpTransport.
+//
+// The peer can write the shared pages at any time. Ring positions and frame headers are
+// validated like socket input, but payload bytes are only as trustworthy as the peer.
+// One event loop driven by progress(): event_threads and the socket options are ignored.
+class ShmTransport final : public ITransport {
+public:
+  ShmTransport();
+  ~ShmTransport() override;
+
+  Status start_server(const TransportOptions& opt, MessageHandler on_msg) override;
+  Status start_client(const TransportOptions& opt, MessageHandler on_msg) override;
+  void set_close_handler(CloseHandler on_close) override { on_close_ = std::move(on_close); }
+  Status send(ConnId conn, uint64_t req_id, uint16_t type, const uint8_t* data, size_t len) override;
+  Status progress(int timeout_ms) override;
+
+private:
+  struct Conn {
+    ConnId id{kNoConn};
+    int sock{-1};             // setup socket, afterwards watched for a hangup
+    int wake_fd{-1};          // kicked by the peer: data in rx, or room in tx
+    int peer_wake_fd{-1};
+    uint8_t* map{nullptr};
+    size_t map_bytes{0};
+    uint64_t cap{0};          // bytes per ring, a power of two
+    ShmRing* rx{nullptr};
+    ShmRing* tx{nullptr};
+    uint8_t* rx_data{nullptr};
+    uint8_t* tx_data{nullptr};
+    uint64_t rx_tail{0};      // our copies of the ring positions we own
+    uint64_t tx_head{0};
+
+    std::vector<uint8_t> stage; // a frame that wraps or does not fit, copied out piece by piece
+    size_t stage_need{0};       // its full size once the header is in (0 = not yet)
+    MsgHeader stage_hdr{};
+    TxQueue txq{slab_pool()};   // frames not yet in the ring
+    size_t tx_off{0};
+    size_t tx_bytes{0};
+    bool dirty{false};
+    uint16_t peer_version{0};   // highest MsgHeader::version received; v6+ gets RESP_BATCH
+  };
+
+  struct OutFrame {
+    ConnId conn{kNoConn};
+    TxFrame frame;
+  };
+
+  Status accept_new();
+  // Server: create the segment and wake fds and send them; client: receive and map them.
+  Status create_segment(Conn& c);
+  Status attach_segment(Conn& c);
+  void bind_rings(Conn& c);
+  Status add_conn(std::unique_ptr<Conn> c);
+  void close_conn(ConnId id);
+  void unmap(Conn& c);
+
+  // Read the rx ring dry, flush what fits of txq, then arm the wakeup and make sure
+  // nothing slipped in meanwhile. False (with `why`) when the peer broke the protocol.
+  bool service(Conn& c, const char*& why);
+  bool drain_rx(Conn& c, const char*& why);
+  bool flush_tx(Conn& c, const char*& why);
+  // `h` is a validated private copy; the payload may sit in the shared mapping.
+  bool deliver(Conn& c, const MsgHeader& h, const uint8_t* payload);
+  void queue_send(ConnId id, TxFrame&& f);
+
+  void wake();
+  Status drain_outbound();
+
+  int ep_{-1};
+  int listen_fd_{-1};
+  int wake_fd_{-1};
+  std::atomic<bool> wake_pending_{false};
+  MpscQueue<OutFrame> outq_{slab_pool()};
+  std::string unlink_path_;
+
+  std::unordered_map<ConnId, std::unique_ptr<Conn>> conns_;
+  std::vector<ConnId> dirty_;
+  std::vector<epoll_event> events_;
+  ConnId next_conn_id_{16};   // even and never reused; id | 1 tags the conn's socket in epoll
+  ConnId peer_{kNoConn};      // for client mode
+
+  MessageHandler on_msg_;
+  CloseHandler on_close_;
+  TransportOptions opt_;
+  TransportMetrics metrics_;
+  bool is_server_{false};
+};
+
+} // namespace cc50
@@ -1,5 +1,15 @@
 #pragma once
 #include "transport.hpp"
+#include "frame.hpp"
+#include "../mpsc_queue.hpp"
+#include "../protocol.hpp"
+#include <sys/epoll.h>
+#include <atomic>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
 #include <unordered_map>
 #include <vector>
 
@@ -12,31 +22,80 @@ public:
 
   Status start_server(const TransportOptions& opt, MessageHandler on_msg) override;
   Status start_client(const TransportOptions& opt, MessageHandler on_msg) override;
-  Status send(uint64_t req_id, uint16_t type, const uint8_t* data, size_t len) override;
+  void set_close_handler(CloseHandler on_close) override { on_close_ = std::move(on_close); }
+  Status send(ConnId conn, uint64_t req_id, uint16_t type, const uint8_t* data, size_t len) override;
   Status progress(int timeout_ms) override;
 
 private:
   struct Conn {
     int fd{-1};
-    std::vector<uint8_t> rx;
-    std::vector<uint8_t> tx;
-    size_t tx_off{0};
+    std::vector<uint8_t> rx;  // [rx_rd, rx_wr) holds unparsed bytes
+    size_t rx_rd{0};
+    size_t rx_wr{0};
+    TxQueue tx{slab_pool()};
+    size_t tx_off{0};   // bytes of tx.front() already written
+    size_t tx_bytes{0}; // unsent bytes across tx
+    // Registered once for IN|OUT|RDHUP, edge-triggered: after a short write the
+    // socket stays unwritable until the next EPOLLOUT edge, so no epoll_ctl per send.
+    bool writable{true};
+    bool dirty{false};  // queued frames not yet flushed in this drain
+    uint16_t peer_version{0}; // highest MsgHeader::version received; v6+ gets RESP_BATCH
   };
 
-  Status make_listen_socket(const std::string& host, uint16_t port);
-  Status accept_new();
-  Status handle_read(int fd);
-  Status handle_write(int fd);
+  // Cross-thread send path: senders push framed bytes and kick the shard's eventfd;
+  // only the thread driving a shard touches its conns.
+  struct OutFrame {
+    ConnId conn{kNoConn};
+    TxFrame frame;
+  };
+
+  // One event loop. A ConnId carries its shard index in the low kShardBits bits,
+  // so send() routes a frame without a lookup.
+  struct Shard {
+    uint32_t index{0};
+    int ep{-1};
+    int listen_fd{-1};
+    int wake_fd{-1};  // eventfd, readable when outq has frames
+    std::atomic<bool> wake_pending{false};
+    MpscQueue<OutFrame> outq{slab_pool()};
+    std::unordered_map<ConnId, Conn> conns;
+    std::vector<epoll_event> events;  // reused across poll() calls
+    std::vector<ConnId> dirty;        // conns with frames queued by the current drain
+    uint64_t next_seq{1}; // never reused, so a late send cannot reach a recycled fd
+    std::thread thread;   // shards other than 0
+  };
+
+  static constexpr int kShardBits = 8;
+  static constexpr int kMaxShards = 1 << kShardBits;
+
+  Status init_shard(Shard& s);
+  Status make_listen_socket(Shard& s, const std::string& host, uint16_t port, bool reuse_port);
+  Status accept_new(Shard& s);
+  Status handle_read(Shard& s, ConnId id);
+  // Write until tx is empty or the socket would block.
+  Status handle_write(Shard& s, ConnId id);
+
+  ConnId add_conn(Shard& s, int fd);
+  void close_conn(Shard& s, ConnId id);
+  Status queue_send(Shard& s, ConnId id, TxFrame&& f);
 
-  Status queue_send(int fd, const uint8_t* bytes, size_t len);
+  void wake(Shard& s);
+  Status drain_outbound(Shard& s);
+  Status poll(Shard& s, int timeout_ms);
+  void run_shard(Shard& s);
 
-  int ep_{-1};
-  int listen_fd_{-1};
-  int peer_fd_{-1}; // for client mode
-  std::unordered_map<int, Conn> conns_;
+  std::vector<std::unique_ptr<Shard>> shards_;  // [0] is driven by progress()
+  ConnId peer_{kNoConn}; // for client mode
+  std::atomic<bool> stop_{false};
+  std::mutex err_mu_;
+  Status shard_err_;     // first failure of a background shard, surfaced by progress()
+  std::atomic<bool> has_shard_err_{false};
   MessageHandler on_msg_;
+  CloseHandler on_close_;
   TransportOptions opt_;
+  TransportMetrics metrics_;
   bool is_server_{false};
+  bool pinned_{false};    // shard 0 pinned to pin_cpu_base, on the first progress()
 };
 
 } // namespace cc50
@@ -1,27 +1,87 @@
 #pragma once
 #include <cstdint>
 #include <functional>
+#include <span>
 #include <string>
 #include <string_view>
 #include <vector>
 #include "../common.hpp"
+#include "../metrics.hpp"
+#include "../socket_options.hpp"
 
 namespace cc50 {
 
+// Opaque per-connection handle. Ids are never reused within a transport instance.
+using ConnId = uint64_t;
+static constexpr ConnId kNoConn = 0;
+
 struct IncomingMessage {
+  ConnId conn{kNoConn};   // connection the message arrived on; reply with it
   uint64_t req_id{};
   uint16_t type{};
-  std::vector<uint8_t> payload;
+  uint16_t version{};     // sender's protocol version (MsgHeader::version)
+  // View into the transport's receive buffer, valid only for the duration of the
+  // handler call; copy out whatever must outlive it.
+  std::span<const uint8_t> payload;
 };
 
 using MessageHandler = std::function<void(const IncomingMessage&)>;
+using CloseHandler = std::function<void(ConnId)>;
 
 struct TransportOptions {
   std::string listen_host{"0.0.0.0"};
   uint16_t listen_port{9199};
   std::string server_host{"127.0.0.1"};
   uint16_t server_port{9199};
+  // unix/shm: AF_UNIX socket the server listens on and the client connects to
+  // ("@name" = abstract namespace); the host/port fields are not used
+  std::string unix_path{};
+  size_t shm_ring_bytes{1u << 20};    // shm: per direction and connection, rounded up to a power of two
   int epoll_max_events{256};
+  int listen_backlog{1024};
+  // Server: number of event-loop shards. Each has its own epoll set and SO_REUSEPORT
+  // listener (the kernel spreads new connections across them) and owns its connections.
+  // Shard 0 runs on the progress() thread, the others on internal threads; with more
+  // than one, the message and close handlers are called concurrently.
+  int event_threads{1};
+  int pin_cpu_base{-1};               // >= 0: pin shard i to CPU pin_cpu_base + i (shard 0: the
+                                      // progress() thread, from its first call on)
+  size_t max_frame_bytes{64u << 20};  // larger frames are treated as a corrupt stream
+  size_t max_conn_tx_bytes{32u << 20}; // unsent bytes queued per connection; a peer that
+                                       // lets more pile up is dropped as a slow consumer (0 = no cap)
+  SocketOptions sock{};                // applied to the listener (inherited on accept) or client socket
+  MetricsRegistry* metrics{nullptr};   // server: where start_server() registers TransportMetrics
+};
+
+// Counted by the event loops of either transport.
+struct TransportMetrics {
+  Counter conns_accepted;
+  Counter conns_closed;
+  Counter slow_consumer_drops;  // closed for letting more than max_conn_tx_bytes pile up
+  Counter corrupt_streams;      // closed for a bad magic or oversized frame
+  Counter frames_rx, bytes_rx;  // complete frames handed to the message handler
+  Counter frames_tx, bytes_tx;  // frames queued / bytes the kernel accepted
+  Counter batched_tx;           // queued frames folded into a RESP_BATCH
+  Gauge conns_open;
+  Gauge tx_queued_bytes;        // framed bytes waiting for the socket, all connections
+
+  void register_with(MetricsRegistry& reg, const std::string& transport) const {
+    const std::string l = metric_label("transport", transport);
+    reg.add("cc50_transport_connections_accepted_total", "Client connections accepted.", l, conns_accepted);
+    reg.add("cc50_transport_connections_closed_total", "Client connections closed for any reason.", l, conns_closed);
+    reg.add("cc50_transport_slow_consumer_drops_total",
+            "Connections dropped because their unsent bytes exceeded the limit.", l, slow_consumer_drops);
+    reg.add("cc50_transport_corrupt_streams_total",
+            "Connections dropped for a bad magic or an oversized frame.", l, corrupt_streams);
+    reg.add("cc50_transport_frames_received_total", "Frames received.", l, frames_rx);
+    reg.add("cc50_transport_received_bytes_total", "Frame bytes received, headers included.", l, bytes_rx);
+    reg.add("cc50_transport_frames_sent_total", "Frames queued for sending.", l, frames_tx);
+    reg.add("cc50_transport_sent_bytes_total", "Bytes written to sockets.", l, bytes_tx);
+    reg.add("cc50_transport_batched_frames_total", "Queued frames that went out inside a RESP_BATCH.", l, batched_tx);
+    reg.add("cc50_transport_connections_open", "Open client connections.", l, conns_open);
+    reg.add("cc50_transport_tx_queued_bytes", "Bytes queued for sending across all connections.", l,
+            tx_queued_bytes);
+  }
 };
 
 class ITransport {
@@ -30,8 +90,20 @@ public:
   virtual Status start_server(const TransportOptions& opt, MessageHandler on_msg) = 0;
   virtual Status start_client(const TransportOptions& opt, MessageHandler on_msg) = 0;
 
-  // Send a message (header + payload). For clients, sends to server. For server, sends to a peer endpoint.
-  virtual Status send(uint64_t req_id, uint16_t type, const uint8_t* data, size_t len) = 0;
+  // Called on the progress() thread after a connection is closed (peer hangup, error,
+  // slow-consumer drop). Set before start_*.
+  virtual void set_close_handler(CloseHandler on_close) = 0;
+
+  // Send a message (header + payload) on `conn`. Clients may pass kNoConn for the server connection.
+  // Frames for a connection that has closed are dropped.
+  // Thread-safe: may be called from any thread while another thread drives progress().
+  virtual Status send(ConnId conn, uint64_t req_id, uint16_t type, const uint8_t* data, size_t len) = 0;
+
+  // Same, for a payload built as a string. Queued frames live in the slab pool, so
+  // the bytes are copied into it either way.
+  virtual Status send(ConnId conn, uint64_t req_id, uint16_t type, std::string&& payload) {
+    return send(conn, req_id, type, (const uint8_t*)payload.data(), payload.size());
+  }
 
   // Drive progress (poll/epoll). Returns when one tick is done.
   virtual Status progress(int timeout_ms) = 0;
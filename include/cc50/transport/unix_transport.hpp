@@ -0,0 +1,97 @@
+#pragma once
+#include "transport.hpp"
+#include "frame.hpp"
+#include "../mpsc_queue.hpp"
+
+#include <sys/epoll.h>
+
+#include <atomic>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace cc50 {
+
+// AF_UNIX SOCK_SEQPACKET sockets, also used by ShmTransport to set up connections.
+// A path starting with '@' names a socket in the abstract namespace (no file; it goes
+// away with the listener). A stale socket file nobody listens on is replaced.
+Status listen_seqpacket(const std::string& path, int backlog, int& fd);
+Status connect_seqpacket(const std::string& path, int& fd);
+
+// ITransport for clients on the same host, over AF_UNIX SOCK_SEQPACKET: no TCP/IP
+// stack, no Nagle or delayed ACKs, and the kernel keeps message boundaries, so a frame
+// of up to kMaxPacket bytes is one packet, dispatched straight out of the receive
+// buffer. Larger frames are split into consecutive packets and put back together.
+// Queued frames leave in one sendmmsg, and a recvmmsg takes up to kRecvBatch packets.
+// Cross-thread send() uses the same MPSC queue + eventfd hand-off as TcpTransport.
+// Listens on / connects to TransportOptions::unix_path. One event loop driven by
+// progress(): event_threads and the TCP socket options are ignored.
+class UnixTransport final : public ITransport {
+public:
+  static constexpr size_t kMaxPacket = 64u << 10;
+  static constexpr int kRecvBatch   = 16;   // packets per recvmmsg
+  static constexpr int kSendBatch   = 64;   // packets per sendmmsg
+
+  UnixTransport();
+  ~UnixTransport() override;
+
+  Status start_server(const TransportOptions& opt, MessageHandler on_msg) override;
+  Status start_client(const TransportOptions& opt, MessageHandler on_msg) override;
+  void set_close_handler(CloseHandler on_close) override { on_close_ = std::move(on_close); }
+  Status send(ConnId conn, uint64_t req_id, uint16_t type, const uint8_t* data, size_t len) override;
+  Status progress(int timeout_ms) override;
+
+private:
+  struct Conn {
+    int fd{-1};
+    std::vector<uint8_t> rx;  // a frame spread over several packets, being reassembled
+    size_t rx_need{0};        // its full size (0 = next packet starts a frame)
+    TxQueue tx{slab_pool()};
+    size_t tx_off{0};         // bytes of tx.front() already sent, always a packet boundary
+    size_t tx_bytes{0};       // unsent bytes across tx
+    bool writable{true};      // false after a full socket, until EPOLLOUT
+    bool watching_out{false}; // EPOLLOUT registered (only while !writable)
+    bool dirty{false};
+    uint16_t peer_version{0}; // highest MsgHeader::version received; v6+ gets RESP_BATCH
+  };
+
+  struct OutFrame {
+    ConnId conn{kNoConn};
+    TxFrame frame;
+  };
+
+  Status add_conn(int fd, ConnId& id);
+  void close_conn(ConnId id);
+  Status accept_new();
+  Status handle_read(ConnId id);
+  Status handle_write(ConnId id);
+  // One received packet; false (with `why`) for a stream that cannot be trusted any more.
+  bool consume(ConnId id, Conn& c, const uint8_t* p, size_t n, const char*& why);
+  bool deliver(ConnId id, Conn& c, const uint8_t* frame, size_t n);
+  Status queue_send(ConnId id, TxFrame&& f);
+  void wake();
+  Status drain_outbound();
+
+  int ep_{-1};
+  int listen_fd_{-1};
+  int wake_fd_{-1};
+  std::atomic<bool> wake_pending_{false};
+  MpscQueue<OutFrame> outq_{slab_pool()};
+  std::string unlink_path_;   // socket file created by start_server
+
+  std::unordered_map<ConnId, Conn> conns_;
+  std::vector<ConnId> dirty_;
+  std::vector<epoll_event> events_;
+  std::vector<uint8_t> rx_buf_;  // kRecvBatch x kMaxPacket, shared by all connections
+  ConnId next_conn_id_{16};      // never reused, so a late send cannot reach a recycled fd
+  ConnId peer_{kNoConn};         // for client mode
+
+  MessageHandler on_msg_;
+  CloseHandler on_close_;
+  TransportOptions opt_;
+  TransportMetrics metrics_;
+  bool is_server_{false};
+};
+
+} // namespace cc50
@@ -0,0 +1,39 @@
+#!/usr/bin/env bash
+# Inter-token latency under different socket settings.
+#
+# Starts cc50_llm_server once per variant (toy backend by default), drives it with the
+# open-loop load generator and prints the ITL distribution of each run. With Nagle on
+# the server and delayed ACKs on the client, ITL p99 sits near the 40 ms delayed-ACK
+# timer; TCP_NODELAY on the server (or TCP_QUICKACK on the client) removes the tail.
+#
+#   scripts/bench_itl.sh [extra server flags...]
+#
+# Environment: BIN (default ./build/bin), PORT (19199), RATE (10), CONNS (2),
+# TOKENS (64), DURATION (5).
+set -euo pipefail
+
+BIN=${BIN:-./build/bin}
+PORT=${PORT:-19199}
+RATE=${RATE:-10}
+CONNS=${CONNS:-2}
+TOKENS=${TOKENS:-64}
+DURATION=${DURATION:-5}
+
+run_variant() {
+  local name=$1 server_flags=$2 client_flags=$3
+  shift 3
+  "$BIN/cc50_llm_server" --listen=127.0.0.1:"$PORT" $server_flags "$@" >/dev/null 2>&1 &
+  local spid=$!
+  sleep 0.5
+  local out
+  out=$("$BIN/cc50_llm_client" --server=127.0.0.1:"$PORT" --mode=load --conns="$CONNS" --outstanding=1 \
+          --rate="$RATE" --duration="$DURATION" --max-tokens="$TOKENS" $client_flags 2>&1 || true)
+  kill "$spid" 2>/dev/null || true
+  wait "$spid" 2>/dev/null || true
+  printf '%-36s %s\n' "$name" "$(grep '^itl_ms' <<<"$out" | sed 's/^itl_ms *//')"
+}
+
+run_variant "server nodelay=0"                   "--tcp-nodelay=0" "" "$@"
+run_variant "server nodelay=0, client quickack=1" "--tcp-nodelay=0" "--tcp-quickack=1" "$@"
+run_variant "server nodelay=1 (default)"          "--tcp-nodelay=1" "" "$@"
+run_variant "server nodelay=1, busy-poll=50us"    "--tcp-nodelay=1 --busy-poll-us=50" "--busy-poll-us=50" "$@"
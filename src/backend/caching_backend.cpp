@@ -0,0 +1,209 @@
+#include "cc50/backend/caching_backend.hpp"
+
+#include <chrono>
+#include <cstring>
+
+namespace cc50 {
+
+CachingBackend::CachingBackend(std::unique_ptr<IBackend> inner, CacheOptions opt)
+  : inner_(std::move(inner)), opt_(opt) {}
+
+std::string CachingBackend::make_key(const InferRequest& req) {
+  // max_tokens, the parameter block (canonical: equal parameters encode alike), the prompt
+  const std::string params = encode_params(req.params);
+  const uint32_t params_len = (uint32_t)params.size();
+  std::string key(sizeof(req.max_tokens) + sizeof(params_len), '\0');
+  std::memcpy(key.data(), &req.max_tokens, sizeof(req.max_tokens));
+  std::memcpy(key.data() + sizeof(req.max_tokens), &params_len, sizeof(params_len));
+  key += params;
+  key += req.prompt;
+  return key;
+}
+
+CachingBackend::Stats CachingBackend::stats() const {
+  std::lock_guard<std::mutex> lk(mu_);
+  Stats s = stats_;
+  s.entries = lru_.size();
+  return s;
+}
+
+bool CachingBackend::lookup_locked(const std::string& key, Chunks& chunks, uint32_t& tokens,
+                                   uint32_t& prompt_tokens) {
+  auto it = index_.find(key);
+  if (it == index_.end()) return false;
+  auto e = it->second;
+  if (e->expires_us && now_us() >= e->expires_us) {
+    stats_.bytes -= e->bytes;
+    index_.erase(it);
+    lru_.erase(e);
+    return false;
+  }
+  lru_.splice(lru_.begin(), lru_, e);
+  chunks = e->chunks;
+  tokens = e->tokens;
+  prompt_tokens = e->prompt_tokens;
+  return true;
+}
+
+void CachingBackend::insert_locked(const std::string& key, Chunks chunks, uint32_t tokens,
+                                   uint32_t prompt_tokens) {
+  size_t bytes = sizeof(Entry) + key.size();
+  for (const auto& c : *chunks) bytes += sizeof(std::string) + c.size();
+  if (bytes > opt_.max_entry_bytes || bytes > opt_.max_bytes) return;
+
+  auto old = index_.find(key);
+  if (old != index_.end()) {
+    auto e = old->second;
+    stats_.bytes -= e->bytes;
+    index_.erase(old);
+    lru_.erase(e);
+  }
+
+  Entry e;
+  e.key = key;
+  e.chunks = std::move(chunks);
+  e.tokens = tokens;
+  e.prompt_tokens = prompt_tokens;
+  e.expires_us = opt_.ttl_ms ? now_us() + uint64_t(opt_.ttl_ms) * 1000 : 0;
+  e.bytes = bytes;
+  lru_.push_front(std::move(e));
+  index_.emplace(lru_.front().key, lru_.begin());
+  stats_.bytes += bytes;
+  evict_locked();
+}
+
+void CachingBackend::evict_locked() {
+  while (stats_.bytes > opt_.max_bytes && !lru_.empty()) {
+    Entry& e = lru_.back();
+    stats_.bytes -= e.bytes;
+    index_.erase(e.key);
+    lru_.pop_back();
+    stats_.evictions++;
+  }
+}
+
+Status CachingBackend::infer_stream(const InferRequest& req, StreamFn on_chunk, InferResult& out,
+                                    const CancelToken& cancel) {
+  const uint64_t t0 = now_us();
+  out = InferResult{};
+
+  const std::string key = make_key(req);
+  for (;;) {
+    Chunks hit;
+    uint32_t tokens = 0, prompt_tokens = 0;
+    std::shared_ptr<Flight> fl;
+    bool leader = false;
+    {
+      std::lock_guard<std::mutex> lk(mu_);
+      if (lookup_locked(key, hit, tokens, prompt_tokens)) {
+        stats_.hits++;
+      } else if (auto it = inflight_.find(key); it != inflight_.end()) {
+        fl = it->second;
+        stats_.coalesced++;
+      } else {
+        fl = std::make_shared<Flight>();
+        inflight_.emplace(key, fl);
+        leader = true;
+        stats_.misses++;
+      }
+    }
+
+    if (hit) {
+      for (const auto& c : *hit) {
+        if (cancel.cancelled()) {
+          out.error = "cancelled";
+          out.elapsed_us = now_us() - t0;
+          return Status::Err(out.error);
+        }
+        if (on_chunk) on_chunk(c);
+        out.text += c;
+      }
+      out.tokens = tokens;
+      out.prompt_tokens = prompt_tokens;
+      out.elapsed_us = now_us() - t0;
+      return Status::Ok();
+    }
+
+    if (leader) return run_leader(key, fl, req, on_chunk, out, cancel);
+
+    Status st = Status::Ok();
+    if (follow(fl, on_chunk, out, cancel, st)) {
+      out.elapsed_us = now_us() - t0;
+      return st;
+    }
+  }
+}
+
+Status CachingBackend::run_leader(const std::string& key, const std::shared_ptr<Flight>& fl,
+                                  const InferRequest& req, StreamFn& on_chunk, InferResult& out,
+                                  const CancelToken& cancel) {
+  Status st = inner_->infer_stream(
+    req,
+    [&](const std::string& c) {
+      {
+        std::lock_guard<std::mutex> lk(fl->mu);
+        fl->chunks.push_back(c);
+      }
+      fl->cv.notify_all();
+      if (on_chunk) on_chunk(c);
+    },
+    out,
+    cancel
+  );
+
+  const bool ok = st.ok && out.error.empty() && !cancel.cancelled();
+  {
+    std::lock_guard<std::mutex> lk(fl->mu);
+    fl->done = true;
+    fl->ok = ok;
+    fl->cancelled = cancel.cancelled();
+    fl->tokens = out.tokens;
+    fl->prompt_tokens = out.prompt_tokens;
+    if (!ok) fl->error = !out.error.empty() ? out.error : !st.msg.empty() ? st.msg : std::string("cancelled");
+  }
+  fl->cv.notify_all();
+
+  // chunks are no longer written once done is set, so they can be copied unlocked
+  Chunks chunks = ok ? std::make_shared<const std::vector<std::string>>(fl->chunks) : nullptr;
+  std::lock_guard<std::mutex> lk(mu_);
+  inflight_.erase(key);
+  if (ok) insert_locked(key, std::move(chunks), out.tokens, out.prompt_tokens);
+  return st;
+}
+
+bool CachingBackend::follow(const std::shared_ptr<Flight>& fl, StreamFn& on_chunk, InferResult& out,
+                            const CancelToken& cancel, Status& st) {
+  size_t next = 0;
+  std::unique_lock<std::mutex> lk(fl->mu);
+  for (;;) {
+    // the follower's cancel token has no wakeup of its own, so poll it
+    fl->cv.wait_for(lk, std::chrono::milliseconds(50), [&] { return fl->done || fl->chunks.size() > next; });
+    if (cancel.cancelled()) {
+      out.error = "cancelled";
+      st = Status::Err(out.error);
+      return true;
+    }
+    if (next < fl->chunks.size()) {
+      std::string c = fl->chunks[next++];
+      lk.unlock();
+      if (on_chunk) on_chunk(c);
+      out.text += c;
+      lk.lock();
+      continue;
+    }
+    if (fl->done) break;
+  }
+
+  if (fl->ok) {
+    out.tokens = fl->tokens;
+    out.prompt_tokens = fl->prompt_tokens;
+    st = Status::Ok();
+    return true;
+  }
+  if (fl->cancelled && next == 0) return false;
+  out.error = fl->error;
+  st = Status::Err(out.error);
+  return true;
+}
+
+} // namespace cc50
@@ -0,0 +1,610 @@
+#include "cc50/backend/http_client.hpp"
+
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <poll.h>
+#include <sys/time.h>
+#include <netdb.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cctype>
+#include <chrono>
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+
+namespace cc50 {
+
+namespace {
+constexpr size_t kMaxHeaderBytes = 64 * 1024;
+constexpr int kCancelPollMs = 50;   // how quickly a cancelled request notices while upstream is silent
+
+std::string join_paths(std::string a, std::string b) {
+  if (a.empty()) return b;
+  if (b.empty()) return a;
+  if (a.back() == '/' && b.front() == '/') return a + b.substr(1);
+  if (a.back() != '/' && b.front() != '/') return a + "/" + b;
+  return a + b;
+}
+
+std::string lower_copy(std::string_view s) {
+  std::string r(s);
+  std::transform(r.begin(), r.end(), r.begin(), [](unsigned char c){ return (char)std::tolower(c); });
+  return r;
+}
+
+std::string_view trim(std::string_view s) {
+  while (!s.empty() && std::isspace((unsigned char)s.front())) s.remove_prefix(1);
+  while (!s.empty() && std::isspace((unsigned char)s.back())) s.remove_suffix(1);
+  return s;
+}
+
+bool set_socket_timeout(int fd, int ms) {
+  timeval tv{};
+  tv.tv_sec = ms / 1000;
+  tv.tv_usec = (ms % 1000) * 1000;
+  if (setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv)) != 0) return false;
+  if (setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv)) != 0) return false;
+  return true;
+}
+
+} // namespace
+
+bool parse_http_url(const std::string& base_url, const std::string& endpoint, UrlParts& out, std::string& err) {
+  std::string url = base_url;
+  if (url.rfind("http://", 0) == 0) url = url.substr(7);
+  else if (url.rfind("https://", 0) == 0) { err = "https:// not supported (use http://)"; return false; }
+
+  // Split path from host[:port]
+  std::string hostport = url;
+  std::string base_path;
+  auto slash = url.find('/');
+  if (slash != std::string::npos) {
+    hostport = url.substr(0, slash);
+    base_path = url.substr(slash); // includes '/'
+  }
+
+  std::string host = hostport;
+  int port = 80;
+  auto colon = hostport.rfind(':');
+  if (colon != std::string::npos && colon + 1 < hostport.size()) {
+    host = hostport.substr(0, colon);
+    port = std::atoi(hostport.substr(colon + 1).c_str());
+    if (port <= 0) { err = "invalid port in url"; return false; }
+  }
+
+  out.host = host;
+  out.port = port;
+  out.path = join_paths(base_path.empty() ? std::string("/") : base_path, endpoint.empty() ? std::string("/") : endpoint);
+  if (out.path.empty() || out.path[0] != '/') out.path = "/" + out.path;
+  return true;
+}
+
+// ---- HttpResponseParser ----
+
+bool HttpResponseParser::emit(const char* p, size_t n) {
+  if (n == 0 || !on_body_) return true;
+  if (!on_body_(std::string_view(p, n))) {
+    stopped_ = true;
+    return false;
+  }
+  return true;
+}
+
+Status HttpResponseParser::parse_headers(std::string_view head) {
+  // Status line: HTTP/1.1 200 OK
+  auto eol = head.find("\r\n");
+  std::string_view status_line = (eol == std::string_view::npos) ? head : head.substr(0, eol);
+  auto sp1 = status_line.find(' ');
+  if (status_line.rfind("HTTP/", 0) != 0 || sp1 == std::string_view::npos) {
+    return Status::Err("bad http response (status line)");
+  }
+  status_ = std::atoi(std::string(status_line.substr(sp1 + 1, 3)).c_str());
+  keep_alive_ = status_line.rfind("HTTP/1.0", 0) != 0;
+
+  bool chunked = false;
+  bool have_length = false;
+  size_t content_length = 0;
+
+  size_t pos = (eol == std::string_view::npos) ? head.size() : eol + 2;
+  while (pos < head.size()) {
+    auto e = head.find("\r\n", pos);
+    std::string_view line = head.substr(pos, (e == std::string_view::npos ? head.size() : e) - pos);
+    pos = (e == std::string_view::npos) ? head.size() : e + 2;
+
+    auto colon = line.find(':');
+    if (colon == std::string_view::npos) continue;
+    std::string name = lower_copy(trim(line.substr(0, colon)));
+    std::string value = lower_copy(trim(line.substr(colon + 1)));
+
+    if (name == "transfer-encoding" && value.find("chunked") != std::string::npos) chunked = true;
+    else if (name == "content-length") { have_length = true; content_length = std::strtoull(value.c_str(), nullptr, 10); }
+    else if (name == "connection") {
+      if (value.find("close") != std::string::npos) keep_alive_ = false;
+      else if (value.find("keep-alive") != std::string::npos) keep_alive_ = true;
+    }
+  }
+
+  if (status_ == 204 || status_ == 304 || (status_ >= 100 && status_ < 200)) {
+    state_ = State::Done;
+  } else if (chunked) {
+    state_ = State::ChunkSize;
+  } else if (have_length) {
+    remaining_ = content_length;
+    state_ = remaining_ ? State::Fixed : State::Done;
+  } else {
+    keep_alive_ = false;
+    state_ = State::UntilClose;
+  }
+  return Status::Ok();
+}
+
+Status HttpResponseParser::feed(const char* p, size_t n) {
+  while (n > 0 && state_ != State::Done && !stopped_) {
+    switch (state_) {
+      case State::Headers: {
+        size_t old = line_.size();
+        line_.append(p, n);
+        // search from slightly before the old end so a split "\r\n\r\n" is found
+        auto sep = line_.find("\r\n\r\n", old >= 3 ? old - 3 : 0);
+        if (sep == std::string::npos) {
+          if (line_.size() > kMaxHeaderBytes) return Status::Err("bad http response (headers too large)");
+          return Status::Ok();
+        }
+        size_t used = sep + 4 - old; // bytes of this feed that belonged to the header block
+        auto st = parse_headers(std::string_view(line_).substr(0, sep));
+        line_.clear();
+        if (!st.ok) return st;
+        p += used;
+        n -= used;
+      } break;
+
+      case State::Fixed: {
+        size_t take = std::min(n, remaining_);
+        remaining_ -= take;
+        if (remaining_ == 0) state_ = State::Done;
+        if (!emit(p, take)) return Status::Ok();
+        p += take;
+        n -= take;
+      } break;
+
+      case State::UntilClose:
+        emit(p, n);
+        return Status::Ok();
+
+      case State::ChunkSize:
+      case State::Trailers: {
+        const char* nl = (const char*)std::memchr(p, '\n', n);
+        size_t take = nl ? (size_t)(nl - p) + 1 : n;
+        line_.append(p, take);
+        p += take;
+        n -= take;
+        if (!nl) {
+          if (line_.size() > kMaxHeaderBytes) return Status::Err("bad http response (chunk line too large)");
+          break;
+        }
+        std::string_view line = trim(line_);
+        if (state_ == State::Trailers) {
+          if (line.empty()) state_ = State::Done;
+        } else {
+          auto semi = line.find(';');
+          if (semi != std::string_view::npos) line = line.substr(0, semi);
+          if (line.empty()) return Status::Err("bad http response (empty chunk size)");
+          char* end = nullptr;
+          std::string hex(line);
+          remaining_ = std::strtoull(hex.c_str(), &end, 16);
+          if (end == hex.c_str()) return Status::Err("bad http response (chunk size)");
+          state_ = remaining_ ? State::ChunkData : State::Trailers;
+        }
+        line_.clear();
+      } break;
+
+      case State::ChunkData: {
+        size_t take = std::min(n, remaining_);
+        remaining_ -= take;
+        if (remaining_ == 0) state_ = State::ChunkCrlf;
+        if (!emit(p, take)) return Status::Ok();
+        p += take;
+        n -= take;
+      } break;
+
+      case State::ChunkCrlf: {
+        // consume the CRLF that terminates chunk data
+        char c = *p++;
+        n--;
+        if (c == '\n') state_ = State::ChunkSize;
+      } break;
+
+      case State::Done:
+        break;
+    }
+  }
+  return Status::Ok();
+}
+
+Status HttpResponseParser::finish_eof() {
+  if (state_ == State::UntilClose) {
+    state_ = State::Done;
+    return Status::Ok();
+  }
+  if (state_ == State::Done || stopped_) return Status::Ok();
+  if (state_ == State::Headers) return Status::Err("bad http response (no header separator)");
+  return Status::Err("http response truncated");
+}
+
+// ---- SseParser ----
+
+bool SseParser::dispatch_line(std::string_view line) {
+  if (!line.empty() && line.back() == '\r') line.remove_suffix(1);
+
+  if (line.empty()) {
+    // blank line terminates the event
+    if (!has_data_) return true;
+    has_data_ = false;
+    bool keep = on_event_(data_);
+    data_.clear();
+    return keep;
+  }
+  if (line.front() == ':') return true; // comment / keep-alive ping
+
+  auto colon = line.find(':');
+  std::string_view field = line.substr(0, colon);
+  std::string_view value = (colon == std::string_view::npos) ? std::string_view{} : line.substr(colon + 1);
+  if (!value.empty() && value.front() == ' ') value.remove_prefix(1);
+
+  if (field == "data") {
+    if (has_data_) data_.push_back('\n');
+    data_.append(value);
+    has_data_ = true;
+  }
+  return true;
+}
+
+bool SseParser::feed(std::string_view bytes) {
+  while (!bytes.empty()) {
+    auto nl = bytes.find('\n');
+    if (nl == std::string_view::npos) {
+      line_.append(bytes);
+      return true;
+    }
+    bool keep;
+    if (line_.empty()) {
+      keep = dispatch_line(bytes.substr(0, nl));
+    } else {
+      line_.append(bytes.substr(0, nl));
+      keep = dispatch_line(line_);
+      line_.clear();
+    }
+    bytes.remove_prefix(nl + 1);
+    if (!keep) return false;
+  }
+  return true;
+}
+
+// ---- connection pool ----
+
+Status detail::resolve_addrs(const UrlParts& u, const std::function<void(const addrinfo*)>& each) {
+  addrinfo hints{};
+  hints.ai_family = AF_UNSPEC;
+  hints.ai_socktype = SOCK_STREAM;
+
+  addrinfo* res = nullptr;
+  std::string port_str = std::to_string(u.port);
+  int gai = getaddrinfo(u.host.c_str(), port_str.c_str(), &hints, &res);
+  if (gai != 0) return Status::Err(std::string("getaddrinfo: ") + gai_strerror(gai));
+  for (addrinfo* p = res; p; p = p->ai_next) each(p);
+  freeaddrinfo(res);
+  return Status::Ok();
+}
+
+bool detail::idle_socket_alive(int fd) {
+  char c;
+  ssize_t n = ::recv(fd, &c, 1, MSG_PEEK | MSG_DONTWAIT);
+  if (n < 0) return errno == EAGAIN || errno == EWOULDBLOCK;
+  return false;
+}
+
+namespace {
+
+int connect_addr(int family, int socktype, int protocol, const sockaddr* sa, socklen_t len, int connect_timeout_ms,
+                 const SocketOptions* sock) {
+  int fd = ::socket(family, socktype | SOCK_CLOEXEC, protocol);
+  if (fd < 0) return -1;
+  if (sock && !apply_socket_options(fd, *sock).ok) {
+    int e = errno;
+    ::close(fd);
+    errno = e;
+    return -1;
+  }
+
+  // connect with a reasonable timeout by relying on SO_SNDTIMEO (simpler than non-blocking+select here)
+  set_socket_timeout(fd, connect_timeout_ms);
+
+  if (::connect(fd, sa, len) == 0) return fd;
+  int e = errno;
+  ::close(fd);
+  errno = e;
+  return -1;
+}
+
+} // namespace
+
+HttpConnPool::~HttpConnPool() {
+  for (auto& [key, up] : ups_) {
+    (void)key;
+    for (auto& idle : up.idle) ::close(idle.fd);
+  }
+}
+
+Status HttpConnPool::resolve(const UrlParts& u, std::vector<Addr>& out) {
+  out.clear();
+  return detail::resolve_addrs(u, [&](const addrinfo* p) {
+    Addr a{};
+    if (p->ai_addrlen > sizeof(a.sa)) return;
+    std::memcpy(&a.sa, p->ai_addr, p->ai_addrlen);
+    a.len = (socklen_t)p->ai_addrlen;
+    a.family = p->ai_family;
+    a.socktype = p->ai_socktype;
+    a.protocol = p->ai_protocol;
+    out.push_back(a);
+  });
+}
+
+void HttpConnPool::prune_locked(Upstream& up, uint64_t now) {
+  const uint64_t max_age = (uint64_t)std::max(opt_.idle_timeout_ms, 0) * 1000;
+  while (!up.idle.empty() && now - up.idle.front().since_us > max_age) {
+    ::close(up.idle.front().fd);
+    up.idle.pop_front();
+    up.open--;
+  }
+}
+
+Status HttpConnPool::acquire(const UrlParts& u, int connect_timeout_ms, int& fd, bool& reused,
+                             const SocketOptions* sock) {
+  fd = -1;
+  reused = false;
+  const std::string key = key_of(u);
+  std::vector<Addr> addrs;
+
+  {
+    std::unique_lock<std::mutex> lk(mu_);
+    auto& up = ups_[key];
+    const auto deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(connect_timeout_ms);
+
+    while (true) {
+      prune_locked(up, now_us());
+      // prefer the most recently used socket: it is the least likely to have been timed out by the server
+      while (!up.idle.empty()) {
+        Idle idle = up.idle.back();
+        up.idle.pop_back();
+        if (detail::idle_socket_alive(idle.fd)) {
+          fd = idle.fd;
+          reused = true;
+          return Status::Ok();
+        }
+        ::close(idle.fd);
+        up.open--;
+      }
+      if (opt_.max_per_host == 0 || up.open < opt_.max_per_host) break;
+      if (cv_.wait_until(lk, deadline) == std::cv_status::timeout) {
+        return Status::Err("http pool exhausted for " + key);
+      }
+    }
+
+    up.open++; // reserve the slot while connecting outside the lock
+    addrs = up.addrs;
+  }
+
+  bool cached = !addrs.empty();
+  Status st = Status::Ok();
+  for (int attempt = 0; attempt < 2 && fd < 0; attempt++) {
+    if (!cached) {
+      st = resolve(u, addrs);
+      if (!st.ok) break;
+    }
+    for (const auto& a : addrs) {
+      fd = connect_addr(a.family, a.socktype, a.protocol, (const sockaddr*)&a.sa, a.len, connect_timeout_ms, sock);
+      if (fd >= 0) break;
+    }
+    if (fd < 0) {
+      st = Status::Err(std::string("connect failed: ") + std::strerror(errno));
+      if (!cached) break;
+      cached = false; // cached address may be stale: re-resolve once
+    }
+  }
+
+  std::lock_guard<std::mutex> lk(mu_);
+  auto& up = ups_[key];
+  if (fd < 0) {
+    up.open--;
+    up.addrs.clear();
+    cv_.notify_one();
+    return st.ok ? Status::Err("connect failed") : st;
+  }
+  if (!cached) up.addrs = std::move(addrs);
+  return Status::Ok();
+}
+
+void HttpConnPool::release(const UrlParts& u, int fd, bool reusable) {
+  std::lock_guard<std::mutex> lk(mu_);
+  auto& up = ups_[key_of(u)];
+  uint64_t now = now_us();
+  prune_locked(up, now);
+  if (reusable && opt_.max_idle > 0 && opt_.idle_timeout_ms > 0) {
+    if (up.idle.size() >= opt_.max_idle) {
+      ::close(up.idle.front().fd);
+      up.idle.pop_front();
+      up.open--;
+    }
+    up.idle.push_back(Idle{fd, now});
+  } else {
+    ::close(fd);
+    up.open--;
+  }
+  cv_.notify_one();
+}
+
+// ---- blocking client ----
+
+namespace {
+
+// Wait for `fd` to become readable, waking every kCancelPollMs to check `cancel`.
+// Returns 1 when readable, 0 on timeout, -1 when cancelled.
+int wait_readable(int fd, int timeout_ms, const CancelToken& cancel) {
+  const uint64_t deadline = now_us() + (uint64_t)std::max(timeout_ms, 0) * 1000;
+  while (true) {
+    if (cancel.cancelled()) return -1;
+    uint64_t now = now_us();
+    if (now >= deadline) return 0;
+    int slice = (int)std::min<uint64_t>(kCancelPollMs, (deadline - now + 999) / 1000);
+    pollfd p{fd, POLLIN, 0};
+    int r = ::poll(&p, 1, slice);
+    if (r > 0) return 1;
+    if (r < 0 && errno != EINTR) return 1; // let recv() report the error
+  }
+}
+
+Status connect_once(const UrlParts& u, int connect_timeout_ms, const SocketOptions* sock, int& fd) {
+  fd = -1;
+  auto st = detail::resolve_addrs(u, [&](const addrinfo* p) {
+    if (fd < 0) {
+      fd = connect_addr(p->ai_family, p->ai_socktype, p->ai_protocol, p->ai_addr, p->ai_addrlen,
+                        connect_timeout_ms, sock);
+    }
+  });
+  if (!st.ok) return st;
+  if (fd < 0) return Status::Err(std::string("connect failed: ") + std::strerror(errno));
+  return Status::Ok();
+}
+
+} // namespace
+
+std::string detail::build_http_request(const char* method, const UrlParts& u, const std::string* body,
+                                       bool accept_sse, bool keep_alive) {
+  std::string req;
+  req.reserve(512 + (body ? body->size() : 0));
+  req += method;
+  req += " " + u.path + " HTTP/1.1\r\n";
+  req += "Host: " + u.host + "\r\n";
+  if (body) req += "Content-Type: application/json\r\n";
+  req += accept_sse ? "Accept: text/event-stream\r\n" : "Accept: application/json\r\n";
+  req += keep_alive ? "Connection: keep-alive\r\n" : "Connection: close\r\n";
+  if (body) {
+    req += "Content-Length: " + std::to_string(body->size()) + "\r\n\r\n";
+    req += *body;
+  } else {
+    req += "\r\n";
+  }
+  return req;
+}
+
+static Status http_request(const char* method, const UrlParts& u, int connect_timeout_ms, int request_timeout_ms,
+                           const std::string* body, bool accept_sse, int& http_status, const HttpBodyFn& on_body,
+                           HttpConnPool* pool, const CancelToken* cancel, const SocketOptions* sock) {
+  const std::string req = detail::build_http_request(method, u, body, accept_sse, pool != nullptr);
+
+  // A pooled socket can be closed by the server between requests; if it fails that way
+  // (EOF, ECONNRESET or EPIPE) before any response byte arrived, the request is simply
+  // replayed on a fresh connection. A timeout is never replayed: the server may still be
+  // working on the request, and a replay would run the same generation again.
+  for (int attempt = 0; ; attempt++) {
+    http_status = 0;
+    if (cancel && cancel->cancelled()) return Status::Err("cancelled");
+
+    int fd = -1;
+    bool reused = false;
+    Status st = pool ? pool->acquire(u, connect_timeout_ms, fd, reused, sock)
+                     : connect_once(u, connect_timeout_ms, sock, fd);
+    if (!st.ok) return st;
+
+    set_socket_timeout(fd, request_timeout_ms);
+
+    bool got_bytes = false;
+    bool cancelled = false;
+    bool peer_closed = false;  // the failure means the server closed the socket
+    auto closed_by_peer = [](int err) { return err == ECONNRESET || err == EPIPE; };
+    const char* ptr = req.data();
+    size_t left = req.size();
+    while (left > 0) {
+      ssize_t n = ::send(fd, ptr, left, MSG_NOSIGNAL);
+      if (n < 0) {
+        if (errno == EINTR) continue;
+        peer_closed = closed_by_peer(errno);
+        st = Status::Err(std::string("send failed: ") + std::strerror(errno));
+        break;
+      }
+      ptr += n;
+      left -= (size_t)n;
+    }
+
+    // the status is set before the first body bytes, which may come in the same read as the headers
+    HttpResponseParser parser([&](std::string_view part) {
+      http_status = parser.status();
+      return on_body ? on_body(part) : true;
+    });
+    if (st.ok) {
+      char buf[8192];
+      while (!parser.complete() && !parser.stopped()) {
+        if (cancel) {
+          int w = wait_readable(fd, request_timeout_ms, *cancel);
+          if (w < 0) { cancelled = true; st = Status::Err("cancelled"); break; }
+          if (w == 0) { st = Status::Err("recv failed: timed out"); break; }
+        }
+        ssize_t n = ::recv(fd, buf, sizeof(buf), 0);
+        if (n == 0) {
+          peer_closed = !got_bytes;
+          st = parser.finish_eof();
+          break;
+        }
+        if (n < 0) {
+          if (errno == EINTR) continue;
+          peer_closed = closed_by_peer(errno);  // not EAGAIN: SO_RCVTIMEO expired
+          st = Status::Err(std::string("recv failed: ") + std::strerror(errno));
+          break;
+        }
+        got_bytes = true;
+        if (sock) rearm_quickack(fd, *sock);
+        st = parser.feed(buf, (size_t)n);
+        if (!st.ok) break;
+        if (parser.headers_done()) http_status = parser.status();
+      }
+    }
+    if (parser.headers_done()) http_status = parser.status();
+
+    if (pool) {
+      bool reusable = st.ok && parser.complete() && !parser.stopped() && parser.keep_alive();
+      pool->release(u, fd, reusable);
+    } else {
+      ::close(fd);
+    }
+
+    if (!st.ok && peer_closed && !cancelled && reused && !got_bytes && attempt < 2) continue;
+    return st;
+  }
+}
+
+Status http_post(const UrlParts& u, int connect_timeout_ms, int request_timeout_ms,
+                 const std::string& body, bool accept_sse, int& http_status, const HttpBodyFn& on_body,
+                 HttpConnPool* pool, const CancelToken* cancel, const SocketOptions* sock) {
+  return http_request("POST", u, connect_timeout_ms, request_timeout_ms, &body, accept_sse, http_status,
+                      on_body, pool, cancel, sock);
+}
+
+Status http_get(const UrlParts& u, int connect_timeout_ms, int request_timeout_ms,
+                int& http_status, std::string& out_body, HttpConnPool* pool, const SocketOptions* sock) {
+  out_body.clear();
+  return http_request("GET", u, connect_timeout_ms, request_timeout_ms, nullptr, false, http_status,
+                      [&](std::string_view part) { out_body.append(part); return true; }, pool, nullptr, sock);
+}
+
+Status http_post_json(const UrlParts& u, int connect_timeout_ms, int request_timeout_ms,
+                      const std::string& body, int& http_status, std::string& out_body,
+                      HttpConnPool* pool, const CancelToken* cancel, const SocketOptions* sock) {
+  out_body.clear();
+  return http_post(u, connect_timeout_ms, request_timeout_ms, body, false, http_status,
+                   [&](std::string_view part) { out_body.append(part); return true; }, pool, cancel, sock);
+}
+
+} // namespace cc50
@@ -0,0 +1,449 @@
+#include "cc50/backend/http_reactor.hpp"
+
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <string>
+#include <utility>
+
+namespace cc50 {
+
+namespace {
+constexpr uint64_t kWakeTag = 1;     // call ids (seq >= 1 above the loop bits) start above it
+constexpr int kTickMs = 50;          // cancel / timeout scan period, as the blocking client's poll slice
+constexpr size_t kReadChunk = 16384;
+constexpr int kReadsPerWake = 4;     // then the next socket gets a turn (level-triggered)
+constexpr uint32_t kReadEvents = EPOLLIN | EPOLLRDHUP;
+} // namespace
+
+HttpReactor::HttpReactor(HttpReactorOptions opt) : opt_(std::move(opt)) {}
+
+HttpReactor::~HttpReactor() {
+  stop();
+  for (auto& l : loops_) {
+    for (auto& [key, h] : l->hosts) {
+      (void)key;
+      for (auto& idle : h.idle) ::close(idle.fd);
+    }
+    if (l->wake_fd >= 0) ::close(l->wake_fd);
+    if (l->ep >= 0) ::close(l->ep);
+  }
+}
+
+Status HttpReactor::start() {
+  if (started_) return Status::Ok();
+  const int n = std::clamp(opt_.threads, 1, kMaxLoops);
+  for (int i = 0; i < n; i++) {
+    auto l = std::make_unique<Loop>();
+    l->index = (uint32_t)i;
+    l->ep = epoll_create1(EPOLL_CLOEXEC);
+    if (l->ep < 0) return Status::Err(std::string("epoll_create1 failed: ") + std::strerror(errno));
+    l->wake_fd = ::eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (l->wake_fd < 0) {
+      ::close(l->ep);
+      return Status::Err(std::string("eventfd failed: ") + std::strerror(errno));
+    }
+    epoll_event ev{};
+    ev.events = EPOLLIN;
+    ev.data.u64 = kWakeTag;
+    if (epoll_ctl(l->ep, EPOLL_CTL_ADD, l->wake_fd, &ev) < 0) {
+      ::close(l->wake_fd);
+      ::close(l->ep);
+      return Status::Err(std::string("epoll_ctl add failed: ") + std::strerror(errno));
+    }
+    l->events.resize(256);
+    loops_.push_back(std::move(l));
+  }
+  for (auto& l : loops_) {
+    Loop* lp = l.get();
+    l->thread = std::thread([this, lp] { run(*lp); });
+  }
+  started_ = true;
+  return Status::Ok();
+}
+
+void HttpReactor::stop() {
+  if (!started_) return;
+  stop_.store(true);
+  for (auto& l : loops_) {
+    wake(*l);
+    if (l->thread.joinable()) l->thread.join();
+  }
+  // the loops are gone: whatever is left is failed here, on the caller's thread
+  for (auto& l : loops_) {
+    Op op;
+    while (l->ops.pop(op)) {
+      if (op.kind == Op::Kind::Start) l->calls.emplace(op.id, std::move(op.call));
+    }
+    while (!l->calls.empty()) finish(*l, l->calls.begin()->first, Status::Err("http reactor stopped"));
+  }
+  started_ = false;
+}
+
+uint64_t HttpReactor::post(const UrlParts& u, const std::string& body, const HttpCallOptions& o, HttpCallbacks cb) {
+  if (!started_ || stop_.load(std::memory_order_relaxed)) {
+    if (cb.on_done) cb.on_done(Status::Err("http reactor stopped"));
+    return 0;
+  }
+  const uint32_t li = rr_.fetch_add(1, std::memory_order_relaxed) % (uint32_t)loops_.size();
+  Loop& l = *loops_[li];
+  auto c = std::make_unique<Call>();
+  c->id = (l.next_seq.fetch_add(1, std::memory_order_relaxed) << kLoopBits) | li;
+  c->u = u;
+  c->key = u.host + ":" + std::to_string(u.port);
+  c->req = detail::build_http_request("POST", u, &body, o.accept_sse, opt_.keep_alive);
+  c->opt = o;
+  c->cb = std::move(cb);
+  const uint64_t id = c->id;
+  submit(l, Op{Op::Kind::Start, id, std::move(c)});
+  return id;
+}
+
+void HttpReactor::pause(uint64_t id) {
+  if (id && started_) submit(loop_of(id), Op{Op::Kind::Pause, id, nullptr});
+}
+
+void HttpReactor::resume(uint64_t id) {
+  if (id && started_) submit(loop_of(id), Op{Op::Kind::Resume, id, nullptr});
+}
+
+void HttpReactor::submit(Loop& l, Op op) {
+  // a pause from a body callback must hold before the loop reads the next buffer
+  if (op.kind != Op::Kind::Start && on_loop_thread(l)) {
+    auto it = l.calls.find(op.id);
+    if (it != l.calls.end()) set_paused(l, *it->second, op.kind == Op::Kind::Pause);
+    return;
+  }
+  l.ops.push(std::move(op));
+  wake(l);
+}
+
+void HttpReactor::wake(Loop& l) {
+  if (l.wake_pending.exchange(true, std::memory_order_acq_rel)) return;
+  uint64_t one = 1;
+  ssize_t n = ::write(l.wake_fd, &one, sizeof(one));
+  (void)n;
+}
+
+void HttpReactor::run(Loop& l) {
+  while (!stop_.load(std::memory_order_relaxed)) {
+    int n = epoll_wait(l.ep, l.events.data(), (int)l.events.size(), kTickMs);
+    if (n < 0) {
+      if (errno == EINTR) continue;
+      CC50_LOG_ERROR("[http] epoll_wait failed: " << std::strerror(errno));
+      break;
+    }
+    for (int i = 0; i < n; i++) {
+      const uint64_t tag = l.events[i].data.u64;
+      if (tag == kWakeTag) {
+        drain_ops(l);
+        continue;
+      }
+      auto it = l.calls.find(tag);
+      if (it == l.calls.end()) continue; // finished earlier in this batch
+      Call& c = *it->second;
+      switch (c.state) {
+        case State::WaitSlot: break;
+        case State::Connecting: on_connected(l, c); break;
+        case State::Writing: handle_write(l, c); break;
+        case State::Reading: handle_read(l, c); break;
+      }
+    }
+    const uint64_t now = now_us();
+    if (now - l.last_scan_us >= (uint64_t)kTickMs * 1000) {
+      l.last_scan_us = now;
+      scan(l, now);
+    }
+  }
+}
+
+void HttpReactor::drain_ops(Loop& l) {
+  uint64_t cnt = 0;
+  ssize_t n = ::read(l.wake_fd, &cnt, sizeof(cnt));
+  (void)n;
+  l.wake_pending.store(false, std::memory_order_seq_cst);
+
+  Op op;
+  while (l.ops.pop(op)) {
+    if (op.kind == Op::Kind::Start) {
+      Call& c = *op.call;
+      l.calls.emplace(op.id, std::move(op.call));
+      if (c.opt.cancel && c.opt.cancel->cancelled()) finish(l, op.id, Status::Err("cancelled"));
+      else begin(l, c);
+      continue;
+    }
+    auto it = l.calls.find(op.id);
+    if (it != l.calls.end()) set_paused(l, *it->second, op.kind == Op::Kind::Pause);
+  }
+}
+
+void HttpReactor::scan(Loop& l, uint64_t now) {
+  std::vector<std::pair<uint64_t, Status>> expired;
+  for (auto& [id, cp] : l.calls) {
+    const Call& c = *cp;
+    if (c.opt.cancel && c.opt.cancel->cancelled()) {
+      expired.emplace_back(id, Status::Err("cancelled"));
+    } else if (!c.paused && c.deadline_us && now >= c.deadline_us) {
+      expired.emplace_back(id, c.state == State::WaitSlot ? Status::Err("http pool exhausted for " + c.key)
+                             : c.state == State::Connecting ? Status::Err("connect failed: timed out")
+                             : Status::Err("recv failed: timed out"));
+    }
+  }
+  for (auto& [id, st] : expired) finish(l, id, st);
+}
+
+void HttpReactor::prune_idle(Host& h, uint64_t now) {
+  const uint64_t max_age = (uint64_t)std::max(opt_.idle_timeout_ms, 0) * 1000;
+  while (!h.idle.empty() && now - h.idle.front().since_us > max_age) {
+    ::close(h.idle.front().fd);
+    h.idle.pop_front();
+    h.open--;
+  }
+}
+
+void HttpReactor::begin(Loop& l, Call& c) {
+  Host& h = l.hosts[c.key];
+  const uint64_t now = now_us();
+  prune_idle(h, now);
+  // the most recently used socket is the least likely to have been timed out by the server
+  while (!h.idle.empty()) {
+    Idle idle = h.idle.back();
+    h.idle.pop_back();
+    if (detail::idle_socket_alive(idle.fd)) {
+      c.fd = idle.fd;
+      c.has_slot = true;
+      c.reused = true;
+      begin_request(l, c);
+      return;
+    }
+    ::close(idle.fd);
+    h.open--;
+  }
+  if (opt_.max_per_host > 0 && h.open >= opt_.max_per_host) {
+    c.state = State::WaitSlot;
+    c.deadline_us = now + (uint64_t)std::max(c.opt.connect_timeout_ms, 0) * 1000;
+    h.waiting.push_back(c.id);
+    return;
+  }
+  h.open++;
+  c.has_slot = true;
+  c.addr_i = 0;
+  connect_next(l, c, Status::Err("connect failed"));
+}
+
+void HttpReactor::connect_next(Loop& l, Call& c, Status err) {
+  Host& h = l.hosts[c.key];
+  if (h.addrs.empty()) {
+    auto st = detail::resolve_addrs(c.u, [&](const addrinfo* p) {
+      Addr a{};
+      if (p->ai_addrlen > sizeof(a.sa)) return;
+      std::memcpy(&a.sa, p->ai_addr, p->ai_addrlen);
+      a.len = (socklen_t)p->ai_addrlen;
+      a.family = p->ai_family;
+      a.socktype = p->ai_socktype;
+      a.protocol = p->ai_protocol;
+      h.addrs.push_back(a);
+    });
+    if (!st.ok) {
+      finish(l, c.id, st);
+      return;
+    }
+  }
+  c.reused = false;
+  c.got_bytes = false;
+  for (; c.addr_i < h.addrs.size(); c.addr_i++) {
+    const Addr& a = h.addrs[c.addr_i];
+    int fd = ::socket(a.family, a.socktype | SOCK_NONBLOCK | SOCK_CLOEXEC, a.protocol);
+    if (fd < 0) {
+      err = Status::Err(std::string("socket failed: ") + std::strerror(errno));
+      continue;
+    }
+    auto so = apply_socket_options(fd, opt_.sock);
+    if (!so.ok) {
+      ::close(fd);
+      err = so;
+      continue;
+    }
+    if (::connect(fd, (const sockaddr*)&a.sa, a.len) == 0 || errno == EINPROGRESS) {
+      c.fd = fd;
+      c.state = State::Connecting;
+      c.deadline_us = now_us() + (uint64_t)std::max(c.opt.connect_timeout_ms, 0) * 1000;
+      watch(l, c, EPOLLOUT);
+      return;
+    }
+    err = Status::Err(std::string("connect failed: ") + std::strerror(errno));
+    ::close(fd);
+  }
+  h.addrs.clear(); // may be stale: resolved again by the next call
+  finish(l, c.id, err);
+}
+
+void HttpReactor::on_connected(Loop& l, Call& c) {
+  int so_err = 0;
+  socklen_t len = sizeof(so_err);
+  if (::getsockopt(c.fd, SOL_SOCKET, SO_ERROR, &so_err, &len) != 0) so_err = errno;
+  if (so_err == 0) {
+    sockaddr_storage peer{};
+    socklen_t plen = sizeof(peer);
+    if (::getpeername(c.fd, (sockaddr*)&peer, &plen) != 0 && errno == ENOTCONN) return; // still handshaking
+    begin_request(l, c);
+    return;
+  }
+  watch(l, c, 0);
+  ::close(c.fd);
+  c.fd = -1;
+  c.addr_i++;
+  connect_next(l, c, Status::Err(std::string("connect failed: ") + std::strerror(so_err)));
+}
+
+void HttpReactor::begin_request(Loop& l, Call& c) {
+  c.state = State::Writing;
+  c.req_off = 0;
+  c.deadline_us = now_us() + (uint64_t)std::max(c.opt.request_timeout_ms, 0) * 1000;
+  Call* cp = &c; // owned by l.calls until finish(), which drops the parser with it
+  c.parser = std::make_unique<HttpResponseParser>([cp](std::string_view part) {
+    if (!cp->headers_reported) {
+      cp->headers_reported = true;
+      if (cp->cb.on_headers) cp->cb.on_headers(cp->parser->status());
+    }
+    return cp->cb.on_body ? cp->cb.on_body(part) : true;
+  });
+  handle_write(l, c);
+}
+
+void HttpReactor::handle_write(Loop& l, Call& c) {
+  while (c.req_off < c.req.size()) {
+    ssize_t n = ::send(c.fd, c.req.data() + c.req_off, c.req.size() - c.req_off, MSG_NOSIGNAL);
+    if (n < 0) {
+      if (errno == EINTR) continue;
+      if (errno == EAGAIN || errno == EWOULDBLOCK) {
+        watch(l, c, EPOLLOUT);
+        return;
+      }
+      fail(l, c, Status::Err(std::string("send failed: ") + std::strerror(errno)));
+      return;
+    }
+    c.req_off += (size_t)n;
+  }
+  c.state = State::Reading;
+  watch(l, c, c.paused ? 0 : kReadEvents);
+}
+
+void HttpReactor::handle_read(Loop& l, Call& c) {
+  char buf[kReadChunk];
+  for (int i = 0; i < kReadsPerWake && !c.paused; i++) {
+    ssize_t n = ::recv(c.fd, buf, sizeof(buf), 0);
+    if (n == 0) {
+      auto st = c.parser->finish_eof();
+      if (!st.ok) fail(l, c, st);
+      else finish(l, c.id, st);
+      return;
+    }
+    if (n < 0) {
+      if (errno == EINTR) continue;
+      if (errno == EAGAIN || errno == EWOULDBLOCK) return;
+      fail(l, c, Status::Err(std::string("recv failed: ") + std::strerror(errno)));
+      return;
+    }
+    c.got_bytes = true;
+    rearm_quickack(c.fd, opt_.sock);
+    c.deadline_us = now_us() + (uint64_t)std::max(c.opt.request_timeout_ms, 0) * 1000;
+    auto st = c.parser->feed(buf, (size_t)n);
+    if (!st.ok) {
+      fail(l, c, st);
+      return;
+    }
+    if (c.parser->headers_done() && !c.headers_reported) {
+      c.headers_reported = true;
+      if (c.cb.on_headers) c.cb.on_headers(c.parser->status());
+    }
+    if (c.parser->complete() || c.parser->stopped()) {
+      finish(l, c.id, Status::Ok());
+      return;
+    }
+  }
+}
+
+void HttpReactor::set_paused(Loop& l, Call& c, bool paused) {
+  if (c.paused == paused) return;
+  c.paused = paused;
+  if (!paused) c.deadline_us = now_us() + (uint64_t)std::max(c.opt.request_timeout_ms, 0) * 1000;
+  if (c.state == State::Reading) watch(l, c, paused ? 0 : kReadEvents);
+}
+
+void HttpReactor::watch(Loop& l, Call& c, uint32_t events) {
+  if (c.fd < 0 || events == c.events) return;
+  epoll_event ev{};
+  ev.events = events;
+  ev.data.u64 = c.id;
+  const int op = c.events == 0 ? EPOLL_CTL_ADD : events == 0 ? EPOLL_CTL_DEL : EPOLL_CTL_MOD;
+  if (epoll_ctl(l.ep, op, c.fd, &ev) < 0) {
+    CC50_LOG_WARN("[http] epoll_ctl failed: " << std::strerror(errno));
+  }
+  c.events = events;
+}
+
+void HttpReactor::fail(Loop& l, Call& c, const Status& st) {
+  // a pooled socket can be closed by the server between requests: replay on a fresh one
+  const bool cancelled = c.opt.cancel && c.opt.cancel->cancelled();
+  if (c.reused && !c.got_bytes && c.attempt < 2 && !cancelled) {
+    c.attempt++;
+    watch(l, c, 0);
+    ::close(c.fd);
+    c.fd = -1;
+    c.parser.reset();
+    c.addr_i = 0;
+    connect_next(l, c, Status::Err("connect failed")); // keeps the slot
+    return;
+  }
+  finish(l, c.id, st);
+}
+
+void HttpReactor::finish(Loop& l, uint64_t id, const Status& st) {
+  auto it = l.calls.find(id);
+  if (it == l.calls.end()) return;
+  std::unique_ptr<Call> c = std::move(it->second);
+  l.calls.erase(it);
+
+  Host& h = l.hosts[c->key];
+  if (!c->has_slot) {
+    auto w = std::find(h.waiting.begin(), h.waiting.end(), id);
+    if (w != h.waiting.end()) h.waiting.erase(w);
+  } else {
+    const uint64_t now = now_us();
+    const bool reusable = c->fd >= 0 && st.ok && c->parser && c->parser->complete() && !c->parser->stopped() &&
+                          c->parser->keep_alive() && opt_.keep_alive && opt_.max_idle > 0 &&
+                          opt_.idle_timeout_ms > 0;
+    watch(l, *c, 0);
+    if (reusable) {
+      prune_idle(h, now);
+      if (h.idle.size() >= opt_.max_idle) {
+        ::close(h.idle.front().fd);
+        h.idle.pop_front();
+        h.open--;
+      }
+      h.idle.push_back(Idle{c->fd, now});
+    } else {
+      if (c->fd >= 0) ::close(c->fd);
+      h.open--;
+    }
+    c->fd = -1;
+    serve_waiting(l, h);
+  }
+  if (c->cb.on_done) c->cb.on_done(st);
+}
+
+void HttpReactor::serve_waiting(Loop& l, Host& h) {
+  while (!h.waiting.empty() && (opt_.max_per_host == 0 || h.open < opt_.max_per_host || !h.idle.empty())) {
+    const uint64_t id = h.waiting.front();
+    h.waiting.pop_front();
+    auto it = l.calls.find(id);
+    if (it != l.calls.end()) begin(l, *it->second);
+  }
+}
+
+} // namespace cc50
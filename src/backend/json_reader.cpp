@@ -0,0 +1,231 @@
+#include "cc50/backend/json_reader.hpp"
+
+#include <charconv>
+#include <cstring>
+
+namespace cc50 {
+
+namespace {
+
+bool is_ws(char c) { return c == ' ' || c == '\n' || c == '\r' || c == '\t'; }
+
+int hex_value(char h) {
+  if (h >= '0' && h <= '9') return h - '0';
+  if (h >= 'a' && h <= 'f') return h - 'a' + 10;
+  if (h >= 'A' && h <= 'F') return h - 'A' + 10;
+  return -1;
+}
+
+bool read_hex4(std::string_view s, size_t pos, uint32_t& v) {
+  if (pos + 4 > s.size()) return false;
+  v = 0;
+  for (size_t i = 0; i < 4; i++) {
+    int h = hex_value(s[pos + i]);
+    if (h < 0) return false;
+    v = (v << 4) | (uint32_t)h;
+  }
+  return true;
+}
+
+void append_utf8(uint32_t cp, std::string& out) {
+  if (cp < 0x80) {
+    out += (char)cp;
+  } else if (cp < 0x800) {
+    out += (char)(0xC0 | (cp >> 6));
+    out += (char)(0x80 | (cp & 0x3F));
+  } else if (cp < 0x10000) {
+    out += (char)(0xE0 | (cp >> 12));
+    out += (char)(0x80 | ((cp >> 6) & 0x3F));
+    out += (char)(0x80 | (cp & 0x3F));
+  } else {
+    out += (char)(0xF0 | (cp >> 18));
+    out += (char)(0x80 | ((cp >> 12) & 0x3F));
+    out += (char)(0x80 | ((cp >> 6) & 0x3F));
+    out += (char)(0x80 | (cp & 0x3F));
+  }
+}
+
+constexpr uint32_t kReplacement = 0xFFFD;
+
+} // namespace
+
+JsonReader::Token JsonReader::scan_string() {
+  // pos_ is just past the opening quote; raw UTF-8 bytes are passed through untouched
+  const size_t start = pos_;
+  const char* const base = s_.data();
+  const char* quote = nullptr;
+  escaped_ = false;
+  while (pos_ <= s_.size()) {
+    const char* p = base + pos_;
+    if (!quote || quote < p) {
+      quote = (const char*)std::memchr(p, '"', s_.size() - pos_);
+      if (!quote) break;
+    }
+    // skip an escaped character, so an escaped quote does not end the string
+    const char* bs = (const char*)std::memchr(p, '\\', (size_t)(quote - p));
+    if (bs) {
+      escaped_ = true;
+      pos_ = (size_t)(bs - base) + 2;
+      continue;
+    }
+    raw_ = s_.substr(start, (size_t)(quote - base) - start);
+    pos_ = (size_t)(quote - base) + 1;
+    if (in_object() && expect_key_) {
+      expect_key_ = false;
+      return Token::Key;
+    }
+    return Token::String;
+  }
+  return fail();
+}
+
+JsonReader::Token JsonReader::scan_literal(std::string_view word, Token t) {
+  if (s_.substr(pos_, word.size()) != word) return fail();
+  raw_ = s_.substr(pos_, word.size());
+  pos_ += word.size();
+  return t;
+}
+
+JsonReader::Token JsonReader::next() {
+  if (failed_) return Token::Error;
+  while (true) {
+    while (pos_ < s_.size() && is_ws(s_[pos_])) pos_++;
+    if (pos_ >= s_.size()) return depth_ == 0 ? Token::End : fail();
+
+    const char c = s_[pos_];
+    switch (c) {
+      case ',':
+        pos_++;
+        expect_key_ = in_object();
+        continue;
+      case ':':
+        pos_++;
+        continue;
+      case '{':
+      case '[':
+        if (depth_ >= kMaxDepth) return fail();
+        pos_++;
+        if (c == '{') objects_ |= (uint64_t)1 << depth_;
+        else objects_ &= ~((uint64_t)1 << depth_);
+        depth_++;
+        expect_key_ = (c == '{');
+        return c == '{' ? Token::BeginObject : Token::BeginArray;
+      case '}':
+      case ']':
+        if (depth_ == 0 || in_object() != (c == '}')) return fail();
+        pos_++;
+        depth_--;
+        expect_key_ = false;
+        return c == '}' ? Token::EndObject : Token::EndArray;
+      case '"':
+        pos_++;
+        return scan_string();
+      case 't': return scan_literal("true", Token::True);
+      case 'f': return scan_literal("false", Token::False);
+      case 'n': return scan_literal("null", Token::Null);
+      default: {
+        if (c != '-' && (c < '0' || c > '9')) return fail();
+        const size_t start = pos_;
+        while (pos_ < s_.size()) {
+          const char d = s_[pos_];
+          if ((d >= '0' && d <= '9') || d == '-' || d == '+' || d == '.' || d == 'e' || d == 'E') pos_++;
+          else break;
+        }
+        raw_ = s_.substr(start, pos_ - start);
+        return Token::Number;
+      }
+    }
+  }
+}
+
+JsonReader::Token JsonReader::skip_value() {
+  const Token first = next();
+  if (first != Token::BeginObject && first != Token::BeginArray) return first;
+  const int base = depth_ - 1;
+  while (depth_ > base) {
+    if (next() == Token::Error) return Token::Error;
+  }
+  return first;
+}
+
+bool json_unescape(std::string_view raw, std::string& out) {
+  size_t pos = 0;
+  while (pos < raw.size()) {
+    const size_t bs = raw.find('\\', pos);
+    if (bs == std::string_view::npos) {
+      out.append(raw.data() + pos, raw.size() - pos);
+      return true;
+    }
+    out.append(raw.data() + pos, bs - pos);
+    if (bs + 1 >= raw.size()) return false;
+    pos = bs + 2;
+    switch (raw[bs + 1]) {
+      case '"':  out += '"'; break;
+      case '\\': out += '\\'; break;
+      case '/':  out += '/'; break;
+      case 'b':  out += '\b'; break;
+      case 'f':  out += '\f'; break;
+      case 'n':  out += '\n'; break;
+      case 'r':  out += '\r'; break;
+      case 't':  out += '\t'; break;
+      case 'u': {
+        uint32_t cp = 0;
+        if (!read_hex4(raw, pos, cp)) return false;
+        pos += 4;
+        if (cp >= 0xD800 && cp <= 0xDBFF) {
+          // high surrogate: must be followed by \uDC00..\uDFFF
+          uint32_t lo = 0;
+          if (pos + 1 < raw.size() && raw[pos] == '\\' && raw[pos + 1] == 'u' &&
+              read_hex4(raw, pos + 2, lo) && lo >= 0xDC00 && lo <= 0xDFFF) {
+            cp = 0x10000 + ((cp - 0xD800) << 10) + (lo - 0xDC00);
+            pos += 6;
+          } else {
+            cp = kReplacement;
+          }
+        } else if (cp >= 0xDC00 && cp <= 0xDFFF) {
+          cp = kReplacement;
+        }
+        append_utf8(cp, out);
+        break;
+      }
+      default:
+        return false;
+    }
+  }
+  return true;
+}
+
+std::string_view json_string(const JsonReader& r, std::string& scratch) {
+  if (!r.escaped()) return r.raw();
+  scratch.clear();
+  if (!json_unescape(r.raw(), scratch)) return r.raw();
+  return scratch;
+}
+
+bool json_to_int(std::string_view num, int64_t& out) {
+  const char* end = num.data() + num.size();
+  int64_t v = 0;
+  auto [p, ec] = std::from_chars(num.data(), end, v);
+  if (ec == std::errc() && p == end) {
+    out = v;
+    return true;
+  }
+  // also accept counters written as floats ("12.0", "1e3")
+  double d = 0;
+  if (!json_to_double(num, d)) return false;
+  // [-2^63, 2^63): the cast is undefined outside it; NaN fails both comparisons
+  if (!(d >= -9223372036854775808.0 && d < 9223372036854775808.0)) return false;
+  out = (int64_t)d;
+  return true;
+}
+
+bool json_to_double(std::string_view num, double& out) {
+  const char* end = num.data() + num.size();
+  double v = 0;
+  auto [p, ec] = std::from_chars(num.data(), end, v);
+  if (ec != std::errc() || p != end) return false;
+  out = v;
+  return true;
+}
+
+} // namespace cc50
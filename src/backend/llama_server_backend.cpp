@@ -1,193 +1,208 @@
 #include "cc50/backend/llama_server_backend.hpp"
+#include "cc50/backend/http_client.hpp"
+#include "cc50/backend/http_reactor.hpp"
+#include "cc50/backend/json_reader.hpp"
 #include "cc50/common.hpp"
 
-#include <sys/types.h>
-#include <sys/socket.h>
-#include <netdb.h>
-#include <unistd.h>
-
-#include <cerrno>
+#include <cmath>
+#include <cstdio>
 #include <cstring>
 #include <cstdlib>
 #include <string>
 #include <string_view>
 #include <vector>
 #include <algorithm>
+#include <chrono>
+#include <random>
 
 namespace cc50 {
 
-static std::string ltrim_copy(std::string s) {
-  s.erase(s.begin(), std::find_if(s.begin(), s.end(), [](unsigned char c){ return !std::isspace(c); }));
-  return s;
+LlamaServerBackend::LlamaServerBackend(LlamaServerOptions opt) : opt_(std::move(opt)) {
+  reset_pool();
+  reset_upstreams();
 }
 
-static std::string join_paths(std::string a, std::string b) {
-  if (a.empty()) return b;
-  if (b.empty()) return a;
-  if (a.back() == '/' && b.front() == '/') return a + b.substr(1);
-  if (a.back() != '/' && b.front() != '/') return a + "/" + b;
-  return a + b;
+LlamaServerBackend::~LlamaServerBackend() {
+  stop_health();
+  reactor_.reset(); // fails what is still in flight while the upstreams exist
 }
 
-struct UrlParts {
-  std::string host;
-  int port{80};
-  std::string path{"/"};
-};
+void LlamaServerBackend::set_options(LlamaServerOptions o) {
+  const bool checking = health_.joinable();
+  const bool reacting = reactor_ != nullptr;
+  stop_health();
+  reactor_.reset();
+  opt_ = std::move(o);
+  reset_pool();
+  reset_upstreams();
+  if (reacting) reset_reactor();
+  if (checking) start_health();
+}
 
-static bool parse_http_url(const std::string& base_url, const std::string& endpoint, UrlParts& out, std::string& err) {
-  std::string url = base_url;
-  if (url.rfind("http://", 0) == 0) url = url.substr(7);
-  else if (url.rfind("https://", 0) == 0) { err = "https:// not supported (use http://)"; return false; }
-
-  // Split path from host[:port]
-  std::string hostport = url;
-  std::string base_path;
-  auto slash = url.find('/');
-  if (slash != std::string::npos) {
-    hostport = url.substr(0, slash);
-    base_path = url.substr(slash); // includes '/'
+void LlamaServerBackend::reset_upstreams() {
+  for (auto& up : ups_) {
+    if (up->ejected.load(std::memory_order_relaxed)) up->m->ejected.dec();
   }
-
-  std::string host = hostport;
-  int port = 80;
-  auto colon = hostport.rfind(':');
-  if (colon != std::string::npos && colon + 1 < hostport.size()) {
-    host = hostport.substr(0, colon);
-    port = std::atoi(hostport.substr(colon + 1).c_str());
-    if (port <= 0) { err = "invalid port in url"; return false; }
+  ups_.clear();
+  const auto& urls = opt_.upstreams.empty() ? std::vector<std::string>{opt_.base_url} : opt_.upstreams;
+  for (const auto& url : urls) {
+    auto up = std::make_unique<Upstream>();
+    up->base_url = url;
+    up->m = &upstream_metrics(url);
+    ups_.push_back(std::move(up));
   }
-
-  out.host = host;
-  out.port = port;
-  out.path = join_paths(base_path.empty() ? std::string("/") : base_path, endpoint.empty() ? std::string("/") : endpoint);
-  if (out.path.empty() || out.path[0] != '/') out.path = "/" + out.path;
-  return true;
 }
 
-static bool set_socket_timeout(int fd, int ms) {
-  timeval tv{};
-  tv.tv_sec = ms / 1000;
-  tv.tv_usec = (ms % 1000) * 1000;
-  if (setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv)) != 0) return false;
-  if (setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv)) != 0) return false;
-  return true;
+LlamaServerBackend::UpstreamMetrics& LlamaServerBackend::upstream_metrics(const std::string& url) {
+  for (auto& [u, m] : up_metrics_) {
+    if (u == url) return *m;
+  }
+  up_metrics_.emplace_back(url, std::make_unique<UpstreamMetrics>());
+  if (metrics_registered_) register_upstream(url, *up_metrics_.back().second);
+  return *up_metrics_.back().second;
 }
 
-static Status http_post_json(const UrlParts& u, int connect_timeout_ms, int request_timeout_ms,
-                             const std::string& body, int& http_status, std::string& out_body) {
-  http_status = 0;
-  out_body.clear();
-
-  addrinfo hints{};
-  hints.ai_family = AF_UNSPEC;
-  hints.ai_socktype = SOCK_STREAM;
-
-  addrinfo* res = nullptr;
-  std::string port_str = std::to_string(u.port);
-  int gai = getaddrinfo(u.host.c_str(), port_str.c_str(), &hints, &res);
-  if (gai != 0) return Status::Err(std::string("getaddrinfo: ") + gai_strerror(gai));
-
-  int fd = -1;
-  for (addrinfo* p = res; p; p = p->ai_next) {
-    fd = ::socket(p->ai_family, p->ai_socktype, p->ai_protocol);
-    if (fd < 0) continue;
-
-    // connect with a reasonable timeout by relying on SO_SNDTIMEO (simpler than non-blocking+select here)
-    set_socket_timeout(fd, connect_timeout_ms);
+void LlamaServerBackend::register_upstream(const std::string& url, const UpstreamMetrics& m) {
+  MetricsRegistry& reg = *opt_.metrics;
+  const std::string l = metric_label("upstream", url);
+  reg.add("cc50_upstream_requests_total", "Attempts sent to a llama-server upstream.", l, m.requests);
+  reg.add("cc50_upstream_failures_total", "Attempts that failed through the upstream's fault.", l, m.failures);
+  reg.add("cc50_upstream_in_flight", "Requests outstanding on the upstream.", l, m.in_flight);
+  reg.add("cc50_upstream_ejected", "1 while the upstream is skipped after repeated failures.", l, m.ejected);
+}
 
-    if (::connect(fd, p->ai_addr, p->ai_addrlen) == 0) break;
-    ::close(fd);
-    fd = -1;
+LlamaServerBackend::Upstream* LlamaServerBackend::pick(const std::vector<Upstream*>& tried) {
+  const uint64_t now = now_us();
+  // healthy upstreams first; if every untried one is ejected, still try the least loaded
+  std::vector<Upstream*> cand;
+  std::vector<Upstream*> ejected;
+  for (auto& up : ups_) {
+    if (std::find(tried.begin(), tried.end(), up.get()) != tried.end()) continue;
+    const bool out = up->ejected.load(std::memory_order_relaxed) &&
+                     now < up->retry_at_us.load(std::memory_order_relaxed);
+    (out ? ejected : cand).push_back(up.get());
   }
-  freeaddrinfo(res);
-  if (fd < 0) return Status::Err(std::string("connect failed: ") + std::strerror(errno));
-
-  set_socket_timeout(fd, request_timeout_ms);
-
-  std::string req;
-  req.reserve(512 + body.size());
-  req += "POST " + u.path + " HTTP/1.1\r\n";
-  req += "Host: " + u.host + "\r\n";
-  req += "Content-Type: application/json\r\n";
-  req += "Accept: application/json\r\n";
-  req += "Connection: close\r\n";
-  req += "Content-Length: " + std::to_string(body.size()) + "\r\n\r\n";
-  req += body;
-
-  const char* ptr = req.data();
-  size_t left = req.size();
-  while (left > 0) {
-    ssize_t n = ::send(fd, ptr, left, 0);
-    if (n < 0) { ::close(fd); return Status::Err(std::string("send failed: ") + std::strerror(errno)); }
-    ptr += n;
-    left -= (size_t)n;
+  if (cand.empty()) cand.swap(ejected);
+  if (cand.empty()) return nullptr;
+  if (cand.size() == 1) return cand[0];
+
+  auto load = [](const Upstream* u) { return u->outstanding.load(std::memory_order_relaxed); };
+  if (opt_.balance == "least") {
+    return *std::min_element(cand.begin(), cand.end(),
+                             [&](const Upstream* a, const Upstream* b) { return load(a) < load(b); });
   }
+  // power of two choices: near least-loaded balance without every picker herding to one minimum
+  thread_local std::minstd_rand rng{std::random_device{}()};
+  std::uniform_int_distribution<size_t> dist(0, cand.size() - 1);
+  Upstream* a = cand[dist(rng)];
+  Upstream* b = cand[dist(rng)];
+  while (b == a) b = cand[dist(rng)];
+  return load(b) < load(a) ? b : a;
+}
 
-  std::string resp;
-  char buf[8192];
-  while (true) {
-    ssize_t n = ::recv(fd, buf, sizeof(buf), 0);
-    if (n == 0) break;
-    if (n < 0) { ::close(fd); return Status::Err(std::string("recv failed: ") + std::strerror(errno)); }
-    resp.append(buf, buf + n);
+void LlamaServerBackend::note_success(Upstream& up) {
+  up.failures.store(0, std::memory_order_relaxed);
+  if (up.ejected.exchange(false, std::memory_order_relaxed)) {
+    up.m->ejected.dec();
+    CC50_LOG_INFO("[Backend] upstream " << up.base_url << " is back");
   }
-  ::close(fd);
-
-  // Split headers/body
-  auto sep = resp.find("\r\n\r\n");
-  if (sep == std::string::npos) return Status::Err("bad http response (no header separator)");
-  std::string headers = resp.substr(0, sep);
-  std::string body_part = resp.substr(sep + 4);
+}
 
-  // Parse status line: HTTP/1.1 200 OK
-  auto eol = headers.find("\r\n");
-  std::string status_line = (eol == std::string::npos) ? headers : headers.substr(0, eol);
-  {
-    auto sp1 = status_line.find(' ');
-    auto sp2 = (sp1 == std::string::npos) ? std::string::npos : status_line.find(' ', sp1 + 1);
-    if (sp1 != std::string::npos && sp2 != std::string::npos) {
-      http_status = std::atoi(status_line.substr(sp1 + 1, sp2 - sp1 - 1).c_str());
-    }
+void LlamaServerBackend::note_failure(Upstream& up, const std::string& why) {
+  const int n = up.failures.fetch_add(1, std::memory_order_relaxed) + 1;
+  if (n < std::max(1, opt_.eject_after_failures)) return;
+  up.retry_at_us.store(now_us() + uint64_t(std::max(0, opt_.eject_ms)) * 1000, std::memory_order_relaxed);
+  if (!up.ejected.exchange(true, std::memory_order_relaxed)) {
+    up.m->ejected.inc();
+    CC50_LOG_WARN("[Backend] upstream " << up.base_url << " ejected after " << n << " failures: " << why);
   }
+}
+
+void LlamaServerBackend::start_health() {
+  if (opt_.health_interval_ms <= 0 || health_.joinable()) return;
+  health_stop_ = false;
+  health_ = std::thread([this] { health_loop(); });
+}
 
-  // Check for chunked encoding
-  bool chunked = false;
+void LlamaServerBackend::stop_health() {
+  if (!health_.joinable()) return;
   {
-    std::string hl = headers;
-    std::transform(hl.begin(), hl.end(), hl.begin(), [](unsigned char c){ return (char)std::tolower(c); });
-    if (hl.find("transfer-encoding: chunked") != std::string::npos) chunked = true;
+    std::lock_guard<std::mutex> lk(health_mu_);
+    health_stop_ = true;
   }
+  health_cv_.notify_all();
+  health_.join();
+}
 
-  if (!chunked) {
-    out_body = body_part;
-    return Status::Ok();
+void LlamaServerBackend::health_loop() {
+  std::unique_lock<std::mutex> lk(health_mu_);
+  while (!health_stop_) {
+    lk.unlock();
+    for (auto& up : ups_) {
+      UrlParts u;
+      std::string err;
+      Status st = Status::Err("bad url");
+      int status = 0;
+      if (parse_http_url(up->base_url, "/health", u, err)) {
+        std::string body;
+        // not pooled: a probe must not take a socket from requests
+        st = http_get(u, opt_.connect_timeout_ms, std::max(opt_.connect_timeout_ms, 1000), status, body,
+                      nullptr, &opt_.sock);
+      }
+      if (st.ok && status == 200) {
+        note_success(*up);
+      } else {
+        note_failure(*up, st.ok ? "/health status=" + std::to_string(status) : st.msg);
+      }
+    }
+    lk.lock();
+    health_cv_.wait_for(lk, std::chrono::milliseconds(opt_.health_interval_ms), [&] { return health_stop_; });
   }
+}
 
-  // Decode chunked
-  std::string decoded;
-  size_t i = 0;
-  while (i < body_part.size()) {
-    // read chunk size line
-    size_t line_end = body_part.find("\r\n", i);
-    if (line_end == std::string::npos) break;
-    std::string sz_hex = body_part.substr(i, line_end - i);
-    size_t semi = sz_hex.find(';');
-    if (semi != std::string::npos) sz_hex = sz_hex.substr(0, semi);
-    int sz = std::strtol(sz_hex.c_str(), nullptr, 16);
-    i = line_end + 2;
-    if (sz <= 0) break;
-    if (i + (size_t)sz > body_part.size()) break;
-    decoded.append(body_part.data() + i, (size_t)sz);
-    i += (size_t)sz;
-    // skip trailing CRLF
-    if (i + 2 <= body_part.size() && body_part.substr(i,2) == "\r\n") i += 2;
+void LlamaServerBackend::reset_pool() {
+  if (!opt_.keep_alive) { pool_.reset(); return; }
+  HttpPoolOptions po;
+  po.max_idle = opt_.pool_max_idle;
+  po.max_per_host = opt_.pool_max_per_host;
+  po.idle_timeout_ms = opt_.pool_idle_timeout_ms;
+  pool_ = std::make_unique<HttpConnPool>(po);
+}
+
+void LlamaServerBackend::reset_reactor() {
+  reactor_.reset();
+  if (opt_.reactor_threads <= 0) return;
+  HttpReactorOptions ro;
+  ro.threads = opt_.reactor_threads;
+  ro.keep_alive = opt_.keep_alive;
+  ro.max_idle = opt_.pool_max_idle;
+  ro.max_per_host = opt_.pool_max_per_host;
+  ro.idle_timeout_ms = opt_.pool_idle_timeout_ms;
+  ro.sock = opt_.sock;
+  auto r = std::make_unique<HttpReactor>(ro);
+  auto st = r->start();
+  if (!st.ok) {
+    CC50_LOG_ERROR("[Backend] http reactor: " << st.msg << "; requests use the blocking client");
+    return;
   }
-  out_body = decoded;
-  return Status::Ok();
+  reactor_ = std::move(r);
 }
 
 Status LlamaServerBackend::init() {
+  if (opt_.metrics && !metrics_registered_) {
+    MetricsRegistry& reg = *opt_.metrics;
+    reg.add("cc50_upstream_fallbacks_total", "Attempts retried on /v1/completions after the primary endpoint failed.",
+            "", fallbacks_);
+    reg.add("cc50_upstream_retries_total", "Requests moved to another upstream before any text was sent.", "", retries_);
+    reg.add("cc50_upstream_attempt_seconds", "Duration of one attempt on one upstream, failed ones included.", "",
+            attempt_us_);
+    reg.add("cc50_upstream_first_event_seconds", "Streaming: request sent to first token event received.", "",
+            first_event_us_);
+    for (const auto& [url, m] : up_metrics_) register_upstream(url, *m);
+    metrics_registered_ = true;
+  }
+  if (!reactor_) reset_reactor();
+  start_health();
   return Status::Ok();
 }
 
@@ -217,192 +232,577 @@ std::string LlamaServerBackend::json_escape(std::string_view s) {
   return out;
 }
 
-static bool json_read_string_at(const std::string& s, size_t pos, std::string& out) {
-  // pos points at opening quote
-  if (pos >= s.size() || s[pos] != '"') return false;
-  pos++;
-  std::string r;
-  while (pos < s.size()) {
-    char c = s[pos++];
-    if (c == '"') { out = r; return true; }
-    if (c == '\\' && pos < s.size()) {
-      char e = s[pos++];
-      switch (e) {
-        case '"': r.push_back('"'); break;
-        case '\\': r.push_back('\\'); break;
-        case '/': r.push_back('/'); break;
-        case 'b': r.push_back('\b'); break;
-        case 'f': r.push_back('\f'); break;
-        case 'n': r.push_back('\n'); break;
-        case 'r': r.push_back('\r'); break;
-        case 't': r.push_back('\t'); break;
-        case 'u': {
-          // minimal \uXXXX (BMP) support: decode hex to UTF-8 if <= 0x7F else keep as '?'
-          if (pos + 4 <= s.size()) {
-            unsigned int v = 0;
-            for (int i = 0; i < 4; i++) {
-              char h = s[pos + i];
-              v <<= 4;
-              if (h >= '0' && h <= '9') v |= (h - '0');
-              else if (h >= 'a' && h <= 'f') v |= (h - 'a' + 10);
-              else if (h >= 'A' && h <= 'F') v |= (h - 'A' + 10);
-              else { v = 0; break; }
-            }
-            pos += 4;
-            if (v <= 0x7F) r.push_back((char)v);
-            else r.push_back('?');
-          }
-        } break;
-        default: r.push_back(e); break;
-      }
-    } else {
-      r.push_back(c);
-    }
+void LlamaServerBackend::Completion::clear() {
+  text.clear();
+  has_text = false;
+  stop = false;
+  has_error = false;
+  error.clear();
+  tokens_predicted = tokens_evaluated = prompt_n = -1;
+  prompt_ms = predicted_ms = -1;
+}
+
+void LlamaServerBackend::apply_usage(const Completion& c, InferResult& out) {
+  if (c.tokens_predicted >= 0) out.tokens = (uint32_t)c.tokens_predicted;
+  // prompt_n pairs with prompt_ms; tokens_evaluated also counts a KV-cache-reused prefix
+  if (c.prompt_n >= 0) out.prompt_tokens = (uint32_t)c.prompt_n;
+  else if (c.tokens_evaluated >= 0) out.prompt_tokens = (uint32_t)c.tokens_evaluated;
+  if (c.prompt_ms >= 0) out.prefill_us = (uint64_t)(c.prompt_ms * 1000.0);
+  if (c.predicted_ms >= 0) out.decode_us = (uint64_t)(c.predicted_ms * 1000.0);
+}
+
+namespace {
+
+using Tok = JsonReader::Token;
+
+// Completion text candidates, most preferred first (the order the old key search used)
+int text_rank(std::string_view key) {
+  if (key == "content") return 0;
+  if (key == "response") return 1;
+  if (key == "completion") return 2;
+  if (key == "text") return 3;
+  return -1;
+}
+
+// Consume the rest of a value whose first token `t` was just read: nothing more for a
+// scalar, the remaining members or elements for an object or array.
+bool finish_value(JsonReader& r, Tok t) {
+  if (t == Tok::Error) return false;
+  if (t != Tok::BeginObject && t != Tok::BeginArray) return true;
+  const int base = r.depth() - 1;
+  while (r.depth() > base) {
+    if (r.next() == Tok::Error) return false;
   }
-  return false;
+  return true;
 }
 
-bool LlamaServerBackend::json_extract_string(const std::string& body, const char* key, std::string& out) {
-  std::string k = "\"";
-  k += key;
-  k += "\"";
-  size_t p = body.find(k);
-  if (p == std::string::npos) return false;
-  p = body.find(':', p + k.size());
-  if (p == std::string::npos) return false;
-  p++;
-  while (p < body.size() && std::isspace((unsigned char)body[p])) p++;
-  if (p >= body.size() || body[p] != '"') return false;
-  return json_read_string_at(body, p, out);
+bool read_text(JsonReader& r, int rank, int& best, std::string& out) {
+  const Tok t = r.next();
+  if (t != Tok::String) return finish_value(r, t);  // not a string after all
+  if (rank >= best) return true;
+  out.clear();
+  if (!r.escaped()) out.assign(r.raw());
+  else if (!json_unescape(r.raw(), out)) return false;
+  best = rank;
+  return true;
 }
 
+bool read_int(JsonReader& r, int64_t& out) {
+  const Tok t = r.skip_value();
+  if (t == Tok::Number) json_to_int(r.raw(), out);
+  return t != Tok::Error;
+}
 
-Status LlamaServerBackend::infer_stream(const InferRequest& req, StreamFn on_chunk, InferResult& out) {
-	std::cout << "[Backend] *** STARTING INFERENCE REQUEST ***\n" << std::flush;
-  const uint64_t t0 = now_us();
-  out = InferResult{};
+bool read_double(JsonReader& r, double& out) {
+  const Tok t = r.skip_value();
+  if (t == Tok::Number) json_to_double(r.raw(), out);
+  return t != Tok::Error;
+}
 
-  std::cout << "[Backend] Starting inference request\n";
-  std::cout << "[Backend] Prompt: " << req.prompt << "\n";
-  std::cout << "[Backend] Max tokens: " << req.max_tokens << "\n";
+// Walk the members of the object just opened, calling on_member(key) with the reader
+// positioned before each value; on_member must consume the value.
+template <typename Fn>
+bool for_each_member(JsonReader& r, std::string& scratch, Fn&& on_member) {
+  const int depth = r.depth();
+  while (true) {
+    const Tok t = r.next();
+    if (t == Tok::EndObject && r.depth() == depth - 1) return true;
+    if (t != Tok::Key) return false;
+    if (!on_member(json_string(r, scratch))) return false;
+  }
+}
 
-  auto call = [&](const std::string& endpoint, const std::string& body, std::string& text_out)->Status {
-    UrlParts u;
-    std::string err;
-    
-    std::cout << "[Backend] Parsing URL: " << opt_.base_url << endpoint << "\n";
-    
-    if (!parse_http_url(opt_.base_url, endpoint, u, err)) {
-      std::cout << "[Backend] URL parse error: " << err << "\n";
-      return Status::Err("parse url: " + err);
-    }
+} // namespace
 
-    std::cout << "[Backend] Sending POST to " << u.host << ":" << u.port << u.path << "\n";
-    std::cout << "[Backend] Request body: " << body << "\n";
+bool LlamaServerBackend::parse_completion(std::string_view body, Completion& out) {
+  out.clear();
+  JsonReader r(body);
+  if (r.next() != Tok::BeginObject) return false;
 
-    int status = 0;
-    std::string resp_body;
-    
-    auto st = http_post_json(u, opt_.connect_timeout_ms, opt_.request_timeout_ms, body, status, resp_body);
-    
-    if (!st.ok) {
-      std::cout << "[Backend] HTTP error: " << st.msg << "\n";
-      return st;
+  std::string key_buf;
+  std::string scratch;
+  int best = 4;  // rank of the text kept so far (4 = none)
+
+  bool ok = for_each_member(r, key_buf, [&](std::string_view key) {
+    if (int rank = text_rank(key); rank >= 0) return read_text(r, rank, best, out.text);
+    if (key == "stop") {
+      const Tok t = r.skip_value();
+      if (t == Tok::True) out.stop = true;
+      return t != Tok::Error;
     }
-    
-    std::cout << "[Backend] HTTP status: " << status << "\n";
-    std::cout << "[Backend] Response body length: " << resp_body.size() << " bytes\n";
-    std::cout << "[Backend] Response body (first 500 chars): " << resp_body.substr(0, 500) << "\n";
-    
-    if (status < 200 || status >= 300) {
-      return Status::Err("llama-server http status=" + std::to_string(status) + " body=" + resp_body.substr(0, 200));
+    if (key == "tokens_predicted") return read_int(r, out.tokens_predicted);
+    if (key == "tokens_evaluated") return read_int(r, out.tokens_evaluated);
+    if (key == "timings" || key == "usage") {
+      const bool timings = key == "timings";
+      if (r.next() != Tok::BeginObject) return false;
+      return for_each_member(r, scratch, [&](std::string_view k) {
+        if (timings && k == "prompt_ms") return read_double(r, out.prompt_ms);
+        if (timings && k == "predicted_ms") return read_double(r, out.predicted_ms);
+        if (timings && k == "prompt_n") return read_int(r, out.prompt_n);
+        if (!timings && k == "prompt_tokens") return read_int(r, out.tokens_evaluated);
+        if (!timings && k == "completion_tokens") return read_int(r, out.tokens_predicted);
+        return r.skip_value() != Tok::Error;
+      });
+    }
+    if (key == "error") {
+      out.has_error = true;
+      const Tok t = r.next();
+      if (t == Tok::String) return json_unescape(r.raw(), out.error);
+      if (t != Tok::BeginObject) return finish_value(r, t);
+      return for_each_member(r, scratch, [&](std::string_view k) {
+        if (k != "message") return r.skip_value() != Tok::Error;
+        const Tok m = r.next();
+        if (m == Tok::String) return json_unescape(r.raw(), out.error);
+        return finish_value(r, m);
+      });
+    }
+    if (key == "choices") {
+      // OpenAI-style: only the first choice is used
+      if (r.next() != Tok::BeginArray) return false;
+      bool first = true;
+      while (true) {
+        const Tok t = r.next();
+        if (t == Tok::EndArray) return true;
+        if (t != Tok::BeginObject) return false;
+        bool ok = for_each_member(r, scratch, [&](std::string_view k) {
+          if (first && k == "text") return read_text(r, 3, best, out.text);
+          if (first && k == "finish_reason") {
+            const Tok f = r.skip_value();
+            if (f == Tok::String) out.stop = true;
+            return f != Tok::Error;
+          }
+          return r.skip_value() != Tok::Error;
+        });
+        if (!ok) return false;
+        first = false;
+      }
     }
+    return r.skip_value() != Tok::Error;
+  });
 
-    // Try common fields
-    std::string tmp;
-    std::cout << "[Backend] Trying to extract 'content' field...\n";
-    if (json_extract_string(resp_body, "content", tmp)) {
-      std::cout << "[Backend] Extracted content: " << tmp << "\n";
-      text_out = std::move(tmp);
-      return Status::Ok();
+  out.has_text = best < 4;
+  return ok && r.next() == Tok::End;
+}
+
+std::string LlamaServerBackend::sampling_json(const SamplingParams& p) {
+  std::string out;
+  auto num = [&](const char* name, const std::optional<float>& v) {
+    if (!v || !std::isfinite(*v)) return; // JSON has no NaN / Infinity
+    char buf[32];
+    std::snprintf(buf, sizeof(buf), "%.7g", (double)*v);
+    out += std::string(",\"") + name + "\":" + buf;
+  };
+  num("temperature", p.temperature);
+  num("top_p", p.top_p);
+  if (p.top_k) out += ",\"top_k\":" + std::to_string(*p.top_k);
+  num("min_p", p.min_p);
+  num("repeat_penalty", p.repeat_penalty);
+  num("presence_penalty", p.presence_penalty);
+  num("frequency_penalty", p.frequency_penalty);
+  if (p.seed) out += ",\"seed\":" + std::to_string(*p.seed);
+  if (!p.stop.empty()) {
+    out += ",\"stop\":[";
+    for (size_t i = 0; i < p.stop.size(); i++) {
+      if (i) out += ',';
+      out += '"' + json_escape(p.stop[i]) + '"';
     }
+    out += ']';
+  }
+  return out;
+}
+
+static std::string make_request_body(uint32_t max_tokens, bool openai, bool stream, std::string_view escaped_prompt,
+                                     std::string_view sampling) {
+  std::string body = "{";
+  if (openai) body += "\"model\":\"\",";
+  body += "\"prompt\":\"";
+  body += escaped_prompt;
+  body += "\",";
+  body += (openai ? "\"max_tokens\":" : "\"n_predict\":") + std::to_string(max_tokens) + ",";
+  body += stream ? "\"stream\":true" : "\"stream\":false";
+  body += sampling;
+  body += "}";
+  return body;
+}
 
-    std::cout << "[Backend] 'content' not found, trying 'response'...\n";
-    if (json_extract_string(resp_body, "response", tmp)) {
-      std::cout << "[Backend] Extracted response: " << tmp << "\n";
-      text_out = std::move(tmp);
-      return Status::Ok();
+// Decoder for the response to one POST, fed by either HTTP client: the body is
+// buffered (non-streaming) or split into SSE events whose text goes to on_chunk as it
+// is decoded off the socket. `out`, `text` and `emitted` are the attempt's.
+struct LlamaServerBackend::Reply {
+  Reply(LlamaServerBackend& be, bool stream, InferResult& out, std::string& text, size_t& emitted,
+        const StreamFn& on_chunk)
+    : be(be), stream(stream), out(out), text(text), emitted(emitted), on_chunk(on_chunk),
+      // After the final event the remainder of the body is still drained (not cut off),
+      // so the keep-alive connection can go back to the pool.
+      sse([this](std::string_view data) { return on_event(data); }) {}
+
+  bool on_body(std::string_view part) {
+    if (!stream) {
+      body.append(part);
+      return true;
     }
+    if (status < 200 || status >= 300) {
+      // not an event stream: keep (a bounded prefix of) the error body
+      if (body.size() < 200) body.append(part.substr(0, 200 - body.size()));
+      return true;
+    }
+    return sse.feed(part);
+  }
 
-    std::cout << "[Backend] 'response' not found, trying 'completion'...\n";
-    if (json_extract_string(resp_body, "completion", tmp)) {
-      std::cout << "[Backend] Extracted completion: " << tmp << "\n";
-      text_out = std::move(tmp);
-      return Status::Ok();
+  bool on_event(std::string_view data) {
+    if (finished) return true;
+    if (data == "[DONE]") { finished = true; return true; }
+    parse_completion(data, ev);
+    if (ev.has_error && !ev.has_text) {
+      event_err = ev.error.empty() ? std::string(data.substr(0, 200)) : ev.error;
+      return false;
+    }
+    if (ev.has_text && !ev.text.empty()) {
+      if (first_event) {
+        be.first_event_us_.record(now_us() - sent_us);
+        first_event = false;
+      }
+      text += ev.text;
+      emitted++;
+      if (on_chunk) on_chunk(ev.text);
     }
+    // counts and timings arrive with the final event; later values win
+    apply_usage(ev, out);
+    if (ev.stop) finished = true;
+    return true;
+  }
 
-    std::cout << "[Backend] 'completion' not found, trying 'text'...\n";
-    if (json_extract_string(resp_body, "text", tmp)) {
-      std::cout << "[Backend] Extracted text: " << tmp << "\n";
-      text_out = std::move(tmp);
-      return Status::Ok();
+  // Outcome once the HTTP client returned `st`. `fault` is set for the upstream's failures.
+  Status finish(const Status& st, bool& fault) {
+    if (!st.ok) {
+      CC50_LOG_WARN("[Backend] HTTP error: " << st.msg);
+      fault = true;
+      return st;
+    }
+    CC50_LOG_DEBUG("[Backend] HTTP status: " << status << " body_bytes=" << body.size() << " events=" << emitted);
+    if (status < 200 || status >= 300) {
+      if (status >= 500) fault = true;
+      return Status::Err("llama-server http status=" + std::to_string(status) + " body=" + body.substr(0, 200));
     }
+    if (!stream) {
+      Completion c;
+      parse_completion(body, c);
+      if (c.has_text) {
+        apply_usage(c, out);
+        text = std::move(c.text);
+        return Status::Ok();
+      }
+      CC50_LOG_ERROR("[Backend] could not parse completion text from response: " << body);
+      return Status::Err("could not parse completion text from response (unexpected schema)");
+    }
+    if (!event_err.empty()) return Status::Err("llama-server stream error: " + event_err);
+    if (!finished && emitted == 0) {
+      fault = true;
+      return Status::Err("llama-server stream ended without events");
+    }
+    // an upstream that does not report usage sends one token per event
+    if (out.tokens == 0) out.tokens = (uint32_t)emitted;
+    return Status::Ok();
+  }
 
-    std::cout << "[Backend] ERROR: Could not parse completion text from response\n";
-    std::cout << "[Backend] Full response: " << resp_body << "\n";
-    return Status::Err("could not parse completion text from response (unexpected schema)");
+  LlamaServerBackend& be;
+  const bool stream;
+  InferResult& out;
+  std::string& text;
+  size_t& emitted;
+  const StreamFn& on_chunk;
+
+  int status{0};
+  std::string body;      // non-streaming: the response; streaming: the start of an error body
+  bool finished{false};  // [DONE] or a stop event seen
+  std::string event_err;
+  Completion ev;         // reused across events, so the text buffer is allocated once
+  const uint64_t sent_us{now_us()};
+  bool first_event{true};
+  SseParser sse;
+};
+
+Status LlamaServerBackend::try_upstream(const Upstream& up, const InferRequest& req, const std::string& prompt,
+                                        const StreamFn& on_chunk, const CancelToken& cancel, InferResult& out,
+                                        std::string& text, size_t& emitted, bool& fault) {
+  const std::string sampling = sampling_json(req.params);
+  // non-streaming: buffer the whole completion, then extract the text; streaming:
+  // "stream":true, each SSE `data:` event carries one token delta
+  auto call = [&](const std::string& endpoint, bool openai) -> Status {
+    UrlParts u;
+    std::string err;
+    if (!parse_http_url(up.base_url, endpoint, u, err)) {
+      CC50_LOG_ERROR("[Backend] URL parse error: " << err);
+      return Status::Err("parse url: " + err);
+    }
+    const std::string body = make_request_body(req.max_tokens, openai, opt_.stream, prompt, sampling);
+    CC50_LOG_DEBUG("[Backend] POST " << u.host << ":" << u.port << u.path << " body_bytes=" << body.size()
+                   << " stream=" << (opt_.stream ? 1 : 0));
+
+    Reply r(*this, opt_.stream, out, text, emitted, on_chunk);
+    auto st = http_post(u, opt_.connect_timeout_ms, opt_.request_timeout_ms, body, opt_.stream, r.status,
+                        [&](std::string_view part) { return r.on_body(part); }, pool_.get(), &cancel, &opt_.sock);
+    return r.finish(st, fault);
   };
 
   // Primary attempt: /completion (llama.cpp classic)
-  std::string text;
-  {
-    std::string body = "{";
-    body += "\"prompt\":\"" + json_escape(req.prompt) + "\",";
-    body += "\"n_predict\":" + std::to_string(req.max_tokens) + ",";
-    body += "\"stream\":false";
-    body += "}";
-
-    std::cout << "[Backend] Attempting primary endpoint: " << opt_.endpoint << "\n";
-    auto st = call(opt_.endpoint, body, text);
-    
-    if (!st.ok) {
-      std::cout << "[Backend] Primary endpoint failed, trying fallback...\n";
-      // Fallback: /v1/completions
-      std::string body2 = "{";
-      body2 += "\"model\":\"\",";
-      body2 += "\"prompt\":\"" + json_escape(req.prompt) + "\",";
-      body2 += "\"max_tokens\":" + std::to_string(req.max_tokens) + ",";
-      body2 += "\"stream\":false";
-      body2 += "}";
-      
-      auto st2 = call("/v1/completions", body2, text);
-      if (!st2.ok) {
-        out.error = st.msg + " | fallback: " + st2.msg;
-        std::cout << "[Backend] Both endpoints failed: " << out.error << "\n";
-        return Status::Err(out.error);
-      }
-    }
+  auto st = call(opt_.endpoint, false);
+
+  // once part of the completion went out a retry would duplicate it
+  if (st.ok || cancel.cancelled() || emitted > 0) return st;
+
+  CC50_LOG_INFO("[Backend] " << up.base_url << opt_.endpoint << " failed (" << st.msg << "), trying /v1/completions");
+  fallbacks_.inc();
+  // Fallback: /v1/completions
+  text.clear();
+  out = InferResult{};
+  auto st2 = call("/v1/completions", true);
+  if (!st2.ok && !cancel.cancelled() && emitted == 0) {
+    CC50_LOG_WARN("[Backend] both endpoints failed: " << st.msg << " | fallback: " << st2.msg);
+    return Status::Err(st.msg + " | fallback: " + st2.msg);
   }
+  return st2;
+}
+
+void LlamaServerBackend::begin_attempt(Upstream& up, std::vector<Upstream*>& tried) {
+  if (!tried.empty()) retries_.inc();
+  tried.push_back(&up);
+  up.outstanding.fetch_add(1, std::memory_order_relaxed);
+  up.m->requests.inc();
+  up.m->in_flight.inc();
+}
+
+bool LlamaServerBackend::end_attempt(Upstream& up, uint64_t attempt_t0, const Status& st, bool fault,
+                                     bool cancelled, size_t emitted, std::string& errors) {
+  attempt_us_.record(now_us() - attempt_t0);
+  up.m->in_flight.dec();
+  up.outstanding.fetch_sub(1, std::memory_order_relaxed);
 
-  std::cout << "[Backend] Successfully got text, length: " << text.size() << " bytes\n";
-
-  // Re-chunk into RESP_CHUNK messages to mimic streaming
-  out.text = text;
-  out.tokens = 0; // token count unknown
-  
-  std::cout << "[Backend] Sending chunks to client...\n";
-  for (size_t i = 0; i < text.size(); i += opt_.chunk_bytes) {
-    std::string_view sv(text.data() + i, std::min(opt_.chunk_bytes, text.size() - i));
-    if (on_chunk) {
-      std::cout << "[Backend] Sending chunk: " << std::string(sv) << "\n";
-      on_chunk(std::string(sv));
+  if (st.ok) {
+    note_success(up);
+    errors.clear();
+    return false;
+  }
+  if (cancelled) return false;
+  if (fault) {
+    up.m->failures.inc();
+    note_failure(up, st.msg);
+  }
+  if (!errors.empty()) errors += " | ";
+  errors += up.base_url + ": " + st.msg;
+  // text already went out, or the upstream rejected the request (4xx, schema), which
+  // would fail the same way elsewhere
+  if (emitted > 0 || !fault) return false;
+  CC50_LOG_INFO("[Backend] upstream " << up.base_url << " failed, trying another");
+  return true;
+}
+
+Status LlamaServerBackend::conclude(const Status& st, bool cancelled, bool attempted, size_t emitted,
+                                    const std::string& errors, std::string& text, const StreamFn& on_chunk,
+                                    uint64_t t0, InferResult& out) {
+  if (!st.ok && cancelled) {
+    // the upstream socket is already closed, which frees the llama-server slot
+    out.error = "cancelled";
+    out.text = std::move(text);
+    CC50_LOG_DEBUG("[Backend] request cancelled");
+    return Status::Err(out.error);
+  }
+  if (!st.ok && emitted > 0) {
+    out.error = st.msg;
+    out.text = std::move(text);
+    CC50_LOG_WARN("[Backend] stream failed mid-response: " << out.error);
+    return Status::Err(out.error);
+  }
+  if (!attempted || !errors.empty()) {
+    out.error = attempted ? errors : "no llama-server upstream configured";
+    out.text = std::move(text);
+    return Status::Err(out.error);
+  }
+
+  out.text = std::move(text);
+
+  if (!opt_.stream) {
+    // Re-chunk into RESP_CHUNK messages to mimic streaming
+    std::string chunk;
+    for (size_t i = 0; i < out.text.size(); i += opt_.chunk_bytes) {
+      chunk.assign(out.text, i, std::min(opt_.chunk_bytes, out.text.size() - i));
+      if (on_chunk) on_chunk(chunk);
     }
   }
 
   out.elapsed_us = now_us() - t0;
-  std::cout << "[Backend] Inference complete, elapsed: " << out.elapsed_us << " us\n";
+  CC50_LOG_EVERY_N(LogLevel::Debug, 64, "[Backend] done text_bytes=" << out.text.size()
+                   << " prompt_tokens=" << out.prompt_tokens << " tokens=" << out.tokens
+                   << " prefill_us=" << out.prefill_us << " decode_us=" << out.decode_us
+                   << " elapsed_us=" << out.elapsed_us);
   return Status::Ok();
 }
 
+Status LlamaServerBackend::infer_stream(const InferRequest& req, StreamFn on_chunk, InferResult& out,
+                                        const CancelToken& cancel) {
+  const uint64_t t0 = now_us();
+  out = InferResult{};
+
+  CC50_LOG_DEBUG("[Backend] request prompt_bytes=" << req.prompt.size() << " max_tokens=" << req.max_tokens
+                 << " stream=" << (opt_.stream ? 1 : 0));
+
+  const std::string prompt = json_escape(req.prompt);
+
+  std::string text;
+  size_t emitted = 0; // chunks already handed to on_chunk (no retry once > 0)
+  std::vector<Upstream*> tried;
+  std::string errors;
+  Status st = Status::Ok();
+  while (Upstream* up = pick(tried)) {
+    begin_attempt(*up, tried);
+    text.clear();
+    out = InferResult{};
+    bool fault = false;
+    const uint64_t attempt_t0 = now_us();
+    st = try_upstream(*up, req, prompt, on_chunk, cancel, out, text, emitted, fault);
+    if (!end_attempt(*up, attempt_t0, st, fault, cancel.cancelled(), emitted, errors)) break;
+  }
+  return conclude(st, cancel.cancelled(), !tried.empty(), emitted, errors, text, on_chunk, t0, out);
+}
+
+// One request driven by HttpReactor callbacks: the upstream loop of infer_stream and
+// the endpoint fallback of try_upstream, advanced one step per finished HTTP call.
+struct LlamaServerBackend::AsyncReq final : AsyncInfer, std::enable_shared_from_this<AsyncReq> {
+  AsyncReq(LlamaServerBackend& be, const InferRequest& req, StreamFn on_chunk, DoneFn on_done,
+           const CancelToken& cancel)
+    : be(be), max_tokens(req.max_tokens), prompt(json_escape(req.prompt)), sampling(sampling_json(req.params)),
+      on_chunk(std::move(on_chunk)), on_done(std::move(on_done)), cancel(cancel) {}
+
+  void pause() override { set_paused(true); }
+  void resume() override { set_paused(false); }
+
+  void set_paused(bool p) {
+    std::lock_guard<std::mutex> lk(mu);
+    if (paused == p) return;
+    paused = p;
+    if (p) be.reactor_->pause(call);
+    else be.reactor_->resume(call);
+  }
+
+  void next_upstream() {
+    up = be.pick(tried);
+    if (!up) {
+      Status st = be.conclude(last, cancel.cancelled(), !tried.empty(), emitted, errors, text, on_chunk, t0, out);
+      on_done(st, out);
+      return;
+    }
+    be.begin_attempt(*up, tried);
+    text.clear();
+    out = InferResult{};
+    fault = false;
+    fallback = false;
+    attempt_t0 = now_us();
+    send();
+  }
+
+  void send() {
+    UrlParts u;
+    std::string err;
+    if (!parse_http_url(up->base_url, fallback ? "/v1/completions" : be.opt_.endpoint, u, err)) {
+      CC50_LOG_ERROR("[Backend] URL parse error: " << err);
+      reply.reset();
+      on_call_done(Status::Err("parse url: " + err));
+      return;
+    }
+    const std::string body = make_request_body(max_tokens, fallback, be.opt_.stream, prompt, sampling);
+    CC50_LOG_DEBUG("[Backend] async POST " << u.host << ":" << u.port << u.path << " body_bytes=" << body.size()
+                   << " stream=" << (be.opt_.stream ? 1 : 0));
+    reply = std::make_unique<Reply>(be, be.opt_.stream, out, text, emitted, on_chunk);
+
+    HttpCallOptions o;
+    o.connect_timeout_ms = be.opt_.connect_timeout_ms;
+    o.request_timeout_ms = be.opt_.request_timeout_ms;
+    o.accept_sse = be.opt_.stream;
+    o.cancel = &cancel;
+    auto self = shared_from_this();
+    HttpCallbacks cb;
+    cb.on_headers = [self](int status) { self->reply->status = status; };
+    cb.on_body = [self](std::string_view part) { return self->reply->on_body(part); };
+    cb.on_done = [self](const Status& st) { self->on_call_done(st); };
+
+    uint64_t n;
+    {
+      std::lock_guard<std::mutex> lk(mu);
+      n = ++sends;
+    }
+    const uint64_t id = be.reactor_->post(u, body, o, std::move(cb));
+    std::lock_guard<std::mutex> lk(mu);
+    if (sends != n) return; // finished already, and the next call is out
+    call = id;
+    if (paused) be.reactor_->pause(id);
+  }
+
+  void on_call_done(const Status& call_st) {
+    Status st = reply ? reply->finish(call_st, fault) : call_st;
+    if (!fallback) {
+      // once part of the completion went out a retry would duplicate it
+      if (!st.ok && !cancel.cancelled() && emitted == 0) {
+        CC50_LOG_INFO("[Backend] " << up->base_url << be.opt_.endpoint << " failed (" << st.msg
+                      << "), trying /v1/completions");
+        be.fallbacks_.inc();
+        text.clear();
+        out = InferResult{};
+        primary_err = st.msg;
+        fallback = true;
+        send();
+        return;
+      }
+    } else if (!st.ok && !cancel.cancelled() && emitted == 0) {
+      CC50_LOG_WARN("[Backend] both endpoints failed: " << primary_err << " | fallback: " << st.msg);
+      st = Status::Err(primary_err + " | fallback: " + st.msg);
+    }
+    last = st;
+    if (be.end_attempt(*up, attempt_t0, st, fault, cancel.cancelled(), emitted, errors)) {
+      next_upstream();
+      return;
+    }
+    Status fin = be.conclude(last, cancel.cancelled(), true, emitted, errors, text, on_chunk, t0, out);
+    on_done(fin, out);
+  }
+
+  LlamaServerBackend& be;
+  const uint64_t t0{now_us()};
+  const uint32_t max_tokens;
+  const std::string prompt;    // escaped
+  const std::string sampling;
+  StreamFn on_chunk;
+  DoneFn on_done;
+  const CancelToken& cancel;
+
+  InferResult out;
+  std::string text;
+  size_t emitted{0};
+  std::vector<Upstream*> tried;
+  std::string errors;
+  Status last{Status::Ok()};
+
+  // current attempt
+  Upstream* up{nullptr};
+  uint64_t attempt_t0{0};
+  bool fault{false};
+  bool fallback{false};        // on /v1/completions
+  std::string primary_err;
+  std::unique_ptr<Reply> reply;
+
+  std::mutex mu;               // the fields below: pause() comes from the caller's threads
+  uint64_t call{0};            // reactor id of the call in flight
+  uint64_t sends{0};
+  bool paused{false};
+};
+
+std::shared_ptr<AsyncInfer> LlamaServerBackend::infer_async(const InferRequest& req, StreamFn on_chunk,
+                                                            DoneFn on_done, const CancelToken& cancel) {
+  if (!reactor_) return IBackend::infer_async(req, std::move(on_chunk), std::move(on_done), cancel);
+  CC50_LOG_DEBUG("[Backend] async request prompt_bytes=" << req.prompt.size() << " max_tokens=" << req.max_tokens
+                 << " stream=" << (opt_.stream ? 1 : 0));
+  auto r = std::make_shared<AsyncReq>(*this, req, std::move(on_chunk), std::move(on_done), cancel);
+  r->next_upstream();
+  return r;
+}
 
 } // namespace cc50
@@ -1,9 +1,17 @@
 #include "cc50/backend/toy_backend.hpp"
+#include "cc50/metrics.hpp"
 #include <cuda_runtime.h>
+#include <algorithm>
+#include <condition_variable>
 #include <cstring>
+#include <mutex>
+#include <thread>
+#include <vector>
 
 namespace cc50 {
 
+static constexpr uint32_t kBlocksPerSeq = 8;
+
 static __global__ void spin_kernel(uint32_t iters, uint32_t* out) {
   uint32_t x = threadIdx.x + blockIdx.x * blockDim.x;
   for (uint32_t i = 0; i < iters; i++) {
@@ -12,10 +20,218 @@ static __global__ void spin_kernel(uint32_t iters, uint32_t* out) {
   if (threadIdx.x == 0 && blockIdx.x == 0) *out = x;
 }
 
+// One decode step for a whole batch: kBlocksPerSeq blocks per sequence, each
+// sequence writes its own output word.
+static __global__ void batch_spin_kernel(uint32_t iters, uint32_t* out) {
+  uint32_t x = threadIdx.x + blockIdx.x * blockDim.x;
+  for (uint32_t i = 0; i < iters; i++) {
+    x = x * 1664525u + 1013904223u;
+  }
+  if (threadIdx.x == 0 && blockIdx.x % kBlocksPerSeq == 0) out[blockIdx.x / kBlocksPerSeq] = x;
+}
+
+static Status cuda_err(const char* what, cudaError_t e) {
+  return Status::Err(std::string(what) + " failed: " + cudaGetErrorString(e));
+}
+
+namespace {
+
+struct Lane {
+  cudaStream_t stream{nullptr};
+  cudaEvent_t done{nullptr};
+  uint32_t* d_out{nullptr};
+};
+
+// A request taking part in the batch. Owned by the requesting worker's stack; the
+// decode thread only touches it under Impl::bmu and drops it before setting `done`.
+struct Slot {
+  uint32_t remaining{0};  // tokens still to decode
+  uint32_t ready{0};      // decoded, not yet handed to the worker
+  bool done{false};
+  const CancelToken* cancel{nullptr};
+  Status err;
+  std::condition_variable cv;
+};
+
+} // namespace
+
+struct ToyBackend::Impl {
+  ToyBackendOptions opt;
+  int dev{0};
+  std::mutex mu;
+  std::vector<Lane> free_lanes;
+
+  // continuous batching state
+  std::mutex bmu;
+  std::condition_variable bcv;  // decode thread: new arrivals / stop
+  std::vector<Slot*> waiting;   // joined, not yet admitted to the batch
+  std::vector<Slot*> active;
+  bool stop{false};
+  Lane step_lane;               // d_out holds max_batch words
+  std::thread decoder;
+
+  Counter steps;                // decode steps (kernel launches); lanes count one per token
+  Counter step_tokens;          // tokens produced by those steps: step_tokens / steps = mean batch
+  Histogram step_us;
+
+  void register_metrics(MetricsRegistry& reg) {
+    reg.add("cc50_toy_decode_steps_total", "Decode steps (one kernel launch each).", "", steps);
+    reg.add("cc50_toy_decode_step_tokens_total", "Tokens produced by decode steps; divided by steps gives the mean batch.",
+            "", step_tokens);
+    reg.add("cc50_toy_decode_step_seconds", "Wall time of one decode step.", "", step_us);
+    if (!opt.batching) return;
+    reg.add_gauge_fn("cc50_toy_batch_active", "Sequences in the running batch.", "", [this] {
+      std::lock_guard<std::mutex> lk(bmu);
+      return (double)active.size();
+    });
+    reg.add_gauge_fn("cc50_toy_batch_waiting", "Sequences waiting for a batch slot.", "", [this] {
+      std::lock_guard<std::mutex> lk(bmu);
+      return (double)waiting.size();
+    });
+  }
+
+  ~Impl() {
+    if (decoder.joinable()) {
+      {
+        std::lock_guard<std::mutex> lk(bmu);
+        stop = true;
+      }
+      bcv.notify_all();
+      decoder.join();
+    }
+    destroy(step_lane);
+    std::lock_guard<std::mutex> lk(mu);
+    for (auto& l : free_lanes) destroy(l);
+  }
+
+  static void destroy(Lane& l) {
+    if (l.d_out) cudaFree(l.d_out);
+    if (l.done) cudaEventDestroy(l.done);
+    if (l.stream) cudaStreamDestroy(l.stream);
+    l = Lane{};
+  }
+
+  Status create(Lane& l, size_t out_words = 1) {
+    cudaError_t e = cudaStreamCreateWithFlags(&l.stream, cudaStreamNonBlocking);
+    if (e != cudaSuccess) return cuda_err("cudaStreamCreate", e);
+    // blocking-sync: the waiting worker sleeps instead of spinning a CPU core
+    e = cudaEventCreateWithFlags(&l.done, cudaEventBlockingSync | cudaEventDisableTiming);
+    if (e != cudaSuccess) { destroy(l); return cuda_err("cudaEventCreate", e); }
+    e = cudaMalloc(&l.d_out, out_words * sizeof(uint32_t));
+    if (e != cudaSuccess) { destroy(l); return cuda_err("cudaMalloc", e); }
+    return Status::Ok();
+  }
+
+  Status acquire(Lane& out) {
+    {
+      std::lock_guard<std::mutex> lk(mu);
+      if (!free_lanes.empty()) {
+        out = free_lanes.back();
+        free_lanes.pop_back();
+        return Status::Ok();
+      }
+    }
+    return create(out);
+  }
+
+  void release(Lane& l) {
+    std::lock_guard<std::mutex> lk(mu);
+    free_lanes.push_back(l);
+    l = Lane{};
+  }
+
+  // Caller holds bmu.
+  static void retire(Slot* s, Status st) {
+    s->err = std::move(st);
+    s->done = true;
+    s->cv.notify_one();
+  }
+
+  // Iteration-level scheduling: between steps, finished and cancelled sequences
+  // leave the batch and waiting ones join it (up to max_batch); every step is one
+  // kernel launch covering the whole batch and yields one token per sequence.
+  void decode_loop() {
+    cudaSetDevice(dev);
+    std::unique_lock<std::mutex> lk(bmu);
+    for (;;) {
+      bcv.wait(lk, [&] { return stop || !waiting.empty() || !active.empty(); });
+      if (stop) break;
+
+      auto cancelled = [](Slot* s) {
+        if (!s->cancel->cancelled()) return false;
+        retire(s, Status::Err("cancelled"));
+        return true;
+      };
+      std::erase_if(active, cancelled);
+      std::erase_if(waiting, cancelled);
+      size_t admit = std::min(waiting.size(), size_t(opt.max_batch) - active.size());
+      active.insert(active.end(), waiting.begin(), waiting.begin() + admit);
+      waiting.erase(waiting.begin(), waiting.begin() + admit);
+      const uint32_t batch = uint32_t(active.size());
+      if (batch == 0) continue;
+
+      // Slots stay in `active`, so their workers keep waiting while the step runs
+      // unlocked; new arrivals queue up in `waiting` meanwhile.
+      lk.unlock();
+      const uint64_t step_t0 = now_us();
+      batch_spin_kernel<<<batch * kBlocksPerSeq, 256, 0, step_lane.stream>>>(opt.kernel_iters, step_lane.d_out);
+      cudaError_t e = cudaGetLastError();
+      if (e == cudaSuccess) e = cudaEventRecord(step_lane.done, step_lane.stream);
+      if (e == cudaSuccess) e = cudaEventSynchronize(step_lane.done);
+      step_us.record(now_us() - step_t0);
+      lk.lock();
+
+      if (e != cudaSuccess) {
+        Status st = cuda_err("batch_spin_kernel", e);
+        for (Slot* s : active) retire(s, st);
+        active.clear();
+        continue;
+      }
+      steps.inc();
+      step_tokens.inc(batch);
+      std::erase_if(active, [](Slot* s) {
+        s->ready++;
+        if (--s->remaining == 0) {
+          retire(s, Status::Ok());
+          return true;
+        }
+        s->cv.notify_one();
+        return false;
+      });
+    }
+    for (Slot* s : active) retire(s, Status::Err("backend shutting down"));
+    for (Slot* s : waiting) retire(s, Status::Err("backend shutting down"));
+    active.clear();
+    waiting.clear();
+  }
+};
+
+ToyBackend::ToyBackend(ToyBackendOptions opt) : impl_(std::make_unique<Impl>()) {
+  if (opt.max_batch == 0) opt.max_batch = 1;
+  impl_->opt = opt;
+}
+
+ToyBackend::~ToyBackend() = default;
+
 Status ToyBackend::init() {
   int dev = 0;
   cudaError_t e = cudaSetDevice(dev);
   if (e != cudaSuccess) return Status::Err(std::string("cudaSetDevice failed: ") + cudaGetErrorString(e));
+  impl_->dev = dev;
+  if (impl_->opt.metrics) impl_->register_metrics(*impl_->opt.metrics);
+
+  if (impl_->opt.batching) {
+    auto st = impl_->create(impl_->step_lane, impl_->opt.max_batch);
+    if (!st.ok) return st;
+    impl_->decoder = std::thread([this] { impl_->decode_loop(); });
+    return Status::Ok();
+  }
+
+  // warm one lane so the first request does not pay for stream/buffer creation
+  Lane l;
+  auto st = impl_->acquire(l);
+  if (!st.ok) return st;
+  impl_->release(l);
   return Status::Ok();
 }
 
@@ -23,22 +239,91 @@ Status ToyBackend::load_model(const std::string&, int, int) {
   return Status::Ok();
 }
 
-Status ToyBackend::infer_stream(const InferRequest& req, StreamFn on_chunk, InferResult& out) {
+Status ToyBackend::infer_stream(const InferRequest& req, StreamFn on_chunk, InferResult& out,
+                                const CancelToken& cancel) {
+  out = InferResult{};
+  if (impl_->opt.batching) return infer_batched(req, on_chunk, out, cancel);
+  return infer_lane(req, on_chunk, out, cancel);
+}
+
+Status ToyBackend::infer_batched(const InferRequest& req, StreamFn& on_chunk, InferResult& out,
+                                 const CancelToken& cancel) {
   const uint64_t t0 = now_us();
-  out.tokens = 0;
-  out.elapsed_us = 0;
-  out.text.clear();
-  out.error.clear();
+  if (req.max_tokens == 0) return Status::Ok();
+
+  Slot slot;
+  slot.remaining = req.max_tokens;
+  slot.cancel = &cancel;
 
-  // Allocate a tiny device buffer
-  uint32_t* d_out = nullptr;
-  cudaMalloc(&d_out, sizeof(uint32_t));
+  std::unique_lock<std::mutex> lk(impl_->bmu);
+  impl_->waiting.push_back(&slot);
+  impl_->bcv.notify_one();
+  for (;;) {
+    slot.cv.wait(lk, [&] { return slot.ready > 0 || slot.done; });
+    const uint32_t n = slot.ready;
+    slot.ready = 0;
+    if (n > 0) {
+      // emit without the lock: on_chunk may block on flow control while the
+      // batch keeps decoding (and accumulating `ready`) for this request
+      lk.unlock();
+      for (uint32_t i = 0; i < n; i++) {
+        if (on_chunk) on_chunk(" token");
+        out.text += " token";
+        out.tokens++;
+      }
+      lk.lock();
+      continue;
+    }
+    if (slot.done) break;
+  }
+  // the decode thread has dropped the slot; it is safe to leave this frame
+
+  out.elapsed_us = now_us() - t0;
+  out.decode_us = out.elapsed_us; // no prompt phase: every step is a decode step
+  if (!slot.err.ok) out.error = slot.err.msg;
+  return slot.err;
+}
+
+Status ToyBackend::infer_lane(const InferRequest& req, StreamFn& on_chunk, InferResult& out,
+                              const CancelToken& cancel) {
+  const uint64_t t0 = now_us();
+
+  // the current device is per host thread; workers may not have set it yet
+  cudaSetDevice(impl_->dev);
+
+  Lane lane;
+  auto st = impl_->acquire(lane);
+  if (!st.ok) {
+    out.error = st.msg;
+    return st;
+  }
 
   // Do "work" roughly proportional to max_tokens so it benchmarks nicely
-  const uint32_t iters = 20000u;
+  const uint32_t iters = impl_->opt.kernel_iters;
   for (uint32_t i = 0; i < req.max_tokens; i++) {
-    spin_kernel<<<8, 256>>>(iters, d_out);
-    cudaDeviceSynchronize();
+    if (cancel.cancelled()) {
+      impl_->release(lane);
+      out.error = "cancelled";
+      out.elapsed_us = now_us() - t0;
+      return Status::Err(out.error);
+    }
+
+    const uint64_t step_t0 = now_us();
+    spin_kernel<<<8, 256, 0, lane.stream>>>(iters, lane.d_out);
+    cudaError_t e = cudaGetLastError();
+    if (e == cudaSuccess) e = cudaEventRecord(lane.done, lane.stream);
+    // waits for this lane's stream only; other requests keep the device busy meanwhile
+    if (e == cudaSuccess) e = cudaEventSynchronize(lane.done);
+    impl_->step_us.record(now_us() - step_t0);
+    if (e != cudaSuccess) {
+      st = cuda_err("spin_kernel", e);
+      out.error = st.msg;
+      impl_->destroy(lane);
+      return st;
+    }
+
+    impl_->steps.inc();
+    impl_->step_tokens.inc();
 
     // Emit a small chunk
     if (on_chunk) on_chunk(" token");
@@ -46,9 +331,10 @@ Status ToyBackend::infer_stream(const InferRequest& req, StreamFn on_chunk, Infe
     out.tokens++;
   }
 
-  cudaFree(d_out);
+  impl_->release(lane);
 
   out.elapsed_us = now_us() - t0;
+  out.decode_us = out.elapsed_us; // no prompt phase: every step is a decode step
   return Status::Ok();
 }
 
@@ -1,6 +1,9 @@
 #include "cc50/common.hpp"
 #include "cc50/protocol.hpp"
+#include "cc50/sampling_params.hpp"
 #include "cc50/transport/tcp_transport.hpp"
+#include "cc50/transport/unix_transport.hpp"
+#include "cc50/transport/shm_transport.hpp"
 
 #include <getopt.h>
 #include <algorithm>
@@ -9,15 +12,32 @@
 #include <atomic>
 #include <cstring>
 #include <memory>
+#include <mutex>
+#include <thread>
+#include <unordered_map>
 
 namespace cc50 {
 
 struct ClientConfig {
-  std::string server{"127.0.0.1:9199"};
+  std::string transport{"tcp"};       // tcp|unix|shm; must match the server's
+  std::string server{"127.0.0.1:9199"}; // HOST:PORT, or a socket PATH for unix|shm
   std::string prompt{"Hello from TCP client. Write one sentence."};
   uint32_t max_tokens{64};
   uint32_t iters{10};
   bool print_chunks{false};
+  uint32_t credit_bytes{256 * 1024};  // flow-control window per request
+  uint8_t priority{0};                // 0..kMaxPriority, higher is served first
+  uint32_t tenant{0};                 // fair-share key (0 = per connection)
+  SocketOptions sock{};               // --tcp-nodelay / --tcp-quickack / --busy-poll-us
+  SamplingParams params{};            // --temperature, --top-p, ... (sent as a v6 parameter block)
+
+  // load generator (--mode=load)
+  std::string mode{"serial"};         // serial|load
+  uint32_t conns{1};                  // client connections, one thread each
+  uint32_t outstanding{1};            // max in-flight requests per connection
+  double rate{10.0};                  // target arrivals/s across all connections (open loop)
+  double rate_end{0.0};               // >0: ramp linearly from rate to rate_end over the run
+  double duration_s{10.0};
 };
 
 static bool parse_hostport(const std::string& s, std::string& host, int& port) {
@@ -28,9 +48,15 @@ static bool parse_hostport(const std::string& s, std::string& host, int& port) {
   return true;
 }
 
-static double percentile(std::vector<double> v, double p) {
+static std::unique_ptr<ITransport> make_transport(const std::string& kind) {
+  if (kind == "unix") return std::make_unique<UnixTransport>();
+  if (kind == "shm") return std::make_unique<ShmTransport>();
+  return std::make_unique<TcpTransport>();
+}
+
+// `v` must be sorted.
+static double percentile(const std::vector<double>& v, double p) {
   if (v.empty()) return 0.0;
-  std::sort(v.begin(), v.end());
   double idx = (p / 100.0) * (v.size() - 1);
   size_t i = (size_t)idx;
   double frac = idx - i;
@@ -38,19 +64,299 @@ static double percentile(std::vector<double> v, double p) {
   return v.back();
 }
 
+// Accepts every InferDone revision (v1 16 bytes, v2 timings, v5 token accounting);
+// fields the peer did not send read as 0.
+static InferDone decode_done(const IncomingMessage& msg) {
+  InferDone d{};
+  std::memcpy(&d, msg.payload.data(), std::min(msg.payload.size(), sizeof(d)));
+  return d;
+}
+
+// Server-reported timings from InferDone, in ms, and the backend's token accounting.
+struct ServerTimings {
+  std::vector<double> queue_ms, backend_ms, ttft_ms, prefill_ms, decode_ms;
+  uint64_t prompt_tokens{0}, tokens{0};
+  // only requests whose backend timed the phase count towards its throughput
+  uint64_t prefill_tokens{0}, prefill_us{0}, decode_tokens{0}, decode_us{0};
+
+  void add(const InferDone& d) {
+    queue_ms.push_back(d.queue_us / 1000.0);
+    backend_ms.push_back(d.backend_us / 1000.0);
+    if (d.ttft_us) ttft_ms.push_back(d.ttft_us / 1000.0);
+    prompt_tokens += d.prompt_tokens;
+    tokens += d.tokens;
+    if (d.prefill_us) {
+      prefill_ms.push_back(d.prefill_us / 1000.0);
+      prefill_tokens += d.prompt_tokens;
+      prefill_us += d.prefill_us;
+    }
+    if (d.decode_us) {
+      decode_ms.push_back(d.decode_us / 1000.0);
+      decode_tokens += d.tokens;
+      decode_us += d.decode_us;
+    }
+  }
+  void merge(const ServerTimings& o) {
+    queue_ms.insert(queue_ms.end(), o.queue_ms.begin(), o.queue_ms.end());
+    backend_ms.insert(backend_ms.end(), o.backend_ms.begin(), o.backend_ms.end());
+    ttft_ms.insert(ttft_ms.end(), o.ttft_ms.begin(), o.ttft_ms.end());
+    prefill_ms.insert(prefill_ms.end(), o.prefill_ms.begin(), o.prefill_ms.end());
+    decode_ms.insert(decode_ms.end(), o.decode_ms.begin(), o.decode_ms.end());
+    prompt_tokens += o.prompt_tokens; tokens += o.tokens;
+    prefill_tokens += o.prefill_tokens; prefill_us += o.prefill_us;
+    decode_tokens += o.decode_tokens; decode_us += o.decode_us;
+  }
+};
+
+// Sorts `v` in place.
+static void print_dist(const char* name, std::vector<double>& v) {
+  std::sort(v.begin(), v.end());
+  std::cout << name
+            << " n=" << v.size()
+            << " p50=" << percentile(v, 50)
+            << " p95=" << percentile(v, 95)
+            << " p99=" << percentile(v, 99)
+            << " p99.9=" << percentile(v, 99.9) << "\n";
+}
+
+static void print_server_timings(ServerTimings& s) {
+  print_dist("srv_queue_ms  ", s.queue_ms);
+  print_dist("srv_backend_ms", s.backend_ms);
+  print_dist("srv_ttft_ms   ", s.ttft_ms);
+  print_dist("srv_prefill_ms", s.prefill_ms);
+  print_dist("srv_decode_ms ", s.decode_ms);
+  // tokens per second of backend time, pooled over requests
+  std::cout << "srv_tokens     prompt=" << s.prompt_tokens
+            << " generated=" << s.tokens
+            << " prefill_tok_s=" << (s.prefill_us ? s.prefill_tokens * 1e6 / s.prefill_us : 0.0)
+            << " decode_tok_s=" << (s.decode_us ? s.decode_tokens * 1e6 / s.decode_us : 0.0) << "\n";
+}
+
+static std::vector<uint8_t> make_infer_payload(const ClientConfig& cfg) {
+  InferRequestHdr rh{};
+  rh.max_tokens = cfg.max_tokens;
+  rh.credit_bytes = cfg.credit_bytes;
+  rh.priority = cfg.priority;
+  rh.tenant = cfg.tenant;
+  rh.prompt_len = (uint32_t)cfg.prompt.size();
+  const std::string params = encode_params(cfg.params);
+  rh.params_len = (uint32_t)params.size();
+
+  std::vector<uint8_t> payload(sizeof(rh) + cfg.prompt.size() + params.size());
+  std::memcpy(payload.data(), &rh, sizeof(rh));
+  std::memcpy(payload.data() + sizeof(rh), cfg.prompt.data(), cfg.prompt.size());
+  std::memcpy(payload.data() + sizeof(rh) + cfg.prompt.size(), params.data(), params.size());
+  return payload;
+}
+
+// Hands consumed RESP_CHUNK bytes back to the server once half the window is used,
+// so a reader that keeps up never lets the window run dry.
+static void consume_credit(ITransport& tr, const ClientConfig& cfg, uint64_t req_id,
+                           uint32_t& unacked, size_t n) {
+  unacked += (uint32_t)n;
+  if (unacked < std::max(1u, cfg.credit_bytes / 2)) return;
+  CreditGrant g{};
+  g.bytes = unacked;
+  tr.send(kNoConn, req_id, (uint16_t)MsgType::CREDIT_GRANT, (const uint8_t*)&g, sizeof(g));
+  unacked = 0;
+}
+
+// ---- open-loop load generator ----
+//
+// Arrivals follow a fixed schedule that does not wait for responses; every latency
+// is measured from the request's *scheduled* time, so time spent queued behind the
+// per-connection outstanding limit (or a slow server) is counted instead of hidden
+// (no coordinated omission).
+
+struct LoadStats {
+  std::vector<double> ttft_ms, itl_ms, e2e_ms;
+  uint64_t sent{0}, completed{0}, errors{0}, unsent{0}, chunks{0}, bytes{0};
+  ServerTimings server;
+
+  void merge(const LoadStats& o) {
+    server.merge(o.server);
+    ttft_ms.insert(ttft_ms.end(), o.ttft_ms.begin(), o.ttft_ms.end());
+    itl_ms.insert(itl_ms.end(), o.itl_ms.begin(), o.itl_ms.end());
+    e2e_ms.insert(e2e_ms.end(), o.e2e_ms.begin(), o.e2e_ms.end());
+    sent += o.sent; completed += o.completed; errors += o.errors;
+    unsent += o.unsent; chunks += o.chunks; bytes += o.bytes;
+  }
+};
+
+// Connection `idx` of `nconns`, each carrying its share of the arrival rate.
+static Status load_worker(const ClientConfig& cfg, const TransportOptions& opt, uint32_t idx, uint32_t nconns,
+                          uint64_t start_us, LoadStats& stats) {
+  struct Req {
+    uint64_t sched_us{0};
+    uint64_t last_us{0};
+    uint32_t unacked{0};
+    bool got_first{false};
+    bool failed{false};   // RESP_ERR seen; its RESP_DONE only retires it
+  };
+
+  auto tp = make_transport(cfg.transport);
+  ITransport& tr = *tp;
+  std::unordered_map<uint64_t, Req> inflight;
+
+  auto st = tr.start_client(opt, [&](const IncomingMessage& msg) {
+    auto it = inflight.find(msg.req_id);
+    if (it == inflight.end()) return;
+    Req& r = it->second;
+    uint64_t now = now_us();
+
+    if (msg.type == (uint16_t)MsgType::RESP_CHUNK) {
+      if (!r.got_first) stats.ttft_ms.push_back((now - r.sched_us) / 1000.0);
+      else stats.itl_ms.push_back((now - r.last_us) / 1000.0);
+      r.got_first = true;
+      r.last_us = now;
+      stats.chunks++;
+      stats.bytes += msg.payload.size();
+      consume_credit(tr, cfg, msg.req_id, r.unacked, msg.payload.size());
+    } else if (msg.type == (uint16_t)MsgType::RESP_ERR) {
+      if (!r.failed) stats.errors++;
+      r.failed = true;
+    } else if (msg.type == (uint16_t)MsgType::RESP_DONE) {
+      // a failed request is neither a completion nor an e2e sample
+      if (!r.failed) {
+        stats.e2e_ms.push_back((now - r.sched_us) / 1000.0);
+        stats.server.add(decode_done(msg));
+        stats.completed++;
+      }
+      inflight.erase(it);
+    }
+  });
+  if (!st.ok) return st;
+
+  const auto payload = make_infer_payload(cfg);
+  const double per_conn_start = cfg.rate / nconns;
+  const double per_conn_end = (cfg.rate_end > 0 ? cfg.rate_end : cfg.rate) / nconns;
+  const uint64_t end_us = start_us + (uint64_t)(cfg.duration_s * 1e6);
+
+  // stagger connections so their schedules interleave instead of firing together
+  double next_us = start_us + (1e6 / std::max(per_conn_start, 1e-9)) * idx / nconns;
+  uint64_t seq = 0;
+
+  while (true) {
+    uint64_t now = now_us();
+
+    // issue every request whose scheduled time has come, as far as the window allows
+    while (next_us < end_us && next_us <= now && inflight.size() < cfg.outstanding) {
+      uint64_t id = ((uint64_t)(idx + 1) << 40) | ++seq;
+      inflight[id] = Req{(uint64_t)next_us, 0, 0, false};
+      tr.send(kNoConn, id, (uint16_t)MsgType::REQ_INFER, payload.data(), payload.size());
+      stats.sent++;
+
+      double frac = std::min(1.0, (next_us - start_us) / std::max(1.0, (double)(end_us - start_us)));
+      double rate = per_conn_start + (per_conn_end - per_conn_start) * frac;
+      next_us += 1e6 / std::max(rate, 1e-9);
+    }
+
+    bool issuing = next_us < end_us;
+    if (!issuing && inflight.empty()) break;
+    if (!issuing && now > end_us + 30'000'000ull) break; // give stragglers 30 s
+
+    int timeout_ms = 50;
+    if (issuing && inflight.size() < cfg.outstanding) {
+      timeout_ms = next_us > now ? (int)std::min<uint64_t>(50, ((uint64_t)next_us - now) / 1000) : 0;
+    }
+    auto ps = tr.progress(timeout_ms);
+    if (!ps.ok) return ps;
+  }
+
+  // scheduled but never sent because the window stayed full until the end
+  while (next_us < end_us) {
+    stats.unsent++;
+    double frac = std::min(1.0, (next_us - start_us) / std::max(1.0, (double)(end_us - start_us)));
+    next_us += 1e6 / std::max(per_conn_start + (per_conn_end - per_conn_start) * frac, 1e-9);
+  }
+  for (const auto& [id, r] : inflight) {
+    if (!r.failed) stats.errors++;  // never completed
+  }
+  return Status::Ok();
+}
+
+static int run_load(const ClientConfig& cfg, const TransportOptions& opt) {
+  const uint32_t n = std::max(1u, cfg.conns);
+  std::vector<LoadStats> per(n);
+  std::vector<std::thread> threads;
+  std::mutex err_mu;
+  bool failed = false;
+
+  const uint64_t start_us = now_us() + 100'000; // let all connections come up first
+  for (uint32_t i = 0; i < n; i++) {
+    threads.emplace_back([&, i] {
+      auto st = load_worker(cfg, opt, i, n, start_us, per[i]);
+      if (!st.ok) {
+        std::lock_guard<std::mutex> lk(err_mu);
+        std::cerr << "[client] conn " << i << ": " << st.msg << "\n";
+        failed = true;
+      }
+    });
+  }
+  for (auto& t : threads) t.join();
+  const double wall_s = (now_us() - start_us) / 1e6;
+
+  LoadStats all;
+  for (auto& s : per) all.merge(s);
+
+  std::cout << "mode=load conns=" << n
+            << " outstanding=" << cfg.outstanding
+            << " rate=" << cfg.rate;
+  if (cfg.rate_end > 0) std::cout << "->" << cfg.rate_end;
+  std::cout << " duration_s=" << cfg.duration_s << "\n";
+  std::cout << "sent=" << all.sent
+            << " completed=" << all.completed
+            << " errors=" << all.errors
+            << " unsent=" << all.unsent
+            << " wall_s=" << wall_s
+            << " req_per_s=" << (all.completed / wall_s)
+            << " chunks_per_s=" << (all.chunks / wall_s)
+            << " bytes_per_s=" << (all.bytes / wall_s) << "\n";
+  print_dist("ttft_ms       ", all.ttft_ms);
+  print_dist("itl_ms        ", all.itl_ms);
+  print_dist("e2e_ms        ", all.e2e_ms);
+  print_server_timings(all.server);
+
+  return (failed || all.errors) ? 2 : 0;
+}
+
 } // namespace cc50
 
 static void usage() {
   std::cerr << R"(cc50_llm_client
+  --transport=tcp|unix|shm   (unix|shm: --server is a socket PATH or @NAME; same host only)
   --server=HOST:PORT
   --prompt="..."
   --max-tokens=64
   --iters=10
   --print=0|1
+  --credit=262144      flow-control window per request (bytes)
+  --priority=0         0 (bulk) .. 3 (most urgent); strict priority on the server
+  --tenant=0           fair-share key; 0 shares per connection
+  --tcp-nodelay=0|1    disable Nagle on the client socket (default 1)
+  --tcp-quickack=0|1   ACK every read at once instead of delaying (default 0)
+  --busy-poll-us=0     SO_BUSY_POLL on the client socket
+
+  # sampling (unset: the backend's defaults):
+  --temperature=T  --top-p=P  --top-k=K  --min-p=P
+  --repeat-penalty=R  --presence-penalty=R  --frequency-penalty=R
+  --seed=N
+  --stop="..."         stop string; may be given several times
+
+  # load generator (open loop, latency measured from the scheduled send time):
+  --mode=serial|load
+  --conns=1            connections (one thread each)
+  --outstanding=1      max in-flight requests per connection
+  --rate=10            target requests/s across all connections
+  --rate-end=0         if >0, ramp linearly from --rate to this over the run
+  --duration=10        seconds of arrivals
 
 Example:
   ./build/bin/cc50_llm_client --server=127.0.0.1:9199 \
     --prompt "Hello from TCP" --max-tokens 128 --iters 5 --print 1
+  ./build/bin/cc50_llm_client --server=127.0.0.1:9199 --mode=load \
+    --conns=8 --outstanding=4 --rate=50 --rate-end=200 --duration=30
+  ./build/bin/cc50_llm_client --transport=shm --server=/run/cc50.sock --iters 5
 )";
 }
 
@@ -58,34 +364,81 @@ int main(int argc, char** argv) {
   cc50::ClientConfig cfg;
 
   static option opts[] = {
+    {"transport", required_argument, nullptr, 'x'},
     {"server", required_argument, nullptr, 's'},
     {"prompt", required_argument, nullptr, 'p'},
     {"max-tokens", required_argument, nullptr, 'k'},
     {"iters", required_argument, nullptr, 'i'},
     {"print", required_argument, nullptr, 'P'},
+    {"credit", required_argument, nullptr, 'C'},
+    {"priority", required_argument, nullptr, 'y'},
+    {"tenant", required_argument, nullptr, 't'},
+    {"tcp-nodelay", required_argument, nullptr, 'N'},
+    {"tcp-quickack", required_argument, nullptr, 'Q'},
+    {"busy-poll-us", required_argument, nullptr, 'B'},
+    {"mode", required_argument, nullptr, 'M'},
+    {"conns", required_argument, nullptr, 'n'},
+    {"outstanding", required_argument, nullptr, 'o'},
+    {"rate", required_argument, nullptr, 'r'},
+    {"rate-end", required_argument, nullptr, 'R'},
+    {"duration", required_argument, nullptr, 'd'},
+    {"temperature", required_argument, nullptr, 'T'},
+    {"top-p", required_argument, nullptr, 'U'},
+    {"top-k", required_argument, nullptr, 'K'},
+    {"min-p", required_argument, nullptr, 'm'},
+    {"repeat-penalty", required_argument, nullptr, 'E'},
+    {"presence-penalty", required_argument, nullptr, 'F'},
+    {"frequency-penalty", required_argument, nullptr, 'G'},
+    {"seed", required_argument, nullptr, 'S'},
+    {"stop", required_argument, nullptr, 'X'},
     {"help", no_argument, nullptr, 'h'},
     {nullptr, 0, nullptr, 0}
   };
 
   while (true) {
     int idx = 0;
-    int c = getopt_long(argc, argv, "s:p:k:i:P:h", opts, &idx);
+    int c = getopt_long(argc, argv, "x:s:p:k:i:P:C:y:t:N:Q:B:M:n:o:r:R:d:T:U:K:m:E:F:G:S:X:h", opts, &idx);
     if (c == -1) break;
     switch (c) {
+      case 'x': cfg.transport = optarg; break;
       case 's': cfg.server = optarg; break;
       case 'p': cfg.prompt = optarg; break;
       case 'k': cfg.max_tokens = (uint32_t)std::stoul(optarg); break;
       case 'i': cfg.iters = (uint32_t)std::stoul(optarg); break;
       case 'P': cfg.print_chunks = (std::stoi(optarg) != 0); break;
+      case 'C': cfg.credit_bytes = (uint32_t)std::stoul(optarg); break;
+      case 'y': cfg.priority = (uint8_t)std::min<unsigned long>(std::stoul(optarg), cc50::kMaxPriority); break;
+      case 't': cfg.tenant = (uint32_t)std::stoul(optarg); break;
+      case 'N': cfg.sock.nodelay = (std::stoi(optarg) != 0); break;
+      case 'Q': cfg.sock.quickack = (std::stoi(optarg) != 0); break;
+      case 'B': cfg.sock.busy_poll_us = std::stoi(optarg); break;
+      case 'M': cfg.mode = optarg; break;
+      case 'n': cfg.conns = (uint32_t)std::stoul(optarg); break;
+      case 'o': cfg.outstanding = (uint32_t)std::stoul(optarg); break;
+      case 'r': cfg.rate = std::stod(optarg); break;
+      case 'R': cfg.rate_end = std::stod(optarg); break;
+      case 'd': cfg.duration_s = std::stod(optarg); break;
+      case 'T': cfg.params.temperature = std::stof(optarg); break;
+      case 'U': cfg.params.top_p = std::stof(optarg); break;
+      case 'K': cfg.params.top_k = (uint32_t)std::stoul(optarg); break;
+      case 'm': cfg.params.min_p = std::stof(optarg); break;
+      case 'E': cfg.params.repeat_penalty = std::stof(optarg); break;
+      case 'F': cfg.params.presence_penalty = std::stof(optarg); break;
+      case 'G': cfg.params.frequency_penalty = std::stof(optarg); break;
+      case 'S': cfg.params.seed = std::stoll(optarg); break;
+      case 'X': cfg.params.stop.emplace_back(optarg); break;
       case 'h': usage(); return 0;
       default: usage(); return 2;
     }
   }
 
-  std::unique_ptr<cc50::ITransport> tr = std::make_unique<cc50::TcpTransport>();
-
   cc50::TransportOptions opt;
-  {
+  if (cfg.transport == "unix" || cfg.transport == "shm") {
+    opt.unix_path = cfg.server;
+  } else if (cfg.transport != "tcp") {
+    std::cerr << "unknown --transport: " << cfg.transport << "\n";
+    return 2;
+  } else {
     std::string host; int port=0;
     if (!cc50::parse_hostport(cfg.server, host, port)) {
       std::cerr << "bad --server, expected HOST:PORT\n";
@@ -93,20 +446,38 @@ int main(int argc, char** argv) {
     }
     opt.server_host = host;
     opt.server_port = port;
+    opt.sock = cfg.sock;
   }
 
+  if (cfg.mode == "load") return cc50::run_load(cfg, opt);
+  if (cfg.mode != "serial") {
+    usage();
+    return 2;
+  }
+
+  std::unique_ptr<cc50::ITransport> tr = cc50::make_transport(cfg.transport);
+
   std::atomic<bool> got_done{false};
   std::atomic<bool> got_err{false};
   uint64_t cur_req{0};
   uint64_t t0{0};
+  uint64_t last_chunk_us{0};
+  uint32_t unacked{0};
 
   std::vector<double> lats_ms;
   lats_ms.reserve(cfg.iters);
+  std::vector<double> ttft_ms, itl_ms;
+  cc50::ServerTimings server;
 
   auto st = tr->start_client(opt, [&](const cc50::IncomingMessage& msg) {
     if (msg.req_id != cur_req) return;
 
     if (msg.type == (uint16_t)cc50::MsgType::RESP_CHUNK) {
+      uint64_t now = cc50::now_us();
+      if (!last_chunk_us) ttft_ms.push_back((now - t0) / 1000.0);
+      else itl_ms.push_back((now - last_chunk_us) / 1000.0);
+      last_chunk_us = now;
+      cc50::consume_credit(*tr, cfg, msg.req_id, unacked, msg.payload.size());
       if (cfg.print_chunks && !msg.payload.empty()) {
         std::cout.write((const char*)msg.payload.data(), (std::streamsize)msg.payload.size());
         std::cout.flush();
@@ -114,6 +485,7 @@ int main(int argc, char** argv) {
     } else if (msg.type == (uint16_t)cc50::MsgType::RESP_DONE) {
       uint64_t t1 = cc50::now_us();
       lats_ms.push_back((t1 - t0) / 1000.0);
+      server.add(cc50::decode_done(msg));
       got_done = true;
     } else if (msg.type == (uint16_t)cc50::MsgType::RESP_ERR) {
       got_err = true;
@@ -130,28 +502,24 @@ int main(int argc, char** argv) {
     return 2;
   }
 
-  cc50::InferRequestHdr rh{};
-  rh.max_tokens = cfg.max_tokens;
-  rh.credit_bytes = 256 * 1024;
-  rh.prompt_len = (uint32_t)cfg.prompt.size();
-
-  std::vector<uint8_t> payload(sizeof(rh) + cfg.prompt.size());
-  std::memcpy(payload.data(), &rh, sizeof(rh));
-  std::memcpy(payload.data() + sizeof(rh), cfg.prompt.data(), cfg.prompt.size());
+  const std::vector<uint8_t> payload = cc50::make_infer_payload(cfg);
 
   for (uint32_t i = 0; i < cfg.iters; i++) {
     got_done = false;
     got_err = false;
     cur_req = (uint64_t)cc50::now_us() ^ ((uint64_t)i << 32);
     t0 = cc50::now_us();
+    last_chunk_us = 0;
+    unacked = 0;
 
     if (cfg.print_chunks) std::cout << "\n--- iter " << i << " ---\n";
-    tr->send(cur_req, (uint16_t)cc50::MsgType::REQ_INFER, payload.data(), payload.size());
+    tr->send(cc50::kNoConn, cur_req, (uint16_t)cc50::MsgType::REQ_INFER, payload.data(), payload.size());
 
     while (!got_done) tr->progress(50);
     if (cfg.print_chunks) std::cout << "\n";
   }
 
+  std::sort(lats_ms.begin(), lats_ms.end());
   double p50 = cc50::percentile(lats_ms, 50);
   double p95 = cc50::percentile(lats_ms, 95);
   double p99 = cc50::percentile(lats_ms, 99);
@@ -165,6 +533,9 @@ int main(int argc, char** argv) {
             << " p50_ms=" << p50
             << " p95_ms=" << p95
             << " p99_ms=" << p99 << "\n";
+  cc50::print_dist("ttft_ms       ", ttft_ms);
+  cc50::print_dist("itl_ms        ", itl_ms);
+  cc50::print_server_timings(server);
 
   return got_err ? 2 : 0;
 }
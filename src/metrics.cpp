@@ -0,0 +1,241 @@
+#include "cc50/metrics.hpp"
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <unistd.h>
+
+#include <cerrno>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+
+namespace cc50 {
+
+namespace {
+
+void append_value(std::string& out, double v) {
+  char buf[32];
+  if (v == std::floor(v) && std::fabs(v) < 1e15) std::snprintf(buf, sizeof(buf), "%.0f", v);
+  else std::snprintf(buf, sizeof(buf), "%.9g", v);
+  out += buf;
+}
+
+// name{labels,extra} value
+void append_sample(std::string& out, std::string_view name, std::string_view labels, std::string_view extra,
+                   double v) {
+  out += name;
+  if (!labels.empty() || !extra.empty()) {
+    out += '{';
+    out += labels;
+    if (!labels.empty() && !extra.empty()) out += ',';
+    out += extra;
+    out += '}';
+  }
+  out += ' ';
+  append_value(out, v);
+  out += '\n';
+}
+
+bool send_all(int fd, const char* p, size_t n) {
+  while (n > 0) {
+    ssize_t w = ::send(fd, p, n, MSG_NOSIGNAL);
+    if (w < 0) {
+      if (errno == EINTR) continue;
+      return false;
+    }
+    p += w;
+    n -= (size_t)w;
+  }
+  return true;
+}
+
+constexpr size_t kMaxRequestBytes = 8192;
+
+} // namespace
+
+std::string metric_label(std::string_view key, std::string_view value) {
+  std::string out(key);
+  out += "=\"";
+  for (char c : value) {
+    if (c == '\\' || c == '"') out += '\\';
+    if (c == '\n') {
+      out += "\\n";
+      continue;
+    }
+    out += c;
+  }
+  out += '"';
+  return out;
+}
+
+void MetricsRegistry::push(Entry e) {
+  std::lock_guard<std::mutex> lk(mu_);
+  entries_.push_back(std::move(e));
+}
+
+void MetricsRegistry::add(std::string name, std::string help, std::string labels, const Counter& c, double scale) {
+  push(Entry{Kind::Counter, std::move(name), std::move(help), std::move(labels), &c, scale, {}});
+}
+
+void MetricsRegistry::add(std::string name, std::string help, std::string labels, const Gauge& g, double scale) {
+  push(Entry{Kind::Gauge, std::move(name), std::move(help), std::move(labels), &g, scale, {}});
+}
+
+void MetricsRegistry::add(std::string name, std::string help, std::string labels, const Histogram& h) {
+  push(Entry{Kind::Histogram, std::move(name), std::move(help), std::move(labels), &h, 1e-6, {}});
+}
+
+void MetricsRegistry::add_counter_fn(std::string name, std::string help, std::string labels,
+                                     std::function<double()> fn) {
+  push(Entry{Kind::CounterFn, std::move(name), std::move(help), std::move(labels), nullptr, 1.0, std::move(fn)});
+}
+
+void MetricsRegistry::add_gauge_fn(std::string name, std::string help, std::string labels,
+                                   std::function<double()> fn) {
+  push(Entry{Kind::GaugeFn, std::move(name), std::move(help), std::move(labels), nullptr, 1.0, std::move(fn)});
+}
+
+std::string MetricsRegistry::render() const {
+  std::lock_guard<std::mutex> lk(mu_);
+  std::string out;
+  out.reserve(entries_.size() * 128);
+  std::vector<bool> done(entries_.size(), false);
+
+  for (size_t i = 0; i < entries_.size(); i++) {
+    if (done[i]) continue;
+    const Entry& head = entries_[i];
+    const char* type = head.kind == Kind::Histogram ? "histogram"
+                     : (head.kind == Kind::Counter || head.kind == Kind::CounterFn) ? "counter" : "gauge";
+    out += "# HELP " + head.name + " " + head.help + "\n";
+    out += "# TYPE " + head.name + " " + type + "\n";
+
+    // every entry of this family, in registration order
+    for (size_t j = i; j < entries_.size(); j++) {
+      const Entry& e = entries_[j];
+      if (done[j] || e.name != head.name) continue;
+      done[j] = true;
+      switch (e.kind) {
+        case Kind::Counter:
+          append_sample(out, e.name, e.labels, {}, (double)((const Counter*)e.src)->value() * e.scale);
+          break;
+        case Kind::Gauge:
+          append_sample(out, e.name, e.labels, {}, (double)((const Gauge*)e.src)->value() * e.scale);
+          break;
+        case Kind::CounterFn:
+        case Kind::GaugeFn:
+          append_sample(out, e.name, e.labels, {}, e.fn());
+          break;
+        case Kind::Histogram: {
+          const Histogram& h = *(const Histogram*)e.src;
+          const std::string bucket = e.name + "_bucket";
+          // the count is the bucket total, so +Inf always matches the finite buckets
+          uint64_t cum = 0;
+          for (size_t b = 0; b + 1 < Histogram::kBuckets; b++) {
+            cum += h.bucket(b);
+            std::string le = "le=\"";
+            append_value(le, (double)Histogram::upper_bound(b) * e.scale);
+            le += '"';
+            append_sample(out, bucket, e.labels, le, (double)cum);
+          }
+          cum += h.bucket(Histogram::kBuckets - 1);
+          append_sample(out, bucket, e.labels, "le=\"+Inf\"", (double)cum);
+          append_sample(out, e.name + "_sum", e.labels, {}, (double)h.sum_us() * e.scale);
+          append_sample(out, e.name + "_count", e.labels, {}, (double)cum);
+          break;
+        }
+      }
+    }
+  }
+  return out;
+}
+
+Status MetricsHttpServer::start(const std::string& host, uint16_t port, const MetricsRegistry& reg) {
+  reg_ = &reg;
+  listen_fd_ = ::socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+  if (listen_fd_ < 0) return Status::Err(std::string("metrics: socket failed: ") + std::strerror(errno));
+
+  int reuse = 1;
+  ::setsockopt(listen_fd_, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
+
+  sockaddr_in addr{};
+  addr.sin_family = AF_INET;
+  addr.sin_port   = htons(port);
+  if (::inet_pton(AF_INET, host.c_str(), &addr.sin_addr) != 1) {
+    return Status::Err("metrics: inet_pton failed for: " + host);
+  }
+  if (::bind(listen_fd_, (sockaddr*)&addr, sizeof(addr)) < 0) {
+    return Status::Err(std::string("metrics: bind failed: ") + std::strerror(errno));
+  }
+  if (::listen(listen_fd_, 16) < 0) {
+    return Status::Err(std::string("metrics: listen failed: ") + std::strerror(errno));
+  }
+
+  thread_ = std::thread([this] { run(); });
+  return Status::Ok();
+}
+
+void MetricsHttpServer::stop() {
+  stop_.store(true);
+  if (thread_.joinable()) thread_.join();
+  if (listen_fd_ >= 0) {
+    ::close(listen_fd_);
+    listen_fd_ = -1;
+  }
+}
+
+void MetricsHttpServer::run() {
+  while (!stop_.load(std::memory_order_relaxed)) {
+    pollfd p{listen_fd_, POLLIN, 0};
+    int n = ::poll(&p, 1, 200);
+    if (n <= 0) continue;
+    int fd = ::accept4(listen_fd_, nullptr, nullptr, SOCK_CLOEXEC);
+    if (fd < 0) continue;
+    serve(fd);
+    ::close(fd);
+  }
+}
+
+void MetricsHttpServer::serve(int fd) {
+  // a scraper that stalls must not hold the endpoint for long
+  timeval tv{2, 0};
+  ::setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+  ::setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv));
+
+  std::string req;
+  char buf[1024];
+  while (req.find("\r\n\r\n") == std::string::npos && req.size() < kMaxRequestBytes) {
+    ssize_t r = ::recv(fd, buf, sizeof(buf), 0);
+    if (r < 0 && errno == EINTR) continue;
+    if (r <= 0) break;
+    req.append(buf, (size_t)r);
+  }
+
+  std::string_view line(req);
+  line = line.substr(0, line.find("\r\n"));
+  std::string_view path;
+  if (line.substr(0, 4) == "GET ") {
+    path = line.substr(4);
+    path = path.substr(0, path.find(' '));
+    path = path.substr(0, path.find('?'));
+  }
+
+  std::string body, status;
+  const char* type = "text/plain; version=0.0.4; charset=utf-8";
+  if (path == "/metrics" || path == "/") {
+    status = "200 OK";
+    body = reg_->render();
+  } else {
+    status = "404 Not Found";
+    body = "not found\n";
+    type = "text/plain";
+  }
+
+  std::string head = "HTTP/1.0 " + status + "\r\nContent-Type: " + type +
+                     "\r\nContent-Length: " + std::to_string(body.size()) + "\r\nConnection: close\r\n\r\n";
+  if (send_all(fd, head.data(), head.size())) send_all(fd, body.data(), body.size());
+}
+
+} // namespace cc50
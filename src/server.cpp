@@ -1,17 +1,31 @@
 #include "cc50/common.hpp"
+#include "cc50/fair_queue.hpp"
+#include "cc50/metrics.hpp"
 #include "cc50/protocol.hpp"
+#include "cc50/slab_pool.hpp"
 #include "cc50/transport/tcp_transport.hpp"
+#include "cc50/transport/unix_transport.hpp"
+#include "cc50/transport/shm_transport.hpp"
+#if CC50_HAVE_IO_URING
+#include "cc50/transport/io_uring_transport.hpp"
+#endif
 #include "cc50/backend/toy_backend.hpp"
 #include "cc50/backend/llama_server_backend.hpp"
 #include "cc50/backend/backend.hpp"
+#include "cc50/backend/caching_backend.hpp"
 
 #include <atomic>
+#include <chrono>
 #include <condition_variable>
 #include <deque>
+#include <memory_resource>
 #include <mutex>
 #include <thread>
+#include <unordered_map>
+#include <vector>
 
 #include <getopt.h>
+#include <algorithm>
 #include <cstring>
 #include <iostream>
 #include <memory>
@@ -19,9 +33,9 @@
 namespace cc50 {
 
 struct ServerConfig {
-  std::string transport{"tcp"};       // tcp only (legacy flag kept for compatibility)
+  std::string transport{"tcp"};       // tcp|io_uring|unix|shm (io_uring needs a liburing build)
   std::string backend{"toy"};         // toy|llama_server
-  std::string listen{"0.0.0.0:9199"};
+  std::string listen{"0.0.0.0:9199"}; // HOST:PORT, or a socket PATH for unix|shm
 
   // kept for compatibility (toy ignores; llama_server ignores; llama-server itself loads the GGUF)
   std::string model{};
@@ -29,10 +43,35 @@ struct ServerConfig {
   int ctx{2048};
   int threads{4};
   uint32_t max_tokens_default{128};
+  int workers{1};                     // concurrent inferences (match llama-server -np)
+  uint32_t credit_default{256 * 1024}; // window when a request asks for 0
+  int credit_stall_ms{30000};         // give up on a stream whose window stays empty this long
+  size_t max_conn_tx_bytes{32u << 20}; // unsent bytes per connection before it is dropped
+  int event_threads{1};               // transport event loops (SO_REUSEPORT shards)
+  int listen_backlog{1024};
+  int pin_cpu_base{-1};               // pin event loop i to CPU base + i (-1 = no pinning)
+  SocketOptions sock{};               // accepted and upstream HTTP sockets
+  size_t max_queue{1024};             // queued requests before new ones are rejected (0 = unlimited)
+  uint32_t drr_quantum{256};          // fair-share quantum in tokens (max_tokens is a request's cost)
+  std::string metrics_listen{};       // HOST:PORT serving GET /metrics (empty = off)
+  int coalesce_us{0};                 // hold RESP_CHUNK bytes of a busy stream up to this long (0 = off)
+  size_t coalesce_bytes{1024};        // ...or until this many are pending
+
+  // result cache in front of the backend (0 MiB = off)
+  size_t cache_mb{0};
+  uint32_t cache_ttl_ms{60000};
+
+  // toy backend options
+  bool toy_batching{true};
+  uint32_t toy_max_batch{64};
 
   // llama-server HTTP options
-  std::string llama_url{"http://127.0.0.1:8090"};
+  std::string llama_url{"http://127.0.0.1:8090"};  // comma-separated for several upstreams
+  std::string llama_balance{"p2c"};
   std::string llama_endpoint{"/completion"};
+  bool llama_stream{true};
+  bool llama_keepalive{true};
+  int llama_reactors{0};              // epoll loops for non-blocking upstream HTTP (0 = a worker thread per request)
 };
 
 static bool parse_hostport(const std::string& s, std::string& host, uint16_t& port) {
@@ -43,8 +82,105 @@ static bool parse_hostport(const std::string& s, std::string& host, uint16_t& po
   return true;
 }
 
+static std::vector<std::string> split_list(const std::string& s) {
+  std::vector<std::string> out;
+  size_t pos = 0;
+  while (pos <= s.size()) {
+    size_t end = s.find(',', pos);
+    if (end == std::string::npos) end = s.size();
+    if (end > pos) out.push_back(s.substr(pos, end - pos));
+    pos = end + 1;
+  }
+  return out;
+}
+
+struct AsyncRun;
+
+// Per-request RESP_CHUNK window, shared by the worker producing chunks and the
+// event loop applying CREDIT_GRANTs for it.
+struct Flow {
+  std::mutex mu;
+  std::condition_variable cv;
+  uint64_t credit{0};   // bytes the producer may still send
+  bool windowed{true};  // false for peers older than kProtoVerCredit
+  CancelToken cancel;   // REQ_CANCEL or client disconnect
+
+  // --coalesce-us: chunk bytes already paid for with credit, not yet framed. tx_mu is
+  // held across the send, so the worker and the flusher thread never reorder frames.
+  std::mutex tx_mu;
+  std::pmr::string pending{slab_pool()};
+  uint64_t pending_since_us{0};
+  uint64_t last_flush_us{0};
+  uint64_t flushes{0};  // bumped by every flush; a timer armed before it is stale
+
+  // Async backends (under mu): bytes a chunk brought beyond the window, sent as
+  // CREDIT_GRANTs arrive while the backend is paused.
+  std::pmr::string held{slab_pool()};
+  std::shared_ptr<AsyncRun> run;  // null unless running on an async backend
+};
+
+struct FlowKey {
+  ConnId conn;
+  uint64_t req_id;
+  bool operator==(const FlowKey&) const = default;
+};
+
+struct FlowKeyHash {
+  size_t operator()(const FlowKey& k) const {
+    return std::hash<uint64_t>{}(k.conn * 0x9E3779B97F4A7C15ull ^ k.req_id);
+  }
+};
+
 struct WorkItem {
+  ConnId conn{kNoConn};
+  uint64_t recv_us{0};
   InferRequest req;
+  std::shared_ptr<Flow> flow;
+};
+
+// A request running on an async backend (--llama-reactors): what worker_loop keeps on
+// its stack, since chunks and the completion arrive on the backend's threads. The
+// fields after `halt` are guarded by the flow's mu.
+struct AsyncRun {
+  WorkItem wi;
+  uint64_t start_us{0};
+  CancelToken halt;                    // the flow's cancel, or a stall: tells the backend to stop
+  std::shared_ptr<AsyncInfer> call;
+  uint64_t first_chunk_us{0};
+  bool paused{false};                  // window full, backend paused
+  uint64_t paused_since_us{0};
+  bool stalled{false};
+  bool done{false};                    // backend finished; held bytes may still be waiting for credit
+  bool finished{false};                // answered
+  uint64_t end_us{0};
+  Status st{Status::Ok()};
+  InferResult res;
+};
+
+// Deadline of a stream's pending chunk bytes. Every timer gets the same delay, so
+// the queue is already ordered by due_us.
+struct CoalesceTimer {
+  uint64_t due_us{0};
+  uint64_t epoch{0};  // Flow::flushes when armed
+  ConnId conn{kNoConn};
+  uint64_t req_id{0};
+  std::shared_ptr<Flow> flow;
+};
+
+static constexpr const char* kBusyMsg = "server busy: queue full";
+
+// Request-level instruments; the transport and backends keep their own.
+struct ServerMetrics {
+  Counter received;
+  Counter ok, failed, cancelled, rejected;  // by outcome, see cc50_requests_total
+  Counter flow_stalls;                      // abandoned for lack of CREDIT_GRANT
+  Counter coalesced;                        // chunks merged into a pending RESP_CHUNK
+  Gauge running;                            // picked up by a worker, RESP_DONE not yet sent
+  Histogram queue_us;                       // REQ_INFER received -> picked up by a worker
+  Histogram ttft_us;                        // REQ_INFER received -> first RESP_CHUNK queued
+  Histogram request_us;                     // REQ_INFER received -> RESP_DONE queued
+  Counter prompt_tokens, tokens;            // as reported by the backend
+  Counter prefill_us, decode_us;
 };
 
 class ServerApp {
@@ -55,11 +191,30 @@ public:
     // Select backend
     if (cfg_.backend == "llama_server") {
       LlamaServerOptions o;
-      o.base_url = cfg_.llama_url;
+      o.upstreams = split_list(cfg_.llama_url);
+      if (!o.upstreams.empty()) o.base_url = o.upstreams.front();
+      o.balance = cfg_.llama_balance;
       o.endpoint = cfg_.llama_endpoint;
+      o.stream = cfg_.llama_stream;
+      o.keep_alive = cfg_.llama_keepalive;
+      o.sock = cfg_.sock;
+      o.reactor_threads = cfg_.llama_reactors;
+      o.metrics = &registry_;
       backend_ = std::make_unique<LlamaServerBackend>(o);
     } else {
-      backend_ = std::make_unique<ToyBackend>();
+      ToyBackendOptions topt;
+      topt.batching = cfg_.toy_batching;
+      topt.max_batch = cfg_.toy_max_batch;
+      topt.metrics = &registry_;
+      backend_ = std::make_unique<ToyBackend>(topt);
+    }
+    if (cfg_.cache_mb > 0) {
+      CacheOptions co;
+      co.max_bytes = cfg_.cache_mb << 20;
+      co.ttl_ms = cfg_.cache_ttl_ms;
+      auto cache = std::make_unique<CachingBackend>(std::move(backend_), co);
+      cache_ = cache.get();
+      backend_ = std::move(cache);
     }
 
     auto st = backend_->init();
@@ -69,68 +224,430 @@ public:
     st = backend_->load_model(cfg_.model, cfg_.ctx, cfg_.threads);
     if (!st.ok) return st;
 
-    // Transport is TCP-only now (legacy flag retained for compatibility)
-    transport_ = std::make_unique<TcpTransport>();
+    async_ = backend_->async_capable();
+    if (cfg_.llama_reactors > 0 && !async_ && cfg_.backend == "llama_server") {
+      CC50_LOG_WARN("[server] --llama-reactors has no effect with --cache-mb: requests run on worker threads");
+    }
+
+    if (cfg_.transport == "tcp") {
+      transport_ = std::make_unique<TcpTransport>();
+    } else if (cfg_.transport == "unix") {
+      transport_ = std::make_unique<UnixTransport>();
+    } else if (cfg_.transport == "shm") {
+      transport_ = std::make_unique<ShmTransport>();
+    } else if (cfg_.transport == "io_uring") {
+#if CC50_HAVE_IO_URING
+      transport_ = std::make_unique<IoUringTransport>();
+#else
+      return Status::Err("--transport=io_uring: this build has no io_uring support (liburing not found)");
+#endif
+    } else {
+      return Status::Err("unknown --transport: " + cfg_.transport);
+    }
 
     TransportOptions opt;
-    if (!parse_hostport(cfg_.listen, opt.listen_host, opt.listen_port)) {
+    opt.max_conn_tx_bytes = cfg_.max_conn_tx_bytes;
+    opt.event_threads = cfg_.event_threads;
+    opt.listen_backlog = cfg_.listen_backlog;
+    opt.pin_cpu_base = cfg_.pin_cpu_base;
+    opt.sock = cfg_.sock;
+    opt.metrics = &registry_;
+    if (cfg_.transport == "unix" || cfg_.transport == "shm") {
+      // a bare HOST:PORT here is almost certainly a leftover, not a file name
+      if (cfg_.listen.find('/') == std::string::npos && cfg_.listen[0] != '@') {
+        return Status::Err("bad --listen for --transport=" + cfg_.transport + ", expected a socket PATH or @NAME");
+      }
+      opt.unix_path = cfg_.listen;
+    } else if (!parse_hostport(cfg_.listen, opt.listen_host, opt.listen_port)) {
       return Status::Err("bad --listen, expected HOST:PORT");
     }
+    std::string metrics_host;
+    uint16_t metrics_port = 0;
+    if (!cfg_.metrics_listen.empty() && !parse_hostport(cfg_.metrics_listen, metrics_host, metrics_port)) {
+      return Status::Err("bad --metrics-listen, expected HOST:PORT");
+    }
+
+    // with --event-threads > 1, start_server() starts shard threads that may call
+    // on_msg / on_close right away: everything they touch must exist before it
+    q_ = FairQueue<WorkItem>(kMaxPriority + 1, cfg_.drr_quantum, cfg_.max_queue, slab_pool());
 
+    transport_->set_close_handler([&](ConnId conn) { on_close(conn); });
     st = transport_->start_server(opt, [&](const IncomingMessage& msg) {
       on_msg(msg);
     });
     if (!st.ok) return st;
 
-    // worker thread: consume queue and run inference
-    worker_ = std::thread([&] { worker_loop(); });
+    // worker pool: each worker takes a whole request, so chunks of one request stay in order.
+    // An async backend needs no thread per request: one dispatcher starts up to
+    // --workers of them and the backend's own threads carry them from there.
+    const int nworkers = std::max(1, cfg_.workers);
+    if (async_) {
+      workers_.emplace_back([&] { dispatch_loop(); });
+    } else {
+      for (int i = 0; i < nworkers; i++) {
+        workers_.emplace_back([&] { worker_loop(); });
+      }
+    }
+    if (cfg_.coalesce_us > 0) coalesce_thread_ = std::thread([&] { coalesce_loop(); });
 
-    std::cout << "[server] transport=" << cfg_.transport
-              << " backend=" << cfg_.backend
-              << " listen=" << cfg_.listen << "\n";
+    register_metrics(nworkers);
+    if (!cfg_.metrics_listen.empty()) {
+      st = metrics_http_.start(metrics_host, metrics_port, registry_);
+      if (!st.ok) {
+        stop_workers();
+        return st;
+      }
+    }
+
+    CC50_LOG_INFO("[server] transport=" << cfg_.transport
+                  << " backend=" << cfg_.backend
+                  << " listen=" << cfg_.listen
+                  << " workers=" << nworkers
+                  << " event_threads=" << std::max(1, cfg_.event_threads)
+                  << " coalesce_us=" << cfg_.coalesce_us
+                  << " metrics=" << (cfg_.metrics_listen.empty() ? std::string("off") : cfg_.metrics_listen));
     if (cfg_.backend == "llama_server") {
-      std::cout << "[server] llama_url=" << cfg_.llama_url
-                << " endpoint=" << cfg_.llama_endpoint << "\n";
+      CC50_LOG_INFO("[server] llama_url=" << cfg_.llama_url
+                    << " balance=" << cfg_.llama_balance
+                    << " endpoint=" << cfg_.llama_endpoint
+                    << " stream=" << (cfg_.llama_stream ? 1 : 0)
+                    << " keepalive=" << (cfg_.llama_keepalive ? 1 : 0)
+                    << " reactors=" << (async_ ? cfg_.llama_reactors : 0));
     }
 
+    uint64_t stall_scan_us = 0;
     while (!stop_) {
       auto ps = transport_->progress(50);
       if (!ps.ok) {
-        std::cerr << "[server] transport error: " << ps.msg << "\n";
+        CC50_LOG_ERROR("[server] transport error: " << ps.msg);
         break;
       }
+      if (async_ && now_us() - stall_scan_us >= 50000) {
+        stall_scan_us = now_us();
+        check_stalls(stall_scan_us);
+      }
     }
 
     // shutdown
+    metrics_http_.stop();
+    stop_workers();
+    if (cache_) {
+      const auto cs = cache_->stats();
+      CC50_LOG_INFO("[server] cache hits=" << cs.hits << " misses=" << cs.misses
+                    << " coalesced=" << cs.coalesced << " evictions=" << cs.evictions
+                    << " entries=" << cs.entries << " bytes=" << cs.bytes);
+    }
+    return Status::Ok();
+  }
+
+private:
+  void stop_workers() {
     stop_ = true;
     {
       std::lock_guard<std::mutex> lk(mu_);
       cv_.notify_all();
     }
-    if (worker_.joinable()) worker_.join();
-    return Status::Ok();
+    std::vector<std::shared_ptr<AsyncRun>> waiting;
+    {
+      std::lock_guard<std::mutex> lk(flows_mu_);
+      for (auto& [key, flow] : flows_) {
+        (void)key;
+        std::lock_guard<std::mutex> flk(flow->mu);
+        flow->cv.notify_all();
+        if (flow->run) {
+          flow->run->halt.cancel();
+          if (flow->run->done) waiting.push_back(flow->run);
+        }
+      }
+    }
+    for (auto& w : workers_) {
+      if (w.joinable()) w.join();
+    }
+    // async requests: the halted ones finish on the backend's threads within a poll period
+    for (auto& r : waiting) complete_async(r);
+    {
+      std::unique_lock<std::mutex> lk(mu_);
+      cv_.wait(lk, [&] { return async_running_ == 0; });
+    }
+    {
+      std::lock_guard<std::mutex> lk(co_mu_);
+      co_cv_.notify_all();
+    }
+    if (coalesce_thread_.joinable()) coalesce_thread_.join();
+  }
+
+  void register_metrics(int nworkers) {
+    MetricsRegistry& r = registry_;
+    r.add("cc50_requests_received_total", "REQ_INFER messages accepted for scheduling.", "", m_.received);
+    r.add("cc50_requests_total", "Finished requests by outcome.", metric_label("outcome", "ok"), m_.ok);
+    r.add("cc50_requests_total", "", metric_label("outcome", "error"), m_.failed);
+    r.add("cc50_requests_total", "", metric_label("outcome", "cancelled"), m_.cancelled);
+    r.add("cc50_requests_total", "", metric_label("outcome", "rejected"), m_.rejected);
+    r.add("cc50_flow_control_stalls_total", "Streams abandoned because the client granted no credit.", "",
+          m_.flow_stalls);
+    r.add_gauge_fn("cc50_slab_pool_bytes", "Heap bytes held by the slab pool (frames, queues, request state).", "",
+                   [] { return (double)slab_pool()->stats().slab_bytes; });
+    r.add_counter_fn("cc50_slab_pool_large_allocs_total", "Allocations too large for the slab pool.", "",
+                     [] { return (double)slab_pool()->stats().large_allocs; });
+    r.add("cc50_chunks_coalesced_total", "Backend chunks sent inside an earlier chunk's RESP_CHUNK (--coalesce-us).",
+          "", m_.coalesced);
+    r.add("cc50_requests_running", "Requests being served by a worker.", "", m_.running);
+    r.add_gauge_fn("cc50_workers", "Worker threads (concurrent requests).", "", [nworkers] { return (double)nworkers; });
+    r.add_gauge_fn("cc50_queue_depth", "Requests waiting for a worker.", "", [this] {
+      std::lock_guard<std::mutex> lk(mu_);
+      return (double)q_.size();
+    });
+    r.add_gauge_fn("cc50_queue_limit", "Queued requests before new ones are rejected (0 = unlimited).", "",
+                   [this] { return (double)cfg_.max_queue; });
+    r.add("cc50_queue_wait_seconds", "REQ_INFER received to picked up by a worker.", "", m_.queue_us);
+    r.add("cc50_time_to_first_chunk_seconds", "REQ_INFER received to first RESP_CHUNK queued.", "", m_.ttft_us);
+    r.add("cc50_request_seconds", "REQ_INFER received to RESP_DONE queued.", "", m_.request_us);
+    r.add("cc50_prompt_tokens_total", "Prompt tokens processed, as reported by the backend.", "", m_.prompt_tokens);
+    r.add("cc50_generated_tokens_total", "Tokens generated, as reported by the backend.", "", m_.tokens);
+    r.add("cc50_prefill_seconds_total", "Backend prompt processing time; prompt tokens / this = prefill tok/s.", "",
+          m_.prefill_us, 1e-6);
+    r.add("cc50_decode_seconds_total", "Backend generation time; generated tokens / this = decode tok/s.", "",
+          m_.decode_us, 1e-6);
+    if (cache_) {
+      auto stat = [this](auto field) { return [this, field] { return (double)(cache_->stats().*field); }; };
+      using S = CachingBackend::Stats;
+      r.add_counter_fn("cc50_cache_hits_total", "Result cache hits.", "", stat(&S::hits));
+      r.add_counter_fn("cc50_cache_misses_total", "Result cache misses that ran the backend.", "", stat(&S::misses));
+      r.add_counter_fn("cc50_cache_coalesced_total", "Misses that joined an identical in-flight request.", "",
+                       stat(&S::coalesced));
+      r.add_counter_fn("cc50_cache_evictions_total", "Entries evicted to stay under the size limit.", "",
+                       stat(&S::evictions));
+      r.add_gauge_fn("cc50_cache_entries", "Cached results.", "", stat(&S::entries));
+      r.add_gauge_fn("cc50_cache_bytes", "Memory held by cached results.", "", stat(&S::bytes));
+    }
   }
 
-private:
   void on_msg(const IncomingMessage& msg) {
+    if (msg.type == (uint16_t)MsgType::CREDIT_GRANT) {
+      on_credit(msg);
+      return;
+    }
+    if (msg.type == (uint16_t)MsgType::REQ_CANCEL) {
+      std::shared_ptr<Flow> flow;
+      {
+        std::lock_guard<std::mutex> lk(flows_mu_);
+        auto it = flows_.find(FlowKey{msg.conn, msg.req_id});
+        if (it != flows_.end()) flow = it->second;
+      }
+      if (flow) cancel_flow(*flow);
+      return;
+    }
     if (msg.type != (uint16_t)MsgType::REQ_INFER) return;
-    if (msg.payload.size() < sizeof(InferRequestHdr)) return;
+    const size_t hdr_size = infer_request_hdr_size(msg.version);
+    if (msg.payload.size() < hdr_size) return;
 
     InferRequestHdr rh{};
-    std::memcpy(&rh, msg.payload.data(), sizeof(rh));
-    if (msg.payload.size() < sizeof(rh) + rh.prompt_len) return;
+    std::memcpy(&rh, msg.payload.data(), hdr_size);
+    if (msg.payload.size() < hdr_size + (uint64_t)rh.prompt_len + rh.params_len) return;
 
     InferRequest req{};
     req.req_id = msg.req_id;
     req.max_tokens = rh.max_tokens ? rh.max_tokens : cfg_.max_tokens_default;
     req.credit_bytes = rh.credit_bytes;
-    req.prompt.assign((const char*)msg.payload.data() + sizeof(rh), rh.prompt_len);
+    req.prompt.assign((const char*)msg.payload.data() + hdr_size, rh.prompt_len);
+    const std::string_view params((const char*)msg.payload.data() + hdr_size + rh.prompt_len, rh.params_len);
+    if (!decode_params(params, req.params)) {
+      static const std::string kBadParams = "malformed parameter block";
+      send(msg.conn, msg.req_id, MsgType::RESP_ERR, (const uint8_t*)kBadParams.data(), kBadParams.size());
+      InferDone done{};
+      send(msg.conn, msg.req_id, MsgType::RESP_DONE, (const uint8_t*)&done, sizeof(done));
+      m_.rejected.inc();
+      return;
+    }
 
+    // registered before queueing so grants that arrive early are not lost
+    auto flow = std::allocate_shared<Flow>(std::pmr::polymorphic_allocator<Flow>(slab_pool()));
+    flow->credit = rh.credit_bytes ? rh.credit_bytes : cfg_.credit_default;
+    flow->windowed = msg.version >= kProtoVerCredit;
+    {
+      std::lock_guard<std::mutex> lk(flows_mu_);
+      flows_[FlowKey{msg.conn, msg.req_id}] = flow;
+    }
+
+    // fair share per tenant when the client names one, otherwise per connection
+    const uint64_t fkey = rh.tenant ? (1ull << 63) | rh.tenant : msg.conn;
+    const size_t level = std::min<size_t>(rh.priority, kMaxPriority);
+    const uint64_t cost = req.max_tokens;
+
+    m_.received.inc();
+    WorkItem wi{msg.conn, now_us(), std::move(req), std::move(flow)};
+    WorkItem shed;
+    bool queued, have_shed = false;
     {
       std::lock_guard<std::mutex> lk(mu_);
-      q_.push_back(WorkItem{std::move(req)});
+      queued = q_.push(level, fkey, cost, wi);
+      if (!queued && q_.shed_below(level, shed)) {
+        have_shed = true;
+        queued = q_.push(level, fkey, cost, wi);
+      }
+    }
+    if (queued) cv_.notify_one();
+    // full queue: a less urgent request gives up its place, or this one is turned away
+    if (have_shed) reject(shed, kBusyMsg);
+    if (!queued) reject(wi, kBusyMsg);
+  }
+
+  // Answer a request that never reached a worker.
+  void reject(const WorkItem& wi, const std::string& em) {
+    {
+      std::lock_guard<std::mutex> lk(flows_mu_);
+      flows_.erase(FlowKey{wi.conn, wi.req.req_id});
+    }
+    send(wi.conn, wi.req.req_id, MsgType::RESP_ERR, (const uint8_t*)em.data(), em.size());
+    m_.rejected.inc();
+    InferDone done{};
+    done.queue_us = now_us() - wi.recv_us;
+    send(wi.conn, wi.req.req_id, MsgType::RESP_DONE, (const uint8_t*)&done, sizeof(done));
+  }
+
+  void on_credit(const IncomingMessage& msg) {
+    if (msg.payload.size() < sizeof(CreditGrant)) return;
+    CreditGrant g{};
+    std::memcpy(&g, msg.payload.data(), sizeof(g));
+
+    std::shared_ptr<Flow> flow;
+    {
+      std::lock_guard<std::mutex> lk(flows_mu_);
+      auto it = flows_.find(FlowKey{msg.conn, msg.req_id});
+      if (it == flows_.end()) return; // already finished
+      flow = it->second;
+    }
+    std::shared_ptr<AsyncRun> done;
+    {
+      std::lock_guard<std::mutex> lk(flow->mu);
+      flow->credit += g.bytes;
+      if (AsyncRun* r = flow->run.get()) {
+        drain_held(*r);
+        if (flow->held.empty() && r->paused) {
+          r->paused = false;
+          if (r->done) done = flow->run;
+          else if (r->call) r->call->resume();
+        }
+      }
+    }
+    flow->cv.notify_one();
+    if (done) complete_async(done);
+  }
+
+  // The client is gone: stop generating for every request it still has queued or running.
+  void on_close(ConnId conn) {
+    std::vector<std::shared_ptr<Flow>> dead;
+    {
+      std::lock_guard<std::mutex> lk(flows_mu_);
+      for (auto& [key, flow] : flows_) {
+        if (key.conn == conn) dead.push_back(flow);
+      }
+    }
+    for (auto& f : dead) cancel_flow(*f);
+  }
+
+  void cancel_flow(Flow& f) {
+    f.cancel.cancel();
+    std::shared_ptr<AsyncRun> done;
+    {
+      std::lock_guard<std::mutex> lk(f.mu);
+      f.cv.notify_all(); // wake a producer parked on an empty window
+      if (f.run) {
+        f.run->halt.cancel();
+        if (f.run->done) done = f.run; // only its unsent bytes were left
+      }
+    }
+    if (done) complete_async(done);
+  }
+
+  // Wait for window space, then send as much of [p, p+n) as it allows.
+  // Returns false if the stream had to be abandoned (stall timeout, cancel or shutdown).
+  bool send_chunk(const WorkItem& wi, const char* p, size_t n) {
+    Flow& f = *wi.flow;
+    while (n > 0) {
+      size_t take = n;
+      {
+        std::unique_lock<std::mutex> lk(f.mu);
+        if (f.windowed) {
+          bool ok = f.cv.wait_for(lk, std::chrono::milliseconds(cfg_.credit_stall_ms),
+                                  [&] { return stop_ || f.cancel.cancelled() || f.credit > 0; });
+          if (!ok || stop_ || f.cancel.cancelled()) return false;
+          take = (size_t)std::min<uint64_t>(take, f.credit);
+          f.credit -= take;
+        }
+      }
+      emit_chunk(wi, p, take);
+      p += take;
+      n -= take;
+    }
+    return true;
+  }
+
+  // Nagle at the request level: a stream that flushed within the last coalesce_us
+  // buffers its next bytes until the delay runs out or coalesce_bytes are pending.
+  // The first chunk, and the first after a quiet spell, go out at once, so TTFT and
+  // slow streams pay nothing; only streams faster than the delay are merged.
+  void emit_chunk(const WorkItem& wi, const char* p, size_t n) {
+    if (cfg_.coalesce_us <= 0) {
+      send(wi.conn, wi.req.req_id, MsgType::RESP_CHUNK, (const uint8_t*)p, n);
+      return;
+    }
+    Flow& f = *wi.flow;
+    const uint64_t delay = (uint64_t)cfg_.coalesce_us;
+    std::lock_guard<std::mutex> lk(f.tx_mu);
+    const uint64_t now = now_us();
+    if (f.pending.empty() && (f.last_flush_us == 0 || now - f.last_flush_us >= delay)) {
+      send(wi.conn, wi.req.req_id, MsgType::RESP_CHUNK, (const uint8_t*)p, n);
+      f.last_flush_us = now;
+      f.flushes++;
+      return;
+    }
+    if (!f.pending.empty() && f.pending.size() + n > cfg_.coalesce_bytes) flush_locked(wi.conn, wi.req.req_id, f, now);
+    if (!f.pending.empty()) m_.coalesced.inc();
+    const bool arm = f.pending.empty();
+    f.pending.append(p, n);
+    if (arm) f.pending_since_us = now;
+    if (f.pending.size() >= cfg_.coalesce_bytes || now - f.pending_since_us >= delay) {
+      flush_locked(wi.conn, wi.req.req_id, f, now);
+    } else if (arm) {
+      std::lock_guard<std::mutex> ql(co_mu_);
+      co_q_.push_back(CoalesceTimer{now + delay, f.flushes, wi.conn, wi.req.req_id, wi.flow});
+      if (co_q_.size() == 1) co_cv_.notify_one();
+    }
+  }
+
+  // Frames the pending bytes of `f` as one RESP_CHUNK. Caller holds f.tx_mu.
+  void flush_locked(ConnId conn, uint64_t req_id, Flow& f, uint64_t now) {
+    if (f.pending.empty()) return;
+    send(conn, req_id, MsgType::RESP_CHUNK, (const uint8_t*)f.pending.data(), f.pending.size());
+    f.pending.clear();
+    f.last_flush_us = now;
+    f.flushes++;
+  }
+
+  // Sends pending bytes whose delay ran out. Workers flush their own stream before
+  // RESP_ERR / RESP_DONE, so a timer that fires later finds nothing to send.
+  void coalesce_loop() {
+    std::unique_lock<std::mutex> lk(co_mu_);
+    while (!stop_) {
+      if (co_q_.empty()) {
+        co_cv_.wait(lk);
+        continue;
+      }
+      const uint64_t now = now_us();
+      if (co_q_.front().due_us > now) {
+        co_cv_.wait_for(lk, std::chrono::microseconds(co_q_.front().due_us - now));
+        continue;
+      }
+      CoalesceTimer t = std::move(co_q_.front());
+      co_q_.pop_front();
+      lk.unlock();
+      {
+        std::lock_guard<std::mutex> flk(t.flow->tx_mu);
+        if (t.flow->flushes == t.epoch) flush_locked(t.conn, t.req_id, *t.flow, now_us());
+      }
+      lk.lock();
     }
-    cv_.notify_one();
   }
 
   void worker_loop() {
@@ -140,50 +657,251 @@ private:
         std::unique_lock<std::mutex> lk(mu_);
         cv_.wait(lk, [&] { return stop_ || !q_.empty(); });
         if (stop_) break;
-        wi = std::move(q_.front());
-        q_.pop_front();
+        q_.pop(wi);
       }
 
       InferResult res{};
-      uint32_t sent_bytes = 0;
-      uint32_t credit = wi.req.credit_bytes ? wi.req.credit_bytes : 256 * 1024;
-
-      auto st = backend_->infer_stream(
-        wi.req,
-        [&](const std::string& chunk) {
-          if (sent_bytes + chunk.size() > credit) return; // credit throttle
-          transport_->send(wi.req.req_id, (uint16_t)MsgType::RESP_CHUNK,
-                           (const uint8_t*)chunk.data(), chunk.size());
-          sent_bytes += (uint32_t)chunk.size();
-        },
-        res
-      );
+      const uint64_t start_us = now_us();
+      // what the chunk callback touches; capturing only `this` and `ss` keeps the
+      // closure small enough for std::function to store inline
+      struct StreamState {
+        const WorkItem& wi;
+        bool stalled{false};
+        uint64_t first_chunk_us{0};
+      } ss{wi};
+      m_.running.inc();
+      m_.queue_us.record(start_us - wi.recv_us);
 
-      if (!st.ok) {
-        const std::string& em = res.error.empty() ? st.msg : res.error;
-        transport_->send(wi.req.req_id, (uint16_t)MsgType::RESP_ERR,
-                         (const uint8_t*)em.data(), em.size());
+      const CancelToken& cancel = wi.flow->cancel;
+      Status st = Status::Ok();
+      if (cancel.cancelled()) {
+        st = Status::Err("cancelled"); // cancelled while still queued
+      } else {
+        st = backend_->infer_stream(
+          wi.req,
+          [this, &ss](const std::string& chunk) {
+            if (ss.stalled || chunk.empty() || ss.wi.flow->cancel.cancelled()) return;
+            if (!ss.first_chunk_us) ss.first_chunk_us = now_us();
+            // blocks while the client's window is empty: backpressure instead of dropping text
+            if (!send_chunk(ss.wi, chunk.data(), chunk.size())) ss.stalled = true;
+          },
+          res,
+          cancel
+        );
       }
+      finish_request(wi, st, res, start_us, now_us(), ss.first_chunk_us, ss.stalled);
+    }
+  }
 
-      InferDone done{};
-      done.tokens = res.tokens;
-      done.elapsed_us = res.elapsed_us;
-      transport_->send(wi.req.req_id, (uint16_t)MsgType::RESP_DONE,
-                       (const uint8_t*)&done, sizeof(done));
+  // Flush, answer and account for a request the backend is done with. `stalled`: its
+  // stream was abandoned (no credit, or cancel / shutdown while waiting for some).
+  void finish_request(const WorkItem& wi, const Status& st, const InferResult& res, uint64_t start_us,
+                      uint64_t end_us, uint64_t first_chunk_us, bool stalled) {
+    const CancelToken& cancel = wi.flow->cancel;
+    if (cfg_.coalesce_us > 0) {
+      std::lock_guard<std::mutex> lk(wi.flow->tx_mu);
+      flush_locked(wi.conn, wi.req.req_id, *wi.flow, end_us);
+    }
+
+    {
+      std::lock_guard<std::mutex> lk(flows_mu_);
+      flows_.erase(FlowKey{wi.conn, wi.req.req_id});
+    }
+
+    if (!st.ok || stalled || cancel.cancelled()) {
+      const std::string em = cancel.cancelled() ? std::string("cancelled")
+                           : !st.ok ? (res.error.empty() ? st.msg : res.error)
+                           : std::string("flow control stalled: no CREDIT_GRANT from client");
+      send(wi.conn, wi.req.req_id, MsgType::RESP_ERR, (const uint8_t*)em.data(), em.size());
+    }
+
+    InferDone done{};
+    done.tokens = res.tokens;
+    done.elapsed_us = res.elapsed_us;
+    done.queue_us = start_us - wi.recv_us;
+    done.backend_us = end_us - start_us;
+    done.ttft_us = first_chunk_us ? first_chunk_us - wi.recv_us : 0;
+    done.prompt_tokens = res.prompt_tokens;
+    done.prefill_us = res.prefill_us;
+    done.decode_us = res.decode_us;
+    send(wi.conn, wi.req.req_id, MsgType::RESP_DONE, (const uint8_t*)&done, sizeof(done));
+
+    if (cancel.cancelled()) m_.cancelled.inc();
+    else if (!st.ok || stalled) m_.failed.inc();
+    else m_.ok.inc();
+    if (stalled && !cancel.cancelled()) m_.flow_stalls.inc();
+    if (first_chunk_us) m_.ttft_us.record(first_chunk_us - wi.recv_us);
+    m_.request_us.record(now_us() - wi.recv_us);
+    m_.prompt_tokens.inc(res.prompt_tokens);
+    m_.tokens.inc(res.tokens);
+    m_.prefill_us.inc(res.prefill_us);
+    m_.decode_us.inc(res.decode_us);
+    m_.running.dec();
+  }
+
+  // Async backends: start requests in fair-queue order while fewer than --workers run.
+  void dispatch_loop() {
+    const size_t limit = (size_t)std::max(1, cfg_.workers);
+    while (!stop_) {
+      WorkItem wi;
+      {
+        std::unique_lock<std::mutex> lk(mu_);
+        cv_.wait(lk, [&] { return stop_ || (!q_.empty() && async_running_ < limit); });
+        if (stop_) break;
+        q_.pop(wi);
+        async_running_++;
+      }
+      start_async(std::move(wi));
+    }
+  }
+
+  void start_async(WorkItem&& wi) {
+    auto run = std::allocate_shared<AsyncRun>(std::pmr::polymorphic_allocator<AsyncRun>(slab_pool()));
+    run->start_us = now_us();
+    run->wi = std::move(wi);
+    m_.running.inc();
+    m_.queue_us.record(run->start_us - run->wi.recv_us);
+
+    Flow& f = *run->wi.flow;
+    {
+      std::lock_guard<std::mutex> lk(f.mu);
+      f.run = run;
+      if (f.cancel.cancelled()) run->halt.cancel(); // cancel_flow ran before f.run was set
+    }
+    if (run->halt.cancelled()) {
+      run->done = true; // cancelled while still queued
+      run->st = Status::Err("cancelled");
+      complete_async(run);
+      return;
+    }
+    auto call = backend_->infer_async(
+      run->wi.req,
+      [this, run](const std::string& chunk) { on_async_chunk(*run, chunk); },
+      [this, run](const Status& st, InferResult& res) { on_async_done(run, st, res); },
+      run->halt);
+    std::lock_guard<std::mutex> lk(f.mu);
+    if (run->done) return;
+    run->call = std::move(call);
+    if (run->paused && run->call) run->call->pause();
+  }
+
+  // Backend thread. Never waits for credit: what the window cannot take is held and the
+  // backend paused until CREDIT_GRANTs drain it.
+  void on_async_chunk(AsyncRun& r, const std::string& chunk) {
+    Flow& f = *r.wi.flow;
+    if (chunk.empty() || f.cancel.cancelled()) return;
+    std::lock_guard<std::mutex> lk(f.mu);
+    if (r.stalled || r.done) return;
+    if (!r.first_chunk_us) r.first_chunk_us = now_us();
+    if (!f.windowed) {
+      emit_chunk(r.wi, chunk.data(), chunk.size());
+      return;
+    }
+    f.held.append(chunk);
+    drain_held(r);
+    if (!f.held.empty() && !r.paused) {
+      r.paused = true;
+      r.paused_since_us = now_us();
+      if (r.call) r.call->pause();
+    }
+  }
+
+  // Send as much of the held bytes as the window allows. Caller holds f.mu, which also
+  // keeps the chunk path and the credit path from reordering bytes.
+  void drain_held(AsyncRun& r) {
+    Flow& f = *r.wi.flow;
+    const size_t take = (size_t)std::min<uint64_t>(f.held.size(), f.credit);
+    if (take == 0) return;
+    f.credit -= take;
+    emit_chunk(r.wi, f.held.data(), take);
+    f.held.erase(0, take);
+  }
+
+  void on_async_done(const std::shared_ptr<AsyncRun>& run, const Status& st, InferResult& res) {
+    Flow& f = *run->wi.flow;
+    {
+      std::lock_guard<std::mutex> lk(f.mu);
+      run->done = true;
+      run->end_us = now_us();
+      run->st = st;
+      run->res = std::move(res);
+      run->call.reset();
+      // the tail still waiting for credit goes out first, as a worker would have sent it
+      if (!f.held.empty() && !run->stalled && !run->halt.cancelled()) return;
+    }
+    complete_async(run);
+  }
+
+  void complete_async(const std::shared_ptr<AsyncRun>& run) {
+    Flow& f = *run->wi.flow;
+    {
+      std::lock_guard<std::mutex> lk(f.mu);
+      if (run->finished) return;
+      run->finished = true;
+      if (!run->end_us) run->end_us = now_us();
+      if (!f.held.empty()) run->stalled = true; // cut short before its tail could be sent
+      f.run.reset();
+    }
+    finish_request(run->wi, run->st, run->res, run->start_us, run->end_us, run->first_chunk_us, run->stalled);
+    {
+      std::lock_guard<std::mutex> lk(mu_);
+      async_running_--;
+    }
+    cv_.notify_all(); // the dispatcher, or stop_workers draining
+  }
+
+  // Main thread: give up on async streams whose window stayed empty for credit_stall_ms.
+  void check_stalls(uint64_t now) {
+    const uint64_t limit = (uint64_t)std::max(0, cfg_.credit_stall_ms) * 1000;
+    std::vector<std::shared_ptr<AsyncRun>> done;
+    {
+      std::lock_guard<std::mutex> lk(flows_mu_);
+      for (auto& [key, flow] : flows_) {
+        (void)key;
+        std::lock_guard<std::mutex> flk(flow->mu);
+        AsyncRun* r = flow->run.get();
+        if (!r || !r->paused || r->stalled || now - r->paused_since_us < limit) continue;
+        r->stalled = true;
+        r->halt.cancel(); // the backend ends within its poll period and completes it
+        if (r->done) done.push_back(flow->run);
+      }
     }
+    for (auto& r : done) complete_async(r);
+  }
+
+  // Called from worker threads; the transport hands frames to its event loop.
+  void send(ConnId conn, uint64_t req_id, MsgType type, const uint8_t* data, size_t len) {
+    transport_->send(conn, req_id, (uint16_t)type, data, len);
   }
 
 private:
   ServerConfig cfg_;
+  // registered instruments live in the members below it; metrics_http_ (last) is
+  // destroyed first, so no scrape can reach a component being torn down
+  MetricsRegistry registry_;
+  ServerMetrics m_;
   std::unique_ptr<ITransport> transport_;
   std::unique_ptr<IBackend> backend_;
+  CachingBackend* cache_{nullptr};       // backend_ when --cache-mb is set
 
   std::atomic<bool> stop_{false};
-  std::thread worker_;
+  bool async_{false};                    // backend_ runs requests without a worker thread each
+  std::vector<std::thread> workers_;
 
   std::mutex mu_;
   std::condition_variable cv_;
-  std::deque<WorkItem> q_;
+  FairQueue<WorkItem> q_;
+  size_t async_running_{0};              // mu_; async requests started, not yet answered
+
+  std::mutex flows_mu_;
+  std::pmr::unordered_map<FlowKey, std::shared_ptr<Flow>, FlowKeyHash> flows_{slab_pool()};
+
+  std::mutex co_mu_;
+  std::condition_variable co_cv_;
+  std::pmr::deque<CoalesceTimer> co_q_{slab_pool()};
+  std::thread coalesce_thread_;
+
+  MetricsHttpServer metrics_http_;
 };
 
 } // namespace cc50
@@ -191,12 +909,44 @@ private:
 static void usage() {
   std::cerr << R"(cc50_llm_server
   --backend=toy|llama_server
-  --listen=HOST:PORT
+  --transport=tcp|io_uring|unix|shm
+                                 (io_uring: single ring, needs a liburing build; unix: AF_UNIX
+                                  SOCK_SEQPACKET; shm: shared-memory rings set up over AF_UNIX)
+  --listen=HOST:PORT             (unix|shm: a socket PATH, or @NAME in the abstract namespace)
   --max-tokens-default=128
+  --workers=1                    (concurrent requests; match llama-server -np)
+  --credit-stall-ms=30000        (abort a stream whose flow-control window stays empty)
+  --max-conn-tx-mb=32            (unsent bytes per connection before it is dropped)
+  --event-threads=1              (transport event loops, each with its own SO_REUSEPORT listener)
+  --listen-backlog=1024
+  --pin-cpu=-1                   (pin event loop i to CPU N+i; -1 = no pinning)
+  --log-level=info               (debug|info|warn|error|off; logs go to stderr asynchronously)
+  --tcp-nodelay=0|1              (disable Nagle on client and upstream sockets, default 1)
+  --tcp-quickack=0|1             (ACK every read at once instead of delaying, default 0)
+  --busy-poll-us=0               (SO_BUSY_POLL; above net.core.busy_read needs CAP_NET_ADMIN)
+  --sock-sndbuf=0                (SO_SNDBUF bytes; 0 = kernel autotuning)
+  --sock-rcvbuf=0                (SO_RCVBUF bytes; 0 = kernel autotuning)
+  --tcp-keepalive=0              (IDLE_S[,INTVL_S[,COUNT]]; 0 = off)
+  --max-queue=1024               (queued requests before new ones get "server busy"; 0 = unlimited)
+  --drr-quantum=256              (fair-share quantum in tokens between tenants/connections)
+  --cache-mb=0                   (result cache for repeated prompts; 0 = off)
+  --cache-ttl-ms=60000           (cache entry lifetime; 0 = until evicted)
+  --metrics-listen=HOST:PORT     (Prometheus text format on GET /metrics; default off)
+  --coalesce-us=0                (merge a fast stream's chunks for up to this long, e.g. 2000; 0 = off)
+  --coalesce-bytes=1024          (flush merged chunks once this many bytes are pending)
+
+  # toy backend options:
+  --toy-batching=0|1             (continuous batching decode loop, default 1)
+  --toy-max-batch=64             (sequences per decode step; batch size is bounded by --workers)
 
   # llama_server backend options:
-  --llama-url=http://127.0.0.1:8080
+  --llama-url=http://127.0.0.1:8080   (comma-separated list balances across several llama-servers)
+  --llama-balance=p2c|least      (upstream choice: power of two choices or least outstanding)
   --llama-endpoint=/completion   (or /v1/completions)
+  --llama-stream=0|1             (SSE token streaming, default 1)
+  --llama-keepalive=0|1          (pooled keep-alive upstream connections, default 1)
+  --llama-reactors=0             (epoll loops running upstream HTTP non-blocking; with N > 0 a request in
+                                  flight holds no thread and --workers only caps concurrency; 0 = blocking)
 
 Example:
   # Terminal 1: start llama-server (from your llama.cpp build)
@@ -213,30 +963,98 @@ int main(int argc, char** argv) {
 
   static option opts[] = {
     {"backend", required_argument, nullptr, 'b'},
+    {"transport", required_argument, nullptr, 't'},
     {"listen", required_argument, nullptr, 'l'},
     {"max-tokens-default", required_argument, nullptr, 'k'},
     {"llama-url", required_argument, nullptr, 'u'},
+    {"llama-balance", required_argument, nullptr, 'A'},
     {"llama-endpoint", required_argument, nullptr, 'e'},
+    {"llama-stream", required_argument, nullptr, 'S'},
+    {"llama-keepalive", required_argument, nullptr, 'K'},
+    {"llama-reactors", required_argument, nullptr, 'R'},
     {"model", required_argument, nullptr, 'm'},
     {"ctx", required_argument, nullptr, 'c'},
     {"threads", required_argument, nullptr, 'p'},
+    {"workers", required_argument, nullptr, 'w'},
+    {"credit-stall-ms", required_argument, nullptr, 'T'},
+    {"max-conn-tx-mb", required_argument, nullptr, 'X'},
+    {"event-threads", required_argument, nullptr, 'E'},
+    {"listen-backlog", required_argument, nullptr, 'G'},
+    {"pin-cpu", required_argument, nullptr, 'I'},
+    {"log-level", required_argument, nullptr, 'v'},
+    {"tcp-nodelay", required_argument, nullptr, 'n'},
+    {"tcp-quickack", required_argument, nullptr, 'q'},
+    {"busy-poll-us", required_argument, nullptr, 'y'},
+    {"sock-sndbuf", required_argument, nullptr, 'o'},
+    {"sock-rcvbuf", required_argument, nullptr, 'r'},
+    {"tcp-keepalive", required_argument, nullptr, 'a'},
+    {"max-queue", required_argument, nullptr, 'Q'},
+    {"drr-quantum", required_argument, nullptr, 'D'},
+    {"cache-mb", required_argument, nullptr, 'C'},
+    {"cache-ttl-ms", required_argument, nullptr, 'L'},
+    {"toy-batching", required_argument, nullptr, 'B'},
+    {"toy-max-batch", required_argument, nullptr, 'N'},
+    {"metrics-listen", required_argument, nullptr, 'M'},
+    {"coalesce-us", required_argument, nullptr, 'g'},
+    {"coalesce-bytes", required_argument, nullptr, 'j'},
     {"help", no_argument, nullptr, 'h'},
     {nullptr, 0, nullptr, 0}
   };
 
   while (true) {
     int idx = 0;
-    int c = getopt_long(argc, argv, "b:l:k:u:e:m:c:p:h", opts, &idx);
+    int c = getopt_long(argc, argv, "b:t:l:k:u:A:e:S:K:R:m:c:p:w:T:X:E:G:I:v:n:q:y:o:r:a:Q:D:C:L:B:N:M:g:j:h", opts, &idx);
     if (c == -1) break;
     switch (c) {
       case 'b': cfg.backend = optarg; break;
+      case 't': cfg.transport = optarg; break;
       case 'l': cfg.listen = optarg; break;
       case 'k': cfg.max_tokens_default = (uint32_t)std::stoul(optarg); break;
       case 'u': cfg.llama_url = optarg; break;
+      case 'A': cfg.llama_balance = optarg; break;
       case 'e': cfg.llama_endpoint = optarg; break;
+      case 'S': cfg.llama_stream = (std::stoi(optarg) != 0); break;
+      case 'K': cfg.llama_keepalive = (std::stoi(optarg) != 0); break;
+      case 'R': cfg.llama_reactors = std::stoi(optarg); break;
       case 'm': cfg.model = optarg; break;
       case 'c': cfg.ctx = std::stoi(optarg); break;
       case 'p': cfg.threads = std::stoi(optarg); break;
+      case 'w': cfg.workers = std::stoi(optarg); break;
+      case 'T': cfg.credit_stall_ms = std::stoi(optarg); break;
+      case 'X': cfg.max_conn_tx_bytes = (size_t)std::stoul(optarg) << 20; break;
+      case 'E': cfg.event_threads = std::stoi(optarg); break;
+      case 'G': cfg.listen_backlog = std::stoi(optarg); break;
+      case 'I': cfg.pin_cpu_base = std::stoi(optarg); break;
+      case 'v': {
+        cc50::LogLevel lvl{};
+        if (!cc50::parse_log_level(optarg, lvl)) {
+          std::cerr << "bad --log-level: " << optarg << "\n";
+          return 2;
+        }
+        cc50::AsyncLog::set_level(lvl);
+        break;
+      }
+      case 'n': cfg.sock.nodelay = (std::stoi(optarg) != 0); break;
+      case 'q': cfg.sock.quickack = (std::stoi(optarg) != 0); break;
+      case 'y': cfg.sock.busy_poll_us = std::stoi(optarg); break;
+      case 'o': cfg.sock.sndbuf = std::stoi(optarg); break;
+      case 'r': cfg.sock.rcvbuf = std::stoi(optarg); break;
+      case 'a': {
+        auto parts = cc50::split_list(optarg);
+        cfg.sock.keepalive_idle_s = parts.size() > 0 ? std::stoi(parts[0]) : 0;
+        cfg.sock.keepalive_intvl_s = parts.size() > 1 ? std::stoi(parts[1]) : 0;
+        cfg.sock.keepalive_cnt = parts.size() > 2 ? std::stoi(parts[2]) : 0;
+        break;
+      }
+      case 'Q': cfg.max_queue = (size_t)std::stoul(optarg); break;
+      case 'D': cfg.drr_quantum = (uint32_t)std::stoul(optarg); break;
+      case 'C': cfg.cache_mb = (size_t)std::stoul(optarg); break;
+      case 'L': cfg.cache_ttl_ms = (uint32_t)std::stoul(optarg); break;
+      case 'B': cfg.toy_batching = (std::stoi(optarg) != 0); break;
+      case 'N': cfg.toy_max_batch = (uint32_t)std::stoul(optarg); break;
+      case 'M': cfg.metrics_listen = optarg; break;
+      case 'g': cfg.coalesce_us = std::stoi(optarg); break;
+      case 'j': cfg.coalesce_bytes = std::max<size_t>(1, std::stoul(optarg)); break;
       case 'h': usage(); return 0;
       default: usage(); return 2;
     }
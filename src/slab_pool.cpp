@@ -0,0 +1,155 @@
+#include "cc50/slab_pool.hpp"
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <bit>
+#include <mutex>
+#include <new>
+
+namespace cc50 {
+
+namespace {
+
+struct FreeBlock {
+  FreeBlock* next;
+};
+
+struct FreeList {
+  FreeBlock* head{nullptr};
+  size_t count{0};
+
+  void push(void* p) {
+    auto* b = static_cast<FreeBlock*>(p);
+    b->next = head;
+    head = b;
+    count++;
+  }
+  void* pop() {
+    FreeBlock* b = head;
+    head = b->next;
+    count--;
+    return b;
+  }
+};
+
+constexpr size_t block_size(size_t c) { return SlabPool::kMinBlock << c; }
+
+size_t class_of(size_t bytes) {
+  if (bytes <= SlabPool::kMinBlock) return 0;
+  return (size_t)(std::bit_width(bytes - 1) - std::countr_zero(SlabPool::kMinBlock));
+}
+
+// blocks moved between a thread and the depot at once: ~32 KiB worth, 1..32 blocks
+constexpr size_t batch_of(size_t c) { return std::clamp<size_t>((32u << 10) / block_size(c), 1, 32); }
+
+struct Depot {
+  std::mutex mu;
+  FreeList free;
+};
+
+struct Shared {
+  std::array<Depot, SlabPool::kClasses> depots;
+  std::atomic<uint64_t> slab_bytes{0};
+  std::atomic<uint64_t> large_allocs{0};
+};
+
+Shared& shared() {
+  static Shared* s = new Shared(); // leaked on purpose, see slab_pool()
+  return *s;
+}
+
+// Fill `l` with up to one batch from the depot, carving a new slab if it is empty.
+void refill(size_t c, FreeList& l) {
+  Depot& d = shared().depots[c];
+  {
+    std::lock_guard<std::mutex> lk(d.mu);
+    for (size_t n = batch_of(c); n > 0 && d.free.head; n--) l.push(d.free.pop());
+  }
+  if (l.head) return;
+
+  const size_t bs = block_size(c);
+  const size_t slab = std::max(SlabPool::kSlabBytes, bs * 4);
+  auto* base = static_cast<char*>(::operator new(slab, std::align_val_t{SlabPool::kMinBlock}));
+  shared().slab_bytes.fetch_add(slab, std::memory_order_relaxed);
+  for (size_t off = slab; off >= bs; off -= bs) l.push(base + off - bs);
+}
+
+// Hand `n` blocks of `l` back to the depot.
+void give_back(size_t c, FreeList& l, size_t n) {
+  FreeList out;
+  while (n-- > 0 && l.head) out.push(l.pop());
+  if (!out.head) return;
+  Depot& d = shared().depots[c];
+  std::lock_guard<std::mutex> lk(d.mu);
+  while (out.head) d.free.push(out.pop());
+}
+
+// Per-thread free lists. A thread that exits returns them; frees that come later
+// from the same thread's teardown go straight to the depot.
+thread_local bool tcache_gone = false;
+
+struct ThreadCache {
+  std::array<FreeList, SlabPool::kClasses> lists;
+  ~ThreadCache() {
+    tcache_gone = true;
+    for (size_t c = 0; c < lists.size(); c++) give_back(c, lists[c], lists[c].count);
+  }
+};
+
+thread_local ThreadCache tcache;
+
+constexpr std::align_val_t large_align(size_t align) {
+  return std::align_val_t{std::max(align, alignof(std::max_align_t))};
+}
+
+} // namespace
+
+void* SlabPool::do_allocate(size_t bytes, size_t align) {
+  if (bytes > kMaxBlock || align > kMinBlock) {
+    shared().large_allocs.fetch_add(1, std::memory_order_relaxed);
+    return ::operator new(bytes, large_align(align));
+  }
+  const size_t c = class_of(bytes);
+  if (tcache_gone) {
+    FreeList one;
+    refill(c, one);
+    void* p = one.pop();
+    give_back(c, one, one.count);
+    return p;
+  }
+  FreeList& l = tcache.lists[c];
+  if (!l.head) refill(c, l);
+  return l.pop();
+}
+
+void SlabPool::do_deallocate(void* p, size_t bytes, size_t align) {
+  if (bytes > kMaxBlock || align > kMinBlock) {
+    ::operator delete(p, large_align(align));
+    return;
+  }
+  const size_t c = class_of(bytes);
+  if (tcache_gone) {
+    FreeList one;
+    one.push(p);
+    give_back(c, one, 1);
+    return;
+  }
+  FreeList& l = tcache.lists[c];
+  l.push(p);
+  if (l.count >= 2 * batch_of(c)) give_back(c, l, batch_of(c));
+}
+
+SlabPool::Stats SlabPool::stats() const {
+  Stats s;
+  s.slab_bytes = shared().slab_bytes.load(std::memory_order_relaxed);
+  s.large_allocs = shared().large_allocs.load(std::memory_order_relaxed);
+  return s;
+}
+
+SlabPool* slab_pool() {
+  static SlabPool* p = new SlabPool(); // never destroyed: frees may arrive during static teardown
+  return p;
+}
+
+} // namespace cc50
@@ -0,0 +1,511 @@
+#include "cc50/transport/io_uring_transport.hpp"
+#include "cc50/protocol.hpp"
+
+#include <arpa/inet.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+
+namespace cc50 {
+
+namespace {
+constexpr unsigned kRingEntries = 1024;
+constexpr unsigned kBufCount    = 512;       // provided recv buffers (power of two)
+constexpr size_t kBufSize       = 16 * 1024;
+constexpr int kBufGroup         = 0;
+
+// user_data: connection id above the low 8 bits, operation in them
+enum Op : uint64_t { kOpAccept = 1, kOpWake = 2, kOpRecv = 3, kOpSend = 4 };
+
+constexpr uint64_t tag(ConnId id, Op op) { return (id << 8) | op; }
+}  // namespace
+
+IoUringTransport::IoUringTransport() {
+  wake_fd_ = ::eventfd(0, EFD_CLOEXEC);
+}
+
+IoUringTransport::~IoUringTransport() {
+  for (auto& [id, c] : conns_) {
+    (void)id;
+    if (c->fd >= 0) ::close(c->fd);
+  }
+  conns_.clear();
+  if (listen_fd_ >= 0) ::close(listen_fd_);
+  if (ring_ok_) {
+    if (br_) io_uring_free_buf_ring(&ring_, br_, kBufCount, kBufGroup);
+    io_uring_queue_exit(&ring_);
+  }
+  std::free(bufs_);
+  if (wake_fd_ >= 0) ::close(wake_fd_);
+}
+
+Status IoUringTransport::init_ring() {
+  if (wake_fd_ < 0) return Status::Err(std::string("eventfd failed: ") + std::strerror(errno));
+
+  io_uring_params p{};
+  p.flags = IORING_SETUP_SUBMIT_ALL | IORING_SETUP_COOP_TASKRUN;
+  int rc = io_uring_queue_init_params(kRingEntries, &ring_, &p);
+  if (rc == -EINVAL) {
+    // kernels before 5.19 reject these flags; they are optimizations only
+    p = io_uring_params{};
+    rc = io_uring_queue_init_params(kRingEntries, &ring_, &p);
+  }
+  if (rc < 0) return Status::Err(std::string("io_uring_queue_init failed: ") + std::strerror(-rc));
+  ring_ok_ = true;
+
+  br_ = io_uring_setup_buf_ring(&ring_, kBufCount, kBufGroup, 0, &rc);
+  if (!br_) {
+    return Status::Err(std::string("io_uring provided buffer ring unavailable (kernel >= 5.19 needed): ") +
+                       std::strerror(-rc));
+  }
+  bufs_ = (uint8_t*)std::aligned_alloc(4096, kBufCount * kBufSize);
+  if (!bufs_) return Status::Err("out of memory for recv buffers");
+  for (unsigned i = 0; i < kBufCount; i++) {
+    io_uring_buf_ring_add(br_, bufs_ + i * kBufSize, kBufSize, (unsigned short)i,
+                          io_uring_buf_ring_mask(kBufCount), (int)i);
+  }
+  io_uring_buf_ring_advance(br_, (int)kBufCount);
+
+  arm_wake();
+  return Status::Ok();
+}
+
+Status IoUringTransport::make_listen_socket(const std::string& host, uint16_t port) {
+  listen_fd_ = ::socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+  if (listen_fd_ < 0) {
+    return Status::Err(std::string("socket failed: ") + std::strerror(errno));
+  }
+
+  int reuse = 1;
+  ::setsockopt(listen_fd_, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
+  // inherited by accepted sockets
+  auto st = apply_socket_options(listen_fd_, opt_.sock);
+  if (!st.ok) return st;
+
+  sockaddr_in addr{};
+  addr.sin_family = AF_INET;
+  addr.sin_port   = htons(port);
+  if (::inet_pton(AF_INET, host.c_str(), &addr.sin_addr) != 1) {
+    return Status::Err("inet_pton failed for: " + host);
+  }
+  if (::bind(listen_fd_, (sockaddr*)&addr, sizeof(addr)) < 0) {
+    return Status::Err(std::string("bind failed: ") + std::strerror(errno));
+  }
+  if (::listen(listen_fd_, std::max(1, opt_.listen_backlog)) < 0) {
+    return Status::Err(std::string("listen failed: ") + std::strerror(errno));
+  }
+  arm_accept();
+  return Status::Ok();
+}
+
+io_uring_sqe* IoUringTransport::get_sqe() {
+  io_uring_sqe* sqe = io_uring_get_sqe(&ring_);
+  if (!sqe) {
+    // SQ full: hand what we have to the kernel and take a fresh slot
+    io_uring_submit(&ring_);
+    sqe = io_uring_get_sqe(&ring_);
+  }
+  return sqe;
+}
+
+void IoUringTransport::arm_accept() {
+  io_uring_sqe* sqe = get_sqe();
+  io_uring_prep_multishot_accept(sqe, listen_fd_, nullptr, nullptr, SOCK_CLOEXEC);
+  io_uring_sqe_set_data64(sqe, tag(0, kOpAccept));
+}
+
+void IoUringTransport::arm_wake() {
+  io_uring_sqe* sqe = get_sqe();
+  io_uring_prep_read(sqe, wake_fd_, &wake_val_, sizeof(wake_val_), 0);
+  io_uring_sqe_set_data64(sqe, tag(0, kOpWake));
+}
+
+void IoUringTransport::arm_recv(Conn& c) {
+  io_uring_sqe* sqe = get_sqe();
+  io_uring_prep_recv_multishot(sqe, c.fd, nullptr, 0, 0);
+  sqe->flags |= IOSQE_BUFFER_SELECT;
+  sqe->buf_group = kBufGroup;
+  io_uring_sqe_set_data64(sqe, tag(c.id, kOpRecv));
+  c.inflight++;
+}
+
+ConnId IoUringTransport::add_conn(int fd) {
+  auto c = std::make_unique<Conn>();
+  c->id = next_conn_id_++;
+  c->fd = fd;
+  metrics_.conns_open.inc();
+  Conn& ref = *c;
+  conns_.emplace(ref.id, std::move(c));
+  arm_recv(ref);
+  return ref.id;
+}
+
+void IoUringTransport::begin_close(Conn& c) {
+  if (c.closing) return;
+  c.closing = true;
+  // frames still queued are never sent (on_send stops counting once closing)
+  metrics_.tx_queued_bytes.add(-(int64_t)c.tx_bytes);
+  metrics_.conns_open.dec();
+  metrics_.conns_closed.inc();
+  // completes the multishot recv (res 0) and fails an in-flight send. The fd, the Conn
+  // and its tx frames (an in-flight sendmsg points into them) stay alive until the
+  // kernel is done with them, see maybe_free().
+  ::shutdown(c.fd, SHUT_RDWR);
+  if (peer_ == c.id) peer_ = kNoConn;
+  if (on_close_) on_close_(c.id);
+}
+
+// Called by progress() after each completion of the connection.
+void IoUringTransport::maybe_free(Conn& c) {
+  if (!c.closing || c.inflight > 0) return;
+  ::close(c.fd);
+  conns_.erase(c.id); // c is gone
+}
+
+void IoUringTransport::queue_send(Conn& c, TxFrame&& f) {
+  if (c.closing) return;
+  if (opt_.max_conn_tx_bytes && c.tx_bytes + f.size() > opt_.max_conn_tx_bytes) {
+    CC50_LOG_WARN("[transport] dropping slow consumer conn=" << c.id << " unsent_bytes=" << c.tx_bytes);
+    metrics_.slow_consumer_drops.inc();
+    begin_close(c);
+    return;
+  }
+  metrics_.frames_tx.inc();
+  size_t grown = 0;
+  if (c.peer_version >= kProtoVerBatch && merge_into_batch(c.tx, std::max<size_t>(c.tx_locked, c.tx_off > 0), f, grown)) {
+    metrics_.batched_tx.inc();
+  } else {
+    grown = f.size();
+    c.tx.push_back(std::move(f));
+  }
+  metrics_.tx_queued_bytes.add((int64_t)grown);
+  c.tx_bytes += grown;
+  if (!c.dirty) {
+    c.dirty = true;
+    dirty_.push_back(c.id);
+  }
+}
+
+void IoUringTransport::flush_sends() {
+  for (ConnId id : dirty_) {
+    auto it = conns_.find(id);
+    if (it == conns_.end()) continue;
+    Conn& c = *it->second;
+    c.dirty = false;
+    if (c.sending || c.closing || c.tx.empty()) continue;
+
+    int niov = gather_tx(c.tx, c.tx_off, c.iov, (int)std::size(c.iov));
+    c.mh = msghdr{};
+    c.mh.msg_iov = c.iov;
+    c.mh.msg_iovlen = (size_t)niov;
+
+    io_uring_sqe* sqe = get_sqe();
+    io_uring_prep_sendmsg(sqe, c.fd, &c.mh, MSG_NOSIGNAL);
+    io_uring_sqe_set_data64(sqe, tag(c.id, kOpSend));
+    c.tx_locked = c.tx.size();
+    c.sending = true;
+    c.inflight++;
+  }
+  dirty_.clear();
+}
+
+void IoUringTransport::on_send(Conn& c, const io_uring_cqe& cqe) {
+  c.sending = false;
+  c.tx_locked = 0;
+  if (c.closing) return;
+  if (cqe.res < 0) {
+    if (cqe.res == -EINTR || cqe.res == -EAGAIN) {
+      c.dirty = true;
+      dirty_.push_back(c.id);
+      return;
+    }
+    // the peer reset the connection: drop it like a hangup
+    begin_close(c);
+    return;
+  }
+  metrics_.bytes_tx.inc((uint64_t)cqe.res);
+  metrics_.tx_queued_bytes.add(-(int64_t)cqe.res);
+  c.tx_bytes -= (size_t)cqe.res;
+  retire_tx(c.tx, c.tx_off, (size_t)cqe.res);
+  if (!c.tx.empty() && !c.dirty) {
+    // short write or frames queued meanwhile: go again
+    c.dirty = true;
+    dirty_.push_back(c.id);
+  }
+}
+
+void IoUringTransport::recycle_buffer(uint16_t bid) {
+  io_uring_buf_ring_add(br_, bufs_ + (size_t)bid * kBufSize, kBufSize, bid,
+                        io_uring_buf_ring_mask(kBufCount), 0);
+  io_uring_buf_ring_advance(br_, 1);
+}
+
+Status IoUringTransport::consume(Conn& c, const uint8_t* p, size_t n) {
+  // false for a malformed RESP_BATCH
+  auto dispatch = [&](const uint8_t* frame, const MsgHeader& h) {
+    IncomingMessage msg{};
+    msg.conn    = c.id;
+    msg.req_id  = h.req_id;
+    msg.type    = h.type;
+    msg.version = h.version;
+    msg.payload = std::span<const uint8_t>(frame + sizeof(MsgHeader), h.length);
+    c.peer_version = std::max(c.peer_version, h.version);
+    metrics_.frames_rx.inc();
+    metrics_.bytes_rx.inc(sizeof(MsgHeader) + h.length);
+    if (h.type == (uint16_t)MsgType::RESP_BATCH) {
+      // handed out one message per entry, as if each had its own frame
+      return for_each_batch_entry(msg.payload, [&](uint64_t req_id, uint16_t type, std::span<const uint8_t> pl) {
+        IncomingMessage m = msg;
+        m.req_id = req_id;
+        m.type = type;
+        m.payload = pl;
+        if (on_msg_) on_msg_(m);
+      });
+    }
+    if (on_msg_) on_msg_(msg);
+    return true;
+  };
+  auto bad = [&](const MsgHeader& h) {
+    return h.magic != kMagic || h.length > opt_.max_frame_bytes;
+  };
+  auto corrupt = [&](const char* why) {
+    // a corrupt stream cannot be resynchronized: drop the connection
+    metrics_.corrupt_streams.inc();
+    begin_close(c);
+    return is_server_ ? Status::Ok() : Status::Err(why);
+  };
+  auto why = [](const MsgHeader& h) { return h.magic != kMagic ? "bad magic" : "frame too large"; };
+
+  // finish a frame that started in an earlier buffer
+  if (c.rx_wr > c.rx_rd) {
+    size_t have = c.rx_wr - c.rx_rd;
+    if (have < sizeof(MsgHeader)) {
+      size_t take = std::min(n, sizeof(MsgHeader) - have);
+      if (c.rx.size() < c.rx_wr + take) c.rx.resize(c.rx_wr + take);
+      std::memcpy(c.rx.data() + c.rx_wr, p, take);
+      c.rx_wr += take;
+      p += take;
+      n -= take;
+      have += take;
+      if (have < sizeof(MsgHeader)) return Status::Ok();
+    }
+    MsgHeader h{};
+    std::memcpy(&h, c.rx.data() + c.rx_rd, sizeof(h));
+    if (bad(h)) return corrupt(why(h));
+    const size_t need = sizeof(MsgHeader) + h.length;
+    const size_t take = std::min(n, need - have);
+    if (c.rx.size() < c.rx_rd + need) c.rx.resize(c.rx_rd + need);
+    std::memcpy(c.rx.data() + c.rx_wr, p, take);
+    c.rx_wr += take;
+    p += take;
+    n -= take;
+    if (c.rx_wr - c.rx_rd < need) return Status::Ok();
+    const bool ok = dispatch(c.rx.data() + c.rx_rd, h);
+    c.rx_rd = c.rx_wr = 0;
+    if (c.rx.size() > (1u << 20)) {
+      c.rx.clear();
+      c.rx.shrink_to_fit();
+    }
+    if (!ok) return corrupt("malformed RESP_BATCH");
+    if (c.closing) return Status::Ok();
+  }
+
+  // whole frames are handed out of the provided buffer without a copy
+  while (n >= sizeof(MsgHeader)) {
+    MsgHeader h{};
+    std::memcpy(&h, p, sizeof(h));
+    if (bad(h)) return corrupt(why(h));
+    const size_t need = sizeof(MsgHeader) + h.length;
+    if (n < need) break;
+    if (!dispatch(p, h)) return corrupt("malformed RESP_BATCH");
+    p += need;
+    n -= need;
+    if (c.closing) return Status::Ok();
+  }
+
+  // keep the partial tail; reserve the full frame once its header is known
+  if (n > 0) {
+    size_t want = n;
+    if (n >= sizeof(MsgHeader)) {
+      MsgHeader h{};
+      std::memcpy(&h, p, sizeof(h));
+      want = sizeof(MsgHeader) + h.length;
+    }
+    if (c.rx.size() < want) c.rx.resize(want);
+    std::memcpy(c.rx.data(), p, n);
+    c.rx_rd = 0;
+    c.rx_wr = n;
+  }
+  return Status::Ok();
+}
+
+Status IoUringTransport::on_recv(Conn& c, const io_uring_cqe& cqe) {
+  const bool more = cqe.flags & IORING_CQE_F_MORE;
+  if (!more) c.inflight--;
+
+  Status st = Status::Ok();
+  if (cqe.res > 0) {
+    const uint16_t bid = (uint16_t)(cqe.flags >> IORING_CQE_BUFFER_SHIFT);
+    if (!c.closing) st = consume(c, bufs_ + (size_t)bid * kBufSize, (size_t)cqe.res);
+    recycle_buffer(bid);
+    if (!c.closing) rearm_quickack(c.fd, opt_.sock);
+    if (!more && !c.closing) arm_recv(c);
+  } else if (cqe.res == -ENOBUFS) {
+    // every provided buffer is in use; they come back as completions are handled
+    if (!more && !c.closing) arm_recv(c);
+  } else if (!c.closing) {
+    // 0: peer closed; < 0: connection error
+    const bool peer_closed = cqe.res == 0;
+    begin_close(c);
+    if (!is_server_) st = Status::Err(peer_closed ? "peer closed" : std::string("recv failed: ") + std::strerror(-cqe.res));
+  }
+  return st;
+}
+
+Status IoUringTransport::on_accept(const io_uring_cqe& cqe) {
+  if (!(cqe.flags & IORING_CQE_F_MORE)) arm_accept();
+  if (cqe.res < 0) {
+    if (cqe.res == -EINTR || cqe.res == -EAGAIN || cqe.res == -ECONNABORTED) return Status::Ok();
+    return Status::Err(std::string("accept failed: ") + std::strerror(-cqe.res));
+  }
+  rearm_quickack(cqe.res, opt_.sock);
+  metrics_.conns_accepted.inc();
+  add_conn(cqe.res);
+  return Status::Ok();
+}
+
+void IoUringTransport::drain_outbound() {
+  wake_pending_.store(false, std::memory_order_seq_cst);
+  arm_wake();
+
+  OutFrame f;
+  while (outq_.pop(f)) {
+    ConnId id = (f.conn == kNoConn) ? peer_ : f.conn;
+    auto it = conns_.find(id);
+    if (it == conns_.end()) continue; // peer went away: drop
+    queue_send(*it->second, std::move(f.frame));
+  }
+}
+
+Status IoUringTransport::start_server(const TransportOptions& opt, MessageHandler on_msg) {
+  is_server_ = true;
+  opt_       = opt;
+  on_msg_    = std::move(on_msg);
+  if (opt.metrics) metrics_.register_with(*opt.metrics, "io_uring");
+
+  auto st = init_ring();
+  if (!st.ok) return st;
+  st = make_listen_socket(opt.listen_host, opt.listen_port);
+  if (!st.ok) return st;
+  io_uring_submit(&ring_);
+  return Status::Ok();
+}
+
+Status IoUringTransport::start_client(const TransportOptions& opt, MessageHandler on_msg) {
+  is_server_ = false;
+  opt_       = opt;
+  on_msg_    = std::move(on_msg);
+
+  auto st = init_ring();
+  if (!st.ok) return st;
+
+  int fd = ::socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+  if (fd < 0) {
+    return Status::Err(std::string("socket failed: ") + std::strerror(errno));
+  }
+  st = apply_socket_options(fd, opt.sock);
+  if (!st.ok) {
+    ::close(fd);
+    return st;
+  }
+
+  sockaddr_in addr{};
+  addr.sin_family = AF_INET;
+  addr.sin_port   = htons(opt.server_port);
+  if (::inet_pton(AF_INET, opt.server_host.c_str(), &addr.sin_addr) != 1) {
+    ::close(fd);
+    return Status::Err("inet_pton failed for: " + opt.server_host);
+  }
+  if (::connect(fd, (sockaddr*)&addr, sizeof(addr)) < 0) {
+    ::close(fd);
+    return Status::Err(std::string("connect failed: ") + std::strerror(errno));
+  }
+
+  peer_ = add_conn(fd);
+  io_uring_submit(&ring_);
+  return Status::Ok();
+}
+
+Status IoUringTransport::send(ConnId conn, uint64_t req_id, uint16_t type, const uint8_t* data, size_t len) {
+  if (!ring_ok_ || wake_fd_ < 0) return Status::Err("io_uring not started");
+
+  OutFrame f{};
+  f.conn = conn;
+  f.frame = make_tx_frame(req_id, type, data, len);
+  outq_.push(std::move(f));
+
+  // one eventfd write per batch: the loop clears the flag before draining
+  if (wake_pending_.exchange(true, std::memory_order_acq_rel)) return Status::Ok();
+  uint64_t one = 1;
+  ssize_t n = ::write(wake_fd_, &one, sizeof(one));
+  (void)n;
+  return Status::Ok();
+}
+
+Status IoUringTransport::progress(int timeout_ms) {
+  if (!ring_ok_) return Status::Err("io_uring not started");
+  if (!fatal_.ok) return fatal_;
+
+  // queued sends go out with the same syscall that waits for completions
+  flush_sends();
+
+  io_uring_cqe* cqe = nullptr;
+  __kernel_timespec ts{};
+  ts.tv_sec  = timeout_ms / 1000;
+  ts.tv_nsec = (long long)(timeout_ms % 1000) * 1000000;
+  int rc = io_uring_submit_and_wait_timeout(&ring_, &cqe, 1, timeout_ms >= 0 ? &ts : nullptr, nullptr);
+  if (rc < 0 && rc != -ETIME && rc != -EINTR && rc != -EBUSY) {
+    return Status::Err(std::string("io_uring wait failed: ") + std::strerror(-rc));
+  }
+
+  unsigned head;
+  unsigned seen = 0;
+  io_uring_for_each_cqe(&ring_, head, cqe) {
+    seen++;
+    const uint64_t ud = io_uring_cqe_get_data64(cqe);
+    const Op op = (Op)(ud & 0xff);
+    const ConnId id = ud >> 8;
+    Status st = Status::Ok();
+
+    if (op == kOpAccept) {
+      st = on_accept(*cqe);
+    } else if (op == kOpWake) {
+      drain_outbound();
+    } else {
+      auto it = conns_.find(id);
+      if (it == conns_.end()) continue;
+      Conn& c = *it->second;
+      if (op == kOpRecv) {
+        st = on_recv(c, *cqe);
+      } else {
+        c.inflight--;
+        on_send(c, *cqe);
+      }
+      maybe_free(c);
+    }
+    if (!st.ok && fatal_.ok) fatal_ = st;
+  }
+  io_uring_cq_advance(&ring_, seen);
+
+  // replies produced by handlers in this batch are submitted right away
+  flush_sends();
+  if (io_uring_sq_ready(&ring_) > 0) io_uring_submit(&ring_);
+  return fatal_;
+}
+
+}  // namespace cc50
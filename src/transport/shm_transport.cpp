@@ -0,0 +1,582 @@
+#include "cc50/transport/shm_transport.hpp"
+#include "cc50/transport/unix_transport.hpp"
+#include "cc50/protocol.hpp"
+
+#include <fcntl.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <bit>
+#include <cstring>
+#include <new>
+
+namespace cc50 {
+
+// Positions count bytes ever written / consumed, so head - tail is the fill level and
+// neither wraps in practice. Each side only stores the fields it owns.
+struct ShmRing {
+  alignas(64) std::atomic<uint64_t> head{0};          // writer
+  alignas(64) std::atomic<uint64_t> tail{0};          // reader
+  alignas(64) std::atomic<uint32_t> reader_asleep{1}; // reader: kick me when head moves
+  std::atomic<uint32_t> writer_blocked{0};            // writer: kick me when tail moves
+};
+static_assert(std::atomic<uint64_t>::is_always_lock_free && std::atomic<uint32_t>::is_always_lock_free,
+              "ring positions are shared between processes");
+
+namespace {
+
+constexpr uint32_t kShmMagic   = 0x4d485343; // "CSHM"
+constexpr uint32_t kShmVersion = 1;
+constexpr uint64_t kMinRing    = 64u << 10;
+constexpr uint64_t kMaxRing    = 1ull << 30;
+constexpr size_t kStageKeepBytes = 1u << 20; // staging buffers larger than this are shrunk
+constexpr int kSetupTimeoutMs  = 5000;
+
+struct ShmSegment {
+  uint32_t magic{kShmMagic};
+  uint32_t version{kShmVersion};
+  uint64_t ring_bytes{0};
+  ShmRing ring[2];  // [0] client -> server, [1] server -> client
+};
+constexpr size_t kDataOff = (sizeof(ShmSegment) + 4095) & ~size_t{4095};
+
+// The server's answer to a connect; carries [memfd, client wake fd, server wake fd].
+struct ShmHello {
+  uint32_t magic{kShmMagic};
+  uint32_t version{kShmVersion};
+  uint64_t ring_bytes{0};
+};
+constexpr int kHelloFds = 3;
+
+// epoll tags for the non-connection fds; connection ids (even, from 16) start above them
+constexpr uint64_t kListenTag = 1;
+constexpr uint64_t kWakeTag   = 2;
+
+Status add_epoll_fd(int ep, int fd, uint64_t tag, uint32_t events) {
+  epoll_event ev{};
+  ev.events  = events;
+  ev.data.u64 = tag;
+  if (epoll_ctl(ep, EPOLL_CTL_ADD, fd, &ev) < 0) {
+    return Status::Err(std::string("epoll_ctl add failed: ") + std::strerror(errno));
+  }
+  return Status::Ok();
+}
+
+void kick(int fd) {
+  uint64_t one = 1;
+  ssize_t n = ::write(fd, &one, sizeof(one));
+  (void)n;
+}
+
+void ring_put(uint8_t* data, uint64_t cap, uint64_t pos, const uint8_t* src, size_t n) {
+  const size_t off = (size_t)(pos & (cap - 1));
+  const size_t first = std::min<size_t>(n, (size_t)cap - off);
+  std::memcpy(data + off, src, first);
+  std::memcpy(data, src + first, n - first);
+}
+
+void ring_get(const uint8_t* data, uint64_t cap, uint64_t pos, uint8_t* dst, size_t n) {
+  const size_t off = (size_t)(pos & (cap - 1));
+  const size_t first = std::min<size_t>(n, (size_t)cap - off);
+  std::memcpy(dst, data + off, first);
+  std::memcpy(dst + first, data, n - first);
+}
+
+bool header_ok(const MsgHeader& h, size_t max_frame, const char*& why) {
+  if (h.magic != kMagic) why = "bad magic";
+  else if (h.length > max_frame) why = "frame too large";
+  else return true;
+  return false;
+}
+
+}  // namespace
+
+ShmTransport::ShmTransport() {
+  ep_ = epoll_create1(EPOLL_CLOEXEC);
+  wake_fd_ = ::eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+  if (ep_ >= 0 && wake_fd_ >= 0 && !add_epoll_fd(ep_, wake_fd_, kWakeTag, EPOLLIN).ok) {
+    ::close(wake_fd_);
+    wake_fd_ = -1;
+  }
+}
+
+ShmTransport::~ShmTransport() {
+  for (auto& [id, c] : conns_) {
+    (void)id;
+    unmap(*c);
+  }
+  conns_.clear();
+  if (listen_fd_ >= 0) ::close(listen_fd_);
+  if (!unlink_path_.empty()) ::unlink(unlink_path_.c_str());
+  if (wake_fd_ >= 0) ::close(wake_fd_);
+  if (ep_ >= 0) ::close(ep_);
+}
+
+void ShmTransport::unmap(Conn& c) {
+  if (c.map) ::munmap(c.map, c.map_bytes);
+  c.map = nullptr;
+  for (int* fd : {&c.sock, &c.wake_fd, &c.peer_wake_fd}) {
+    if (*fd >= 0) ::close(*fd);
+    *fd = -1;
+  }
+}
+
+void ShmTransport::bind_rings(Conn& c) {
+  auto* seg = reinterpret_cast<ShmSegment*>(c.map);
+  uint8_t* c2s = c.map + kDataOff;
+  uint8_t* s2c = c2s + c.cap;
+  c.rx      = &seg->ring[is_server_ ? 0 : 1];
+  c.tx      = &seg->ring[is_server_ ? 1 : 0];
+  c.rx_data = is_server_ ? c2s : s2c;
+  c.tx_data = is_server_ ? s2c : c2s;
+  c.rx_tail = c.rx->tail.load(std::memory_order_acquire);
+  c.tx_head = c.tx->head.load(std::memory_order_acquire);
+}
+
+Status ShmTransport::create_segment(Conn& c) {
+  c.cap = std::bit_ceil(std::clamp<uint64_t>(opt_.shm_ring_bytes, kMinRing, kMaxRing));
+  c.map_bytes = kDataOff + 2 * c.cap;
+
+  int mfd = ::memfd_create("cc50-shm", MFD_CLOEXEC);
+  if (mfd < 0) return Status::Err(std::string("memfd_create failed: ") + std::strerror(errno));
+  Status st = Status::Ok();
+  if (::ftruncate(mfd, (off_t)c.map_bytes) < 0) {
+    st = Status::Err(std::string("ftruncate failed: ") + std::strerror(errno));
+  } else {
+    void* p = ::mmap(nullptr, c.map_bytes, PROT_READ | PROT_WRITE, MAP_SHARED, mfd, 0);
+    if (p == MAP_FAILED) st = Status::Err(std::string("mmap failed: ") + std::strerror(errno));
+    else c.map = static_cast<uint8_t*>(p);
+  }
+  if (st.ok) {
+    auto* seg = new (c.map) ShmSegment();
+    seg->ring_bytes = c.cap;
+    c.wake_fd = ::eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    c.peer_wake_fd = ::eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (c.wake_fd < 0 || c.peer_wake_fd < 0) st = Status::Err(std::string("eventfd failed: ") + std::strerror(errno));
+  }
+  if (st.ok) {
+    ShmHello hello;
+    hello.ring_bytes = c.cap;
+    iovec iov{&hello, sizeof(hello)};
+    alignas(cmsghdr) char ctl[CMSG_SPACE(kHelloFds * sizeof(int))] = {};
+    msghdr mh{};
+    mh.msg_iov = &iov;
+    mh.msg_iovlen = 1;
+    mh.msg_control = ctl;
+    mh.msg_controllen = sizeof(ctl);
+    cmsghdr* cm = CMSG_FIRSTHDR(&mh);
+    cm->cmsg_level = SOL_SOCKET;
+    cm->cmsg_type = SCM_RIGHTS;
+    cm->cmsg_len = CMSG_LEN(kHelloFds * sizeof(int));
+    const int fds[kHelloFds] = {mfd, c.peer_wake_fd, c.wake_fd};
+    std::memcpy(CMSG_DATA(cm), fds, sizeof(fds));
+    if (::sendmsg(c.sock, &mh, MSG_NOSIGNAL) != (ssize_t)sizeof(hello)) {
+      st = Status::Err(std::string("sending the segment failed: ") + std::strerror(errno));
+    }
+  }
+  ::close(mfd); // the mapping and the peer's copy keep it alive
+  if (st.ok) bind_rings(c);
+  return st;
+}
+
+Status ShmTransport::attach_segment(Conn& c) {
+  timeval tv{kSetupTimeoutMs / 1000, 0};
+  ::setsockopt(c.sock, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+
+  ShmHello hello;
+  iovec iov{&hello, sizeof(hello)};
+  alignas(cmsghdr) char ctl[CMSG_SPACE(kHelloFds * sizeof(int))] = {};
+  msghdr mh{};
+  mh.msg_iov = &iov;
+  mh.msg_iovlen = 1;
+  mh.msg_control = ctl;
+  mh.msg_controllen = sizeof(ctl);
+  ssize_t n = ::recvmsg(c.sock, &mh, MSG_CMSG_CLOEXEC);
+  if (n < 0) return Status::Err(std::string("waiting for the segment failed: ") + std::strerror(errno));
+
+  int fds[kHelloFds] = {-1, -1, -1};
+  cmsghdr* cm = CMSG_FIRSTHDR(&mh);
+  if (cm && cm->cmsg_level == SOL_SOCKET && cm->cmsg_type == SCM_RIGHTS &&
+      cm->cmsg_len == CMSG_LEN(kHelloFds * sizeof(int))) {
+    std::memcpy(fds, CMSG_DATA(cm), sizeof(fds));
+  }
+  const int mfd = fds[0];
+  c.wake_fd = fds[1];
+  c.peer_wake_fd = fds[2];
+
+  Status st = Status::Ok();
+  struct stat sb{};
+  if (n != (ssize_t)sizeof(hello) || mfd < 0 || c.wake_fd < 0 || c.peer_wake_fd < 0 ||
+      (mh.msg_flags & (MSG_TRUNC | MSG_CTRUNC)) != 0) {
+    st = Status::Err("bad answer from the server (is it running --transport=shm?)");
+  } else if (hello.magic != kShmMagic || hello.version != kShmVersion) {
+    st = Status::Err("unsupported shared-memory segment version " + std::to_string(hello.version));
+  } else if (!std::has_single_bit(hello.ring_bytes) || hello.ring_bytes < kMinRing || hello.ring_bytes > kMaxRing ||
+             ::fstat(mfd, &sb) < 0 || (uint64_t)sb.st_size != kDataOff + 2 * hello.ring_bytes) {
+    st = Status::Err("shared-memory segment has an unexpected size");
+  } else {
+    c.cap = hello.ring_bytes;
+    c.map_bytes = kDataOff + 2 * c.cap;
+    void* p = ::mmap(nullptr, c.map_bytes, PROT_READ | PROT_WRITE, MAP_SHARED, mfd, 0);
+    if (p == MAP_FAILED) st = Status::Err(std::string("mmap failed: ") + std::strerror(errno));
+    else c.map = static_cast<uint8_t*>(p);
+  }
+  if (mfd >= 0) ::close(mfd);
+  if (st.ok) bind_rings(c);
+  return st;
+}
+
+Status ShmTransport::add_conn(std::unique_ptr<Conn> c) {
+  c->id = next_conn_id_;
+  next_conn_id_ += 2;
+  const ConnId id = c->id;
+  auto st = add_epoll_fd(ep_, c->wake_fd, id, EPOLLIN);
+  if (st.ok) st = add_epoll_fd(ep_, c->sock, id | 1, EPOLLIN | EPOLLRDHUP);
+  conns_.emplace(id, std::move(c));
+  metrics_.conns_open.inc();
+  if (!st.ok) {
+    close_conn(id);
+    return st;
+  }
+  if (!is_server_) peer_ = id;
+  return Status::Ok();
+}
+
+void ShmTransport::close_conn(ConnId id) {
+  auto it = conns_.find(id);
+  if (it == conns_.end()) return;
+  unmap(*it->second);
+  metrics_.tx_queued_bytes.add(-(int64_t)it->second->tx_bytes);
+  metrics_.conns_open.dec();
+  metrics_.conns_closed.inc();
+  conns_.erase(it);
+  if (peer_ == id) peer_ = kNoConn;
+  if (on_close_) on_close_(id);
+}
+
+Status ShmTransport::accept_new() {
+  while (true) {
+    int cfd = ::accept4(listen_fd_, nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC);
+    if (cfd < 0) {
+      if (errno == EAGAIN || errno == EWOULDBLOCK) return Status::Ok();
+      if (errno == EINTR || errno == ECONNABORTED) continue;
+      return Status::Err(std::string("accept failed: ") + std::strerror(errno));
+    }
+    metrics_.conns_accepted.inc();
+    auto c = std::make_unique<Conn>();
+    c->sock = cfd;
+    auto st = create_segment(*c);
+    if (!st.ok) {
+      // this client goes away; the listener keeps serving others
+      CC50_LOG_WARN("[transport] shm connection setup failed: " << st.msg);
+      unmap(*c);
+      continue;
+    }
+    st = add_conn(std::move(c));
+    if (!st.ok) return st;
+  }
+}
+
+Status ShmTransport::start_server(const TransportOptions& opt, MessageHandler on_msg) {
+  if (ep_ < 0 || wake_fd_ < 0) return Status::Err("epoll not available");
+  is_server_ = true;
+  opt_       = opt;
+  on_msg_    = std::move(on_msg);
+  if (opt.metrics) metrics_.register_with(*opt.metrics, "shm");
+
+  auto st = listen_seqpacket(opt.unix_path, opt.listen_backlog, listen_fd_);
+  if (!st.ok) return st;
+  if (opt.unix_path[0] != '@') unlink_path_ = opt.unix_path;
+  return add_epoll_fd(ep_, listen_fd_, kListenTag, EPOLLIN);
+}
+
+Status ShmTransport::start_client(const TransportOptions& opt, MessageHandler on_msg) {
+  if (ep_ < 0 || wake_fd_ < 0) return Status::Err("epoll not available");
+  is_server_ = false;
+  opt_       = opt;
+  on_msg_    = std::move(on_msg);
+
+  auto c = std::make_unique<Conn>();
+  auto st = connect_seqpacket(opt.unix_path, c->sock);
+  if (st.ok) st = attach_segment(*c);
+  if (st.ok && ::fcntl(c->sock, F_SETFL, ::fcntl(c->sock, F_GETFL, 0) | O_NONBLOCK) < 0) {
+    st = Status::Err(std::string("failed to set non-blocking: ") + std::strerror(errno));
+  }
+  if (!st.ok) {
+    unmap(*c);
+    return st;
+  }
+  return add_conn(std::move(c));
+}
+
+Status ShmTransport::send(ConnId conn, uint64_t req_id, uint16_t type, const uint8_t* data, size_t len) {
+  if (ep_ < 0 || wake_fd_ < 0) return Status::Err("epoll not available");
+  OutFrame f{};
+  f.conn = conn;
+  f.frame = make_tx_frame(req_id, type, data, len);
+  outq_.push(std::move(f));
+  wake();
+  return Status::Ok();
+}
+
+void ShmTransport::wake() {
+  if (wake_pending_.exchange(true, std::memory_order_acq_rel)) return;
+  kick(wake_fd_);
+}
+
+void ShmTransport::queue_send(ConnId id, TxFrame&& f) {
+  auto it = conns_.find(id);
+  if (it == conns_.end()) return; // peer went away: drop
+  Conn& c = *it->second;
+
+  if (opt_.max_conn_tx_bytes && c.tx_bytes + f.size() > opt_.max_conn_tx_bytes) {
+    CC50_LOG_WARN("[transport] dropping slow consumer conn=" << id << " unsent_bytes=" << c.tx_bytes);
+    metrics_.slow_consumer_drops.inc();
+    close_conn(id);
+    return;
+  }
+  metrics_.frames_tx.inc();
+  size_t grown = 0;
+  if (c.peer_version >= kProtoVerBatch && merge_into_batch(c.txq, c.tx_off > 0 ? 1 : 0, f, grown)) {
+    metrics_.batched_tx.inc();
+  } else {
+    grown = f.size();
+    c.txq.push_back(std::move(f));
+  }
+  metrics_.tx_queued_bytes.add((int64_t)grown);
+  c.tx_bytes += grown;
+
+  if (!c.dirty) {
+    c.dirty = true;
+    dirty_.push_back(id);
+  }
+}
+
+Status ShmTransport::drain_outbound() {
+  uint64_t cnt = 0;
+  ssize_t n = ::read(wake_fd_, &cnt, sizeof(cnt));
+  (void)n;
+  wake_pending_.store(false, std::memory_order_seq_cst);
+
+  OutFrame f;
+  while (outq_.pop(f)) queue_send(f.conn == kNoConn ? peer_ : f.conn, std::move(f.frame));
+
+  Status st = Status::Ok();
+  for (ConnId id : dirty_) {
+    auto it = conns_.find(id);
+    if (it == conns_.end()) continue;
+    it->second->dirty = false;
+    const char* why = nullptr;
+    if (flush_tx(*it->second, why)) continue;
+    metrics_.corrupt_streams.inc();
+    close_conn(id);
+    if (!is_server_) st = Status::Err(why);
+  }
+  dirty_.clear();
+  return st;
+}
+
+bool ShmTransport::flush_tx(Conn& c, const char*& why) {
+  bool wrote = false;
+  bool asked = false;
+  while (!c.txq.empty()) {
+    const uint64_t used = c.tx_head - c.tx->tail.load(std::memory_order_acquire);
+    if (used > c.cap) {
+      why = "ring tail out of range";
+      return false;
+    }
+    if (used == c.cap) {
+      if (asked) break;
+      // full: ask for a kick, then look once more in case room was made meanwhile
+      c.tx->writer_blocked.store(1, std::memory_order_seq_cst);
+      std::atomic_thread_fence(std::memory_order_seq_cst);
+      asked = true;
+      continue;
+    }
+
+    size_t room = (size_t)(c.cap - used);
+    iovec iov[64];
+    const int niov = gather_tx(c.txq, c.tx_off, iov, (int)std::size(iov));
+    size_t put = 0;
+    for (int i = 0; i < niov && room > 0; i++) {
+      const size_t k = std::min(room, iov[i].iov_len);
+      ring_put(c.tx_data, c.cap, c.tx_head + put, (const uint8_t*)iov[i].iov_base, k);
+      put += k;
+      room -= k;
+    }
+    c.tx_head += put;
+    c.tx->head.store(c.tx_head, std::memory_order_release);
+    wrote = true;
+
+    metrics_.bytes_tx.inc(put);
+    metrics_.tx_queued_bytes.add(-(int64_t)put);
+    c.tx_bytes -= put;
+    retire_tx(c.txq, c.tx_off, put);
+  }
+
+  // pairs with the reader's store of reader_asleep before its last look at head
+  if (wrote) {
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if (c.tx->reader_asleep.load(std::memory_order_relaxed) && c.tx->reader_asleep.exchange(0)) {
+      kick(c.peer_wake_fd);
+    }
+  }
+  return true;
+}
+
+bool ShmTransport::deliver(Conn& c, const MsgHeader& h, const uint8_t* payload) {
+  IncomingMessage msg{};
+  msg.conn    = c.id;
+  msg.req_id  = h.req_id;
+  msg.type    = h.type;
+  msg.version = h.version;
+  msg.payload = std::span<const uint8_t>(payload, h.length);
+  c.peer_version = std::max(c.peer_version, h.version);
+
+  metrics_.frames_rx.inc();
+  metrics_.bytes_rx.inc(sizeof(MsgHeader) + h.length);
+  if (h.type == (uint16_t)MsgType::RESP_BATCH) {
+    return for_each_batch_entry(msg.payload, [&](uint64_t req_id, uint16_t type, std::span<const uint8_t> p) {
+      IncomingMessage m = msg;
+      m.req_id = req_id;
+      m.type = type;
+      m.payload = p;
+      if (on_msg_) on_msg_(m);
+    });
+  }
+  if (on_msg_) on_msg_(msg);
+  return true;
+}
+
+bool ShmTransport::drain_rx(Conn& c, const char*& why) {
+  bool consumed = false;
+  while (true) {
+    const uint64_t avail = c.rx->head.load(std::memory_order_acquire) - c.rx_tail;
+    if (avail == 0) break;
+    if (avail > c.cap) {
+      why = "ring head out of range";
+      return false;
+    }
+    consumed = true;
+
+    if (c.stage.empty() && avail >= sizeof(MsgHeader)) {
+      MsgHeader h{};
+      ring_get(c.rx_data, c.cap, c.rx_tail, (uint8_t*)&h, sizeof(h));
+      if (!header_ok(h, opt_.max_frame_bytes, why)) return false;
+      const size_t need = sizeof(MsgHeader) + h.length;
+      const size_t off = (size_t)(c.rx_tail & (c.cap - 1));
+      if (need <= avail && off + need <= c.cap) {
+        // whole and contiguous: handed out in place, released once the handler is done
+        if (!deliver(c, h, c.rx_data + off + sizeof(MsgHeader))) {
+          why = "malformed RESP_BATCH";
+          return false;
+        }
+        c.rx_tail += need;
+        c.rx->tail.store(c.rx_tail, std::memory_order_release);
+        continue;
+      }
+    }
+
+    // copy out the current frame: its header first, then up to the end of its payload
+    const size_t want = c.stage_need ? c.stage_need - c.stage.size() : sizeof(MsgHeader) - c.stage.size();
+    const size_t n = (size_t)std::min<uint64_t>(avail, want);
+    const size_t at = c.stage.size();
+    c.stage.resize(at + n);
+    ring_get(c.rx_data, c.cap, c.rx_tail, c.stage.data() + at, n);
+    c.rx_tail += n;
+    c.rx->tail.store(c.rx_tail, std::memory_order_release);
+
+    if (!c.stage_need && c.stage.size() == sizeof(MsgHeader)) {
+      std::memcpy(&c.stage_hdr, c.stage.data(), sizeof(MsgHeader));
+      if (!header_ok(c.stage_hdr, opt_.max_frame_bytes, why)) return false;
+      c.stage_need = sizeof(MsgHeader) + c.stage_hdr.length;
+      c.stage.reserve(c.stage_need);
+    }
+    if (c.stage_need && c.stage.size() == c.stage_need) {
+      const bool ok = deliver(c, c.stage_hdr, c.stage.data() + sizeof(MsgHeader));
+      c.stage.clear();
+      c.stage_need = 0;
+      if (c.stage.capacity() > kStageKeepBytes) c.stage.shrink_to_fit(); // a one-off huge frame
+      if (!ok) {
+        why = "malformed RESP_BATCH";
+        return false;
+      }
+    }
+  }
+
+  // pairs with the writer's store of writer_blocked before its last look at tail
+  if (consumed) {
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if (c.rx->writer_blocked.load(std::memory_order_relaxed) && c.rx->writer_blocked.exchange(0)) {
+      kick(c.peer_wake_fd);
+    }
+  }
+  return true;
+}
+
+bool ShmTransport::service(Conn& c, const char*& why) {
+  while (true) {
+    if (!drain_rx(c, why) || !flush_tx(c, why)) return false;
+    // about to sleep: ask for a kick, then look once more in case data came meanwhile
+    c.rx->reader_asleep.store(1, std::memory_order_seq_cst);
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if (c.rx->head.load(std::memory_order_acquire) == c.rx_tail) return true;
+    c.rx->reader_asleep.store(0, std::memory_order_relaxed);
+  }
+}
+
+Status ShmTransport::progress(int timeout_ms) {
+  if (ep_ < 0) return Status::Err("epoll not available");
+
+  if (events_.empty()) events_.resize((size_t)std::max(1, opt_.epoll_max_events));
+  int n = epoll_wait(ep_, events_.data(), (int)events_.size(), timeout_ms);
+  if (n < 0) {
+    if (errno == EINTR) return Status::Ok();
+    return Status::Err(std::string("epoll_wait failed: ") + std::strerror(errno));
+  }
+
+  for (int i = 0; i < n; i++) {
+    const uint64_t tag = events_[i].data.u64;
+
+    if (tag == kListenTag) {
+      auto st = accept_new();
+      if (!st.ok) return st;
+      continue;
+    }
+    if (tag == kWakeTag) {
+      auto st = drain_outbound();
+      if (!st.ok) return st;
+      continue;
+    }
+
+    const ConnId id = tag & ~uint64_t{1};
+    auto it = conns_.find(id);
+    if (it == conns_.end()) continue; // closed earlier in this batch
+    Conn& c = *it->second;
+
+    if (tag & 1) {
+      // nothing follows the setup message on the socket: this is the hangup
+      close_conn(id);
+      if (!is_server_) return Status::Err("peer closed");
+      continue;
+    }
+
+    uint64_t cnt = 0;
+    ssize_t r = ::read(c.wake_fd, &cnt, sizeof(cnt));
+    (void)r;
+    const char* why = nullptr;
+    if (service(c, why)) continue;
+    metrics_.corrupt_streams.inc();
+    close_conn(id);
+    if (!is_server_) return Status::Err(why);
+  }
+  return Status::Ok();
+}
+
+}  // namespace cc50
@@ -3,19 +3,28 @@
 
 #include <arpa/inet.h>
 #include <fcntl.h>
+#include <pthread.h>
+#include <sched.h>
 #include <sys/epoll.h>
+#include <sys/eventfd.h>
 #include <sys/socket.h>
+#include <sys/uio.h>
 #include <unistd.h>
 
+#include <algorithm>
 #include <cstring>
-#include <iostream>
 #include <stdexcept>
 
 namespace cc50 {
 
 namespace {
-constexpr int kListenBacklog = 16;
 constexpr size_t kReadChunk  = 4096;
+constexpr int kMaxIov        = 64;   // frames (x2 iovecs) flushed per sendmsg
+constexpr size_t kRxKeepBytes = 1u << 20; // idle rx buffers larger than this are shrunk
+
+// epoll tags for the non-connection fds; connection ids (seq >= 1 above the shard bits) start above them
+constexpr uint64_t kListenTag = 1;
+constexpr uint64_t kWakeTag   = 2;
 
 int make_non_blocking(int fd) {
   int flags = fcntl(fd, F_GETFL, 0);
@@ -23,52 +32,88 @@ int make_non_blocking(int fd) {
   return fcntl(fd, F_SETFL, flags | O_NONBLOCK);
 }
 
-Status add_epoll_fd(int ep, int fd, uint32_t events) {
+Status add_epoll_fd(int ep, int fd, uint64_t tag, uint32_t events) {
   epoll_event ev{};
   ev.events  = events;
-  ev.data.fd = fd;
+  ev.data.u64 = tag;
   if (epoll_ctl(ep, EPOLL_CTL_ADD, fd, &ev) < 0) {
     return Status::Err(std::string("epoll_ctl add failed: ") + std::strerror(errno));
   }
   return Status::Ok();
 }
 
-Status mod_epoll_fd(int ep, int fd, uint32_t events) {
-  epoll_event ev{};
-  ev.events  = events;
-  ev.data.fd = fd;
-  if (epoll_ctl(ep, EPOLL_CTL_MOD, fd, &ev) < 0) {
-    return Status::Err(std::string("epoll_ctl mod failed: ") + std::strerror(errno));
-  }
-  return Status::Ok();
+// Connections are registered once; readers drain to EAGAIN and writers write until
+// EAGAIN, after which the next edge reports the change.
+constexpr uint32_t kConnEvents = EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLET;
+
+void pin_current_thread(int cpu) {
+  const int ncpu = (int)std::max(1L, sysconf(_SC_NPROCESSORS_ONLN));
+  cpu_set_t set;
+  CPU_ZERO(&set);
+  CPU_SET(cpu % ncpu, &set);
+  int rc = pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+  if (rc != 0) CC50_LOG_WARN("[transport] pinning to cpu " << cpu % ncpu << " failed: " << std::strerror(rc));
 }
 
 }  // namespace
 
 TcpTransport::TcpTransport() {
-  ep_ = epoll_create1(0);
+  auto s = std::make_unique<Shard>();
+  init_shard(*s);
+  shards_.push_back(std::move(s));
 }
 
 TcpTransport::~TcpTransport() {
-  for (auto& [fd, conn] : conns_) {
-    (void)conn;
-    close(fd);
+  stop_.store(true);
+  for (auto& s : shards_) {
+    if (s->thread.joinable()) {
+      wake(*s);
+      s->thread.join();
+    }
   }
-  conns_.clear();
+  for (auto& s : shards_) {
+    for (auto& [id, conn] : s->conns) {
+      (void)id;
+      close(conn.fd);
+    }
+    s->conns.clear();
 
-  if (listen_fd_ >= 0) close(listen_fd_);
-  if (peer_fd_ >= 0 && conns_.count(peer_fd_) == 0) close(peer_fd_);
-  if (ep_ >= 0) close(ep_);
+    if (s->listen_fd >= 0) close(s->listen_fd);
+    if (s->wake_fd >= 0) close(s->wake_fd);
+    if (s->ep >= 0) close(s->ep);
+  }
 }
 
-Status TcpTransport::make_listen_socket(const std::string& host, uint16_t port) {
-  listen_fd_ = ::socket(AF_INET, SOCK_STREAM, 0);
-  if (listen_fd_ < 0) {
+Status TcpTransport::init_shard(Shard& s) {
+  s.ep = epoll_create1(0);
+  if (s.ep < 0) return Status::Err(std::string("epoll_create1 failed: ") + std::strerror(errno));
+  s.wake_fd = ::eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+  if (s.wake_fd < 0) return Status::Err(std::string("eventfd failed: ") + std::strerror(errno));
+  auto st = add_epoll_fd(s.ep, s.wake_fd, kWakeTag, EPOLLIN);
+  if (!st.ok) {
+    ::close(s.wake_fd);
+    s.wake_fd = -1;
+  }
+  return st;
+}
+
+Status TcpTransport::make_listen_socket(Shard& s, const std::string& host, uint16_t port, bool reuse_port) {
+  s.listen_fd = ::socket(AF_INET, SOCK_STREAM, 0);
+  if (s.listen_fd < 0) {
     return Status::Err(std::string("socket failed: ") + std::strerror(errno));
   }
 
   int reuse = 1;
-  ::setsockopt(listen_fd_, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
+  ::setsockopt(s.listen_fd, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
+  // every shard binds the same port; the kernel load-balances incoming connections
+  if (reuse_port && ::setsockopt(s.listen_fd, SOL_SOCKET, SO_REUSEPORT, &reuse, sizeof(reuse)) < 0) {
+    return Status::Err(std::string("SO_REUSEPORT failed: ") + std::strerror(errno));
+  }
+
+  // accepted sockets inherit these from the listener; buffer sizes must be in place
+  // before listen() to take part in window scaling
+  auto st = apply_socket_options(s.listen_fd, opt_.sock);
+  if (!st.ok) return st;
 
   sockaddr_in addr{};
   addr.sin_family = AF_INET;
@@ -77,116 +122,223 @@ Status TcpTransport::make_listen_socket(const std::string& host, uint16_t port)
     return Status::Err("inet_pton failed for: " + host);
   }
 
-  if (::bind(listen_fd_, (sockaddr*)&addr, sizeof(addr)) < 0) {
+  if (::bind(s.listen_fd, (sockaddr*)&addr, sizeof(addr)) < 0) {
     return Status::Err(std::string("bind failed: ") + std::strerror(errno));
   }
-  if (::listen(listen_fd_, kListenBacklog) < 0) {
+  if (::listen(s.listen_fd, std::max(1, opt_.listen_backlog)) < 0) {
     return Status::Err(std::string("listen failed: ") + std::strerror(errno));
   }
-  if (make_non_blocking(listen_fd_) < 0) {
+  if (make_non_blocking(s.listen_fd) < 0) {
     return Status::Err(std::string("failed to set non-blocking: ") + std::strerror(errno));
   }
 
-  return add_epoll_fd(ep_, listen_fd_, EPOLLIN);
+  return add_epoll_fd(s.ep, s.listen_fd, kListenTag, EPOLLIN);
 }
 
-Status TcpTransport::accept_new() {
+ConnId TcpTransport::add_conn(Shard& s, int fd) {
+  ConnId id = (s.next_seq++ << kShardBits) | s.index;
+  Conn c{};
+  c.fd = fd;
+  s.conns.emplace(id, std::move(c));
+  metrics_.conns_open.inc();
+  return id;
+}
+
+void TcpTransport::close_conn(Shard& s, ConnId id) {
+  auto it = s.conns.find(id);
+  if (it == s.conns.end()) return;
+  ::close(it->second.fd); // also removes it from the epoll set
+  metrics_.tx_queued_bytes.add(-(int64_t)it->second.tx_bytes);
+  metrics_.conns_open.dec();
+  metrics_.conns_closed.inc();
+  s.conns.erase(it);
+  if (peer_ == id) peer_ = kNoConn;
+  if (on_close_) on_close_(id);
+}
+
+Status TcpTransport::accept_new(Shard& s) {
   while (true) {
     sockaddr_in addr{};
     socklen_t len = sizeof(addr);
-    int cfd = ::accept4(listen_fd_, (sockaddr*)&addr, &len, SOCK_NONBLOCK);
+    int cfd = ::accept4(s.listen_fd, (sockaddr*)&addr, &len, SOCK_NONBLOCK);
     if (cfd < 0) {
       if (errno == EAGAIN || errno == EWOULDBLOCK) return Status::Ok();
       return Status::Err(std::string("accept failed: ") + std::strerror(errno));
     }
 
-    Conn c{};
-    c.fd = cfd;
-    conns_.emplace(cfd, std::move(c));
-    if (peer_fd_ < 0) peer_fd_ = cfd;
-
-    auto st = add_epoll_fd(ep_, cfd, EPOLLIN | EPOLLRDHUP);
-    if (!st.ok) return st;
+    rearm_quickack(cfd, opt_.sock);
+    metrics_.conns_accepted.inc();
+    ConnId id = add_conn(s, cfd);
+    auto st = add_epoll_fd(s.ep, cfd, id, kConnEvents);
+    if (!st.ok) {
+      close_conn(s, id);
+      return st;
+    }
   }
 }
 
-Status TcpTransport::queue_send(int fd, const uint8_t* bytes, size_t len) {
-  auto it = conns_.find(fd);
-  if (it == conns_.end()) return Status::Err("peer not connected");
+Status TcpTransport::queue_send(Shard& s, ConnId id, TxFrame&& f) {
+  auto it = s.conns.find(id);
+  if (it == s.conns.end()) return Status::Err("peer not connected");
 
   auto& c = it->second;
-  c.tx.insert(c.tx.end(), bytes, bytes + len);
+  if (opt_.max_conn_tx_bytes && c.tx_bytes + f.size() > opt_.max_conn_tx_bytes) {
+    CC50_LOG_WARN("[transport] dropping slow consumer conn=" << id << " unsent_bytes=" << c.tx_bytes);
+    metrics_.slow_consumer_drops.inc();
+    close_conn(s, id);
+    return Status::Ok();
+  }
+  metrics_.frames_tx.inc();
+  size_t grown = 0;
+  if (c.peer_version >= kProtoVerBatch && merge_into_batch(c.tx, c.tx_off > 0 ? 1 : 0, f, grown)) {
+    metrics_.batched_tx.inc();
+  } else {
+    grown = f.size();
+    c.tx.push_back(std::move(f));
+  }
+  metrics_.tx_queued_bytes.add((int64_t)grown);
+  c.tx_bytes += grown;
 
-  uint32_t events = EPOLLIN | EPOLLRDHUP;
-  if (!c.tx.empty()) events |= EPOLLOUT;
-  return mod_epoll_fd(ep_, fd, events);
+  // flushed once per drain, so frames queued together share a sendmsg
+  if (!c.dirty) {
+    c.dirty = true;
+    s.dirty.push_back(id);
+  }
+  return Status::Ok();
 }
 
-Status TcpTransport::handle_write(int fd) {
-  auto it = conns_.find(fd);
-  if (it == conns_.end()) return Status::Err("peer not connected");
+Status TcpTransport::handle_write(Shard& s, ConnId id) {
+  auto it = s.conns.find(id);
+  if (it == s.conns.end()) return Status::Err("peer not connected");
   auto& c = it->second;
 
-  while (c.tx_off < c.tx.size()) {
-    ssize_t n = ::send(fd, c.tx.data() + c.tx_off, c.tx.size() - c.tx_off, 0);
+  while (!c.tx.empty()) {
+    // gather header+payload of the queued frames; the first one may be partly written
+    iovec iov[kMaxIov * 2];
+    int niov = gather_tx(c.tx, c.tx_off, iov, (int)std::size(iov));
+
+    msghdr mh{};
+    mh.msg_iov = iov;
+    mh.msg_iovlen = (size_t)niov;
+    ssize_t n = ::sendmsg(c.fd, &mh, MSG_NOSIGNAL);
     if (n < 0) {
-      if (errno == EAGAIN || errno == EWOULDBLOCK) break;
-      return Status::Err(std::string("send failed: ") + std::strerror(errno));
+      if (errno == EINTR) continue;
+      if (errno == EAGAIN || errno == EWOULDBLOCK) {
+        c.writable = false; // resume on the next EPOLLOUT edge
+        break;
+      }
+      // the peer reset the connection: drop it like a hangup
+      std::string err = std::strerror(errno);
+      close_conn(s, id);
+      return is_server_ ? Status::Ok() : Status::Err("send failed: " + err);
     }
     if (n == 0) break;
-    c.tx_off += (size_t)n;
-  }
 
-  if (c.tx_off >= c.tx.size()) {
-    c.tx.clear();
-    c.tx_off = 0;
-    return mod_epoll_fd(ep_, fd, EPOLLIN | EPOLLRDHUP);
+    // retire fully written frames
+    metrics_.bytes_tx.inc((uint64_t)n);
+    metrics_.tx_queued_bytes.add(-(int64_t)n);
+    c.tx_bytes -= (size_t)n;
+    retire_tx(c.tx, c.tx_off, (size_t)n);
   }
 
   return Status::Ok();
 }
 
-Status TcpTransport::handle_read(int fd) {
-  auto it = conns_.find(fd);
-  if (it == conns_.end()) return Status::Err("peer not connected");
+Status TcpTransport::handle_read(Shard& s, ConnId id) {
+  auto it = s.conns.find(id);
+  if (it == s.conns.end()) return Status::Err("peer not connected");
   auto& c = it->second;
 
-  uint8_t buf[kReadChunk];
   while (true) {
-    ssize_t n = ::recv(fd, buf, sizeof(buf), 0);
+    // Make room at the tail. Compaction is lazy: buffered bytes only move when the
+    // tail is too short, and a partially received frame reserves its full size so
+    // a large prompt is received straight into place.
+    size_t want = kReadChunk;
+    if (c.rx_wr - c.rx_rd >= sizeof(MsgHeader)) {
+      MsgHeader h{};
+      std::memcpy(&h, c.rx.data() + c.rx_rd, sizeof(h));
+      size_t frame = sizeof(MsgHeader) + h.length;
+      if (frame > c.rx_wr - c.rx_rd) want = std::max(want, frame - (c.rx_wr - c.rx_rd));
+    }
+    if (c.rx.size() - c.rx_wr < want) {
+      if (c.rx_rd > 0) {
+        std::memmove(c.rx.data(), c.rx.data() + c.rx_rd, c.rx_wr - c.rx_rd);
+        c.rx_wr -= c.rx_rd;
+        c.rx_rd = 0;
+      }
+      if (c.rx.size() - c.rx_wr < want) c.rx.resize(std::max(c.rx.size() * 2, c.rx_wr + want));
+    }
+
+    ssize_t n = ::recv(c.fd, c.rx.data() + c.rx_wr, c.rx.size() - c.rx_wr, 0);
     if (n < 0) {
-      if (errno == EAGAIN || errno == EWOULDBLOCK) break;
-      return Status::Err(std::string("recv failed: ") + std::strerror(errno));
+      if (errno == EINTR) continue;
+      if (errno == EAGAIN || errno == EWOULDBLOCK) {
+        rearm_quickack(c.fd, opt_.sock);
+        break;
+      }
+      // ECONNRESET and the like: one client's failure, dropped like a hangup
+      std::string err = std::strerror(errno);
+      close_conn(s, id);
+      return is_server_ ? Status::Ok() : Status::Err("recv failed: " + err);
     }
     if (n == 0) {
       // peer closed
-      ::close(fd);
-      conns_.erase(it);
-      if (peer_fd_ == fd) peer_fd_ = -1;
-      return Status::Err("peer closed");
+      close_conn(s, id);
+      return is_server_ ? Status::Ok() : Status::Err("peer closed");
     }
+    c.rx_wr += (size_t)n;
 
-    c.rx.insert(c.rx.end(), buf, buf + n);
-
-    while (c.rx.size() >= sizeof(MsgHeader)) {
+    while (c.rx_wr - c.rx_rd >= sizeof(MsgHeader)) {
       MsgHeader h{};
-      std::memcpy(&h, c.rx.data(), sizeof(h));
-      if (h.magic != kMagic) return Status::Err("bad magic");
+      std::memcpy(&h, c.rx.data() + c.rx_rd, sizeof(h));
+      if (h.magic != kMagic || h.length > opt_.max_frame_bytes) {
+        // a corrupt stream cannot be resynchronized: drop the connection
+        metrics_.corrupt_streams.inc();
+        close_conn(s, id);
+        return is_server_ ? Status::Ok() : Status::Err(h.magic != kMagic ? "bad magic" : "frame too large");
+      }
 
       size_t need = sizeof(MsgHeader) + h.length;
-      if (c.rx.size() < need) break;
+      if (c.rx_wr - c.rx_rd < need) break;
 
       IncomingMessage msg{};
-      msg.req_id = h.req_id;
-      msg.type   = h.type;
-      if (h.length) {
-        msg.payload.resize(h.length);
-        std::memcpy(msg.payload.data(), c.rx.data() + sizeof(MsgHeader), h.length);
+      msg.conn    = id;
+      msg.req_id  = h.req_id;
+      msg.type    = h.type;
+      msg.version = h.version;
+      msg.payload = std::span<const uint8_t>(c.rx.data() + c.rx_rd + sizeof(MsgHeader), h.length);
+      c.peer_version = std::max(c.peer_version, h.version);
+
+      metrics_.frames_rx.inc();
+      metrics_.bytes_rx.inc(need);
+      if (h.type == (uint16_t)MsgType::RESP_BATCH) {
+        // handed out one message per entry, as if each had its own frame
+        bool ok = for_each_batch_entry(msg.payload, [&](uint64_t req_id, uint16_t type, std::span<const uint8_t> p) {
+          IncomingMessage m = msg;
+          m.req_id = req_id;
+          m.type = type;
+          m.payload = p;
+          if (on_msg_) on_msg_(m);
+        });
+        if (!ok) {
+          metrics_.corrupt_streams.inc();
+          close_conn(s, id);
+          return is_server_ ? Status::Ok() : Status::Err("malformed RESP_BATCH");
+        }
+      } else if (on_msg_) {
+        on_msg_(msg);
       }
 
-      if (on_msg_) on_msg_(msg);
+      c.rx_rd += need;
+    }
 
-      c.rx.erase(c.rx.begin(), c.rx.begin() + (long)need);
+    if (c.rx_rd == c.rx_wr) {
+      c.rx_rd = c.rx_wr = 0;
+      // give back the memory of a one-off huge frame
+      if (c.rx.size() > kRxKeepBytes) {
+        c.rx.resize(kReadChunk);
+        c.rx.shrink_to_fit();
+      }
     }
   }
 
@@ -194,102 +346,204 @@ Status TcpTransport::handle_read(int fd) {
 }
 
 Status TcpTransport::start_server(const TransportOptions& opt, MessageHandler on_msg) {
-  if (ep_ < 0) return Status::Err("epoll not available");
+  if (shards_[0]->ep < 0 || shards_[0]->wake_fd < 0) return Status::Err("epoll not available");
   is_server_ = true;
   opt_       = opt;
   on_msg_    = std::move(on_msg);
+  if (opt.metrics) metrics_.register_with(*opt.metrics, "tcp");
+
+  const int nshards = std::clamp(opt.event_threads, 1, kMaxShards);
+  while ((int)shards_.size() < nshards) {
+    auto s = std::make_unique<Shard>();
+    s->index = (uint32_t)shards_.size();
+    auto st = init_shard(*s);
+    shards_.push_back(std::move(s));
+    if (!st.ok) return st;
+  }
+  for (auto& s : shards_) {
+    auto st = make_listen_socket(*s, opt.listen_host, opt.listen_port, nshards > 1);
+    if (!st.ok) return st;
+  }
+
+  // shard 0 runs on the caller's progress() thread and is pinned there, not here: a
+  // thread inherits its creator's mask, so pinning the caller now would put every
+  // thread it starts before the event loop (workers and the like) on the same CPU
+  for (size_t i = 1; i < shards_.size(); i++) {
+    Shard* s = shards_[i].get();
+    s->thread = std::thread([this, s] { run_shard(*s); });
+  }
+  return Status::Ok();
+}
 
-  return make_listen_socket(opt.listen_host, opt.listen_port);
+void TcpTransport::run_shard(Shard& s) {
+  if (opt_.pin_cpu_base >= 0) pin_current_thread(opt_.pin_cpu_base + (int)s.index);
+  while (!stop_.load(std::memory_order_relaxed)) {
+    auto st = poll(s, 50);
+    if (!st.ok) {
+      std::lock_guard<std::mutex> lk(err_mu_);
+      if (!has_shard_err_.load()) {
+        shard_err_ = Status::Err("shard " + std::to_string(s.index) + ": " + st.msg);
+        has_shard_err_.store(true);
+      }
+      return;
+    }
+  }
 }
 
 Status TcpTransport::start_client(const TransportOptions& opt, MessageHandler on_msg) {
-  if (ep_ < 0) return Status::Err("epoll not available");
+  Shard& s = *shards_[0];
+  if (s.ep < 0 || s.wake_fd < 0) return Status::Err("epoll not available");
   is_server_ = false;
   opt_       = opt;
   on_msg_    = std::move(on_msg);
 
-  peer_fd_ = ::socket(AF_INET, SOCK_STREAM, 0);
-  if (peer_fd_ < 0) {
+  int fd = ::socket(AF_INET, SOCK_STREAM, 0);
+  if (fd < 0) {
     return Status::Err(std::string("socket failed: ") + std::strerror(errno));
   }
 
+  auto st = apply_socket_options(fd, opt.sock);
+  if (!st.ok) {
+    ::close(fd);
+    return st;
+  }
+
   sockaddr_in addr{};
   addr.sin_family = AF_INET;
   addr.sin_port   = htons(opt.server_port);
   if (::inet_pton(AF_INET, opt.server_host.c_str(), &addr.sin_addr) != 1) {
+    ::close(fd);
     return Status::Err("inet_pton failed for: " + opt.server_host);
   }
 
-  if (::connect(peer_fd_, (sockaddr*)&addr, sizeof(addr)) < 0) {
+  if (::connect(fd, (sockaddr*)&addr, sizeof(addr)) < 0) {
+    ::close(fd);
     return Status::Err(std::string("connect failed: ") + std::strerror(errno));
   }
-  if (make_non_blocking(peer_fd_) < 0) {
+  if (make_non_blocking(fd) < 0) {
+    ::close(fd);
     return Status::Err(std::string("failed to set non-blocking: ") + std::strerror(errno));
   }
 
-  Conn c{};
-  c.fd = peer_fd_;
-  conns_.emplace(peer_fd_, std::move(c));
+  peer_ = add_conn(s, fd);
+  return add_epoll_fd(s.ep, fd, peer_, kConnEvents);
+}
+
+Status TcpTransport::send(ConnId conn, uint64_t req_id, uint16_t type, const uint8_t* data, size_t len) {
+  const size_t shard = conn == kNoConn ? 0 : (size_t)(conn & (kMaxShards - 1));
+  if (shard >= shards_.size()) return Status::Err("unknown connection");
+  Shard& s = *shards_[shard];
+  if (s.ep < 0 || s.wake_fd < 0) return Status::Err("epoll not available");
+
+  OutFrame f{};
+  f.conn = conn;
+  f.frame = make_tx_frame(req_id, type, data, len);
 
-  return add_epoll_fd(ep_, peer_fd_, EPOLLIN | EPOLLRDHUP);
+  s.outq.push(std::move(f));
+  wake(s);
+  return Status::Ok();
+}
+
+void TcpTransport::wake(Shard& s) {
+  // one eventfd write per batch: the loop clears the flag before draining
+  if (s.wake_pending.exchange(true, std::memory_order_acq_rel)) return;
+  uint64_t one = 1;
+  ssize_t n = ::write(s.wake_fd, &one, sizeof(one));
+  (void)n;
 }
 
-Status TcpTransport::send(uint64_t req_id, uint16_t type, const uint8_t* data, size_t len) {
-  MsgHeader h{};
-  h.magic   = kMagic;
-  h.version = kProtoVer;
-  h.type    = type;
-  h.req_id  = req_id;
-  h.flags   = 0;
-  h.length  = static_cast<uint32_t>(len);
-
-  std::vector<uint8_t> buf;
-  buf.resize(sizeof(MsgHeader) + len);
-  std::memcpy(buf.data(), &h, sizeof(MsgHeader));
-  if (len) std::memcpy(buf.data() + sizeof(MsgHeader), data, len);
-
-  int fd = peer_fd_;
-  if (is_server_ && fd < 0 && !conns_.empty()) {
-    fd = conns_.begin()->first;
+Status TcpTransport::drain_outbound(Shard& s) {
+  uint64_t cnt = 0;
+  ssize_t n = ::read(s.wake_fd, &cnt, sizeof(cnt));
+  (void)n;
+  s.wake_pending.store(false, std::memory_order_seq_cst);
+
+  OutFrame f;
+  while (s.outq.pop(f)) {
+    ConnId id = (f.conn == kNoConn) ? peer_ : f.conn;
+    if (s.conns.find(id) == s.conns.end()) continue; // peer went away: drop
+
+    auto st = queue_send(s, id, std::move(f.frame));
+    if (!st.ok) return st;
   }
-  if (fd < 0) return Status::Err("no peer connected");
 
-  return queue_send(fd, buf.data(), buf.size());
+  // write directly; a socket that is still unwritable finishes on its EPOLLOUT edge
+  for (size_t i = 0; i < s.dirty.size(); i++) {
+    const ConnId id = s.dirty[i];
+    auto it = s.conns.find(id);
+    if (it == s.conns.end()) continue; // dropped as a slow consumer
+    it->second.dirty = false;
+    if (!it->second.writable) continue;
+    auto st = handle_write(s, id);
+    if (!st.ok) {
+      s.dirty.clear();
+      return st;
+    }
+  }
+  s.dirty.clear();
+  return Status::Ok();
 }
 
 Status TcpTransport::progress(int timeout_ms) {
-  if (ep_ < 0) return Status::Err("epoll not available");
+  if (has_shard_err_.load(std::memory_order_relaxed)) {
+    std::lock_guard<std::mutex> lk(err_mu_);
+    return shard_err_;
+  }
+  if (is_server_ && !pinned_ && opt_.pin_cpu_base >= 0) {
+    pin_current_thread(opt_.pin_cpu_base);
+    pinned_ = true;
+  }
+  return poll(*shards_[0], timeout_ms);
+}
 
-  std::vector<epoll_event> events(opt_.epoll_max_events);
-  int n = epoll_wait(ep_, events.data(), (int)events.size(), timeout_ms);
+Status TcpTransport::poll(Shard& s, int timeout_ms) {
+  if (s.ep < 0) return Status::Err("epoll not available");
+
+  if (s.events.empty()) s.events.resize((size_t)std::max(1, opt_.epoll_max_events));
+  auto& events = s.events;
+  int n = epoll_wait(s.ep, events.data(), (int)events.size(), timeout_ms);
   if (n < 0) {
     if (errno == EINTR) return Status::Ok();
     return Status::Err(std::string("epoll_wait failed: ") + std::strerror(errno));
   }
 
   for (int i = 0; i < n; i++) {
-    int fd = events[i].data.fd;
+    uint64_t tag = events[i].data.u64;
     uint32_t ev = events[i].events;
 
-    if (fd == listen_fd_) {
-      auto st = accept_new();
+    if (tag == kListenTag) {
+      auto st = accept_new(s);
+      if (!st.ok) return st;
+      continue;
+    }
+    if (tag == kWakeTag) {
+      auto st = drain_outbound(s);
       if (!st.ok) return st;
       continue;
     }
 
-    if (ev & (EPOLLERR | EPOLLHUP | EPOLLRDHUP)) {
-      ::close(fd);
-      conns_.erase(fd);
-      if (peer_fd_ == fd) peer_fd_ = -1;
+    ConnId id = tag;
+    if (s.conns.find(id) == s.conns.end()) continue; // closed earlier in this batch
+    if (ev & (EPOLLERR | EPOLLHUP)) {
+      close_conn(s, id);
       continue;
     }
 
     if (ev & EPOLLIN) {
-      auto st = handle_read(fd);
+      // read before honouring RDHUP so frames that arrived with the FIN are not lost
+      auto st = handle_read(s, id);
       if (!st.ok) return st;
     }
+    if (ev & EPOLLRDHUP) {
+      close_conn(s, id);
+      continue;
+    }
     if (ev & EPOLLOUT) {
-      auto st = handle_write(fd);
+      auto it = s.conns.find(id);
+      if (it == s.conns.end()) continue; // closed by the read
+      it->second.writable = true;
+      if (it->second.tx.empty()) continue;
+      auto st = handle_write(s, id);
       if (!st.ok) return st;
     }
   }
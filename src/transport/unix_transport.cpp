@@ -0,0 +1,527 @@
+#include "cc50/transport/unix_transport.hpp"
+#include "cc50/protocol.hpp"
+
+#include <fcntl.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cstddef>
+#include <cstring>
+
+namespace cc50 {
+
+namespace {
+constexpr size_t kRxKeepBytes = 1u << 20; // reassembly buffers larger than this are shrunk
+
+// epoll tags for the non-connection fds; connection ids start above them
+constexpr uint64_t kListenTag = 1;
+constexpr uint64_t kWakeTag   = 2;
+
+// Packets are drained on the edge. Unlike TCP, an AF_UNIX socket reports write space
+// to a registered EPOLLOUT every time the peer consumes a packet, so EPOLLOUT is only
+// added while a socket is full.
+constexpr uint32_t kConnEvents = EPOLLIN | EPOLLRDHUP | EPOLLET;
+
+// A packet may not exceed the sender's SO_SNDBUF; keep room for a few full ones.
+constexpr int kMinSndBuf = (int)(4 * UnixTransport::kMaxPacket);
+
+Status unix_addr(const std::string& path, sockaddr_un& a, socklen_t& len) {
+  if (path.empty()) return Status::Err("no socket path");
+  if (path.size() >= sizeof(a.sun_path)) return Status::Err("socket path too long: " + path);
+  a = sockaddr_un{};
+  a.sun_family = AF_UNIX;
+  std::memcpy(a.sun_path, path.data(), path.size());
+  const bool abstract = path[0] == '@';
+  if (abstract) a.sun_path[0] = '\0';
+  len = (socklen_t)(offsetof(sockaddr_un, sun_path) + path.size() + (abstract ? 0 : 1));
+  return Status::Ok();
+}
+
+int make_non_blocking(int fd) {
+  int flags = fcntl(fd, F_GETFL, 0);
+  if (flags < 0) return -1;
+  return fcntl(fd, F_SETFL, flags | O_NONBLOCK);
+}
+
+Status add_epoll_fd(int ep, int fd, uint64_t tag, uint32_t events) {
+  epoll_event ev{};
+  ev.events  = events;
+  ev.data.u64 = tag;
+  if (epoll_ctl(ep, EPOLL_CTL_ADD, fd, &ev) < 0) {
+    return Status::Err(std::string("epoll_ctl add failed: ") + std::strerror(errno));
+  }
+  return Status::Ok();
+}
+
+void watch_out(int ep, int fd, uint64_t tag, bool on) {
+  epoll_event ev{};
+  ev.events = kConnEvents | (on ? (uint32_t)EPOLLOUT : 0u);
+  ev.data.u64 = tag;
+  epoll_ctl(ep, EPOLL_CTL_MOD, fd, &ev);
+}
+
+void ensure_sndbuf(int fd) {
+  int cur = 0;
+  socklen_t len = sizeof(cur);
+  if (::getsockopt(fd, SOL_SOCKET, SO_SNDBUF, &cur, &len) == 0 && cur >= kMinSndBuf) return;
+  ::setsockopt(fd, SOL_SOCKET, SO_SNDBUF, &kMinSndBuf, sizeof(kMinSndBuf));
+}
+
+// iovecs for bytes [off, off + n) of a queued frame (header, then payload)
+int frame_iov(const TxFrame& f, size_t off, size_t n, iovec* iov) {
+  int niov = 0;
+  if (off < sizeof(MsgHeader)) {
+    const size_t k = std::min(n, sizeof(MsgHeader) - off);
+    iov[niov++] = iovec{(void*)((const uint8_t*)&f.hdr + off), k};
+    off += k;
+    n -= k;
+  }
+  if (n > 0) iov[niov++] = iovec{(void*)(f.payload.data() + (off - sizeof(MsgHeader))), n};
+  return niov;
+}
+
+}  // namespace
+
+Status listen_seqpacket(const std::string& path, int backlog, int& fd) {
+  sockaddr_un addr{};
+  socklen_t alen = 0;
+  auto st = unix_addr(path, addr, alen);
+  if (!st.ok) return st;
+
+  if (path[0] != '@') {
+    struct stat sb{};
+    if (::lstat(path.c_str(), &sb) == 0 && S_ISSOCK(sb.st_mode)) {
+      int probe = -1;
+      if (connect_seqpacket(path, probe).ok) {
+        ::close(probe);
+        return Status::Err("another server is listening on " + path);
+      }
+      ::unlink(path.c_str()); // left behind by a server that did not shut down cleanly
+    }
+  }
+
+  fd = ::socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0);
+  if (fd < 0) return Status::Err(std::string("socket failed: ") + std::strerror(errno));
+  if (::bind(fd, (sockaddr*)&addr, alen) < 0) {
+    st = Status::Err("bind failed for " + path + ": " + std::strerror(errno));
+  } else if (::listen(fd, std::max(1, backlog)) < 0) {
+    st = Status::Err(std::string("listen failed: ") + std::strerror(errno));
+  } else if (make_non_blocking(fd) < 0) {
+    st = Status::Err(std::string("failed to set non-blocking: ") + std::strerror(errno));
+  }
+  if (!st.ok) {
+    ::close(fd);
+    fd = -1;
+  }
+  return st;
+}
+
+Status connect_seqpacket(const std::string& path, int& fd) {
+  sockaddr_un addr{};
+  socklen_t alen = 0;
+  auto st = unix_addr(path, addr, alen);
+  if (!st.ok) return st;
+
+  fd = ::socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0);
+  if (fd < 0) return Status::Err(std::string("socket failed: ") + std::strerror(errno));
+  if (::connect(fd, (sockaddr*)&addr, alen) < 0) {
+    st = Status::Err("connect failed for " + path + ": " + std::strerror(errno));
+    ::close(fd);
+    fd = -1;
+  }
+  return st;
+}
+
+UnixTransport::UnixTransport() {
+  ep_ = epoll_create1(EPOLL_CLOEXEC);
+  wake_fd_ = ::eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+  if (ep_ >= 0 && wake_fd_ >= 0 && !add_epoll_fd(ep_, wake_fd_, kWakeTag, EPOLLIN).ok) {
+    ::close(wake_fd_);
+    wake_fd_ = -1;
+  }
+}
+
+UnixTransport::~UnixTransport() {
+  for (auto& [id, c] : conns_) {
+    (void)id;
+    ::close(c.fd);
+  }
+  conns_.clear();
+  if (listen_fd_ >= 0) ::close(listen_fd_);
+  if (!unlink_path_.empty()) ::unlink(unlink_path_.c_str());
+  if (wake_fd_ >= 0) ::close(wake_fd_);
+  if (ep_ >= 0) ::close(ep_);
+}
+
+Status UnixTransport::add_conn(int fd, ConnId& id) {
+  ensure_sndbuf(fd);
+  id = next_conn_id_++;
+  Conn c{};
+  c.fd = fd;
+  conns_.emplace(id, std::move(c));
+  metrics_.conns_open.inc();
+  return add_epoll_fd(ep_, fd, id, kConnEvents);
+}
+
+void UnixTransport::close_conn(ConnId id) {
+  auto it = conns_.find(id);
+  if (it == conns_.end()) return;
+  ::close(it->second.fd);
+  metrics_.tx_queued_bytes.add(-(int64_t)it->second.tx_bytes);
+  metrics_.conns_open.dec();
+  metrics_.conns_closed.inc();
+  conns_.erase(it);
+  if (peer_ == id) peer_ = kNoConn;
+  if (on_close_) on_close_(id);
+}
+
+Status UnixTransport::accept_new() {
+  while (true) {
+    int cfd = ::accept4(listen_fd_, nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC);
+    if (cfd < 0) {
+      if (errno == EAGAIN || errno == EWOULDBLOCK) return Status::Ok();
+      if (errno == EINTR || errno == ECONNABORTED) continue;
+      return Status::Err(std::string("accept failed: ") + std::strerror(errno));
+    }
+    metrics_.conns_accepted.inc();
+    ConnId id = kNoConn;
+    auto st = add_conn(cfd, id);
+    if (!st.ok) {
+      close_conn(id);
+      return st;
+    }
+  }
+}
+
+Status UnixTransport::start_server(const TransportOptions& opt, MessageHandler on_msg) {
+  if (ep_ < 0 || wake_fd_ < 0) return Status::Err("epoll not available");
+  is_server_ = true;
+  opt_       = opt;
+  on_msg_    = std::move(on_msg);
+  if (opt.metrics) metrics_.register_with(*opt.metrics, "unix");
+
+  auto st = listen_seqpacket(opt.unix_path, opt.listen_backlog, listen_fd_);
+  if (!st.ok) return st;
+  if (opt.unix_path[0] != '@') unlink_path_ = opt.unix_path;
+  return add_epoll_fd(ep_, listen_fd_, kListenTag, EPOLLIN);
+}
+
+Status UnixTransport::start_client(const TransportOptions& opt, MessageHandler on_msg) {
+  if (ep_ < 0 || wake_fd_ < 0) return Status::Err("epoll not available");
+  is_server_ = false;
+  opt_       = opt;
+  on_msg_    = std::move(on_msg);
+
+  int fd = -1;
+  auto st = connect_seqpacket(opt.unix_path, fd);
+  if (!st.ok) return st;
+  if (make_non_blocking(fd) < 0) {
+    ::close(fd);
+    return Status::Err(std::string("failed to set non-blocking: ") + std::strerror(errno));
+  }
+  return add_conn(fd, peer_);
+}
+
+Status UnixTransport::send(ConnId conn, uint64_t req_id, uint16_t type, const uint8_t* data, size_t len) {
+  if (ep_ < 0 || wake_fd_ < 0) return Status::Err("epoll not available");
+  OutFrame f{};
+  f.conn = conn;
+  f.frame = make_tx_frame(req_id, type, data, len);
+  outq_.push(std::move(f));
+  wake();
+  return Status::Ok();
+}
+
+void UnixTransport::wake() {
+  if (wake_pending_.exchange(true, std::memory_order_acq_rel)) return;
+  uint64_t one = 1;
+  ssize_t n = ::write(wake_fd_, &one, sizeof(one));
+  (void)n;
+}
+
+Status UnixTransport::queue_send(ConnId id, TxFrame&& f) {
+  auto it = conns_.find(id);
+  if (it == conns_.end()) return Status::Ok(); // peer went away: drop
+
+  auto& c = it->second;
+  if (opt_.max_conn_tx_bytes && c.tx_bytes + f.size() > opt_.max_conn_tx_bytes) {
+    CC50_LOG_WARN("[transport] dropping slow consumer conn=" << id << " unsent_bytes=" << c.tx_bytes);
+    metrics_.slow_consumer_drops.inc();
+    close_conn(id);
+    return Status::Ok();
+  }
+  metrics_.frames_tx.inc();
+  size_t grown = 0;
+  if (c.peer_version >= kProtoVerBatch && merge_into_batch(c.tx, c.tx_off > 0 ? 1 : 0, f, grown)) {
+    metrics_.batched_tx.inc();
+  } else {
+    grown = f.size();
+    c.tx.push_back(std::move(f));
+  }
+  metrics_.tx_queued_bytes.add((int64_t)grown);
+  c.tx_bytes += grown;
+
+  if (!c.dirty) {
+    c.dirty = true;
+    dirty_.push_back(id);
+  }
+  return Status::Ok();
+}
+
+Status UnixTransport::drain_outbound() {
+  uint64_t cnt = 0;
+  ssize_t n = ::read(wake_fd_, &cnt, sizeof(cnt));
+  (void)n;
+  wake_pending_.store(false, std::memory_order_seq_cst);
+
+  OutFrame f;
+  while (outq_.pop(f)) {
+    auto st = queue_send(f.conn == kNoConn ? peer_ : f.conn, std::move(f.frame));
+    if (!st.ok) return st;
+  }
+
+  for (size_t i = 0; i < dirty_.size(); i++) {
+    auto it = conns_.find(dirty_[i]);
+    if (it == conns_.end()) continue;
+    it->second.dirty = false;
+    if (!it->second.writable) continue;
+    auto st = handle_write(dirty_[i]);
+    if (!st.ok) {
+      dirty_.clear();
+      return st;
+    }
+  }
+  dirty_.clear();
+  return Status::Ok();
+}
+
+Status UnixTransport::handle_write(ConnId id) {
+  auto it = conns_.find(id);
+  if (it == conns_.end()) return Status::Ok();
+  auto& c = it->second;
+
+  while (!c.tx.empty()) {
+    // one packet per frame, or per kMaxPacket piece of a larger one
+    mmsghdr msgs[kSendBatch];
+    iovec iov[kSendBatch * 2];
+    int npkt = 0, niov = 0;
+    size_t off = c.tx_off;
+    for (auto f = c.tx.begin(); f != c.tx.end() && npkt < kSendBatch; ++f, off = 0) {
+      for (; off < f->size() && npkt < kSendBatch; npkt++) {
+        const size_t n = std::min(kMaxPacket, f->size() - off);
+        msgs[npkt] = mmsghdr{};
+        msgs[npkt].msg_hdr.msg_iov = &iov[niov];
+        msgs[npkt].msg_hdr.msg_iovlen = (size_t)frame_iov(*f, off, n, &iov[niov]);
+        niov += (int)msgs[npkt].msg_hdr.msg_iovlen;
+        off += n;
+      }
+      if (off < f->size()) break;
+    }
+
+    int sent = ::sendmmsg(c.fd, msgs, (unsigned)npkt, MSG_NOSIGNAL);
+    if (sent < 0) {
+      if (errno == EINTR) continue;
+      if (errno == EAGAIN || errno == EWOULDBLOCK) {
+        c.writable = false; // resume on EPOLLOUT
+        break;
+      }
+      std::string err = std::strerror(errno);
+      close_conn(id);
+      return is_server_ ? Status::Ok() : Status::Err("send failed: " + err);
+    }
+
+    size_t bytes = 0;
+    for (int i = 0; i < sent; i++) bytes += msgs[i].msg_len; // packets go whole or not at all
+    metrics_.bytes_tx.inc(bytes);
+    metrics_.tx_queued_bytes.add(-(int64_t)bytes);
+    c.tx_bytes -= bytes;
+    retire_tx(c.tx, c.tx_off, bytes);
+    if (sent < npkt) {
+      c.writable = false; // the next packet hit a full socket
+      break;
+    }
+  }
+  if (c.writable == c.watching_out) {
+    c.watching_out = !c.writable;
+    watch_out(ep_, c.fd, id, c.watching_out);
+  }
+  return Status::Ok();
+}
+
+bool UnixTransport::deliver(ConnId id, Conn& c, const uint8_t* frame, size_t n) {
+  MsgHeader h{};
+  std::memcpy(&h, frame, sizeof(h));
+  IncomingMessage msg{};
+  msg.conn    = id;
+  msg.req_id  = h.req_id;
+  msg.type    = h.type;
+  msg.version = h.version;
+  msg.payload = std::span<const uint8_t>(frame + sizeof(MsgHeader), n - sizeof(MsgHeader));
+  c.peer_version = std::max(c.peer_version, h.version);
+
+  metrics_.frames_rx.inc();
+  metrics_.bytes_rx.inc(n);
+  if (h.type == (uint16_t)MsgType::RESP_BATCH) {
+    return for_each_batch_entry(msg.payload, [&](uint64_t req_id, uint16_t type, std::span<const uint8_t> p) {
+      IncomingMessage m = msg;
+      m.req_id = req_id;
+      m.type = type;
+      m.payload = p;
+      if (on_msg_) on_msg_(m);
+    });
+  }
+  if (on_msg_) on_msg_(msg);
+  return true;
+}
+
+bool UnixTransport::consume(ConnId id, Conn& c, const uint8_t* p, size_t n, const char*& why) {
+  if (c.rx_need > 0) {
+    // the next piece of a large frame
+    if (c.rx.size() + n > c.rx_need) {
+      why = "frame overrun";
+      return false;
+    }
+    c.rx.insert(c.rx.end(), p, p + n);
+    if (c.rx.size() < c.rx_need) return true;
+    const bool ok = deliver(id, c, c.rx.data(), c.rx.size());
+    c.rx.clear();
+    c.rx_need = 0;
+    if (c.rx.capacity() > kRxKeepBytes) c.rx.shrink_to_fit(); // a one-off huge frame
+    if (!ok) why = "malformed RESP_BATCH";
+    return ok;
+  }
+
+  MsgHeader h{};
+  if (n < sizeof(h)) {
+    why = "short packet";
+    return false;
+  }
+  std::memcpy(&h, p, sizeof(h));
+  if (h.magic != kMagic || h.length > opt_.max_frame_bytes) {
+    why = h.magic != kMagic ? "bad magic" : "frame too large";
+    return false;
+  }
+  const size_t need = sizeof(MsgHeader) + h.length;
+  if (n > need) {
+    why = "packet longer than its frame";
+    return false;
+  }
+  if (n < need) {
+    c.rx.reserve(need);
+    c.rx.assign(p, p + n);
+    c.rx_need = need;
+    return true;
+  }
+  if (!deliver(id, c, p, n)) {
+    why = "malformed RESP_BATCH";
+    return false;
+  }
+  return true;
+}
+
+Status UnixTransport::handle_read(ConnId id) {
+  auto it = conns_.find(id);
+  if (it == conns_.end()) return Status::Ok();
+  auto& c = it->second;
+
+  if (rx_buf_.empty()) rx_buf_.resize(kRecvBatch * kMaxPacket);
+  mmsghdr msgs[kRecvBatch];
+  iovec iov[kRecvBatch];
+  while (true) {
+    for (int i = 0; i < kRecvBatch; i++) {
+      iov[i] = iovec{rx_buf_.data() + (size_t)i * kMaxPacket, kMaxPacket};
+      msgs[i] = mmsghdr{};
+      msgs[i].msg_hdr.msg_iov = &iov[i];
+      msgs[i].msg_hdr.msg_iovlen = 1;
+    }
+    int n = ::recvmmsg(c.fd, msgs, kRecvBatch, MSG_DONTWAIT, nullptr);
+    if (n < 0) {
+      if (errno == EINTR) continue;
+      if (errno == EAGAIN || errno == EWOULDBLOCK) break;
+      // ECONNRESET and the like: one client's failure, dropped like a hangup
+      std::string err = std::strerror(errno);
+      close_conn(id);
+      return is_server_ ? Status::Ok() : Status::Err("recv failed: " + err);
+    }
+
+    for (int i = 0; i < n; i++) {
+      const size_t len = msgs[i].msg_len;
+      if (len == 0) {
+        // peer closed (no frame is ever empty)
+        close_conn(id);
+        return is_server_ ? Status::Ok() : Status::Err("peer closed");
+      }
+      const char* why = nullptr;
+      if ((msgs[i].msg_hdr.msg_flags & MSG_TRUNC) != 0) why = "oversized packet";
+      if (!why && consume(id, c, (const uint8_t*)iov[i].iov_base, len, why)) continue;
+      metrics_.corrupt_streams.inc();
+      close_conn(id);
+      return is_server_ ? Status::Ok() : Status::Err(why);
+    }
+    // a short batch emptied the queue; a packet arriving later raises a new edge
+    if (n < kRecvBatch) break;
+  }
+  return Status::Ok();
+}
+
+Status UnixTransport::progress(int timeout_ms) {
+  if (ep_ < 0) return Status::Err("epoll not available");
+
+  if (events_.empty()) events_.resize((size_t)std::max(1, opt_.epoll_max_events));
+  int n = epoll_wait(ep_, events_.data(), (int)events_.size(), timeout_ms);
+  if (n < 0) {
+    if (errno == EINTR) return Status::Ok();
+    return Status::Err(std::string("epoll_wait failed: ") + std::strerror(errno));
+  }
+
+  for (int i = 0; i < n; i++) {
+    const uint64_t tag = events_[i].data.u64;
+    const uint32_t ev = events_[i].events;
+
+    if (tag == kListenTag) {
+      auto st = accept_new();
+      if (!st.ok) return st;
+      continue;
+    }
+    if (tag == kWakeTag) {
+      auto st = drain_outbound();
+      if (!st.ok) return st;
+      continue;
+    }
+
+    const ConnId id = tag;
+    if (conns_.find(id) == conns_.end()) continue; // closed earlier in this batch
+    if (ev & EPOLLERR) {
+      close_conn(id);
+      if (!is_server_) return Status::Err("socket error");
+      continue;
+    }
+    if (ev & EPOLLIN) {
+      // packets that arrived with the hangup are still delivered
+      auto st = handle_read(id);
+      if (!st.ok) return st;
+    }
+    if (ev & (EPOLLHUP | EPOLLRDHUP)) {
+      const bool was_open = conns_.count(id) > 0;
+      close_conn(id);
+      if (!is_server_ && was_open) return Status::Err("peer closed");
+      continue;
+    }
+    if (ev & EPOLLOUT) {
+      auto it = conns_.find(id);
+      if (it == conns_.end()) continue;
+      it->second.writable = true;
+      auto st = handle_write(id);
+      if (!st.ok) return st;
+    }
+  }
+  return Status::Ok();
+}
+
+}  // namespace cc50